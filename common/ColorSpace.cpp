@@ -0,0 +1,86 @@
+#include "ColorSpace.h"
+#include <string.h>
+
+static const char *sMatrixNames[COLOR_MATRIX_COUNT] = {"bt601", "bt709", "bt2020"};
+static const char *sNames[COLOR_MATRIX_COUNT][COLOR_RANGE_COUNT] = {
+    {"bt601", "bt601_full"},
+    {"bt709", "bt709_full"},
+    {"bt2020", "bt2020_full"},
+};
+static const char *sLayoutNames[CHROMA_LAYOUT_COUNT] = {"444", "i420", "nv12"};
+static const char *sFilterNames[CHROMA_FILTER_COUNT] = {"nearest", "bilinear"};
+static const char *sMathNames[KERNEL_MATH_COUNT] = {"float", "fixed"};
+
+int parseColorSpace(const char *s, ColorMatrix *matrix, ColorRange *range){
+    for(int m = 0; m < COLOR_MATRIX_COUNT; m++){
+        size_t len = strlen(sMatrixNames[m]);
+        if(strncmp(s, sMatrixNames[m], len) != 0)
+            continue;
+        if(s[len] == 0){
+            *range = RANGE_LIMITED;
+        }else if(strcmp(s + len, "-full") == 0){
+            *range = RANGE_FULL;
+        }else{
+            continue;
+        }
+        *matrix = (ColorMatrix)m;
+        return 0;
+    }
+    return -1;
+}
+
+const char *colorSpaceName(ColorMatrix matrix, ColorRange range){
+    return sNames[matrix][range];
+}
+
+int parseChromaLayout(const char *s, ChromaLayout *layout, ChromaFilter *filter){
+    for(int l = 0; l < CHROMA_LAYOUT_COUNT; l++){
+        size_t len = strlen(sLayoutNames[l]);
+        if(strncmp(s, sLayoutNames[l], len) != 0)
+            continue;
+        if(s[len] == 0){
+            *filter = FILTER_NEAREST;
+        }else if(strcmp(s + len, "-bilinear") == 0 && l != CHROMA_444){
+            *filter = FILTER_BILINEAR;
+        }else{
+            continue;
+        }
+        *layout = (ChromaLayout)l;
+        return 0;
+    }
+    return -1;
+}
+
+const char *chromaLayoutName(ChromaLayout layout){
+    return sLayoutNames[layout];
+}
+
+const char *chromaFilterName(ChromaFilter filter){
+    return sFilterNames[filter];
+}
+
+int parseKernelMath(const char *s, KernelMath *math){
+    for(int m = 0; m < KERNEL_MATH_COUNT; m++){
+        if(strcmp(s, sMathNames[m]) == 0){
+            *math = (KernelMath)m;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+const char *kernelMathName(KernelMath math){
+    return sMathNames[math];
+}
+
+uint32_t chromaPlanes(ChromaLayout layout){
+    return layout == CHROMA_NV12 ? 2 : 3;
+}
+
+uint32_t chromaPlaneSize(ChromaLayout layout, uint32_t width, uint32_t height, uint32_t plane){
+    if(plane == 0 || layout == CHROMA_444)
+        return width * height;
+    if(layout == CHROMA_NV12)
+        return plane == 1 ? width * (height / 2) : 0;
+    return (width / 2) * (height / 2);
+}
@@ -0,0 +1,121 @@
+#ifndef _COLORSPACE_H_
+#define _COLORSPACE_H_
+#include <stdint.h>
+
+enum ColorMatrix{
+	COLOR_BT601 = 0,
+	COLOR_BT709,
+	COLOR_BT2020,
+	COLOR_MATRIX_COUNT,
+};
+
+enum ColorRange{
+	RANGE_LIMITED = 0,  // y 16..235, chroma 16..240
+	RANGE_FULL,         // 0..255
+	COLOR_RANGE_COUNT,
+};
+
+// Layout of the input planes
+enum ChromaLayout{
+	CHROMA_444 = 0,  // y, u, v at full size
+	CHROMA_I420,     // y, then u and v at half width and height
+	CHROMA_NV12,     // y, then interleaved uv at half height
+	CHROMA_LAYOUT_COUNT,
+};
+
+// How 4:2:0 chroma is brought up to 4:4:4
+enum ChromaFilter{
+	FILTER_NEAREST = 0,  // each chroma sample covers its 2x2 block
+	FILTER_BILINEAR,     // centered siting, 9/3/3/1 weights rounded to 8 bit
+	CHROMA_FILTER_COUNT,
+};
+
+// YCbCr -> RGB in 8 bit units:
+//   r = y * (Y - yOffset) + rv * (V - 128)
+//   g = y * (Y - yOffset) + gu * (U - 128) + gv * (V - 128)
+//   b = y * (Y - yOffset) + bu * (U - 128)
+struct ColorCoefs{
+	float y;
+	float rv;
+	float gu;
+	float gv;
+	float bu;
+	float yOffset;
+};
+
+// From the luma weights kr, kb of a standard and the range scales
+constexpr ColorCoefs makeColorCoefs(double kr, double kb, double ys, double cs, double yOffset){
+    return ColorCoefs{(float)ys, (float)(cs * 2 * (1 - kr)), (float)(-cs * 2 * kb * (1 - kb) / (1 - kr - kb)),
+                      (float)(-cs * 2 * kr * (1 - kr) / (1 - kr - kb)), (float)(cs * 2 * (1 - kb)), (float)yOffset};
+}
+
+#define LIMITED_Y_SCALE (255.0 / 219.0)
+#define LIMITED_C_SCALE (255.0 / 224.0)
+
+// Shared by the shader generator and the CPU path so both sides use the
+// exact same constants
+static constexpr ColorCoefs kColorCoefs[COLOR_MATRIX_COUNT][COLOR_RANGE_COUNT] = {
+    {makeColorCoefs(0.299, 0.114, LIMITED_Y_SCALE, LIMITED_C_SCALE, 16), makeColorCoefs(0.299, 0.114, 1, 1, 0)},
+    {makeColorCoefs(0.2126, 0.0722, LIMITED_Y_SCALE, LIMITED_C_SCALE, 16), makeColorCoefs(0.2126, 0.0722, 1, 1, 0)},
+    {makeColorCoefs(0.2627, 0.0593, LIMITED_Y_SCALE, LIMITED_C_SCALE, 16), makeColorCoefs(0.2627, 0.0593, 1, 1, 0)},
+};
+
+// Integer kernels: the same coefficients in 16.16 fixed point. A channel is
+//   clamp((y * (Y - yOffset) + c * (C - 128) + round) >> FIXED_SHIFT, 0, 255)
+// in 32 bit ints, so every GPU and the scalar CPU reference agree to the bit.
+enum KernelMath{
+	MATH_FLOAT = 0,
+	MATH_FIXED,
+	KERNEL_MATH_COUNT,
+};
+
+#define FIXED_SHIFT 16
+
+struct FixedCoefs{
+	int32_t y;
+	int32_t rv;
+	int32_t gu;
+	int32_t gv;
+	int32_t bu;
+	int32_t yOffset;
+};
+
+constexpr int32_t toFixed(float f){
+    return (int32_t)(f * (1 << FIXED_SHIFT) + (f < 0 ? -0.5f : 0.5f));
+}
+
+constexpr FixedCoefs makeFixedCoefs(const ColorCoefs &c){
+    return FixedCoefs{toFixed(c.y), toFixed(c.rv), toFixed(c.gu), toFixed(c.gv), toFixed(c.bu), (int32_t)c.yOffset};
+}
+
+static constexpr FixedCoefs kFixedCoefs[COLOR_MATRIX_COUNT][COLOR_RANGE_COUNT] = {
+    {makeFixedCoefs(kColorCoefs[0][0]), makeFixedCoefs(kColorCoefs[0][1])},
+    {makeFixedCoefs(kColorCoefs[1][0]), makeFixedCoefs(kColorCoefs[1][1])},
+    {makeFixedCoefs(kColorCoefs[2][0]), makeFixedCoefs(kColorCoefs[2][1])},
+};
+
+// Rounds and clamps one fixed point channel, the shaders do the same
+static inline uint8_t fixedClamp(int32_t x){
+    x += 1 << (FIXED_SHIFT - 1);
+    if(x < 0)
+        return 0;
+    x >>= FIXED_SHIFT;
+    return x > 255 ? 255 : x;
+}
+
+// "bt601", "bt709", "bt2020", with an optional "-full" suffix. -1 if unknown.
+int parseColorSpace(const char *s, ColorMatrix *matrix, ColorRange *range);
+// "bt709_full" style tag, used in kernel names
+const char *colorSpaceName(ColorMatrix matrix, ColorRange range);
+
+// "444", "i420" or "nv12", with an optional "-bilinear" suffix. -1 if unknown.
+int parseChromaLayout(const char *s, ChromaLayout *layout, ChromaFilter *filter);
+const char *chromaLayoutName(ChromaLayout layout);
+const char *chromaFilterName(ChromaFilter filter);
+// "float" or "fixed", -1 if unknown
+int parseKernelMath(const char *s, KernelMath *math);
+const char *kernelMathName(KernelMath math);
+// planes of a layout and the bytes in each one
+uint32_t chromaPlanes(ChromaLayout layout);
+uint32_t chromaPlaneSize(ChromaLayout layout, uint32_t width, uint32_t height, uint32_t plane);
+#endif
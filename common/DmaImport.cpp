@@ -0,0 +1,278 @@
+#include "DmaImport.h"
+#include "GLCheck.h"
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <EGL/eglext.h>
+
+#ifndef EGL_LINUX_DMA_BUF_EXT
+#define EGL_LINUX_DMA_BUF_EXT 0x3270
+#define EGL_LINUX_DRM_FOURCC_EXT 0x3271
+#define EGL_DMA_BUF_PLANE0_FD_EXT 0x3272
+#define EGL_DMA_BUF_PLANE0_OFFSET_EXT 0x3273
+#define EGL_DMA_BUF_PLANE0_PITCH_EXT 0x3274
+#endif
+// DRM_FORMAT_ABGR8888: bytes R, G, B, A in memory, one plane byte per channel
+#define FOURCC_ABGR8888 0x34324241
+
+// linux/dma-buf.h, not in every NDK
+struct DmaBufSync{
+	uint64_t flags;
+};
+#define DMA_BUF_SYNC_READ (1 << 0)
+#define DMA_BUF_SYNC_START (0 << 2)
+#define DMA_BUF_SYNC_END (1 << 2)
+#define DMA_BUF_IOCTL_SYNC _IOW('b', 0, struct DmaBufSync)
+
+typedef void *(EGLAPIENTRYP CreateImageProc)(EGLDisplay dpy, EGLContext ctx, EGLenum target, EGLClientBuffer buffer,
+                                             const EGLint *attribs);
+typedef EGLBoolean (EGLAPIENTRYP DestroyImageProc)(EGLDisplay dpy, void *image);
+typedef void (GL_APIENTRYP ImageTargetTexture2DProc)(GLenum target, void *image);
+static CreateImageProc eglCreateImageKHRPtr = NULL;
+static DestroyImageProc eglDestroyImageKHRPtr = NULL;
+static ImageTargetTexture2DProc glEGLImageTargetTexture2DOESPtr = NULL;
+static EGLDisplay sDisplay = EGL_NO_DISPLAY;
+
+int fdKey(int fd, FdKey *key, uint64_t *size){
+    struct stat st;
+
+    if(fstat(fd, &st) != 0)
+        return -1;
+    key->dev = st.st_dev;
+    key->ino = st.st_ino;
+    *size = st.st_size;
+    return 0;
+}
+
+static bool sameKey(const FdKey *a, const FdKey *b){
+    return a->dev == b->dev && a->ino == b->ino;
+}
+
+//static
+bool DmaImport::init(EGLDisplay display){
+    const char *egl = eglQueryString(display, EGL_EXTENSIONS);
+    const char *gl = (const char *)glGetString(GL_EXTENSIONS);
+
+    if(egl == NULL || strstr(egl, "EGL_EXT_image_dma_buf_import") == NULL || strstr(egl, "EGL_KHR_image_base") == NULL)
+        return false;
+    if(gl == NULL || strstr(gl, "GL_OES_EGL_image") == NULL)
+        return false;
+    eglCreateImageKHRPtr = (CreateImageProc)eglGetProcAddress("eglCreateImageKHR");
+    eglDestroyImageKHRPtr = (DestroyImageProc)eglGetProcAddress("eglDestroyImageKHR");
+    glEGLImageTargetTexture2DOESPtr = (ImageTargetTexture2DProc)eglGetProcAddress("glEGLImageTargetTexture2DOES");
+    sDisplay = display;
+    return eglCreateImageKHRPtr != NULL && eglDestroyImageKHRPtr != NULL && glEGLImageTargetTexture2DOESPtr != NULL;
+}
+
+DmaImport::DmaImport():
+    mCount(0), mClock(0), mHits(0), mMisses(0){
+    pthread_mutex_init(&mLock, NULL);
+    memset(&mLayout, 0, sizeof(mLayout));
+    memset(mEntries, 0, sizeof(mEntries));
+}
+
+DmaImport::~DmaImport(){
+    // clear() already ran on the GL thread
+    pthread_mutex_destroy(&mLock);
+}
+
+void DmaImport::setLayout(const DmaLayout *layout){
+    mLayout = *layout;
+}
+
+// mLock held
+DmaImport::Entry *DmaImport::find(const FdKey *key){
+    for(uint32_t i = 0; i < mCount; i++){
+        if(sameKey(&mEntries[i].key, key))
+            return &mEntries[i];
+    }
+    return NULL;
+}
+
+// GL thread, mLock held
+void DmaImport::release(Entry *e){
+    for(uint32_t j = 0; j < MAX_PLANES; j++){
+        if(e->tex[j] != 0)
+            glDeleteTextures(1, &e->tex[j]);
+        if(e->image[j] != NULL)
+            eglDestroyImageKHRPtr(sDisplay, e->image[j]);
+    }
+    memset(e->image, 0, sizeof(e->image));
+    memset(e->tex, 0, sizeof(e->tex));
+}
+
+void DmaImport::drop(Entry *e){
+    release(e);
+    *e = mEntries[--mCount];
+}
+
+bool DmaImport::known(const FdKey *key, bool *ok){
+    Entry *e;
+
+    pthread_mutex_lock(&mLock);
+    e = find(key);
+    if(e != NULL){
+        e->used = ++mClock;
+        *ok = e->ok;
+        mHits++;
+    }
+    pthread_mutex_unlock(&mLock);
+    return e != NULL;
+}
+
+int DmaImport::import(int fd, const FdKey *key){
+    Entry *e;
+    uint32_t oldest = 0;
+
+    pthread_mutex_lock(&mLock);
+    e = find(key);
+    if(e != NULL){
+        pthread_mutex_unlock(&mLock);
+        return e->ok ? 0 : -1;
+    }
+    if(mCount == MAX_IMPORTS){
+        for(uint32_t i = 1; i < mCount; i++){
+            if(mEntries[i].used < mEntries[oldest].used)
+                oldest = i;
+        }
+        drop(&mEntries[oldest]);
+    }
+    e = &mEntries[mCount++];
+    memset(e, 0, sizeof(*e));
+    e->key = *key;
+    e->used = ++mClock;
+    e->ok = true;
+    mMisses++;
+
+    for(uint32_t j = 0; j < mLayout.planes && e->ok; j++){
+        EGLint attribs[] = {
+            EGL_WIDTH, (EGLint)mLayout.width[j],
+            EGL_HEIGHT, (EGLint)mLayout.height[j],
+            EGL_LINUX_DRM_FOURCC_EXT, FOURCC_ABGR8888,
+            EGL_DMA_BUF_PLANE0_FD_EXT, fd,
+            EGL_DMA_BUF_PLANE0_OFFSET_EXT, (EGLint)mLayout.offset[j],
+            EGL_DMA_BUF_PLANE0_PITCH_EXT, (EGLint)mLayout.pitch[j],
+            EGL_NONE,
+        };
+        e->image[j] = eglCreateImageKHRPtr(sDisplay, EGL_NO_CONTEXT, EGL_LINUX_DMA_BUF_EXT, NULL, attribs);
+        if(e->image[j] == NULL){
+            printf("eglCreateImageKHR plane %d failed, error:%x\n", j, eglGetError());
+            GLCheck::fail();
+            e->ok = false;
+            break;
+        }
+        glGenTextures(1, &e->tex[j]);
+        glBindTexture(GL_TEXTURE_2D, e->tex[j]);
+        glEGLImageTargetTexture2DOESPtr(GL_TEXTURE_2D, e->image[j]);
+        // no mipmaps, texelFetch() needs a complete texture
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        if(GL_CHECK_INIT("import plane") != 0){
+            printf("imported plane %d can't be sampled\n", j);
+            GLCheck::fail();
+            e->ok = false;
+        }
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+    // a failed buffer keeps its entry, so it isn't tried again
+    if(!e->ok)
+        release(e);
+    pthread_mutex_unlock(&mLock);
+    return e->ok ? 0 : -1;
+}
+
+int DmaImport::get(const FdKey *key, GLuint *tex){
+    Entry *e;
+
+    pthread_mutex_lock(&mLock);
+    e = find(key);
+    if(e != NULL && e->ok)
+        memcpy(tex, e->tex, sizeof(e->tex));
+    pthread_mutex_unlock(&mLock);
+    return e != NULL && e->ok ? 0 : -1;
+}
+
+void DmaImport::clear(void){
+    pthread_mutex_lock(&mLock);
+    while(mCount > 0)
+        drop(&mEntries[mCount - 1]);
+    pthread_mutex_unlock(&mLock);
+}
+
+void DmaImport::stats(uint64_t *hits, uint64_t *misses){
+    pthread_mutex_lock(&mLock);
+    *hits = mHits;
+    *misses = mMisses;
+    pthread_mutex_unlock(&mLock);
+}
+
+FdMapCache::FdMapCache():
+    mCount(0), mClock(0), mHits(0), mMisses(0){
+    memset(mEntries, 0, sizeof(mEntries));
+}
+
+FdMapCache::~FdMapCache(){
+    for(uint32_t i = 0; i < mCount; i++)
+        munmap(mEntries[i].base, mEntries[i].size);
+}
+
+const uint8_t *FdMapCache::map(int fd, const FdKey *key, uint64_t size){
+    uint32_t oldest = 0;
+    Entry *e;
+    void *base;
+
+    for(uint32_t i = 0; i < mCount; i++){
+        e = &mEntries[i];
+        // a memfd can have grown since it was mapped
+        if(sameKey(&e->key, key) && e->size >= size){
+            e->used = ++mClock;
+            mHits++;
+            return e->base;
+        }
+        if(sameKey(&e->key, key)){
+            munmap(e->base, e->size);
+            *e = mEntries[--mCount];
+            break;
+        }
+    }
+    base = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    if(base == MAP_FAILED){
+        printf("mmap of fd %d failed\n", fd);
+        return NULL;
+    }
+    if(mCount == MAX_IMPORTS){
+        for(uint32_t i = 1; i < mCount; i++){
+            if(mEntries[i].used < mEntries[oldest].used)
+                oldest = i;
+        }
+        munmap(mEntries[oldest].base, mEntries[oldest].size);
+        mEntries[oldest] = mEntries[--mCount];
+    }
+    e = &mEntries[mCount++];
+    e->key = *key;
+    e->base = (uint8_t *)base;
+    e->size = size;
+    e->used = ++mClock;
+    mMisses++;
+    return e->base;
+}
+
+//static
+void FdMapCache::beginRead(int fd){
+    DmaBufSync sync = {DMA_BUF_SYNC_START | DMA_BUF_SYNC_READ};
+    // fails with ENOTTY on anything but a dma-buf, nothing to sync then
+    ioctl(fd, DMA_BUF_IOCTL_SYNC, &sync);
+}
+
+//static
+void FdMapCache::endRead(int fd){
+    DmaBufSync sync = {DMA_BUF_SYNC_END | DMA_BUF_SYNC_READ};
+    ioctl(fd, DMA_BUF_IOCTL_SYNC, &sync);
+}
+
+void FdMapCache::stats(uint64_t *hits, uint64_t *misses){
+    *hits = mHits;
+    *misses = mMisses;
+}
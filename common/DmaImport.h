@@ -0,0 +1,112 @@
+#ifndef _DMAIMPORT_H_
+#define _DMAIMPORT_H_
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <EGL/egl.h>
+#include <GLES3/gl31.h>
+#include "Kernels.h"
+
+// Buffers one stream keeps imported / mapped, decoder pools are smaller
+#define MAX_IMPORTS 32
+
+// A shared buffer is known by its inode: decoders hand the same few
+// buffers back every frame, often under a new fd number each time.
+// Holding the import or mapping keeps the buffer and so its inode alive,
+// a cached key can't be reused by another buffer meanwhile.
+struct FdKey{
+	uint64_t dev;
+	uint64_t ino;
+};
+// -1 if fd can't be fstat()ed
+int fdKey(int fd, FdKey *key, uint64_t *size);
+
+// Where the planes are in an imported buffer, and how much of each row the
+// kernel reads: width texels of 4 bytes, height rows
+struct DmaLayout{
+	uint32_t planes;
+	uint32_t offset[MAX_PLANES];
+	uint32_t pitch[MAX_PLANES];
+	uint32_t width[MAX_PLANES];
+	uint32_t height[MAX_PLANES];
+};
+
+// dma-buf frames imported as EGLImages (EGL_EXT_image_dma_buf_import), one
+// DRM_FORMAT_ABGR8888 image per plane, so a texel is 4 plane bytes like in
+// the staging buffers. Each image backs a texture
+// (glEGLImageTargetTexture2DOES) the kernel's importSource samples. Buffers the
+// driver rejects are remembered too, lookups then fail fast. The least
+// recently used entry goes when the cache is full. import(), get() and
+// clear() on the GL thread, known() from any thread.
+class DmaImport{
+public:
+    // Extension lookup on the calling GL thread, false when dma-buf import
+    // is missing. Once per engine.
+    static bool init(EGLDisplay display);
+
+    DmaImport();
+    ~DmaImport();
+    void setLayout(const DmaLayout *layout);
+    // true when key has been imported before, *ok false if that failed
+    bool known(const FdKey *key, bool *ok);
+    // Import the planes of fd's buffer unless key is cached already, -1 if
+    // the driver rejects it
+    int import(int fd, const FdKey *key);
+    // Textures of a buffer import() took, one per plane
+    int get(const FdKey *key, GLuint *tex);
+    void clear(void);
+    void stats(uint64_t *hits, uint64_t *misses);
+
+private:
+	struct Entry{
+		FdKey key;
+		bool ok;
+		void *image[MAX_PLANES];  // EGLImageKHR
+		GLuint tex[MAX_PLANES];
+		uint64_t used;
+	};
+
+	Entry *find(const FdKey *key);
+	void release(Entry *e);
+	void drop(Entry *e);
+
+private:
+	pthread_mutex_t mLock;
+	DmaLayout mLayout;
+	Entry mEntries[MAX_IMPORTS];
+	uint32_t mCount;
+	uint64_t mClock;
+	uint64_t mHits;
+	uint64_t mMisses;
+};
+
+// CPU side fallback: the whole buffer mapped read only, for fds that can't
+// be imported (memfd, no import extension, CPU streams). Frames are then
+// copied in from the mapping like any other submit(). dma-bufs are read
+// between DMA_BUF_IOCTL_SYNC calls. One thread only.
+class FdMapCache{
+public:
+    FdMapCache();
+    ~FdMapCache();
+    // The first size bytes of fd's buffer, NULL if it can't be mapped
+    const uint8_t *map(int fd, const FdKey *key, uint64_t size);
+    // cache coherency around CPU reads of a dma-buf, no-op for memfd
+    static void beginRead(int fd);
+    static void endRead(int fd);
+    void stats(uint64_t *hits, uint64_t *misses);
+
+private:
+	struct Entry{
+		FdKey key;
+		uint8_t *base;
+		size_t size;
+		uint64_t used;
+	};
+
+	Entry mEntries[MAX_IMPORTS];
+	uint32_t mCount;
+	uint64_t mClock;
+	uint64_t mHits;
+	uint64_t mMisses;
+};
+#endif
@@ -0,0 +1,250 @@
+#include "FrameIO.h"
+#include "StageTimer.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+FrameReader::FrameReader():
+    mFd(-1), mFile(NULL), mFrameSize(0), mFileSize(0), mPos(0), mMap(NULL), mMapOffset(0),
+    mMapLen(0), mDropped(0), mBuf(NULL){
+    mPage = sysconf(_SC_PAGESIZE);
+}
+
+FrameReader::~FrameReader(){
+    close();
+}
+
+int FrameReader::open(const char *path, uint32_t frameSize){
+    struct stat st;
+
+    close();
+    mFrameSize = frameSize;
+    mPos = 0;
+    mFd = ::open(path, O_RDONLY);
+    if(mFd < 0){
+        printf("can't open %s, errno:%d\n", path, errno);
+        return -1;
+    }
+    if(fstat(mFd, &st) == 0 && S_ISREG(st.st_mode)){
+        mFileSize = st.st_size;
+        if(mFileSize < frameSize || remap(0) == 0)
+            return 0;
+    }
+    // not a regular file, or it can't be mapped
+    mFile = fdopen(mFd, "rb");
+    if(mFile == NULL){
+        ::close(mFd);
+        mFd = -1;
+        return -1;
+    }
+    mBuf = (uint8_t *)malloc(frameSize);
+    return mBuf != NULL ? 0 : -1;
+}
+
+void FrameReader::close(void){
+    if(mMap != NULL)
+        munmap(mMap, mMapLen);
+    mMap = NULL;
+    if(mFile != NULL)
+        fclose(mFile);
+    else if(mFd >= 0)
+        ::close(mFd);
+    mFile = NULL;
+    mFd = -1;
+    free(mBuf);
+    mBuf = NULL;
+}
+
+bool FrameReader::mapped(void){
+    return mMap != NULL;
+}
+
+// map a window starting at the page holding pos
+int FrameReader::remap(uint64_t pos){
+    uint64_t offset = pos & ~(uint64_t)(mPage - 1);
+    uint64_t len = READ_WINDOW;
+    void *p;
+
+    if(mMap != NULL)
+        munmap(mMap, mMapLen);
+    mMap = NULL;
+    // a window always holds at least one whole frame
+    if(len < pos - offset + mFrameSize)
+        len = pos - offset + mFrameSize;
+    if(len > mFileSize - offset)
+        len = mFileSize - offset;
+    p = mmap(NULL, len, PROT_READ, MAP_SHARED, mFd, offset);
+    if(p == MAP_FAILED){
+        printf("mmap of %llu bytes at %llu failed, errno:%d\n", (unsigned long long)len,
+               (unsigned long long)offset, errno);
+        return -1;
+    }
+    madvise(p, len, MADV_SEQUENTIAL);
+    mMap = (uint8_t *)p;
+    mMapOffset = offset;
+    mMapLen = len;
+    mDropped = offset;
+    return 0;
+}
+
+const uint8_t *FrameReader::next(void){
+    const uint8_t *frame;
+    uint64_t end, drop;
+
+    if(mFile != NULL){
+        if(fread(mBuf, mFrameSize, 1, mFile) != 1)
+            return NULL;
+        return mBuf;
+    }
+    if(mMap == NULL || mPos + mFrameSize > mFileSize)
+        return NULL;
+    if(mPos + mFrameSize > mMapOffset + mMapLen && remap(mPos) != 0)
+        return NULL;
+
+    // the previous frame is done with, let the kernel reclaim its pages
+    drop = mPos & ~(uint64_t)(mPage - 1);
+    if(drop > mDropped){
+        madvise(mMap + (mDropped - mMapOffset), drop - mDropped, MADV_DONTNEED);
+        mDropped = drop;
+    }
+    frame = mMap + (mPos - mMapOffset);
+    mPos += mFrameSize;
+
+    // start reading the next frame while this one is converted
+    end = mPos + mFrameSize;
+    if(end > mMapOffset + mMapLen)
+        end = mMapOffset + mMapLen;
+    if(end > mPos){
+        drop = mPos & ~(uint64_t)(mPage - 1);
+        madvise(mMap + (drop - mMapOffset), end - drop, MADV_WILLNEED);
+    }
+    return frame;
+}
+
+FrameWriter::FrameWriter(FILE *out, uint32_t frameSize, uint32_t slots):
+    mOut(out), mFrameSize(frameSize), mSlots(slots), mGetIndex(0), mPutIndex(0), mWriteIndex(0),
+    mQuit(false), mFailed(false), mStallNs(0), mWriteNs(0){
+    mBuffers = (uint8_t *)malloc((size_t)frameSize * slots);
+    mBytes = (uint32_t *)malloc(sizeof(uint32_t) * slots);
+    sem_init(&mFreeSem, 0, slots);
+    sem_init(&mFullSem, 0, 0);
+    pthread_create(&mThread, NULL, writer_entry, this);
+}
+
+FrameWriter::~FrameWriter(){
+    // the writer drains what was queued before it sees the flag
+    mQuit = true;
+    sem_post(&mFullSem);
+    pthread_join(mThread, NULL);
+    sem_destroy(&mFreeSem);
+    sem_destroy(&mFullSem);
+    free(mBuffers);
+    free(mBytes);
+}
+
+//static
+void *FrameWriter::writer_entry(void *data){
+    static_cast<FrameWriter *>(data)->writerMain();
+    return NULL;
+}
+
+void FrameWriter::writerMain(void){
+    uint32_t bytes;
+    uint64_t start;
+
+    for(;;){
+        sem_wait(&mFullSem);
+        if(mQuit && mWriteIndex == mPutIndex)
+            break;
+        bytes = mBytes[mWriteIndex % mSlots];
+        start = StageTimer::now();
+        if(!mFailed && fwrite(mBuffers + (size_t)(mWriteIndex % mSlots) * mFrameSize, bytes, 1, mOut) != 1){
+            printf("write failed, errno:%d\n", errno);
+            mFailed = true;
+        }
+        mWriteNs += StageTimer::now() - start;
+        mWriteIndex++;
+        sem_post(&mFreeSem);
+    }
+    fflush(mOut);
+}
+
+uint8_t *FrameWriter::get(void){
+    uint8_t *buf = mBuffers + (size_t)(mGetIndex % mSlots) * mFrameSize;
+    uint64_t start;
+
+    if(sem_trywait(&mFreeSem) != 0){
+        start = StageTimer::now();
+        sem_wait(&mFreeSem);
+        mStallNs += StageTimer::now() - start;
+    }
+    mGetIndex++;
+    return buf;
+}
+
+void FrameWriter::put(uint32_t bytes){
+    mBytes[mPutIndex % mSlots] = bytes < mFrameSize ? bytes : mFrameSize;
+    mPutIndex++;
+    sem_post(&mFullSem);
+}
+
+void FrameWriter::finish(void){
+    uint64_t start = StageTimer::now();
+
+    // every buffer free again means the ring is drained
+    for(uint32_t i = 0; i < mSlots; i++)
+        sem_wait(&mFreeSem);
+    fflush(mOut);
+    for(uint32_t i = 0; i < mSlots; i++)
+        sem_post(&mFreeSem);
+    mStallNs += StageTimer::now() - start;
+}
+
+bool FrameWriter::failed(void){
+    return mFailed;
+}
+
+uint64_t FrameWriter::stallNs(void){
+    return mStallNs;
+}
+
+uint64_t FrameWriter::writeNs(void){
+    return mWriteNs;
+}
+
+void copyPlane(uint8_t *dst, uint32_t dstPitch, const uint8_t *src, uint32_t srcPitch, uint32_t width, uint32_t rows){
+    if(rows == 0)
+        return;
+    if(dstPitch == srcPitch){
+        // the last row may end at the width
+        memcpy(dst, src, (size_t)dstPitch * (rows - 1) + width);
+        return;
+    }
+    for(uint32_t r = 0; r < rows; r++)
+        memcpy(dst + (size_t)r * dstPitch, src + (size_t)r * srcPitch, width);
+}
+
+int memfdFrame(const uint8_t *data, size_t size){
+#ifdef __NR_memfd_create
+    // the NDK has no memfd_create() wrapper
+    int fd = syscall(__NR_memfd_create, "frame", 0);
+    void *map;
+
+    if(fd < 0)
+        return -1;
+    if(ftruncate(fd, size) != 0 || (map = mmap(NULL, size, PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED){
+        ::close(fd);
+        return -1;
+    }
+    memcpy(map, data, size);
+    munmap(map, size);
+    return fd;
+#else
+    return -1;
+#endif
+}
@@ -0,0 +1,94 @@
+#ifndef _FRAMEIO_H_
+#define _FRAMEIO_H_
+#include <stdint.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sys/types.h>
+
+// Bytes of the input file mapped at a time
+#define READ_WINDOW (64 << 20)
+// Output frames that may wait for the writer thread, on top of the pipeline depth
+#define WRITE_QUEUE 8
+
+// Raw input frames handed out straight from a read-only mapping of the file.
+// The file is mapped one window at a time with sequential hints, pages ahead
+// are prefetched and pages behind are dropped, so multi-GB captures stream
+// without growing the resident set. Files that can't be mapped (pipes) are
+// read with fread into one frame buffer instead.
+class FrameReader{
+public:
+    FrameReader();
+    ~FrameReader();
+    int open(const char *path, uint32_t frameSize);
+    void close(void);
+    // next whole frame, NULL at the end of the file. Valid until the next call.
+    const uint8_t *next(void);
+    bool mapped(void);
+
+private:
+    int remap(uint64_t pos);
+
+private:
+	int mFd;
+	FILE *mFile;
+	uint32_t mFrameSize;
+	uint64_t mFileSize;
+	uint64_t mPos;
+	uint8_t *mMap;
+	uint64_t mMapOffset;
+	size_t mMapLen;
+	uint64_t mDropped;   // file offset the pages before which are released
+	uint8_t *mBuf;
+	size_t mPage;
+};
+
+// Output frames are written by a dedicated thread from a bounded ring of
+// buffers. get() and put() must be called in the same order, get() only
+// blocks while every buffer is queued or waiting to be written.
+class FrameWriter{
+public:
+    FrameWriter(FILE *out, uint32_t frameSize, uint32_t slots);
+    // waits for the queued frames
+    ~FrameWriter();
+    uint8_t *get(void);
+    // queue the buffer from the oldest outstanding get(), bytes <= frameSize
+    void put(uint32_t bytes);
+    // wait until everything queued so far is written and flushed, every
+    // get() must have been put() first
+    void finish(void);
+    bool failed(void);
+    // time get() spent waiting for a free buffer, and the writer spent in fwrite
+    uint64_t stallNs(void);
+    uint64_t writeNs(void);
+
+private:
+	static void *writer_entry(void *data);
+	void writerMain(void);
+
+private:
+	FILE *mOut;
+	uint32_t mFrameSize;
+	uint32_t mSlots;
+	uint8_t *mBuffers;
+	uint32_t *mBytes;
+	uint64_t mGetIndex;     // frame counters, the slot is index % slots
+	uint64_t mPutIndex;
+	uint64_t mWriteIndex;
+	sem_t mFreeSem;
+	sem_t mFullSem;
+	pthread_t mThread;
+	volatile bool mQuit;
+	volatile bool mFailed;
+	uint64_t mStallNs;
+	volatile uint64_t mWriteNs;
+};
+
+// rows rows of width bytes from src to dst at their own pitches, one copy
+// when both are packed the same
+void copyPlane(uint8_t *dst, uint32_t dstPitch, const uint8_t *src, uint32_t srcPitch, uint32_t width, uint32_t rows);
+
+// An anonymous memfd holding size bytes of data, a stand-in for a decoder's
+// shared buffer. -1 if the kernel has no memfd_create.
+int memfdFrame(const uint8_t *data, size_t size);
+#endif
@@ -0,0 +1,163 @@
+#include "GLCheck.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <EGL/egl.h>
+
+std::atomic<uint32_t> GLCheck::sEvery(0);
+std::atomic<uint32_t> GLCheck::sTick(0);
+static std::atomic<uint64_t> sChecks(0);
+static std::atomic<uint64_t> sErrors(0);
+static std::atomic<uint64_t> sFailures(0);
+static std::atomic<uint64_t> sMessages(0);
+static std::atomic<uint32_t> sLastError(0);
+
+#ifdef GLCHECK_DEBUG
+// GL_KHR_debug, not in every NDK's headers
+#define DEBUG_OUTPUT_KHR 0x92E0
+#define DEBUG_OUTPUT_SYNCHRONOUS_KHR 0x8242
+#define DEBUG_SEVERITY_HIGH_KHR 0x9146
+#define DEBUG_SEVERITY_MEDIUM_KHR 0x9147
+#define DEBUG_SEVERITY_LOW_KHR 0x9148
+#define DEBUG_SEVERITY_NOTIFICATION_KHR 0x826B
+
+typedef void (GL_APIENTRYP DebugProc)(GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei length,
+                                      const GLchar *message, const void *userParam);
+typedef void (GL_APIENTRYP DebugMessageCallbackProc)(DebugProc callback, const void *userParam);
+typedef void (GL_APIENTRYP DebugMessageControlProc)(GLenum source, GLenum type, GLenum severity, GLsizei count,
+                                                    const GLuint *ids, GLboolean enabled);
+
+// last checked call site of a thread, for the debug messages
+struct CheckSite{
+	const char *what;
+	const char *func;
+	int line;
+};
+
+static pthread_key_t sSiteKey;
+static pthread_once_t sSiteOnce = PTHREAD_ONCE_INIT;
+
+static void makeSiteKey(void){
+    pthread_key_create(&sSiteKey, free);
+}
+
+static CheckSite *threadSite(void){
+    CheckSite *site;
+
+    pthread_once(&sSiteOnce, makeSiteKey);
+    site = (CheckSite *)pthread_getspecific(sSiteKey);
+    if(site == NULL){
+        site = (CheckSite *)calloc(1, sizeof(*site));
+        pthread_setspecific(sSiteKey, site);
+    }
+    return site;
+}
+
+static const char *severityName(GLenum severity){
+    switch(severity){
+    case DEBUG_SEVERITY_HIGH_KHR:
+        return "high";
+    case DEBUG_SEVERITY_MEDIUM_KHR:
+        return "medium";
+    case DEBUG_SEVERITY_LOW_KHR:
+        return "low";
+    default:
+        return "note";
+    }
+}
+
+// synchronous output, so this runs on the thread that made the call
+static void GL_APIENTRY debug_callback(GLenum, GLenum, GLuint id, GLenum severity, GLsizei, const GLchar *message,
+                                       const void *){
+    CheckSite *site = threadSite();
+
+    sMessages++;
+    if(site->what != NULL)
+        printf("gl %s %x: %s, since %s (%s:%d)\n", severityName(severity), id, message, site->what, site->func,
+               site->line);
+    else
+        printf("gl %s %x: %s\n", severityName(severity), id, message);
+}
+#endif
+
+//static
+void GLCheck::install(void){
+    const char *env = getenv("GLESCONVERT_GL_CHECK");
+
+    if(env != NULL)
+        sEvery = strtoul(env, NULL, 0);
+#ifdef GLCHECK_DEBUG
+    static const GLenum severities[] = {DEBUG_SEVERITY_HIGH_KHR, DEBUG_SEVERITY_MEDIUM_KHR, DEBUG_SEVERITY_LOW_KHR,
+                                        DEBUG_SEVERITY_NOTIFICATION_KHR};
+    const char *ext = (const char *)glGetString(GL_EXTENSIONS);
+    DebugMessageCallbackProc callback;
+    DebugMessageControlProc control;
+    uint32_t levels = 2;
+
+    if(ext == NULL || strstr(ext, "GL_KHR_debug") == NULL){
+        printf("no GL_KHR_debug, glGetError() checks only\n");
+        return;
+    }
+    callback = (DebugMessageCallbackProc)eglGetProcAddress("glDebugMessageCallbackKHR");
+    control = (DebugMessageControlProc)eglGetProcAddress("glDebugMessageControlKHR");
+    if(callback == NULL || control == NULL)
+        return;
+    env = getenv("GLESCONVERT_GL_DEBUG");
+    if(env != NULL && strcmp(env, "high") == 0)
+        levels = 1;
+    else if(env != NULL && strcmp(env, "low") == 0)
+        levels = 3;
+    else if(env != NULL && strcmp(env, "all") == 0)
+        levels = 4;
+    // the driver drops what is filtered out, the callback never sees it
+    control(GL_DONT_CARE, GL_DONT_CARE, GL_DONT_CARE, 0, NULL, GL_FALSE);
+    for(uint32_t i = 0; i < levels; i++)
+        control(GL_DONT_CARE, GL_DONT_CARE, severities[i], 0, NULL, GL_TRUE);
+    callback(debug_callback, NULL);
+    glEnable(DEBUG_OUTPUT_KHR);
+    glEnable(DEBUG_OUTPUT_SYNCHRONOUS_KHR);
+    printf("GL_KHR_debug callback, severity %s and up\n", severityName(severities[levels - 1]));
+#endif
+}
+
+//static
+void GLCheck::setSampling(uint32_t every){
+    sEvery = every;
+}
+
+//static
+void GLCheck::stats(GLErrorStats *stats){
+    stats->checks = sChecks.load();
+    stats->errors = sErrors.load();
+    stats->failures = sFailures.load();
+    stats->messages = sMessages.load();
+    stats->lastError = sLastError.load();
+}
+
+//static
+int GLCheck::check(const char *what, const char *func, int line){
+    GLenum err;
+    int n = 0;
+
+#ifdef GLCHECK_DEBUG
+    CheckSite *site = threadSite();
+    site->what = what;
+    site->func = func;
+    site->line = line;
+#endif
+    sChecks++;
+    // one error per flag is queued, a lost context can keep returning one
+    while(n < 8 && (err = glGetError()) != GL_NO_ERROR){
+        printf("glError:%x at %s (%s:%d)\n", err, what, func, line);
+        sLastError = err;
+        n++;
+    }
+    sErrors += n;
+    return n;
+}
+
+//static
+void GLCheck::fail(void){
+    sFailures++;
+}
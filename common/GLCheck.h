@@ -0,0 +1,67 @@
+#ifndef _GLCHECK_H_
+#define _GLCHECK_H_
+#include <stdint.h>
+#include <atomic>
+#include <GLES3/gl31.h>
+
+// GL error checking that stays out of release builds. glGetError() can
+// stall on the driver, so the per frame code only checks where a macro
+// says so:
+//
+// GL_CHECK(what)       after a group of calls on the frame path. Only with
+//                      -DGLCHECK_DEBUG, nothing otherwise.
+// GL_CHECK_FRAME(what) once per frame. Always with -DGLCHECK_DEBUG, in
+//                      release builds every Nth call when sampling is on
+//                      (GLESCONVERT_GL_CHECK=N or setSampling()), off by
+//                      default.
+// GL_CHECK_INIT(what)  setup and teardown code, every build.
+//
+// Checks print the errors with the call site. A check reports whatever was
+// raised since the one before, so errors the frame path leaves behind come
+// out at the next setup check or when the stream goes. With
+// -DGLCHECK_DEBUG every context also gets a GL_KHR_debug callback, when the
+// driver has it: driver messages at or above GLESCONVERT_GL_DEBUG (high,
+// medium (default), low or all) are printed with the last checked site of
+// that thread. fail() counts failures the code finds itself (incomplete
+// framebuffers, failed waits). Counts go to stats() in every build,
+// sampling off or not.
+struct GLErrorStats{
+	uint64_t checks;    // glGetError() rounds
+	uint64_t errors;    // error codes they returned
+	uint64_t failures;  // fail() calls
+	uint64_t messages;  // KHR_debug messages past the severity filter
+	uint32_t lastError;
+};
+
+class GLCheck{
+public:
+    // On each engine thread once its context is current
+    static void install(void);
+    // check every Nth GL_CHECK_FRAME() in release builds, 0 turns it off
+    static void setSampling(uint32_t every);
+    static void stats(GLErrorStats *stats);
+
+    // glGetError() until it is clean, 0 if nothing was pending
+    static int check(const char *what, const char *func, int line);
+    // a failure the caller found and reported itself
+    static void fail(void);
+
+    static bool sampleDue(void){
+        uint32_t every = sEvery.load(std::memory_order_relaxed);
+        return every != 0 && sTick.fetch_add(1, std::memory_order_relaxed) % every == 0;
+    }
+
+private:
+	static std::atomic<uint32_t> sEvery;
+	static std::atomic<uint32_t> sTick;
+};
+
+#ifdef GLCHECK_DEBUG
+#define GL_CHECK(what) GLCheck::check(what, __FUNCTION__, __LINE__)
+#define GL_CHECK_FRAME(what) GLCheck::check(what, __FUNCTION__, __LINE__)
+#else
+#define GL_CHECK(what) ((void)0)
+#define GL_CHECK_FRAME(what) do{ if(GLCheck::sampleDue()) GLCheck::check(what, __FUNCTION__, __LINE__); }while(0)
+#endif
+#define GL_CHECK_INIT(what) GLCheck::check(what, __FUNCTION__, __LINE__)
+#endif
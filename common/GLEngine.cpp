@@ -0,0 +1,998 @@
+#include "GLEngine.h"
+#include "GLStream.h"
+#include "StageTimer.h"
+#include "DmaImport.h"
+#include "GLCheck.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+typedef void (GL_APIENTRYP BufferStorageEXTProc)(GLenum target, GLsizeiptr size, const void *data, GLbitfield flags);
+static BufferStorageEXTProc glBufferStorageEXTPtr = NULL;
+
+static pthread_mutex_t sEngineLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t sCompileLock = PTHREAD_MUTEX_INITIALIZER;
+static GLEngine *sEngines[MAX_ENGINES];
+static uint32_t sEngineRefs[MAX_ENGINES];
+
+static GLuint buildProgram(ProgramCache *cache, const KernelDesc *desc, const char *body, LocalSize local,
+                           OutputMode output);
+
+//static
+GLEngine *GLEngine::get(uint32_t worker){
+    GLEngine *share = worker > 0 ? get(0) : NULL;
+    GLEngine *engine;
+    bool created = false;
+
+    pthread_mutex_lock(&sEngineLock);
+    if(sEngines[worker] == NULL){
+        sEngines[worker] = new GLEngine(worker, share);
+        created = true;
+    }
+    sEngineRefs[worker]++;
+    engine = sEngines[worker];
+    pthread_mutex_unlock(&sEngineLock);
+    // only the worker's creation keeps a reference on engine 0
+    if(share != NULL && !created)
+        put(share);
+    return engine;
+}
+
+//static
+void GLEngine::put(GLEngine *engine){
+    GLEngine *share = NULL;
+
+    pthread_mutex_lock(&sEngineLock);
+    for(uint32_t i = 0; i < MAX_ENGINES; i++){
+        if(engine == sEngines[i] && --sEngineRefs[i] == 0){
+            share = engine->mShare;
+            delete engine;
+            sEngines[i] = NULL;
+        }
+    }
+    pthread_mutex_unlock(&sEngineLock);
+    if(share != NULL)
+        put(share);
+}
+
+uint32_t GLEngine::worker(void){
+    return mWorker;
+}
+
+GLEngine::GLEngine(uint32_t worker, GLEngine *share):
+    mWorker(worker), mShare(share), mCalls(0), mNextStream(0), mBatchSize(1), mOutputMode(OUTPUT_IMAGE), mHasGL(false), mPersistent(false), mDmaImport(false), display(EGL_NO_DISPLAY), context(EGL_NO_CONTEXT){
+#ifdef USE_PBUFFER
+    surface = EGL_NO_SURFACE;
+#endif
+    memset(&mLimits, 0, sizeof(mLimits));
+    memset(&mParams, 0, sizeof(mParams));
+    mParamsBuffer = 0;
+    sem_init(&mInitSem, 0, 0);
+    pthread_mutex_init(&mJobLock, NULL);
+    pthread_mutex_init(&mKernelLock, NULL);
+
+    const char *env = getenv("GLESCONVERT_BATCH");
+    if(env != NULL)
+        setBatchSize(atoi(env));
+    env = getenv("GLESCONVERT_OUTPUT");
+    if(env != NULL && strcmp(env, "ssbo") == 0)
+        setOutputMode(OUTPUT_SSBO);
+
+    if(0 != pthread_create(&mThread, NULL, engine_entry, this)){
+        printf("Could not create dispatch thread\n");
+        return;
+    }
+    sem_wait(&mInitSem);
+}
+
+GLEngine::~GLEngine(){
+    Job job;
+
+    memset(&job, 0, sizeof(job));
+    job.type = JOB_QUIT;
+    pushJob(job);
+
+    int status = pthread_join(mThread, NULL);
+    if (status != 0) {
+       printf("pthread_join error:%d\n", status);
+    }
+
+    sem_destroy(&mInitSem);
+    pthread_mutex_destroy(&mJobLock);
+    pthread_mutex_destroy(&mKernelLock);
+}
+
+//static
+void *GLEngine::engine_entry(void *data){
+    GLEngine *me = static_cast<GLEngine *>(data);
+    me->engineMain();
+    return NULL;
+}
+
+void GLEngine::engineMain(void){
+    if(initEgl() == 0){
+        GLCheck::install();
+        // staging and readback buffers that stay mapped for their whole life
+        const char *ext = (const char *)glGetString(GL_EXTENSIONS);
+        if(ext != NULL && strstr(ext, "GL_EXT_buffer_storage") != NULL)
+            glBufferStorageEXTPtr = (BufferStorageEXTProc)eglGetProcAddress("glBufferStorageEXT");
+        mPersistent = glBufferStorageEXTPtr != NULL;
+        printf("persistent buffers:%d\n", mPersistent);
+        mDmaImport = DmaImport::init(display);
+        printf("dma-buf import:%d\n", mDmaImport);
+        mCache.init();
+        mTuner.init(mCache.dir());
+        printf("gpu timer queries:%d\n", StageTimer::initGL());
+        glGetIntegerv(GL_MAX_TEXTURE_SIZE, &mLimits.maxTextureSize);
+        glGetInteger64v(GL_MAX_SHADER_STORAGE_BLOCK_SIZE, &mLimits.maxSSBOSize);
+        for(int i = 0; i < 3; i++)
+            glGetIntegeri_v(GL_MAX_COMPUTE_WORK_GROUP_COUNT, i, &mLimits.maxGroups[i]);
+        printf("limits texture:%d ssbo:%lld groups:%dx%dx%d\n", mLimits.maxTextureSize,
+               (long long)mLimits.maxSSBOSize, mLimits.maxGroups[0], mLimits.maxGroups[1], mLimits.maxGroups[2]);
+        // stays bound, the binding is state of this engine's context
+        memset(&mParams, 0, sizeof(mParams));
+        glGenBuffers(1, &mParamsBuffer);
+        glBindBuffer(GL_UNIFORM_BUFFER, mParamsBuffer);
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(mParams), &mParams, GL_DYNAMIC_DRAW);
+        glBindBufferBase(GL_UNIFORM_BUFFER, KERNEL_PARAMS_BINDING, mParamsBuffer);
+        GL_CHECK_INIT("kernel params");
+        mHasGL = true;
+    }else{
+        printf("EGL not available, only CPU streams can run\n");
+        cleanEgl();
+    }
+    sem_post(&mInitSem);
+
+    for(;;){
+        bool busy = false;
+
+        if(mCalls.load() > 0){
+            Job job = popJob();
+            if(job.type == JOB_QUIT)
+                break;
+            job.fn(job.arg);
+            sem_post(job.done);
+            busy = true;
+        }
+
+        // one frame per pass, streams take turns. A fed stream that ran dry
+        // takes the next waiting frame now
+        for(size_t i = 0; i < mStreams.size(); i++){
+            GLStream *stream = mStreams[(mNextStream + i) % mStreams.size()];
+            if(stream->hasJob() || stream->feed(true)){
+                mNextStream = (mNextStream + i + 1) % mStreams.size();
+                stageFrame(stream);
+                busy = true;
+                break;
+            }
+        }
+
+        // hand back whatever is already finished without stalling
+        while(!mInFlight.empty() && retireOldest(false) == 0)
+            busy = true;
+        if(busy)
+            continue;
+
+        if(!mInFlight.empty()){
+            // nothing new queued, finish the oldest frame
+            retireOldest(true);
+        }else{
+            mWake.wait(work_ready, this);
+        }
+    }
+    while(!mInFlight.empty())
+        retireOldest(true);
+
+    if(mHasGL){
+        for(size_t i = 0; i < mBatches.size(); i++)
+            cleanBatch(&mBatches[i]);
+        for(size_t i = 0; i < mKernels.size(); i++){
+            if(mKernels[i].owned)
+                glDeleteProgram(mKernels[i].program);
+        }
+        glDeleteBuffers(1, &mParamsBuffer);
+        for(size_t i = 0; i < mTargets.size(); i++){
+            glDeleteTextures(1, &mTargets[i].tex);
+            glDeleteFramebuffers(1, &mTargets[i].fbo);
+        }
+        cleanEgl();
+    }
+}
+
+void GLEngine::pushJob(const Job &job){
+    pthread_mutex_lock(&mJobLock);
+    mJobs.push_back(job);
+    mCalls++;
+    pthread_mutex_unlock(&mJobLock);
+    mWake.wake();
+}
+
+GLEngine::Job GLEngine::popJob(void){
+    pthread_mutex_lock(&mJobLock);
+    Job job = mJobs.front();
+    mJobs.pop_front();
+    mCalls--;
+    pthread_mutex_unlock(&mJobLock);
+    return job;
+}
+
+// GL thread only
+bool GLEngine::framesQueued(void){
+    for(size_t i = 0; i < mStreams.size(); i++){
+        if(mStreams[i]->hasJob() || mStreams[i]->feed(false))
+            return true;
+    }
+    return false;
+}
+
+//static
+bool GLEngine::work_ready(void *data){
+    GLEngine *me = static_cast<GLEngine *>(data);
+    return me->mCalls.load() > 0 || me->framesQueued();
+}
+
+static bool sameGeometry(const StreamGeometry *a, const StreamGeometry *b){
+    return a->inWidth == b->inWidth && a->inHeight == b->inHeight &&
+           memcmp(a->planeSize, b->planeSize, sizeof(a->planeSize)) == 0 &&
+           memcmp(a->pitch, b->pitch, sizeof(a->pitch)) == 0 &&
+           a->outWidth == b->outWidth && a->outHeight == b->outHeight && a->outSize == b->outSize &&
+           a->stride == b->stride && a->luma == b->luma;
+}
+
+void GLEngine::setBatchSize(uint32_t n){
+    if(n < 1)
+        n = 1;
+    if(n > MAX_BATCH)
+        n = MAX_BATCH;
+    mBatchSize = n;
+}
+
+void GLEngine::setOutputMode(OutputMode mode){
+    mOutputMode = mode;
+}
+
+OutputMode GLEngine::outputMode(void){
+    return mOutputMode;
+}
+
+// Batch resources for this stream's kernel and size, created on first use
+GLEngine::Batch *GLEngine::findBatch(GLStream *stream){
+    const KernelDesc *desc = stream->desc();
+    const StreamGeometry *geo = stream->geometry();
+    GLint maxSize, maxLayers;
+    Batch b;
+
+    for(size_t i = 0; i < mBatches.size(); i++){
+        if(mBatches[i].kernel == stream->kernel() && sameGeometry(&mBatches[i].geo, geo))
+            return &mBatches[i];
+    }
+
+    memset(&b, 0, sizeof(b));
+    b.kernel = stream->kernel();
+    b.geo = *geo;
+    b.program = buildProgram(&mCache, desc, desc->batchSource, kernelLocalSize(b.kernel), kernelOutput(b.kernel));
+    if(b.program != 0){
+        // layers are stacked in one output image, keep it under the size limit
+        glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+        glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+        b.layers = MAX_BATCH;
+        if(b.layers > maxSize / geo->outHeight)
+            b.layers = maxSize / geo->outHeight;
+        if(b.layers > (uint32_t)maxLayers)
+            b.layers = maxLayers;
+    }
+    if(b.layers >= 2){
+        if(desc->input == INPUT_IMAGE){
+            glGenTextures(desc->planes, b.in);
+            for(uint32_t j = 0; j < desc->planes; j++){
+                glBindTexture(GL_TEXTURE_2D_ARRAY, b.in[j]);
+                glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_RGBA8UI, geo->inWidth, geo->inHeight, b.layers);
+            }
+        }else{
+            glGenBuffers(desc->planes, b.in);
+            for(uint32_t j = 0; j < desc->planes; j++){
+                glBindBuffer(GL_SHADER_STORAGE_BUFFER, b.in[j]);
+                glBufferData(GL_SHADER_STORAGE_BUFFER, geo->planeSize[j] * b.layers, NULL, GL_STREAM_COPY);
+            }
+        }
+
+        if(kernelOutput(b.kernel) == OUTPUT_IMAGE){
+            glGenTextures(1, &b.tex);
+            glBindTexture(GL_TEXTURE_2D, b.tex);
+            glTexStorage2D(GL_TEXTURE_2D, 1, desc->outFormat, geo->outWidth, geo->outHeight * b.layers);
+            glGenFramebuffers(1, &b.fbo);
+            glBindFramebuffer(GL_FRAMEBUFFER, b.fbo);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, b.tex, 0);
+            GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+            if(status != GL_FRAMEBUFFER_COMPLETE){
+                printf("failed  %x\n", status);
+                GLCheck::fail();
+            }
+        }
+
+        glGenBuffers(1, &b.pbo);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, b.pbo);
+        glBufferData(GL_PIXEL_PACK_BUFFER, geo->outSize * b.layers, NULL, GL_STREAM_COPY);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        GL_CHECK_INIT("batch buffers");
+    }else{
+        b.layers = 0;
+    }
+    printf("batch %s %dx%d layers:%d\n", desc->name, geo->outWidth, geo->outHeight, b.layers);
+    mBatches.push_back(b);
+    return &mBatches.back();
+}
+
+void GLEngine::cleanBatch(Batch *b){
+    if(b->program != 0)
+        glDeleteProgram(b->program);
+    if(b->layers == 0)
+        return;
+    if(mKernels[b->kernel].desc->input == INPUT_IMAGE)
+        glDeleteTextures(mKernels[b->kernel].desc->planes, b->in);
+    else
+        glDeleteBuffers(mKernels[b->kernel].desc->planes, b->in);
+    if(b->tex != 0){
+        glDeleteTextures(1, &b->tex);
+        glDeleteFramebuffers(1, &b->fbo);
+    }
+    glDeleteBuffers(1, &b->pbo);
+}
+
+// Stage one queued frame. With batching on, pull every other queued frame
+// of the same kernel and size off the job rings and convert them together,
+// each stream's frames in order.
+void GLEngine::stageFrame(GLStream *first){
+    GLStream *members[MAX_BATCH];
+    uint32_t slots[MAX_BATCH];
+    uint32_t n = 1, limit;
+    const KernelDesc *desc;
+    const StreamGeometry *geo;
+    KernelParams params;
+    Batch *b;
+
+    if(mBatchSize < 2 || !first->batchable() || (b = findBatch(first))->layers < 2){
+        if(first->stage())
+            mInFlight.push_back(first);
+        return;
+    }
+
+    limit = mBatchSize < b->layers ? mBatchSize : b->layers;
+    members[0] = first;
+    while(n < limit && first->batchable(n))
+        members[n++] = first;
+    for(size_t i = 0; i < mStreams.size() && n < limit; i++){
+        GLStream *stream = mStreams[i];
+        if(stream == first || !stream->batchable() || stream->kernel() != first->kernel() ||
+           !sameGeometry(stream->geometry(), first->geometry()))
+            continue;
+        for(uint32_t k = 0; n < limit && stream->batchable(k); k++)
+            members[n++] = stream;
+    }
+    if(n == 1){
+        if(first->stage())
+            mInFlight.push_back(first);
+        return;
+    }
+
+    desc = first->desc();
+    geo = first->geometry();
+    glUseProgram(b->program);
+    kernelParams(&params, geo);
+    setParams(&params);
+
+    // each stream's staging buffer goes into its own layer
+    for(uint32_t i = 0; i < n; i++)
+        slots[i] = members[i]->stageLayer(b->in, i);
+    for(uint32_t j = 0; j < desc->planes; j++){
+        if(desc->input == INPUT_IMAGE)
+            glBindImageTexture(j, b->in[j], 0, GL_TRUE, 0, GL_READ_ONLY, GL_RGBA8UI);
+        else
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, j, b->in[j]);
+    }
+    if(b->tex == 0){
+        // layers land straight in the batch buffer, finishLayer() copies them out
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, OUTPUT_SSBO_BINDING, b->pbo);
+        glDispatchCompute(geo->groupsX, geo->groupsY, n);
+        glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+    }else{
+        glBindImageTexture(desc->outBinding, b->tex, 0, GL_FALSE, 0, GL_WRITE_ONLY, desc->outFormat);
+        glDispatchCompute(geo->groupsX, geo->groupsY, n);
+        glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, b->fbo);
+        glReadBuffer(GL_COLOR_ATTACHMENT0);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, b->pbo);
+        glReadPixels(0, 0, geo->outWidth, geo->outHeight * n, GL_RGBA_INTEGER, desc->outType, 0);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+    GL_CHECK_FRAME("batch");
+
+    // route every layer back to the pack buffer of the slot it came from
+    for(uint32_t i = 0; i < n; i++){
+        members[i]->finishLayer(b->pbo, i, slots[i]);
+        mInFlight.push_back(members[i]);
+    }
+    glFlush();
+}
+
+// Frames retire in the order they were staged, whichever stream they belong to
+int GLEngine::retireOldest(bool wait){
+    if(mInFlight.front()->retire(wait) != 0)
+        return -1;
+    mInFlight.pop_front();
+    return 0;
+}
+
+void GLEngine::addStream(GLStream *stream){
+    mStreams.push_back(stream);
+}
+
+// Called before a stream frees its buffers
+void GLEngine::removeStream(GLStream *stream){
+    while(stream->hasJob())
+        stageFrame(stream);
+    for(;;){
+        bool found = false;
+        for(size_t i = 0; i < mInFlight.size() && !found; i++)
+            found = mInFlight[i] == stream;
+        if(!found)
+            break;
+        retireOldest(true);
+    }
+    for(size_t i = 0; i < mStreams.size(); i++){
+        if(mStreams[i] == stream){
+            mStreams.erase(mStreams.begin() + i);
+            break;
+        }
+    }
+    mNextStream = 0;
+}
+
+void GLEngine::runOnThread(void (*fn)(void *), void *arg){
+    Job job;
+    sem_t done;
+
+    sem_init(&done, 0, 0);
+    job.type = JOB_CALL;
+    job.fn = fn;
+    job.arg = arg;
+    job.done = &done;
+    pushJob(job);
+    sem_wait(&done);
+    sem_destroy(&done);
+}
+
+// Streams take turns, most passes dispatch with the same values as the last
+void GLEngine::setParams(const KernelParams *params){
+    if(memcmp(params, &mParams, sizeof(mParams)) == 0)
+        return;
+    mParams = *params;
+    glBindBuffer(GL_UNIFORM_BUFFER, mParamsBuffer);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(mParams), &mParams);
+}
+
+void GLEngine::frameQueued(void){
+    mWake.wake();
+}
+
+bool GLEngine::hasGL(void){
+    return mHasGL;
+}
+
+bool GLEngine::persistent(void){
+    return mPersistent;
+}
+
+bool GLEngine::dmaImport(void){
+    return mDmaImport;
+}
+
+const GLLimits *GLEngine::limits(void){
+    return &mLimits;
+}
+
+ProgramCache *GLEngine::programCache(void){
+    return &mCache;
+}
+
+static GLuint loadShader(GLenum type, const char *shaderSrc){
+	GLuint shader;
+	GLint compiled;
+
+	// Create the shader object
+	shader = glCreateShader(type);
+	if (shader == 0){
+		return 0;
+	}
+	// Load the shader source
+	glShaderSource(shader, 1, &shaderSrc, NULL);
+	// Compile the shader
+	glCompileShader(shader);
+	// Check the compile status
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+	if (!compiled){
+		GLint infoLen = 0;
+		glGetShaderiv ( shader, GL_INFO_LOG_LENGTH, &infoLen );
+		if (infoLen > 1){
+			char *infoLog = (char *)malloc(sizeof (char) * infoLen);
+
+			glGetShaderInfoLog (shader, infoLen, NULL, infoLog);
+			printf("Error compiling shader:\n%s\n", infoLog);
+			free ( infoLog );
+		}
+		glDeleteShader ( shader );
+		return 0;
+	}
+	return shader;
+}
+
+// store() for the kernel's output, see KernelDesc
+static void outputBlock(const KernelDesc *desc, OutputMode output, char *buf, size_t size){
+    bool rgba8 = desc->outFormat == GL_RGBA8UI;
+
+    if(output == OUTPUT_IMAGE){
+        snprintf(buf, size,
+                 "precision highp uimage2D;\n"
+                 "layout(binding = %u, %s) writeonly uniform  uimage2D output_image;\n"
+                 "void store(ivec2 pos, uvec4 texel){\n"
+                 "    imageStore(output_image, pos, texel);\n"
+                 "}\n", desc->outBinding, rgba8 ? "rgba8ui" : "rgba32ui");
+    }else if(rgba8){
+        // one rgba8ui texel is one word, clamped the way the image store
+        // would. Texels outside the image are dropped like imageStore does,
+        // kernels count on that for the invocations past threadsX.
+        snprintf(buf, size,
+                 "layout(std430, binding = %d) writeonly buffer outBuffer{\n"
+                 "    uint data[];\n"
+                 "}OutData;\n"
+                 "void store(ivec2 pos, uvec4 texel){\n"
+                 "    int i = pos.y * outStride + pos.x;\n"
+                 "    if(pos.x >= outStride || i >= OutData.data.length())\n"
+                 "        return;\n"
+                 "    uvec4 c = min(texel, uvec4(255u));\n"
+                 "    OutData.data[i] = c.x | (c.y << 8) | (c.z << 16) | (c.w << 24);\n"
+                 "}\n", OUTPUT_SSBO_BINDING);
+    }else{
+        snprintf(buf, size,
+                 "layout(std430, binding = %d) writeonly buffer outBuffer{\n"
+                 "    uvec4 data[];\n"
+                 "}OutData;\n"
+                 "void store(ivec2 pos, uvec4 texel){\n"
+                 "    int i = pos.y * outStride + pos.x;\n"
+                 "    if(pos.x >= outStride || i >= OutData.data.length())\n"
+                 "        return;\n"
+                 "    OutData.data[i] = texel;\n"
+                 "}\n", OUTPUT_SSBO_BINDING);
+    }
+}
+
+// Load the kernel from the program cache or build it, 0 on failure. The
+// version, workgroup size, parameter block and store() go in front of the
+// kernel body.
+static GLuint buildProgram(ProgramCache *cache, const KernelDesc *desc, const char *body, LocalSize local,
+                           OutputMode output){
+    GLuint computeShader;
+    GLuint program;
+    GLint linked;
+    char *source;
+    char store[512];
+    size_t len;
+
+    outputBlock(desc, output, store, sizeof(store));
+    len = strlen(body) + strlen(store) + 384;
+    source = (char *)malloc(len);
+    snprintf(source, len, "#version 310 es\n"
+             "layout(local_size_x = %u, local_size_y = %u, local_size_z = 1) in;\n"
+             "layout(std140, binding = %d) uniform Params{\n"
+             "    int stride;\n"
+             "    int rows;\n"
+             "    int luma;\n"
+             "    int outStride;\n"
+             "    ivec3 pitch;\n"
+             "};\n%s%s", local.x, local.y, KERNEL_PARAMS_BINDING, store, body);
+
+    program = cache->load(source);
+    if(program != 0){
+        free(source);
+        return program;
+    }
+
+    computeShader = loadShader(GL_COMPUTE_SHADER, source);
+    if(computeShader == 0){
+        free(source);
+        return 0;
+    }
+
+    // Create the program object
+    program = glCreateProgram();
+    glAttachShader(program, computeShader);
+    if(cache->enabled())
+        glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    // Link the program
+    glLinkProgram(program);
+    glDeleteShader(computeShader);
+
+    // Check the link status
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+    if(!linked){
+        GLint infoLen = 0;
+        glGetProgramiv(program, GL_INFO_LOG_LENGTH, &infoLen);
+        if (infoLen > 1){
+            char *infoLog = (char *)malloc(sizeof (char) * infoLen);
+
+            glGetProgramInfoLog(program, infoLen, NULL, infoLog);
+            printf("Error linking program:\n%s\n", infoLog);
+            free(infoLog);
+        }
+        glDeleteProgram(program);
+        free(source);
+        return 0;
+    }
+    cache->store(program, source);
+    free(source);
+    return program;
+}
+
+struct CompileArgs{
+    GLEngine *engine;
+    ProgramCache *cache;
+    const KernelDesc *desc;
+    const StreamGeometry *geo;
+    LocalSize local;
+    OutputMode output;
+    bool imported;
+    GLuint program;
+};
+
+//static
+void GLEngine::compile_entry(void *data){
+    CompileArgs *args = static_cast<CompileArgs *>(data);
+
+    const char *body = args->imported ? args->desc->importSource : args->desc->source;
+
+    args->program = buildProgram(args->cache, args->desc, body, args->local, args->output);
+    // workers use the program from their own contexts, it has to be
+    // complete before they can see it
+    if(args->program != 0)
+        glFinish();
+}
+
+//static
+void GLEngine::tune_entry(void *data){
+    CompileArgs *args = static_cast<CompileArgs *>(data);
+
+    args->local = args->engine->tuneKernel(args->desc, args->geo);
+}
+
+// Time every candidate workgroup size on scratch buffers of the stream's
+// size and keep the fastest. GL thread.
+LocalSize GLEngine::tuneKernel(const KernelDesc *desc, const StreamGeometry *geo){
+    LocalSize sizes[MAX_LOCAL_SIZES];
+    LocalSize best = {DEFAULT_LOCAL_X, DEFAULT_LOCAL_Y};
+    uint64_t bestNs = 0, ns;
+    GLuint in[MAX_PLANES];
+    GLuint out, program;
+    KernelParams params;
+    uint32_t n = mTuner.candidates(sizes, MAX_LOCAL_SIZES);
+
+    if(desc->input == INPUT_IMAGE){
+        glGenTextures(desc->planes, in);
+        for(uint32_t j = 0; j < desc->planes; j++){
+            glBindTexture(GL_TEXTURE_2D, in[j]);
+            glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8UI, geo->inWidth, geo->inHeight);
+            glBindImageTexture(j, in[j], 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA8UI);
+        }
+    }else{
+        glGenBuffers(desc->planes, in);
+        for(uint32_t j = 0; j < desc->planes; j++){
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, in[j]);
+            glBufferData(GL_SHADER_STORAGE_BUFFER, geo->planeSize[j], NULL, GL_STREAM_COPY);
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, j, in[j]);
+        }
+    }
+    glGenTextures(1, &out);
+    glBindTexture(GL_TEXTURE_2D, out);
+    glTexStorage2D(GL_TEXTURE_2D, 1, desc->outFormat, geo->outWidth, geo->outHeight);
+    glBindImageTexture(desc->outBinding, out, 0, GL_FALSE, 0, GL_WRITE_ONLY, desc->outFormat);
+    kernelParams(&params, geo);
+    setParams(&params);
+
+    for(uint32_t i = 0; i < n; i++){
+        GLuint gx = (geo->threadsX + sizes[i].x - 1) / sizes[i].x;
+        GLuint gy = (geo->threadsY + sizes[i].y - 1) / sizes[i].y;
+        uint64_t start;
+
+        program = buildProgram(&mCache, desc, desc->source, sizes[i], OUTPUT_IMAGE);
+        if(program == 0)
+            continue;
+        glUseProgram(program);
+        // first dispatch pays for the driver's lazy setup
+        glDispatchCompute(gx, gy, 1);
+        glFinish();
+        start = StageTimer::now();
+        for(int r = 0; r < TUNE_RUNS; r++){
+            glDispatchCompute(gx, gy, 1);
+            glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+        }
+        glFinish();
+        ns = (StageTimer::now() - start) / TUNE_RUNS;
+        glDeleteProgram(program);
+        printf("tune %s %ux%u local %ux%u: %.3fms\n", desc->name, geo->threadsX, geo->threadsY,
+               sizes[i].x, sizes[i].y, ns / 1e6);
+        if(bestNs == 0 || ns < bestNs){
+            bestNs = ns;
+            best = sizes[i];
+        }
+    }
+    glUseProgram(0);
+
+    if(desc->input == INPUT_IMAGE)
+        glDeleteTextures(desc->planes, in);
+    else
+        glDeleteBuffers(desc->planes, in);
+    glDeleteTextures(1, &out);
+
+    if(bestNs != 0)
+        mTuner.store(desc->name, geo->threadsX, geo->threadsY, best);
+    return best;
+}
+
+int GLEngine::addKernel(const KernelDesc *desc, const StreamGeometry *geo, OutputMode output, bool imported){
+    CompileArgs args;
+    LocalSize local = {DEFAULT_LOCAL_X, DEFAULT_LOCAL_Y};
+    Kernel k;
+    int id = -1;
+
+    if(!mHasGL || (imported && desc->importSource == NULL))
+        return -1;
+    if(mShare != NULL)
+        return addSharedKernel(desc, geo, output, imported);
+
+    // one compile at a time so two streams don't build the same kernel
+    pthread_mutex_lock(&sCompileLock);
+    args.engine = this;
+    args.cache = &mCache;
+    args.desc = desc;
+    args.geo = geo;
+    args.output = output;
+    args.imported = imported;
+    if(!mTuner.lookup(desc->name, geo->threadsX, geo->threadsY, &local) && mTuner.enabled()){
+        runOnThread(tune_entry, &args);
+        local = args.local;
+    }
+
+    pthread_mutex_lock(&mKernelLock);
+    for(size_t i = 0; i < mKernels.size(); i++){
+        if(mKernels[i].desc == desc && mKernels[i].local.x == local.x && mKernels[i].local.y == local.y &&
+           mKernels[i].output == output && mKernels[i].imported == imported)
+            id = i;
+    }
+    pthread_mutex_unlock(&mKernelLock);
+
+    if(id < 0){
+        args.local = local;
+        runOnThread(compile_entry, &args);
+        if(args.program != 0){
+            k.desc = desc;
+            k.local = local;
+            k.output = output;
+            k.imported = imported;
+            k.program = args.program;
+            k.owned = true;
+            pthread_mutex_lock(&mKernelLock);
+            mKernels.push_back(k);
+            id = mKernels.size() - 1;
+            pthread_mutex_unlock(&mKernelLock);
+            printf("kernel %s%s ready, id:%d local:%ux%u output:%s cache hits:%u misses:%u\n", desc->name,
+                   imported ? " (imported input)" : "", id, local.x, local.y, output == OUTPUT_SSBO ? "ssbo" : "image",
+                   mCache.hits(), mCache.misses());
+        }
+    }
+    pthread_mutex_unlock(&sCompileLock);
+    return id;
+}
+
+// Worker engines use engine 0's program, their contexts are in its share
+// group and the parameters come from each engine's own buffer. Engine 0
+// outlives its workers, so it keeps the program.
+int GLEngine::addSharedKernel(const KernelDesc *desc, const StreamGeometry *geo, OutputMode output, bool imported){
+    int shared = mShare->addKernel(desc, geo, output, imported);
+    Kernel k;
+    int id = -1;
+
+    if(shared < 0)
+        return -1;
+    k.desc = desc;
+    k.local = mShare->kernelLocalSize(shared);
+    k.output = output;
+    k.imported = imported;
+    k.program = mShare->kernelProgram(shared);
+    k.owned = false;
+    pthread_mutex_lock(&mKernelLock);
+    for(size_t i = 0; i < mKernels.size(); i++){
+        if(mKernels[i].program == k.program)
+            id = i;
+    }
+    if(id < 0){
+        mKernels.push_back(k);
+        id = mKernels.size() - 1;
+    }
+    pthread_mutex_unlock(&mKernelLock);
+    return id;
+}
+
+GLuint GLEngine::kernelProgram(int kernel){
+    pthread_mutex_lock(&mKernelLock);
+    GLuint program = mKernels[kernel].program;
+    pthread_mutex_unlock(&mKernelLock);
+    return program;
+}
+
+LocalSize GLEngine::kernelLocalSize(int kernel){
+    pthread_mutex_lock(&mKernelLock);
+    LocalSize local = mKernels[kernel].local;
+    pthread_mutex_unlock(&mKernelLock);
+    return local;
+}
+
+OutputMode GLEngine::kernelOutput(int kernel){
+    pthread_mutex_lock(&mKernelLock);
+    OutputMode output = mKernels[kernel].output;
+    pthread_mutex_unlock(&mKernelLock);
+    return output;
+}
+
+// Output image of one format and size, streams only read it back right
+// after their own dispatch on this thread so they can share it.
+GLuint GLEngine::acquireTarget(GLenum format, uint32_t width, uint32_t height, GLuint *tex){
+    Target t;
+
+    for(size_t i = 0; i < mTargets.size(); i++){
+        Target *s = &mTargets[i];
+        if(s->format == format && s->width == width && s->height == height){
+            s->refs++;
+            *tex = s->tex;
+            return s->fbo;
+        }
+    }
+
+    t.format = format;
+    t.width = width;
+    t.height = height;
+    t.refs = 1;
+    glGenFramebuffers(1, &t.fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, t.fbo);
+
+    glGenTextures(1, &t.tex);
+    glBindTexture(GL_TEXTURE_2D, t.tex);
+    glTexStorage2D(GL_TEXTURE_2D, 1, format, width, height);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, t.tex, 0);
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    if(status != GL_FRAMEBUFFER_COMPLETE){
+        printf("failed  %x\n", status);
+        GLCheck::fail();
+    }
+    GL_CHECK_INIT("output target");
+
+    mTargets.push_back(t);
+    *tex = t.tex;
+    return t.fbo;
+}
+
+void GLEngine::releaseTarget(GLuint fbo){
+    for(size_t i = 0; i < mTargets.size(); i++){
+        Target *t = &mTargets[i];
+        if(t->fbo != fbo)
+            continue;
+        if(--t->refs == 0){
+            glDeleteTextures(1, &t->tex);
+            glDeleteFramebuffers(1, &t->fbo);
+            mTargets.erase(mTargets.begin() + i);
+        }
+        return;
+    }
+}
+
+void GLEngine::bufferStorage(GLenum target, GLsizeiptr size, GLbitfield flags){
+    glBufferStorageEXTPtr(target, size, NULL, flags);
+}
+
+int GLEngine::initEgl(){
+	EGLint major,minor;
+
+	if (mShare != NULL && !mShare->hasGL()){
+		printf("engine %d: engine 0 has no context to share\n", mWorker);
+		return -1;
+	}
+
+	display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+	if (display == EGL_NO_DISPLAY){
+		printf("unable to open connection to local windowing system, error:%d\n", eglGetError());
+		return -1;
+	}
+
+	if (!eglInitialize(display, &major, &minor)){
+		printf("unable to initialize EGL, error:%d\n", eglGetError());
+		return -1;
+	}
+	printf("EGL Verion:%d.%d\n", major, minor);
+
+	EGLint attribs [] = {
+		EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_ES2_BIT,
+		EGL_RED_SIZE, 8,
+		EGL_GREEN_SIZE, 8,
+		EGL_BLUE_SIZE, 8,
+		EGL_DEPTH_SIZE, 0,
+		EGL_NONE
+	};
+
+	EGLint numConfigs;
+	EGLConfig config;
+	if (!eglChooseConfig(display, attribs, &config, 1, &numConfigs)){
+		printf("can't find suitable configs, error:%d\n", eglGetError());
+		return -1;
+	}
+
+    EGLint value;
+	eglGetConfigAttrib(display, config, EGL_SURFACE_TYPE, &value);
+	printf("EGL_SURFACE_TYPE:%x\n", value);
+
+	eglGetConfigAttrib(display, config, EGL_MAX_PBUFFER_WIDTH, &value);
+	printf("EGL_MAX_PBUFFER_WIDTH:%x\n", value);
+
+    EGLint contextAttrib[] = {
+		EGL_CONTEXT_CLIENT_VERSION, 3,
+		EGL_NONE
+	};
+
+	// workers join engine 0's share group
+	context = eglCreateContext(display, config, mShare != NULL ? mShare->context : EGL_NO_CONTEXT, contextAttrib);
+	if (context == EGL_NO_CONTEXT){
+		printf("Can't Create EGLContext, error:%d\n", eglGetError());
+		return -1;
+	}
+
+#ifdef USE_PBUFFER
+    EGLint attrib_pb[] = {
+        EGL_WIDTH, 1,
+        EGL_HEIGHT, 1,
+        EGL_NONE
+    };
+
+    surface = eglCreatePbufferSurface(display, config, attrib_pb);
+    if (eglMakeCurrent(display, surface, surface, context) == EGL_FALSE){
+        printf("Initilize error at eglMakeCurrent, error:%d\n", eglGetError());
+        return -1;
+    }
+#else
+	if (eglMakeCurrent(display, NULL, NULL, context) == EGL_FALSE){
+		printf("Initilize error at eglMakeCurrent, error:%d\n", eglGetError());
+		return -1;
+	}
+#endif
+	return 0;
+
+}
+
+void GLEngine::cleanEgl(void){
+#ifdef USE_PBUFFER
+    if(surface != EGL_NO_SURFACE)
+        eglDestroySurface(display, surface);
+    surface = EGL_NO_SURFACE;
+#endif
+    if(context != EGL_NO_CONTEXT)
+        eglDestroyContext(display, context);
+    context = EGL_NO_CONTEXT;
+    // the display belongs to engine 0, which outlives its workers
+    if(display != EGL_NO_DISPLAY && mShare == NULL)
+        eglTerminate(display);
+    display = EGL_NO_DISPLAY;
+    eglReleaseThread();
+}
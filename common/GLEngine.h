@@ -0,0 +1,217 @@
+#ifndef _GLENGINE_H_
+#define _GLENGINE_H_
+#include <stdint.h>
+#include <EGL/egl.h>
+#include <GLES3/gl31.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <atomic>
+#include <deque>
+#include <vector>
+#include "Kernels.h"
+#include "ProgramCache.h"
+#include "WorkgroupTuner.h"
+#include "Parker.h"
+
+// Some platform can't do eglMakeCurrent with NULL surface
+// So use pbuffer to create a 1x1 surface
+#define USE_PBUFFER 1
+
+// Most frames converted by one batched dispatch
+#define MAX_BATCH 16
+// Engines (GL threads + contexts) a process can run, see GLEngine::get()
+#define MAX_ENGINES 8
+// Timed dispatches per workgroup size when tuning
+#define TUNE_RUNS 8
+
+class GLStream;
+
+// Size limits of the context that decide whether a stream has to run in
+// strips, queried once at init (see glestest for the full list)
+struct GLLimits{
+	GLint maxTextureSize;
+	GLint64 maxSSBOSize;       // GL_MAX_SHADER_STORAGE_BLOCK_SIZE, bytes
+	GLint maxGroups[3];        // GL_MAX_COMPUTE_WORK_GROUP_COUNT
+};
+
+// BACKEND_AUTO runs on the GPU and falls back to the CPU when GLES 3.1
+// compute can't be set up. GLESCONVERT_BACKEND=gpu|cpu|hybrid in the
+// environment overrides BACKEND_AUTO. BACKEND_HYBRID splits every frame by
+// rows between the GPU and the CPU threads, converters without a CPU path
+// that can take part of a frame run it as BACKEND_GPU.
+enum ConvertBackend{
+	BACKEND_AUTO = 0,
+	BACKEND_GPU,
+	BACKEND_CPU,
+	BACKEND_HYBRID,
+};
+
+// One EGL context and one dispatch thread shared by every stream in the
+// process. Kernels are compiled once and kept in a registry, output images
+// are shared between streams of the same format and size, and frames from
+// all streams are interleaved on the GPU instead of each converter owning
+// its own context. Frames come in through each stream's lock-free job ring,
+// only setup calls (runOnThread) take the locked queue.
+//
+// Engine 0 is that shared engine. Engines 1.. are extra workers for
+// StreamPool, each with its own thread and a context in engine 0's share
+// group, so one process can feed several GPU queues (or llvmpipe
+// rasterizer threads). Kernel programs are linked once, by engine 0, and
+// shared with the workers. Kernels take their parameters from a uniform
+// block (KernelParams) backed by a buffer of each engine, not from program
+// uniforms, so engines never change each other's values.
+class GLEngine{
+public:
+    // Process wide engine number worker (< MAX_ENGINES), created on first
+    // use and torn down with the last put(). Blocks until EGL init has
+    // finished. A worker engine holds on to engine 0 while it lives.
+    static GLEngine *get(uint32_t worker = 0);
+    static void put(GLEngine *engine);
+    uint32_t worker(void);
+
+    // false when EGL / GLES 3.1 could not be set up, streams then have to
+    // run on the CPU (the dispatch thread still serves them)
+    bool hasGL(void);
+    // pack/staging buffers can stay mapped (GL_EXT_buffer_storage)
+    bool persistent(void);
+    // dma-buf frames can be imported as EGLImages, see DmaImport
+    bool dmaImport(void);
+    // all zero without GL
+    const GLLimits *limits(void);
+
+    // Compiles the kernel on first use (or loads it from the program
+    // cache) with the workgroup size tuned for geo and the given output
+    // mode, returns its id or -1. With autotuning on, an untuned size is
+    // timed here first. imported builds the desc's importSource instead,
+    // -1 if it has none.
+    int addKernel(const KernelDesc *desc, const StreamGeometry *geo, OutputMode output = OUTPUT_IMAGE,
+                  bool imported = false);
+    GLuint kernelProgram(int kernel);
+    LocalSize kernelLocalSize(int kernel);
+    OutputMode kernelOutput(int kernel);
+    // hit/miss counters of the on-disk program cache
+    ProgramCache *programCache(void);
+
+    // Convert up to n queued same size frames (from any streams) with one
+    // dispatch over a texture array / layered SSBO and one readback. 1 turns
+    // batching off, GLESCONVERT_BATCH=N sets it from the environment.
+    void setBatchSize(uint32_t n);
+    // Output mode of streams created from now on. OUTPUT_SSBO skips the
+    // fbo + glReadPixels round trip, GLESCONVERT_OUTPUT=ssbo|image sets it
+    // from the environment. Default OUTPUT_IMAGE.
+    void setOutputMode(OutputMode mode);
+    OutputMode outputMode(void);
+
+    // Run fn on the GL thread and wait for it
+    void runOnThread(void (*fn)(void *), void *arg);
+    // A stream pushed a frame onto its job ring, or a feed has one waiting
+    void frameQueued(void);
+
+    // GL thread only
+    GLuint acquireTarget(GLenum format, uint32_t width, uint32_t height, GLuint *tex);
+    void releaseTarget(GLuint fbo);
+    void bufferStorage(GLenum target, GLsizeiptr size, GLbitfield flags);
+    // parameters of the next dispatches, KERNEL_PARAMS_BINDING
+    void setParams(const KernelParams *params);
+    void addStream(GLStream *stream);
+    // stages and retires whatever the stream still has queued first
+    void removeStream(GLStream *stream);
+
+private:
+	GLEngine(uint32_t worker, GLEngine *share);
+	~GLEngine();
+
+	enum JobType{
+		JOB_CALL,
+		JOB_QUIT,
+	};
+	struct Job{
+		JobType type;
+		void (*fn)(void *);
+		void *arg;
+		sem_t *done;
+	};
+	struct Kernel{
+		const KernelDesc *desc;
+		LocalSize local;
+		OutputMode output;
+		bool imported;  // built from importSource
+		GLuint program;
+		bool owned;    // false for engine 0's program on a worker
+	};
+	// output image + fbo, shared by every stream that renders this size
+	struct Target{
+		GLenum format;
+		uint32_t width;
+		uint32_t height;
+		GLuint tex;
+		GLuint fbo;
+		uint32_t refs;
+	};
+
+	// Shared resources of one batched kernel + size
+	struct Batch{
+		int kernel;
+		StreamGeometry geo;
+		GLuint program;
+		uint32_t layers;          // capacity, 0 if the batch kernel is unusable
+		GLuint in[MAX_PLANES];    // texture arrays or SSBOs, one per plane
+		GLuint tex;               // output image, layers stacked vertically (OUTPUT_IMAGE)
+		GLuint fbo;
+		GLuint pbo;               // single readback for the whole batch, or the output SSBO
+	};
+
+	static void *engine_entry(void *data);
+	static void compile_entry(void *data);
+	static void tune_entry(void *data);
+	static bool work_ready(void *data);
+	LocalSize tuneKernel(const KernelDesc *desc, const StreamGeometry *geo);
+	int addSharedKernel(const KernelDesc *desc, const StreamGeometry *geo, OutputMode output, bool imported);
+	void engineMain(void);
+	void pushJob(const Job &job);
+	Job popJob(void);
+	bool framesQueued(void);
+	int retireOldest(bool wait);
+	void stageFrame(GLStream *stream);
+	Batch *findBatch(GLStream *stream);
+	void cleanBatch(Batch *b);
+
+	int initEgl(void);
+	void cleanEgl(void);
+
+private:
+	uint32_t mWorker;
+	GLEngine *mShare;  // engine 0 for workers, its context is shared
+	pthread_t mThread;
+	sem_t mInitSem;   // GL init done
+	Parker mWake;     // GL thread sleeps here when there is nothing to do
+	pthread_mutex_t mJobLock;
+	std::deque<Job> mJobs;
+	std::atomic<uint32_t> mCalls;            // size of mJobs, read without the lock
+	std::vector<GLStream *> mStreams;        // GL thread only
+	size_t mNextStream;                      // round robin position in mStreams
+
+	pthread_mutex_t mKernelLock;
+	std::vector<Kernel> mKernels;
+	std::vector<Target> mTargets;            // GL thread only
+	std::deque<GLStream *> mInFlight;        // staged frames, oldest first
+	std::vector<Batch> mBatches;             // GL thread only
+	volatile uint32_t mBatchSize;
+	volatile OutputMode mOutputMode;
+
+	ProgramCache mCache;
+	WorkgroupTuner mTuner;
+	bool mHasGL;
+	bool mPersistent;
+	bool mDmaImport;
+	GLLimits mLimits;
+	GLuint mParamsBuffer;  // KernelParams uniform buffer, GL thread only
+	KernelParams mParams;  // what it holds
+
+	EGLDisplay display;
+	EGLContext context;
+#ifdef USE_PBUFFER
+	EGLSurface surface;
+#endif
+};
+#endif
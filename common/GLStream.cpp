@@ -0,0 +1,1330 @@
+#include "GLStream.h"
+#include "GLCheck.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifndef GL_MAP_PERSISTENT_BIT_EXT
+#define GL_MAP_PERSISTENT_BIT_EXT 0x0040
+#define GL_MAP_COHERENT_BIT_EXT 0x0080
+#endif
+
+GLStream::GLStream(GLEngine *engine, const KernelDesc *desc, uint32_t width, uint32_t height, uint32_t stride,
+                   uint32_t depth, CpuFunc cpu, void *cpuCtx, const PlaneLayout *input):
+    mEngine(engine), mKernel(-1), mDesc(desc), mWidth(width), mHeight(height), mStride(stride), mCpu(cpu),
+    mCpuCtx(cpuCtx), mReady(false){
+    if(depth < 1)
+        depth = 1;
+    if(depth > MAX_PIPELINE_DEPTH)
+        depth = MAX_PIPELINE_DEPTH;
+    mDepth = depth;
+    memset(mSlots, 0, sizeof(mSlots));
+    mSubmitIndex = 0;
+    mFree = mDepth;
+    mOutstanding = 0;
+    mReleaseIndex = 0;
+    mRetrieved = 0;
+    mInputHeld = false;
+    mBusyNs = 0;
+    mStageIndex = 0;
+    mRetireIndex = 0;
+    mInFlight = 0;
+    mPersistent = false;
+    mLastDoneNs = 0;
+    fboid = 0;
+    texOut = 0;
+    program = 0;
+    importProgram = 0;
+    mOutput = OUTPUT_IMAGE;
+    mStrips = 0;
+    mStripRows = 0;
+    mStripCap = height;
+    memset(mStripSets, 0, sizeof(mStripSets));
+    mSlices = 1;
+    mSliceStrips = 0;
+    mSliceFunc = NULL;
+    mSliceCtx = NULL;
+    mImportable = false;
+    mImportFd = -1;
+    mImportResult = -1;
+    mFdImported = 0;
+    mFdMapped = 0;
+    mFeed = NULL;
+    mFeedCtx = NULL;
+    mNewFeed = NULL;
+    mNewFeedCtx = NULL;
+
+    const char *env = getenv("GLESCONVERT_TIMING");
+    if(env != NULL)
+        mTimer.setInterval(atoi(env));
+
+    // kernels write whole texels, output rows are padded to them
+    mPackStride = ((stride > width ? stride : width) + 3) & ~3;
+    mDesc->layout(&mGeo, width, height, mPackStride);
+    // stage at the caller's pitch when the kernel can read it in place
+    for(uint32_t j = 0; j < MAX_PLANES; j++){
+        uint32_t src = input != NULL && input->stride[j] > 0 ? input->stride[j] : mGeo.pitch[j];
+        mSrcPitch[j] = src;
+        mRowBytes[j] = mGeo.pitch[j];
+        mPitch[j] = src % 4 == 0 && src >= mGeo.pitch[j] ? src : mGeo.pitch[j];
+    }
+    layoutRows(&mGeo, height);
+    // submitFd() buffers, planes back to back when the layout has no offsets
+    bool packed = true;
+    for(uint32_t j = 0; j < MAX_PLANES && input != NULL; j++)
+        packed = packed && input->offset[j] == 0;
+    mSrcSize = 0;
+    for(uint32_t j = 0; j < mDesc->planes; j++){
+        uint64_t end;
+        if(mPitch[j] == 0)
+            continue;
+        mSrcOffset[j] = packed ? mSrcSize : input->offset[j];
+        end = mSrcOffset[j] + (uint64_t)mGeo.planeSize[j] / mPitch[j] * mSrcPitch[j];
+        mSrcSize = end > mSrcSize ? end : mSrcSize;
+    }
+    mGeo.groupsX = 0;
+    mGeo.groupsY = 0;
+    if(mCpu == NULL){
+        mOutput = mEngine->outputMode();
+        const char *rows = getenv("GLESCONVERT_STRIP_ROWS");
+        if(rows != NULL && atoi(rows) > 0)
+            mStripCap = atoi(rows);
+        if(planStrips(mStripCap) != 0)
+            return;
+        // striped streams compile and tune for the strip size
+        mKernel = mEngine->addKernel(desc, mStrips > 0 ? &mStripGeo : &mGeo, mOutput);
+        if(mKernel < 0)
+            return;
+        program = mEngine->kernelProgram(mKernel);
+        // dma-buf frames are sampled where they are, no strips for those
+        if(mStrips == 0 && mEngine->dmaImport()){
+            int imported = mEngine->addKernel(desc, &mGeo, mOutput, true);
+            if(imported >= 0)
+                importProgram = mEngine->kernelProgram(imported);
+        }
+        mLocal = mEngine->kernelLocalSize(mKernel);
+        mGeo.groupsX = (mGeo.threadsX + mLocal.x - 1) / mLocal.x;
+        mGeo.groupsY = (mGeo.threadsY + mLocal.y - 1) / mLocal.y;
+    }
+    mEngine->runOnThread(init_entry, this);
+}
+
+GLStream::~GLStream(){
+    if(mReady)
+        mEngine->runOnThread(clean_entry, this);
+}
+
+bool GLStream::ready(void){
+    return mReady;
+}
+
+//static
+void GLStream::init_entry(void *data){
+    GLStream *me = static_cast<GLStream *>(data);
+    if(me->mCpu != NULL){
+        me->initCPU();
+        me->mReady = true;
+    }else{
+        me->mReady = me->initGL() == 0;
+    }
+    if(me->mReady)
+        me->mEngine->addStream(me);
+}
+
+//static
+void GLStream::clean_entry(void *data){
+    GLStream *me = static_cast<GLStream *>(data);
+    me->mEngine->removeStream(me);
+    if(me->mCpu != NULL)
+        me->cleanCPU();
+    else
+        me->cleanGL();
+}
+
+int GLStream::initGL(void){
+    FrameSlot *slot;
+    uint32_t planes = mDesc->planes;
+    GLsizeiptr inSize = planeOffset(&mGeo, planes);
+    GLsizeiptr outSize = mGeo.outSize;
+
+    mPersistent = mEngine->persistent();
+    initKernelIO();
+
+    // the import kernel reads the planes at the staging pitch, in whole texels
+    mImportable = mEngine->dmaImport() && importProgram != 0;
+    for(uint32_t j = 0; j < planes; j++){
+        if(mSrcPitch[j] != mPitch[j] || mSrcOffset[j] % 4 != 0)
+            mImportable = false;
+    }
+    if(mImportable){
+        DmaLayout layout;
+        memset(&layout, 0, sizeof(layout));
+        layout.planes = planes;
+        for(uint32_t j = 0; j < planes; j++){
+            layout.offset[j] = mSrcOffset[j];
+            layout.pitch[j] = mPitch[j];
+            layout.width[j] = mRowBytes[j] / 4;
+            layout.height[j] = mGeo.planeSize[j] / mPitch[j];
+        }
+        mImports.setLayout(&layout);
+    }
+
+    for(uint32_t i = 0; i < mDepth; i++){
+        slot = &mSlots[i];
+        if(mDesc->input == INPUT_IMAGE){
+            // staging buffer is allocated once, the caller writes into its mapping
+            glGenBuffers(1, &slot->unpackid);
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot->unpackid);
+            if(mPersistent){
+                GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT_EXT | GL_MAP_COHERENT_BIT_EXT;
+                mEngine->bufferStorage(GL_PIXEL_UNPACK_BUFFER, inSize, flags);
+                slot->upload[0] = (uint8_t *)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, inSize, flags);
+                for(uint32_t j = 1; j < planes; j++)
+                    slot->upload[j] = slot->upload[0] + planeOffset(&mGeo, j);
+            }else{
+                glBufferData(GL_PIXEL_UNPACK_BUFFER, inSize, NULL, GL_STREAM_DRAW);
+            }
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        }else{
+            // input SSBOs are allocated once and double as the staging buffers
+            glGenBuffers(planes, slot->vbo);
+            for(uint32_t j = 0; j < planes; j++){
+                glBindBuffer(GL_SHADER_STORAGE_BUFFER, slot->vbo[j]);
+                if(mPersistent){
+                    GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT_EXT | GL_MAP_COHERENT_BIT_EXT;
+                    mEngine->bufferStorage(GL_SHADER_STORAGE_BUFFER, mGeo.planeSize[j], flags);
+                    slot->upload[j] = (uint8_t *)glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, mGeo.planeSize[j], flags);
+                }else{
+                    glBufferData(GL_SHADER_STORAGE_BUFFER, mGeo.planeSize[j], NULL, GL_STREAM_DRAW);
+                }
+            }
+        }
+        mapInput(slot);
+        GL_CHECK_INIT("staging buffers");
+
+        glGenBuffers(1, &slot->pboid);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, slot->pboid);
+        if(mPersistent){
+            GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT_EXT | GL_MAP_COHERENT_BIT_EXT;
+            mEngine->bufferStorage(GL_PIXEL_PACK_BUFFER, outSize, flags);
+            slot->map = (uint8_t *)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, outSize, flags);
+            GL_CHECK_INIT("pack buffers");
+        }else{
+            glBufferData(GL_PIXEL_PACK_BUFFER, outSize, NULL, GL_DYNAMIC_READ);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        mTimer.createQueries(&slot->timing);
+    }
+    return 0;
+}
+
+// The kernel's layout for a frame of rows input rows, with the planes at
+// the staging pitch
+void GLStream::layoutRows(StreamGeometry *geo, uint32_t rows){
+    mDesc->layout(geo, mWidth, rows, mPackStride);
+    for(uint32_t j = 0; j < mDesc->planes; j++){
+        if(geo->pitch[j] == 0)
+            continue;
+        geo->planeSize[j] = geo->planeSize[j] / geo->pitch[j] * mPitch[j];
+        geo->pitch[j] = mPitch[j];
+    }
+}
+
+// CPU streams: staging and output live in plain memory that is never
+// unmapped, so the persistent mapping paths cover them.
+void GLStream::initCPU(void){
+    FrameSlot *slot;
+
+    mPersistent = true;
+    for(uint32_t i = 0; i < mDepth; i++){
+        slot = &mSlots[i];
+        for(uint32_t j = 0; j < mDesc->planes; j++)
+            slot->upload[j] = (uint8_t *)malloc(mGeo.planeSize[j]);
+        slot->map = (uint8_t *)malloc(mGeo.outSize);
+    }
+}
+
+void GLStream::cleanGL(void){
+    FrameSlot *slot;
+
+    // errors the frames left behind unchecked still get counted
+    GL_CHECK_INIT("stream frames");
+    for(uint32_t i = 0; i < mDepth; i++){
+        slot = &mSlots[i];
+        if(slot->fence)
+            glDeleteSync(slot->fence);
+        for(uint32_t s = 0; s < MAX_SLICES; s++)
+            if(slot->sliceFence[s])
+                glDeleteSync(slot->sliceFence[s]);
+        if(mDesc->input == INPUT_IMAGE){
+            glDeleteBuffers(1, &slot->unpackid);
+        }else{
+            glDeleteBuffers(mDesc->planes, slot->vbo);
+        }
+        glDeleteBuffers(1, &slot->pboid);
+        mTimer.deleteQueries(&slot->timing);
+    }
+    mImports.clear();
+    cleanKernelIO();
+}
+
+// What the kernel reads and writes: per slot input textures plus the shared
+// output target for whole frames, the strip sets for striped ones. With
+// OUTPUT_SSBO whole frames are written straight into the slot's pack buffer.
+void GLStream::initKernelIO(void){
+    if(mStrips > 0){
+        initStrips();
+        return;
+    }
+    if(mOutput == OUTPUT_IMAGE)
+        fboid = mEngine->acquireTarget(mDesc->outFormat, mGeo.outWidth, mGeo.outHeight, &texOut);
+    if(mDesc->input != INPUT_IMAGE)
+        return;
+    for(uint32_t i = 0; i < mDepth; i++){
+        FrameSlot *slot = &mSlots[i];
+        glGenTextures(mDesc->planes, slot->texIn);
+        for(uint32_t j = 0; j < mDesc->planes; j++){
+            glBindTexture(GL_TEXTURE_2D, slot->texIn[j]);
+            glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8UI, mGeo.inWidth, mGeo.inHeight);
+            GL_CHECK_INIT("input textures");
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        }
+    }
+}
+
+void GLStream::cleanKernelIO(void){
+    if(mStrips > 0){
+        cleanStrips();
+        memset(mStripSets, 0, sizeof(mStripSets));
+        return;
+    }
+    if(fboid != 0)
+        mEngine->releaseTarget(fboid);
+    fboid = 0;
+    texOut = 0;
+    if(mDesc->input != INPUT_IMAGE)
+        return;
+    for(uint32_t i = 0; i < mDepth; i++){
+        glDeleteTextures(mDesc->planes, mSlots[i].texIn);
+        memset(mSlots[i].texIn, 0, sizeof(mSlots[i].texIn));
+    }
+}
+
+void GLStream::cleanCPU(void){
+    for(uint32_t i = 0; i < mDepth; i++){
+        for(uint32_t j = 0; j < mDesc->planes; j++)
+            free(mSlots[i].upload[j]);
+        free(mSlots[i].map);
+    }
+}
+
+// Map the staging buffers of a slot whose previous frame is finished, so the
+// caller can fill them. The fence already guarantees the GPU is done reading.
+void GLStream::mapInput(FrameSlot *slot){
+    GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT;
+
+    if(mPersistent)
+        return;
+    if(mDesc->input == INPUT_IMAGE){
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot->unpackid);
+        slot->upload[0] = (uint8_t *)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0,
+                planeOffset(&mGeo, mDesc->planes), flags);
+        for(uint32_t j = 1; j < mDesc->planes; j++)
+            slot->upload[j] = slot->upload[0] + planeOffset(&mGeo, j);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }else{
+        for(uint32_t j = 0; j < mDesc->planes; j++){
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, slot->vbo[j]);
+            slot->upload[j] = (uint8_t *)glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, mGeo.planeSize[j], flags);
+        }
+    }
+}
+
+// Drop the caller's mapping of the staging buffers before the GPU touches
+// them, no-op if they are not mapped
+void GLStream::unmapInput(FrameSlot *slot){
+    if(mPersistent || slot->upload[0] == NULL)
+        return;
+    if(mDesc->input == INPUT_IMAGE){
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot->unpackid);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }else{
+        for(uint32_t j = 0; j < mDesc->planes; j++){
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, slot->vbo[j]);
+            glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+        }
+    }
+    memset(slot->upload, 0, sizeof(slot->upload));
+}
+
+void GLStream::performCompute(FrameSlot *slot){
+    uint32_t planes = mDesc->planes;
+    bool sampled = slot->timing.active;
+    // a partial frame reads halo rows past its own, and covers fewer threads
+    uint32_t inRows = slot->rows + mDesc->halo < mGeo.inHeight ? slot->rows + mDesc->halo : mGeo.inHeight;
+    uint32_t threadsY = (mGeo.threadsY * slot->rows + mGeo.inHeight - 1) / mGeo.inHeight;
+    KernelParams params;
+    GLuint tex[MAX_PLANES];
+    bool imported = slot->imported && mImports.get(&slot->key, tex) == 0;
+
+    if(slot->imported && !imported)
+        printf("import of the frame's buffer is gone, converting stale input\n");
+    glUseProgram(imported ? importProgram : program);
+    kernelParams(&params, &mGeo);
+    mEngine->setParams(&params);
+
+    if(sampled)
+        mTimer.begin(&slot->timing, STAGE_UPLOAD);
+    if(imported){
+        // the kernel samples the imported planes, staging stays as it is
+        for(uint32_t j = 0; j < planes; j++){
+            glActiveTexture(GL_TEXTURE0 + j);
+            glBindTexture(GL_TEXTURE_2D, tex[j]);
+        }
+        glActiveTexture(GL_TEXTURE0);
+    }else if(mDesc->input == INPUT_IMAGE){
+        // upload from the staging buffer, the copy runs on the GPU timeline
+        unmapInput(slot);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot->unpackid);
+        for(uint32_t j = 0; j < planes; j++){
+            glPixelStorei(GL_UNPACK_ROW_LENGTH, mGeo.pitch[j] / 4);
+            glBindTexture(GL_TEXTURE_2D, slot->texIn[j]);
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, mGeo.inWidth, inRows, GL_RGBA_INTEGER,
+                    GL_UNSIGNED_BYTE, (void *)planeOffset(&mGeo, j));
+            GL_CHECK("upload");
+        }
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        for(uint32_t j = 0; j < planes; j++)
+            glBindImageTexture(j, slot->texIn[j], 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA8UI);
+    }else{
+        // the caller already wrote the planes into the mapped SSBOs
+        unmapInput(slot);
+        for(uint32_t j = 0; j < planes; j++)
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, j, slot->vbo[j]);
+    }
+    GL_CHECK("input bind");
+    if(sampled){
+        mTimer.end(&slot->timing, STAGE_UPLOAD);
+        mTimer.begin(&slot->timing, STAGE_DISPATCH);
+    }
+
+    if(mOutput == OUTPUT_SSBO)
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, OUTPUT_SSBO_BINDING, slot->pboid);
+    else
+        glBindImageTexture(mDesc->outBinding, texOut, 0, GL_FALSE, 0, GL_WRITE_ONLY, mDesc->outFormat);
+    GL_CHECK("output bind");
+
+    glDispatchCompute(mGeo.groupsX, (threadsY + mLocal.y - 1) / mLocal.y, 1);
+    GL_CHECK_FRAME("dispatch");
+
+    // SSBO output is mapped by retire() once the fence signals
+    glMemoryBarrier(mOutput == OUTPUT_SSBO ? GL_BUFFER_UPDATE_BARRIER_BIT : GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+    if(sampled)
+        mTimer.end(&slot->timing, STAGE_DISPATCH);
+}
+
+static bool fitsLimits(const KernelDesc *desc, OutputMode output, const StreamGeometry *geo, const GLLimits *lim){
+    // group counts depend on the local size picked later, one invocation
+    // per group is the worst case
+    if(geo->threadsX > (GLuint)lim->maxGroups[0] || geo->threadsY > (GLuint)lim->maxGroups[1])
+        return false;
+    if(desc->input == INPUT_IMAGE){
+        if(geo->inWidth > (uint32_t)lim->maxTextureSize || geo->inHeight > (uint32_t)lim->maxTextureSize)
+            return false;
+    }else{
+        for(uint32_t j = 0; j < desc->planes; j++)
+            if(geo->planeSize[j] > lim->maxSSBOSize)
+                return false;
+    }
+    if(output == OUTPUT_IMAGE)
+        return geo->outWidth <= (uint32_t)lim->maxTextureSize && geo->outHeight <= (uint32_t)lim->maxTextureSize;
+    return geo->outSize <= lim->maxSSBOSize;
+}
+
+// Pick the tallest strip of at most cap rows that fits the limits, or none
+// if the whole frame does. -1 if not even the smallest strip fits, the
+// width alone is too big.
+int GLStream::planStrips(uint32_t cap){
+    const GLLimits *lim = mEngine->limits();
+    uint32_t align = mDesc->rowAlign > 0 ? mDesc->rowAlign : 1;
+    uint32_t lo, hi, mid;
+    StreamGeometry geo;
+
+    mStrips = 0;
+    mStripRows = 0;
+    if(!mEngine->hasGL())
+        return 0;
+    if(cap >= mHeight && fitsLimits(mDesc, mOutput, &mGeo, lim))
+        return 0;
+    if(cap >= mHeight)
+        cap = mHeight - 1;
+
+    // strips of lo * align rows fit, binary search for the most that do
+    lo = 1;
+    hi = cap / align > 1 ? cap / align : 1;
+    layoutRows(&geo, align + 2 * mDesc->halo < mHeight ? align + 2 * mDesc->halo : mHeight);
+    if(!fitsLimits(mDesc, mOutput, &geo, lim)){
+        printf("%s %dx%d does not fit the GL limits, not even in strips\n", mDesc->name, mWidth, mHeight);
+        return -1;
+    }
+    while(lo < hi){
+        mid = (lo + hi + 1) / 2;
+        uint32_t rows = mid * align + 2 * mDesc->halo;
+        layoutRows(&geo, rows < mHeight ? rows : mHeight);
+        if(fitsLimits(mDesc, mOutput, &geo, lim))
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+
+    mStripRows = lo * align;
+    mStrips = (mHeight + mStripRows - 1) / mStripRows;
+    uint32_t tallest = mStripRows + 2 * mDesc->halo;
+    layoutRows(&mStripGeo, tallest < mHeight ? tallest : mHeight);
+    // limits may need more strips than slices, a slice is then several strips
+    mSliceStrips = (mStrips + mSlices - 1) / mSlices;
+    printf("%s %dx%d runs in %d strips of %d rows\n", mDesc->name, mWidth, mHeight, mStrips, mStripRows);
+    return 0;
+}
+
+// Input rows [first, first + count) of a strip, halo included. The strip's
+// own rows start top rows in.
+void GLStream::stripRows(uint32_t strip, uint32_t *first, uint32_t *count, uint32_t *top){
+    uint32_t begin = strip * mStripRows;
+    uint32_t end = begin + mStripRows < mHeight ? begin + mStripRows : mHeight;
+    uint32_t below = mHeight - end < mDesc->halo ? mHeight - end : mDesc->halo;
+
+    *top = begin < mDesc->halo ? begin : mDesc->halo;
+    *first = begin - *top;
+    *count = end + below - *first;
+}
+
+void GLStream::initStrips(void){
+    for(uint32_t s = 0; s < STRIP_SETS; s++){
+        StripSet *set = &mStripSets[s];
+        if(mDesc->input == INPUT_IMAGE){
+            glGenTextures(mDesc->planes, set->in);
+            for(uint32_t j = 0; j < mDesc->planes; j++){
+                glBindTexture(GL_TEXTURE_2D, set->in[j]);
+                glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8UI, mStripGeo.inWidth, mStripGeo.inHeight);
+            }
+        }else{
+            glGenBuffers(mDesc->planes, set->in);
+            for(uint32_t j = 0; j < mDesc->planes; j++){
+                glBindBuffer(GL_SHADER_STORAGE_BUFFER, set->in[j]);
+                glBufferData(GL_SHADER_STORAGE_BUFFER, mStripGeo.planeSize[j], NULL, GL_STREAM_COPY);
+            }
+        }
+        if(mOutput == OUTPUT_IMAGE){
+            glGenTextures(1, &set->tex);
+            glBindTexture(GL_TEXTURE_2D, set->tex);
+            glTexStorage2D(GL_TEXTURE_2D, 1, mDesc->outFormat, mStripGeo.outWidth, mStripGeo.outHeight);
+            glGenFramebuffers(1, &set->fbo);
+            glBindFramebuffer(GL_FRAMEBUFFER, set->fbo);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, set->tex, 0);
+            GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+            if(status != GL_FRAMEBUFFER_COMPLETE){
+                printf("failed  %x\n", status);
+                GLCheck::fail();
+            }
+        }else{
+            glGenBuffers(1, &set->out);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, set->out);
+            glBufferData(GL_SHADER_STORAGE_BUFFER, mStripGeo.outSize, NULL, GL_STREAM_COPY);
+        }
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    GL_CHECK_INIT("strip buffers");
+}
+
+void GLStream::cleanStrips(void){
+    for(uint32_t s = 0; s < STRIP_SETS; s++){
+        StripSet *set = &mStripSets[s];
+        if(mDesc->input == INPUT_IMAGE)
+            glDeleteTextures(mDesc->planes, set->in);
+        else
+            glDeleteBuffers(mDesc->planes, set->in);
+        if(set->tex != 0){
+            glDeleteTextures(1, &set->tex);
+            glDeleteFramebuffers(1, &set->fbo);
+        }
+        if(set->out != 0)
+            glDeleteBuffers(1, &set->out);
+    }
+}
+
+// Copy a strip's rows of every plane from the staging buffers into its set.
+// Plane sizes are linear in the rows, strips start on rowAlign boundaries.
+void GLStream::uploadStrip(FrameSlot *slot, uint32_t strip){
+    StripSet *set = &mStripSets[strip % STRIP_SETS];
+    uint32_t first, count, top;
+
+    stripRows(strip, &first, &count, &top);
+    for(uint32_t j = 0; j < mDesc->planes; j++){
+        GLsizeiptr offset = mGeo.planeSize[j] * first / mGeo.inHeight;
+        GLsizeiptr size = mGeo.planeSize[j] * count / mGeo.inHeight;
+        if(mDesc->input == INPUT_IMAGE){
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot->unpackid);
+            glPixelStorei(GL_UNPACK_ROW_LENGTH, mGeo.pitch[j] / 4);
+            glBindTexture(GL_TEXTURE_2D, set->in[j]);
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, mGeo.inWidth, count, GL_RGBA_INTEGER, GL_UNSIGNED_BYTE,
+                    (void *)(planeOffset(&mGeo, j) + offset));
+        }else{
+            glBindBuffer(GL_COPY_READ_BUFFER, slot->vbo[j]);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, set->in[j]);
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, offset, 0, size);
+        }
+    }
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+// Striped frame: every strip is a normal dispatch at the strip's height on
+// one of the strip sets, its own rows (halo dropped) are then read back
+// into their place in the slot's pack buffer. Strip k + 1 is uploaded
+// before strip k is read back so the copy can overlap the readback. The
+// whole loop is timed as the dispatch stage.
+void GLStream::performStrips(FrameSlot *slot){
+    GLsizeiptr rowBytes = mGeo.outSize / mGeo.outHeight;
+    bool sampled = slot->timing.active;
+
+    if(sampled)
+        mTimer.begin(&slot->timing, STAGE_DISPATCH);
+    // the whole frame was staged, unmap before the GPU reads it
+    unmapInput(slot);
+
+    glUseProgram(program);
+    uploadStrip(slot, 0);
+    for(uint32_t k = 0; k < mStrips; k++){
+        StripSet *set = &mStripSets[k % STRIP_SETS];
+        StreamGeometry geo;
+        KernelParams params;
+        uint32_t first, count, top, own;
+        GLsizeiptr srcRow = 0, dstRow = 0;
+
+        stripRows(k, &first, &count, &top);
+        own = mHeight - k * mStripRows < mStripRows ? mHeight - k * mStripRows : mStripRows;
+        layoutRows(&geo, count);
+        // the strip's rows, stride and pitch are the frame's
+        kernelParams(&params, &geo);
+        mEngine->setParams(&params);
+        for(uint32_t j = 0; j < mDesc->planes; j++){
+            if(mDesc->input == INPUT_IMAGE)
+                glBindImageTexture(j, set->in[j], 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA8UI);
+            else
+                glBindBufferBase(GL_SHADER_STORAGE_BUFFER, j, set->in[j]);
+        }
+        if(mOutput == OUTPUT_SSBO)
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, OUTPUT_SSBO_BINDING, set->out);
+        else
+            glBindImageTexture(mDesc->outBinding, set->tex, 0, GL_FALSE, 0, GL_WRITE_ONLY, mDesc->outFormat);
+        glDispatchCompute((geo.threadsX + mLocal.x - 1) / mLocal.x, (geo.threadsY + mLocal.y - 1) / mLocal.y, 1);
+        glMemoryBarrier(mOutput == OUTPUT_SSBO ? GL_BUFFER_UPDATE_BARRIER_BIT : GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+        if(k + 1 < mStrips)
+            uploadStrip(slot, k + 1);
+
+        // each output section of the strip goes below the same section of
+        // the strips before it
+        if(mOutput == OUTPUT_IMAGE){
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, set->fbo);
+            glReadBuffer(GL_COLOR_ATTACHMENT0);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, slot->pboid);
+        }else{
+            glBindBuffer(GL_COPY_READ_BUFFER, set->out);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, slot->pboid);
+        }
+        for(uint32_t p = 0; p < MAX_OUT_PLANES && geo.outRows[p] > 0; p++){
+            GLsizeiptr src = srcRow + top * geo.outRows[p] / geo.inHeight;
+            GLsizeiptr dst = dstRow + k * mStripRows * mGeo.outRows[p] / mGeo.inHeight;
+            GLsizei rows = own * geo.outRows[p] / geo.inHeight;
+            if(mOutput == OUTPUT_IMAGE)
+                glReadPixels(0, src, mGeo.outWidth, rows, GL_RGBA_INTEGER, mDesc->outType, (void *)(dst * rowBytes));
+            else
+                glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, src * rowBytes, dst * rowBytes,
+                        rows * rowBytes);
+            srcRow += geo.outRows[p];
+            dstRow += mGeo.outRows[p];
+        }
+        if(mSliceFunc != NULL && ((k + 1) % mSliceStrips == 0 || k + 1 == mStrips)){
+            // let the GPU start on the slice while later strips are queued
+            slot->sliceFence[k / mSliceStrips] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            glFlush();
+        }
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    GL_CHECK_FRAME("strips");
+    if(sampled)
+        mTimer.end(&slot->timing, STAGE_DISPATCH);
+}
+
+bool GLStream::hasJob(void){
+    return !mJobs.empty();
+}
+
+// Take the next queued frame off the job ring, its slot is always the next
+// one in ring order
+GLStream::FrameSlot *GLStream::nextJob(void){
+    FrameJob job;
+    FrameSlot *slot;
+
+    // the engine only calls this after hasJob()
+    memset(&job, 0, sizeof(job));
+    mJobs.pop(&job);
+    slot = &mSlots[job.slot];
+    slot->dst = job.dst;
+    slot->rows = job.rows;
+    slot->tag = job.tag;
+    slot->imported = job.imported;
+    slot->key = job.key;
+    return slot;
+}
+
+// Hand a finished frame back to the caller
+void GLStream::complete(uint32_t index){
+    FrameJob job;
+
+    memset(&job, 0, sizeof(job));
+    job.slot = index;
+    job.dst = mSlots[index].dst;
+    job.rows = mSlots[index].rows;
+    job.tag = mSlots[index].tag;
+    // never full, the caller has at most depth frames out
+    mDone.push(job);
+    mDoneWait.wake();
+}
+
+// Run the next queued frame. Returns true if it was left in flight on the
+// GPU and has to be retired later.
+bool GLStream::stage(void){
+    FrameSlot *slot = nextJob();
+    uint32_t index = mStageIndex;
+
+    slot->timing.active = mTimer.sampleFrame();
+    slot->slicesDone = 0;
+    slot->failed = false;
+    slot->stagedNs = StageTimer::now();
+    if(mCpu != NULL){
+        // done as soon as it returns, nothing is left in flight
+        uint64_t start = slot->timing.active ? StageTimer::now() : 0;
+        mCpu(mCpuCtx, slot->upload, slot->dst != NULL ? slot->dst : slot->map);
+        if(slot->timing.active)
+            mTimer.add(STAGE_DISPATCH, StageTimer::now() - start, false);
+        if(mSliceFunc != NULL)
+            mSliceFunc(mSliceCtx, 0, mHeight, slot->dst != NULL ? slot->dst : slot->map);
+        slot->busyNs = StageTimer::now() - slot->stagedNs;
+        mStageIndex = (mStageIndex + 1) % mDepth;
+        mRetireIndex = mStageIndex;
+        complete(index);
+        return false;
+    }
+
+    if(slot->map != NULL && !mPersistent){
+        // the caller has released this view, drop the old mapping before
+        // the GPU writes the buffer again
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, slot->pboid);
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        slot->map = NULL;
+    }
+
+    // upload + dispatch + async readback into this slot's pbo, with
+    // OUTPUT_SSBO the dispatch already wrote it
+    if(mStrips > 0)
+        performStrips(slot);
+    else
+        performCompute(slot);
+
+    if(mOutput == OUTPUT_IMAGE && mStrips == 0){
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, fboid);
+        glReadBuffer(GL_COLOR_ATTACHMENT0);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, slot->pboid);
+        if(slot->timing.active)
+            mTimer.begin(&slot->timing, STAGE_READBACK);
+        if(slot->rows == mHeight){
+            glReadPixels(0, 0, mGeo.outWidth, mGeo.outHeight, GL_RGBA_INTEGER, mDesc->outType, 0);
+        }else{
+            // only the rows the GPU converted, section by section
+            GLsizeiptr rowBytes = mGeo.outSize / mGeo.outHeight;
+            uint32_t base = 0;
+            for(uint32_t p = 0; p < MAX_OUT_PLANES && mGeo.outRows[p] > 0; p++){
+                glReadPixels(0, base, mGeo.outWidth, slot->rows * mGeo.outRows[p] / mGeo.inHeight, GL_RGBA_INTEGER,
+                        mDesc->outType, (void *)(base * rowBytes));
+                base += mGeo.outRows[p];
+            }
+        }
+        if(slot->timing.active)
+            mTimer.end(&slot->timing, STAGE_READBACK);
+    }
+    slot->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glFlush();
+
+    mStageIndex = (mStageIndex + 1) % mDepth;
+    mInFlight++;
+    return true;
+}
+
+uint32_t GLStream::stageLayer(const GLuint *in, uint32_t layer){
+    uint32_t index = mStageIndex;
+    FrameSlot *slot = nextJob();
+
+    // batched frames are not timed, the stages are shared with other streams
+    slot->timing.active = false;
+    slot->failed = false;
+    slot->stagedNs = StageTimer::now();
+    unmapInput(slot);
+    if(mDesc->input == INPUT_IMAGE){
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot->unpackid);
+        for(uint32_t j = 0; j < mDesc->planes; j++){
+            glPixelStorei(GL_UNPACK_ROW_LENGTH, mGeo.pitch[j] / 4);
+            glBindTexture(GL_TEXTURE_2D_ARRAY, in[j]);
+            glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer, mGeo.inWidth, mGeo.inHeight, 1,
+                    GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, (void *)planeOffset(&mGeo, j));
+        }
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }else{
+        for(uint32_t j = 0; j < mDesc->planes; j++){
+            glBindBuffer(GL_COPY_READ_BUFFER, slot->vbo[j]);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, in[j]);
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, mGeo.planeSize[j] * layer,
+                    mGeo.planeSize[j]);
+        }
+    }
+    mStageIndex = (mStageIndex + 1) % mDepth;
+    mInFlight++;
+    return index;
+}
+
+void GLStream::finishLayer(GLuint pbo, uint32_t layer, uint32_t index){
+    FrameSlot *slot = &mSlots[index];
+
+    if(slot->map != NULL && !mPersistent){
+        // the caller has released this view, drop the old mapping
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, slot->pboid);
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        slot->map = NULL;
+    }
+    glBindBuffer(GL_COPY_READ_BUFFER, pbo);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, slot->pboid);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, mGeo.outSize * layer, 0, mGeo.outSize);
+    slot->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+int GLStream::kernel(void){
+    return mKernel;
+}
+
+const KernelDesc *GLStream::desc(void){
+    return mDesc;
+}
+
+const StreamGeometry *GLStream::geometry(void){
+    return &mGeo;
+}
+
+bool GLStream::batchable(uint32_t i){
+    FrameJob job;
+
+    return mCpu == NULL && mDesc->batchSource != NULL && mStrips == 0 && mJobs.peek(&job, i) &&
+           job.rows == mHeight && !job.imported;
+}
+
+static int waitFence(GLsync fence, bool wait){
+    GLenum ret;
+
+    do{
+        ret = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, wait ? 1000000000 : 0);
+    }while(wait && ret == GL_TIMEOUT_EXPIRED);
+    if(ret == GL_TIMEOUT_EXPIRED)
+        return -1;
+    if(ret == GL_WAIT_FAILED){
+        printf("glClientWaitSync failed, error:%x\n", glGetError());
+        GLCheck::fail();
+    }
+    return 0;
+}
+
+uint32_t GLStream::sliceCount(void){
+    return mStrips > 0 ? (mStrips + mSliceStrips - 1) / mSliceStrips : 1;
+}
+
+// Frame rows of a slice, the last one may be shorter
+void GLStream::sliceRows(uint32_t slice, uint32_t *begin, uint32_t *end){
+    uint32_t rows = mStrips > 0 ? mSliceStrips * mStripRows : mHeight;
+
+    *begin = slice * rows;
+    *end = *begin + rows < mHeight ? *begin + rows : mHeight;
+}
+
+// Copy input rows [begin, end) of every output section from the mapped
+// pack buffer to dst, a row at a time when dst has a narrower stride
+void GLStream::copyRows(FrameSlot *slot, uint32_t begin, uint32_t end){
+    GLsizeiptr rowBytes = mGeo.outSize / mGeo.outHeight;
+    GLsizeiptr dstRow = rowBytes / mPackStride * mStride;
+    GLsizeiptr used = rowBytes / mPackStride * (mWidth < mStride ? mWidth : mStride);
+    GLsizeiptr base = 0;
+
+    for(uint32_t p = 0; p < MAX_OUT_PLANES && mGeo.outRows[p] > 0; p++){
+        GLsizeiptr first = base + begin * mGeo.outRows[p] / mGeo.inHeight;
+        GLsizeiptr rows = (end - begin) * mGeo.outRows[p] / mGeo.inHeight;
+        if(dstRow == rowBytes){
+            memcpy(slot->dst + first * rowBytes, slot->map + first * rowBytes, rows * rowBytes);
+        }else{
+            for(GLsizeiptr r = first; r < first + rows; r++)
+                memcpy(slot->dst + r * dstRow, slot->map + r * rowBytes, used);
+        }
+        base += mGeo.outRows[p];
+    }
+}
+
+// Copy a slice that has landed out to dst, if the frame has one, and hand
+// it to the callback. The pack buffer is mapped.
+void GLStream::deliverSlice(FrameSlot *slot, uint32_t slice){
+    uint32_t begin, end;
+
+    if(slot->sliceFence[slice] != 0){
+        glDeleteSync(slot->sliceFence[slice]);
+        slot->sliceFence[slice] = 0;
+    }
+    sliceRows(slice, &begin, &end);
+    if(slot->dst != NULL)
+        copyRows(slot, begin, end);
+    mSliceFunc(mSliceCtx, begin, end, slot->dst != NULL ? slot->dst : slot->map);
+}
+
+// Copy out (or map for acquire()) the oldest frame in flight once its fence
+// has signaled. Returns -1 if wait is false and the GPU is not done with it yet.
+int GLStream::retire(bool wait){
+    FrameSlot *slot = &mSlots[mRetireIndex];
+    bool sampled = slot->timing.active;
+    uint64_t start = sampled ? StageTimer::now() : 0;
+    uint32_t slices = mSliceFunc != NULL ? sliceCount() : 0;
+    uint64_t done;
+
+    // persistent pack buffers can be read while later slices are still
+    // being written, hand out every slice whose own fence has signaled.
+    // glMapBufferRange() waits for every write to the buffer, so without
+    // them the slices wait for the frame.
+    while(mPersistent && slot->slicesDone < slices && slot->sliceFence[slot->slicesDone] != 0){
+        if(waitFence(slot->sliceFence[slot->slicesDone], wait) != 0)
+            return -1;
+        deliverSlice(slot, slot->slicesDone++);
+    }
+    if(waitFence(slot->fence, wait) != 0)
+        return -1;
+    glDeleteSync(slot->fence);
+    slot->fence = 0;
+    done = StageTimer::now();
+    slot->busyNs = done - (slot->stagedNs > mLastDoneNs ? slot->stagedNs : mLastDoneNs);
+    mLastDoneNs = done;
+    mTimer.collect(&slot->timing);
+    mapInput(slot);
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, slot->pboid);
+    if(slot->map == NULL)
+        slot->map = (uint8_t *)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, mGeo.outSize, GL_MAP_READ_BIT);
+    if(slot->map == NULL){
+        // lost context or out of memory, the frame comes back failed
+        printf("can't map the frame's output, error:%x\n", glGetError());
+        GLCheck::fail();
+        slot->failed = true;
+        for(; slot->slicesDone < slices; slot->slicesDone++){
+            if(slot->sliceFence[slot->slicesDone] != 0)
+                glDeleteSync(slot->sliceFence[slot->slicesDone]);
+            slot->sliceFence[slot->slicesDone] = 0;
+        }
+    }
+    if(sampled){
+        uint64_t mapped = StageTimer::now();
+        mTimer.add(STAGE_MAP, mapped - start, false);
+        start = mapped;
+    }
+    // the rest of the slices, all of them without persistent buffers
+    while(slot->slicesDone < slices)
+        deliverSlice(slot, slot->slicesDone++);
+    if(slot->dst != NULL && !slot->failed){
+        if(slices == 0 && slot->rows == mHeight && mPackStride == mStride)
+            memcpy(slot->dst, slot->map, mGeo.outSize);
+        else if(slices == 0)
+            copyRows(slot, 0, slot->rows);
+        if(sampled)
+            mTimer.add(STAGE_COPY, StageTimer::now() - start, false);
+        if(!mPersistent){
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+            slot->map = NULL;
+        }
+    }
+
+    complete(mRetireIndex);
+    mRetireIndex = (mRetireIndex + 1) % mDepth;
+    mInFlight--;
+    return 0;
+}
+
+void GLStream::copyInput(uint8_t **to, uint8_t *const *planes, uint32_t rows, bool staged){
+    // partial frames only stage the rows the kernel reads, 4:2:0 chroma
+    // planes have half as many rows so this stays exact for even heights
+    uint32_t inRows = rows + mDesc->halo < mHeight ? rows + mDesc->halo : mHeight;
+
+    for(uint32_t j = 0; j < mDesc->planes; j++){
+        uint32_t planeRows = mGeo.planeSize[j] / mPitch[j] * inRows / mHeight;
+        uint32_t pitch = staged ? mPitch[j] : mSrcPitch[j];
+        if(pitch == mPitch[j]){
+            memcpy(to[j], planes[j], (size_t)planeRows * mPitch[j]);
+        }else{
+            // repack to the staging pitch, padding bytes are left as they are
+            uint32_t bytes = pitch < mPitch[j] ? pitch : mPitch[j];
+            for(uint32_t r = 0; r < planeRows; r++)
+                memcpy(to[j] + (size_t)r * mPitch[j], planes[j] + (size_t)r * pitch, bytes);
+        }
+    }
+}
+
+int GLStream::submit(uint8_t **planes, uint8_t *dst, uint32_t rows, void *tag){
+    uint8_t *staging[MAX_PLANES];
+
+    if(getInputBuffer(staging) != 0)
+        return -1;
+    rows = dst != NULL ? gpuRows(rows) : mHeight;
+    copyInput(staging, planes, rows, false);
+    return submitInput(dst, rows, tag);
+}
+
+int GLStream::submitFd(int fd, uint8_t *dst, uint32_t rows, void *tag){
+    uint8_t *planes[MAX_PLANES];
+    const uint8_t *base;
+    uint64_t size;
+    FdKey key;
+    bool ok = false;
+    int ret;
+
+    if(!mReady)
+        return -1;
+    if(fdKey(fd, &key, &size) != 0 || size < mSrcSize){
+        printf("fd %d does not hold a %dx%d frame\n", fd, mWidth, mHeight);
+        return -1;
+    }
+    // strips only read staging, setSlices() can turn them on after init
+    if(mImportable && mStrips == 0){
+        if(!mImports.known(&key, &ok)){
+            mImportFd = fd;
+            mImportKey = key;
+            // a feed already runs this on the engine thread
+            if(mFeed != NULL)
+                import_entry(this);
+            else
+                mEngine->runOnThread(import_entry, this);
+            ok = mImportResult == 0;
+        }
+        if(ok){
+            // the import kernel samples the planes, the slot's staging
+            // buffers are not touched
+            if(claimSlot() != 0)
+                return -1;
+            mFdImported++;
+            return queueInput(dst, rows, tag, &key);
+        }
+    }
+    base = mMaps.map(fd, &key, mSrcSize);
+    if(base == NULL)
+        return -1;
+    fdPlanes(base, planes);
+    FdMapCache::beginRead(fd);
+    ret = submit(planes, dst, rows, tag);
+    FdMapCache::endRead(fd);
+    if(ret == 0)
+        mFdMapped++;
+    return ret;
+}
+
+//static
+void GLStream::import_entry(void *data){
+    GLStream *me = static_cast<GLStream *>(data);
+    me->mImportResult = me->mImports.import(me->mImportFd, &me->mImportKey);
+}
+
+bool GLStream::importable(void){
+    return mImportable && mStrips == 0;
+}
+
+uint64_t GLStream::fdSize(void){
+    return mSrcSize;
+}
+
+void GLStream::fdPlanes(const uint8_t *base, uint8_t **planes){
+    for(uint32_t j = 0; j < mDesc->planes; j++)
+        planes[j] = (uint8_t *)base + mSrcOffset[j];
+}
+
+void GLStream::fdStats(uint64_t *imported, uint64_t *mapped, uint64_t *misses){
+    uint64_t hits, importMisses, mapMisses;
+
+    mImports.stats(&hits, &importMisses);
+    mMaps.stats(&hits, &mapMisses);
+    *imported = mFdImported;
+    *mapped = mFdMapped;
+    *misses = importMisses + mapMisses;
+}
+
+// Rows a partial frame converts on the GPU, the whole frame when the
+// stream can't split it
+uint32_t GLStream::gpuRows(uint32_t rows){
+    uint32_t align = mDesc->rowAlign > 0 ? mDesc->rowAlign : 1;
+
+    if(rows == 0 || mCpu != NULL || mStrips > 0 || mSliceFunc != NULL)
+        return mHeight;
+    rows = (rows + align - 1) / align * align;
+    return rows < mHeight ? rows : mHeight;
+}
+
+// Hold the next free slot for a frame, without its staging buffers
+int GLStream::claimSlot(void){
+    // all slots queued or held is the caller's cue to retrieve, no log
+    if(!mReady || mInputHeld || mFree == 0)
+        return -1;
+    mFree--;
+    mInputHeld = true;
+    return 0;
+}
+
+int GLStream::getInputBuffer(uint8_t **planes){
+    FrameSlot *slot;
+
+    if(claimSlot() != 0)
+        return -1;
+    slot = &mSlots[mSubmitIndex];
+    for(uint32_t j = 0; j < mDesc->planes; j++)
+        planes[j] = slot->upload[j];
+    return 0;
+}
+
+uint32_t GLStream::inputPitch(uint32_t plane){
+    return plane < MAX_PLANES ? mPitch[plane] : 0;
+}
+
+uint32_t GLStream::outputStride(void){
+    // CPU streams write the caller's stride straight into the pack buffer
+    return mCpu != NULL ? mStride : mPackStride;
+}
+
+int GLStream::submitInput(uint8_t *dst, uint32_t rows, void *tag){
+    return queueInput(dst, rows, tag, NULL);
+}
+
+// Queue the held slot, its input is in staging or, with key, an imported
+// buffer
+int GLStream::queueInput(uint8_t *dst, uint32_t rows, void *tag, const FdKey *key){
+    FrameJob job;
+
+    if(!mInputHeld)
+        return -1;
+    memset(&job, 0, sizeof(job));
+    job.slot = mSubmitIndex;
+    job.dst = dst;
+    job.rows = dst != NULL ? gpuRows(rows) : mHeight;
+    job.tag = tag;
+    job.imported = key != NULL;
+    if(key != NULL)
+        job.key = *key;
+    // never full, only free slots are handed out
+    mJobs.push(job);
+    mSubmitIndex = (mSubmitIndex + 1) % mDepth;
+    mOutstanding++;
+    mInputHeld = false;
+    mEngine->frameQueued();
+    return 0;
+}
+
+void GLStream::cancelInput(void){
+    if(!mInputHeld)
+        return;
+    mInputHeld = false;
+    mFree++;
+}
+
+//static
+bool GLStream::done_ready(void *data){
+    GLStream *me = static_cast<GLStream *>(data);
+    return !me->mDone.empty();
+}
+
+// Wait for the next finished frame, caller side
+GLStream::FrameSlot *GLStream::takeFrame(void){
+    FrameJob job;
+    FrameSlot *slot;
+
+    if(!mReady || mOutstanding == 0)
+        return NULL;
+    while(!mDone.pop(&job))
+        mDoneWait.wait(done_ready, this);
+    slot = &mSlots[job.slot];
+    mBusyNs = slot->busyNs;
+    mOutstanding--;
+    mRetrieved++;
+    return slot;
+}
+
+// Slots are reused in ring order, so give them back oldest first and stop
+// at the first one still leased out.
+void GLStream::reclaimSlots(void){
+    while(mRetrieved > 0 && !mSlots[mReleaseIndex].leased){
+        mReleaseIndex = (mReleaseIndex + 1) % mDepth;
+        mRetrieved--;
+        mFree++;
+    }
+}
+
+int GLStream::retrieve(uint8_t **dst, void **tag){
+    FrameSlot *slot = takeFrame();
+    int ret = 0;
+
+    if(slot == NULL)
+        return -1;
+    if(tag != NULL)
+        *tag = slot->tag;
+    if(slot->failed){
+        ret = -1;
+    }else if(slot->dst == NULL){
+        printf("frame was submitted for zero copy, use acquire()\n");
+        ret = -1;
+    }else if(dst){
+        *dst = slot->dst;
+    }
+    reclaimSlots();
+    return ret;
+}
+
+int GLStream::acquire(const uint8_t **data, void **tag){
+    FrameSlot *slot = takeFrame();
+
+    if(slot == NULL)
+        return -1;
+    if(tag != NULL)
+        *tag = slot->tag;
+    if(slot->failed){
+        reclaimSlots();
+        return -1;
+    }
+    if(slot->dst != NULL){
+        // already copied out, nothing to hold on to
+        *data = slot->dst;
+        reclaimSlots();
+        return 0;
+    }
+    slot->leased = true;
+    *data = slot->map;
+    return 0;
+}
+
+uint64_t GLStream::busyNs(void){
+    return mBusyNs;
+}
+
+uint32_t GLStream::freeSlots(void){
+    return mInputHeld ? 0 : mFree.load();
+}
+
+uint32_t GLStream::pending(void){
+    return mOutstanding - mDone.size();
+}
+
+uint64_t GLStream::bytes(void){
+    uint64_t in = planeOffset(&mGeo, mDesc->planes);
+    uint64_t frame = in + mGeo.outSize;
+
+    // whole frame input textures on top of the staging buffers
+    if(mCpu == NULL && mDesc->input == INPUT_IMAGE && mStrips == 0)
+        frame += in;
+    return frame * mDepth;
+}
+
+void GLStream::setTiming(uint32_t every){
+    mTimer.setInterval(every);
+}
+
+int GLStream::stageStats(ConvertStage stage, StageStats *stats){
+    return mTimer.stats(stage, stats);
+}
+
+int GLStream::setSlices(uint32_t count, SliceFunc fn, void *ctx){
+    uint32_t old = mSlices;
+
+    if(!mReady || mOutstanding > 0 || mRetrieved > 0 || mInputHeld)
+        return -1;
+    if(count < 1)
+        count = 1;
+    if(count > MAX_SLICES)
+        count = MAX_SLICES;
+    // the plan reads mSlices, the callback is only taken once it succeeded
+    mSlices = fn != NULL ? count : 1;
+    if(mCpu == NULL){
+        mEngine->runOnThread(reslice_entry, this);
+        if(mResliceResult != 0){
+            // back to the plan the stream had, it fit before
+            mSlices = old;
+            mEngine->runOnThread(reslice_entry, this);
+            return -1;
+        }
+    }
+    mSliceFunc = fn;
+    mSliceCtx = ctx;
+    return 0;
+}
+
+void GLStream::setFeed(FeedFunc fn, void *ctx){
+    mNewFeed = fn;
+    mNewFeedCtx = ctx;
+    mEngine->runOnThread(feed_entry, this);
+}
+
+//static
+void GLStream::feed_entry(void *data){
+    GLStream *me = static_cast<GLStream *>(data);
+    me->mFeed = me->mNewFeed;
+    me->mFeedCtx = me->mNewFeedCtx;
+}
+
+bool GLStream::feed(bool take){
+    if(mFeed == NULL || !mJobs.empty() || freeSlots() == 0)
+        return false;
+    return mFeed(mFeedCtx, this, take);
+}
+
+// Rebuild the strip plan for the slice count, GL thread. Nothing is in
+// flight, the engine has retired every frame the caller got back.
+//static
+void GLStream::reslice_entry(void *data){
+    GLStream *me = static_cast<GLStream *>(data);
+    uint32_t align = me->mDesc->rowAlign > 0 ? me->mDesc->rowAlign : 1;
+    uint32_t cap = me->mStripCap;
+
+    if(me->mSlices > 1){
+        // rounded up so the strips come out as exactly mSlices or fewer
+        uint32_t rows = (me->mHeight + me->mSlices - 1) / me->mSlices;
+        rows = (rows + align - 1) / align * align;
+        if(rows < cap)
+            cap = rows;
+    }
+    me->cleanKernelIO();
+    me->mResliceResult = me->planStrips(cap);
+    me->initKernelIO();
+}
+
+int GLStream::release(const uint8_t *data){
+    uint32_t index = mReleaseIndex;
+
+    for(uint32_t i = 0; i < mRetrieved; i++){
+        if(mSlots[index].leased && mSlots[index].map == data){
+            mSlots[index].leased = false;
+            reclaimSlots();
+            return 0;
+        }
+        index = (index + 1) % mDepth;
+    }
+    return -1;
+}
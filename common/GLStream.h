@@ -0,0 +1,305 @@
+#ifndef _GLSTREAM_H_
+#define _GLSTREAM_H_
+#include <stdint.h>
+#include <GLES3/gl31.h>
+#include <atomic>
+#include "GLEngine.h"
+#include "StageTimer.h"
+#include "SpscRing.h"
+#include "Parker.h"
+#include "DmaImport.h"
+
+// Max frames that can be in flight between submit() and retrieve()
+#define MAX_PIPELINE_DEPTH 4
+// Strip sized input / output sets a striped stream cycles through
+#define STRIP_SETS 2
+// Most slices a frame can be delivered in
+#define MAX_SLICES 16
+
+// Where a decoder put the planes of a frame: byte offset of each plane from
+// the start of its buffer and bytes per row, 0 for tightly packed rows. All
+// offsets 0 puts the planes back to back for submitFd().
+struct PlaneLayout{
+	uint32_t offset[MAX_PLANES];
+	uint32_t stride[MAX_PLANES];
+};
+
+// One conversion stream on a GLEngine: a kernel at a fixed size plus the
+// ring of per frame staging / readback buffers. Caller side methods must be
+// used from one thread, everything else runs on the engine thread (with a
+// feed the submit side moves there, see setFeed()). Frames
+// go to the engine and come back through a pair of lock-free single
+// producer / single consumer rings, both sides spin briefly before they
+// sleep (Parker), so up to depth frames can be queued back to back without
+// a syscall per frame.
+//
+// A frame that would break the GL limits (texture size, SSBO block size,
+// work group count) is converted in horizontal strips. The staging and pack
+// buffers still hold whole frames, only the kernel's inputs and output are
+// strip sized, so callers see no difference. GLESCONVERT_STRIP_ROWS=N caps
+// the strip height below what the limits allow.
+//
+// submit() takes planes at the row strides of the input layout. Strides that
+// are a multiple of 4 and cover the row are staged as they are, one copy per
+// plane, anything else is repacked a row at a time. Output rows go to dst at
+// stride, acquire() views are at outputStride().
+class GLStream{
+public:
+    // Runs a frame on the dispatch thread instead of the GPU
+    typedef void (*CpuFunc)(void *ctx, uint8_t **planes, uint8_t *dst);
+    // Rows [rowBegin, rowEnd) of the frame are final in every output
+    // section (NV12: the y rows and their uv rows). frame is the start of
+    // the whole output frame, dst or the view acquire() will return.
+    typedef void (*SliceFunc)(void *ctx, uint32_t rowBegin, uint32_t rowEnd, const uint8_t *frame);
+    // Engine thread: is a frame waiting for the stream, or (take) queue it
+    // on the stream now. Returns false if there is none.
+    typedef bool (*FeedFunc)(void *ctx, GLStream *stream, bool take);
+
+    // cpu == NULL runs the kernel on the GPU, ready() is false if it
+    // could not be compiled there
+    GLStream(GLEngine *engine, const KernelDesc *desc, uint32_t width, uint32_t height, uint32_t stride,
+             uint32_t depth, CpuFunc cpu = NULL, void *cpuCtx = NULL, const PlaneLayout *input = NULL);
+    ~GLStream();
+    // resources were set up, the other calls fail if not
+    bool ready(void);
+
+    // rows > 0 converts only input rows [0, rows) of the frame on the GPU,
+    // rounded up to the kernel's rowAlign, and only those rows are copied
+    // in and out. The caller fills in the rest of dst itself. Whole frames
+    // on CPU, striped or sliced streams.
+    // tag is handed back by retrieve() / acquire() with the frame
+    int submit(uint8_t **planes, uint8_t *dst, uint32_t rows = 0, void *tag = NULL);
+    // Same for a frame in a dma-buf or memfd, planes at the input layout.
+    // GPU streams import dma-bufs once per buffer (DmaImport) and the
+    // kernel samples the planes there, fd must stay open and the buffer
+    // unchanged until the frame is retrieved. Anything else is mapped once
+    // per buffer and copied in before this returns.
+    int submitFd(int fd, uint8_t *dst, uint32_t rows = 0, void *tag = NULL);
+    // Frames submitFd() imported / copied from a mapping, and buffers it
+    // had to import or map first
+    void fdStats(uint64_t *imported, uint64_t *mapped, uint64_t *misses);
+    // Rows submit() would convert on the GPU for a partial frame of rows
+    uint32_t gpuRows(uint32_t rows);
+    // What submit() copies of a frame of rows (from gpuRows()) into
+    // staging, to memory in the staging layout (inputPitch(), planes at
+    // planeOffset()). staged: planes already are in that layout.
+    void copyInput(uint8_t **to, uint8_t *const *planes, uint32_t rows, bool staged);
+    // submitFd() imports dma-bufs instead of mapping them, and the layout
+    // of its buffers: least size and the planes in a mapping of one
+    bool importable(void);
+    uint64_t fdSize(void);
+    void fdPlanes(const uint8_t *base, uint8_t **planes);
+    // Staging planes are at inputPitch() bytes per row. -1 when all depth
+    // slots are queued or held, retrieve a frame first.
+    int getInputBuffer(uint8_t **planes);
+    uint32_t inputPitch(uint32_t plane);
+    // Output stride of acquire() views, on the GPU the stride rounded up
+    // to a multiple of 4
+    uint32_t outputStride(void);
+    int submitInput(uint8_t *dst, uint32_t rows = 0, void *tag = NULL);
+    void cancelInput(void);
+    // -1 as well for a frame whose output couldn't be mapped, its slot is
+    // free again and tag still set
+    int retrieve(uint8_t **dst, void **tag = NULL);
+    int acquire(const uint8_t **data, void **tag = NULL);
+    int release(const uint8_t *data);
+    // Slice mode: every frame is converted as count strips (at most
+    // MAX_SLICES), each with its own fence, and fn runs on the engine
+    // thread as each one lands, before the frame can be retrieved. Keep it
+    // short, it holds up every stream. Early slices only come back before
+    // the whole frame with persistent buffers, otherwise they are handed
+    // out together once the frame is done. fn == NULL turns it off. Only
+    // while no frames are submitted or held, -1 otherwise.
+    int setSlices(uint32_t count, SliceFunc fn, void *ctx);
+    // Frames that wait outside the stream until the engine can start them
+    // (StreamPool): whenever the job ring has run dry and a slot is free
+    // the engine thread asks fn for the next one, which queues it with
+    // submit(), submitFd() or getInputBuffer() + submitInput() right there.
+    // Those then only run on the engine thread, retrieve(), acquire() and
+    // release() stay on the caller's. NULL turns it off, waits for the
+    // engine thread.
+    void setFeed(FeedFunc fn, void *ctx);
+    // engine thread: a frame is waiting for the stream, or (take) queue it
+    bool feed(bool take);
+    // GPU time of the last retrieved frame: staging to its fence, less the
+    // part spent behind the frame before it. Measured on the engine thread,
+    // so it runs late when other streams keep it busy.
+    uint64_t busyNs(void);
+    // Caller side load: slots getInputBuffer() can still hand out, and
+    // frames submitted but not finished yet. Finished frames waiting for
+    // retrieve() don't count.
+    uint32_t freeSlots(void);
+    uint32_t pending(void);
+    // GPU memory of the staging, input and pack buffers, roughly
+    uint64_t bytes(void);
+
+    // Per stage timing, sampled every Nth frame, 0 turns it off.
+    // GLESCONVERT_TIMING=N in the environment sets the initial interval.
+    void setTiming(uint32_t every);
+    int stageStats(ConvertStage stage, StageStats *stats);
+
+    // engine thread
+    bool hasJob(void);
+    bool stage(void);
+    int retire(bool wait);
+    int kernel(void);
+    const KernelDesc *desc(void);
+    const StreamGeometry *geometry(void);
+    // GPU stream whose kernel has a batched variant, and its queued frame i
+    // (0 = next) can go into a batched dispatch. Imported frames can't.
+    bool batchable(uint32_t i = 0);
+    // Batched path: copy the next queued frame into layer of the batch
+    // inputs, returns its slot. finishLayer() copies that layer of the batch
+    // readback into the slot's pack buffer and fences it.
+    uint32_t stageLayer(const GLuint *in, uint32_t layer);
+    void finishLayer(GLuint pbo, uint32_t layer, uint32_t index);
+
+private:
+	// A frame queued for the engine (mJobs), or retired and waiting for
+	// the caller (mDone)
+	struct FrameJob{
+		uint32_t slot;
+		uint8_t *dst;
+		uint32_t rows;
+		void *tag;
+		bool imported;  // input is the DmaImport buffer key
+		FdKey key;
+	};
+
+	// Per frame resources, one for each frame in flight
+	struct FrameSlot{
+		GLuint texIn[MAX_PLANES];  // INPUT_IMAGE textures
+		GLuint vbo[MAX_PLANES];    // INPUT_SSBO buffers, written directly as staging
+		GLuint unpackid;           // INPUT_IMAGE staging buffer, planes back to back
+		GLuint pboid;              // readback buffer, written by the kernel itself with OUTPUT_SSBO
+		GLsync fence;
+		uint8_t *upload[MAX_PLANES]; // staging mappings, NULL when unmapped
+		uint8_t *map;    // pack buffer mapping, NULL when unmapped
+		bool leased;     // map handed out by acquire(), not released yet
+		uint8_t *dst;
+		void *tag;
+		StageTimer::Queries timing;
+		GLsync sliceFence[MAX_SLICES];
+		uint32_t slicesDone;  // slices handed to the callback so far
+		uint32_t rows;        // input rows converted on the GPU
+		uint64_t stagedNs;
+		uint64_t busyNs;
+		bool failed;     // output couldn't be mapped, dst was not written
+		bool imported;
+		FdKey key;
+	};
+
+	// Kernel inputs and output of one strip
+	struct StripSet{
+		GLuint in[MAX_PLANES];  // textures (INPUT_IMAGE) or SSBOs
+		GLuint tex;             // output image + fbo (OUTPUT_IMAGE)
+		GLuint fbo;
+		GLuint out;             // output SSBO (OUTPUT_SSBO)
+	};
+
+	static void init_entry(void *data);
+	static void clean_entry(void *data);
+	static void reslice_entry(void *data);
+	static void import_entry(void *data);
+	static void feed_entry(void *data);
+	static bool done_ready(void *data);
+	int initGL(void);
+	void initCPU(void);
+	void layoutRows(StreamGeometry *geo, uint32_t rows);
+	void cleanGL(void);
+	void initKernelIO(void);
+	void cleanKernelIO(void);
+	uint32_t sliceCount(void);
+	void sliceRows(uint32_t slice, uint32_t *begin, uint32_t *end);
+	void deliverSlice(FrameSlot *slot, uint32_t slice);
+	void cleanCPU(void);
+	void copyRows(FrameSlot *slot, uint32_t begin, uint32_t end);
+	void performCompute(FrameSlot *slot);
+	int planStrips(uint32_t cap);
+	void stripRows(uint32_t strip, uint32_t *first, uint32_t *count, uint32_t *top);
+	void initStrips(void);
+	void cleanStrips(void);
+	void uploadStrip(FrameSlot *slot, uint32_t strip);
+	void performStrips(FrameSlot *slot);
+	void mapInput(FrameSlot *slot);
+	void unmapInput(FrameSlot *slot);
+	int claimSlot(void);
+	int queueInput(uint8_t *dst, uint32_t rows, void *tag, const FdKey *key);
+	FrameSlot *nextJob(void);
+	void complete(uint32_t index);
+	FrameSlot *takeFrame(void);
+	void reclaimSlots(void);
+
+private:
+	GLEngine *mEngine;
+	int mKernel;
+	const KernelDesc *mDesc;
+	StreamGeometry mGeo;
+	uint32_t mWidth;
+	uint32_t mHeight;
+	uint32_t mStride;
+	uint32_t mPackStride;             // mStride rounded up to whole texels
+	uint32_t mSrcPitch[MAX_PLANES];   // row bytes of the planes given to submit()
+	uint32_t mPitch[MAX_PLANES];      // row bytes of the staging planes
+	uint32_t mRowBytes[MAX_PLANES];   // bytes of each row the kernel reads
+	uint32_t mSrcOffset[MAX_PLANES];  // plane offsets in a submitFd() buffer
+	uint64_t mSrcSize;                // least size of a submitFd() buffer
+	LocalSize mLocal;
+	CpuFunc mCpu;
+	void *mCpuCtx;
+	bool mReady;
+	StageTimer mTimer;
+
+	FrameSlot mSlots[MAX_PIPELINE_DEPTH];
+	uint32_t mDepth;
+	SpscRing<FrameJob, MAX_PIPELINE_DEPTH> mJobs;  // caller -> engine, submit order
+	SpscRing<FrameJob, MAX_PIPELINE_DEPTH> mDone;  // engine -> caller, same order
+	Parker mDoneWait;                              // caller sleeps on mDone
+	// caller side, the submit side runs on the engine thread with a feed
+	uint32_t mSubmitIndex;
+	std::atomic<uint32_t> mFree;         // slots neither queued nor held
+	std::atomic<uint32_t> mOutstanding;
+	uint32_t mReleaseIndex;  // oldest slot not yet given back
+	uint32_t mRetrieved;     // retrieved frames still holding their slot
+	std::atomic<bool> mInputHeld;        // slot claimed (getInputBuffer()), not queued yet
+	uint64_t mBusyNs;        // of the last retrieved frame
+	// engine thread side
+	uint32_t mStageIndex;
+	uint32_t mRetireIndex;
+	uint32_t mInFlight;
+	bool mPersistent;  // pack/staging buffers stay mapped
+	uint64_t mLastDoneNs;  // when the last retired frame's fence was seen
+	OutputMode mOutput;
+	// strips, mStrips == 0 when the frame runs as one dispatch
+	uint32_t mStrips;
+	uint32_t mStripRows;       // rows per strip, the last one may be shorter
+	uint32_t mStripCap;        // GLESCONVERT_STRIP_ROWS, or the height
+	StreamGeometry mStripGeo;  // tallest strip, halo included, sizes the strip sets
+	StripSet mStripSets[STRIP_SETS];
+	// slice mode, set by setSlices()
+	uint32_t mSlices;          // requested slices, 1 when off
+	uint32_t mSliceStrips;     // strips per slice
+	SliceFunc mSliceFunc;
+	void *mSliceCtx;
+	int mResliceResult;
+	// submitFd()
+	bool mImportable;          // dma-bufs can be imported at this layout
+	DmaImport mImports;
+	FdMapCache mMaps;          // caller side
+	int mImportFd;             // import_entry() arguments and result
+	FdKey mImportKey;
+	int mImportResult;
+	uint64_t mFdImported;
+	uint64_t mFdMapped;
+	// setFeed(), engine thread
+	FeedFunc mFeed;
+	void *mFeedCtx;
+	FeedFunc mNewFeed;         // feed_entry() arguments
+	void *mNewFeedCtx;
+
+	GLuint fboid;      // shared output target from the engine, 0 with OUTPUT_SSBO
+	GLuint texOut;
+	GLuint program;
+	GLuint importProgram;  // desc's importSource, 0 without dma-buf import
+};
+#endif
@@ -0,0 +1,515 @@
+#include "Kernels.h"
+#include <stdio.h>
+#include <pthread.h>
+
+// Plane j holds rows of width bytes, padded to whole words
+static void setPlane(StreamGeometry *geo, uint32_t plane, uint32_t width, uint32_t rows){
+    geo->pitch[plane] = (width + 3) & ~3;
+    geo->planeSize[plane] = (GLsizeiptr)geo->pitch[plane] * rows;
+}
+
+// uv texel of one 2x2 block: u0/v0 the top row, u1/v1 the bottom row, each
+// texel holding 4 pixels. Rounded down, like CPUConvert's rowScalar().
+#define NV12_AVERAGE_FLOAT \
+        "uvec4 average(uvec4 u0, uvec4 u1, uvec4 v0, uvec4 v1){\n" \
+        "    vec4 u = vec4(u0) + vec4(u1);\n" \
+        "    vec4 v = vec4(v0) + vec4(v1);\n" \
+        "    u.x += u.y;\n" \
+        "    u.z += u.w;\n" \
+        "    u.y = v.x + v.y;\n" \
+        "    u.w = v.z + v.w;\n" \
+        "    u = u * 0.25 ;\n" \
+        "    return uvec4(u);\n" \
+        "}\n"
+
+#define NV12_AVERAGE_FIXED \
+        "uvec4 average(uvec4 u0, uvec4 u1, uvec4 v0, uvec4 v1){\n" \
+        "    uvec4 u = u0 + u1;\n" \
+        "    uvec4 v = v0 + v1;\n" \
+        "    return uvec4(u.x + u.y, v.x + v.y, u.z + u.w, v.z + v.w) >> 2u;\n" \
+        "}\n"
+
+// Input planes of the single frame kernels: rgba8ui images, or for
+// importSource the RGBA8 textures of an imported buffer, read with LOAD()
+#define IMAGE_PLANE(binding, name) \
+        "layout(binding = " #binding ", rgba8ui) readonly uniform  uimage2D " #name "; \n"
+#define IMAGE_LOAD \
+        "#define LOAD(image, pos) imageLoad(image, pos)\n"
+#define IMPORT_PLANE(binding, name) \
+        "layout(binding = " #binding ") uniform highp sampler2D " #name ";\n"
+#define IMPORT_LOAD \
+        "#define LOAD(image, pos) uvec4(texelFetch(image, pos, 0) * 255.0 + 0.5)\n"
+
+#define NV12_SOURCE(planes, average) \
+        "precision highp uimage2D;\n" \
+        planes \
+        average \
+        "void main(void){\n" \
+        "    ivec2 pos = ivec2(gl_GlobalInvocationID.xy);\n" \
+        "    ivec2 index = pos;\n" \
+        "    index.y *= 2;\n" \
+        "    ivec2 next = index + ivec2(0, 1);\n" \
+        "    store(pos, average(LOAD(u_image, index), LOAD(u_image, next),\n" \
+        "                       LOAD(v_image, index), LOAD(v_image, next)));\n" \
+        "}\n"
+
+#define NV12_BATCH_SOURCE(average) \
+        "precision highp uimage2D;\n" \
+        "precision highp uimage2DArray;\n" \
+        "layout(binding = 0, rgba8ui) readonly uniform  uimage2DArray u_image; \n" \
+        "layout(binding = 1, rgba8ui) readonly uniform  uimage2DArray v_image; \n" \
+        average \
+        "void main(void){\n" \
+        "    ivec3 pos = ivec3(gl_GlobalInvocationID);\n" \
+        "    if(pos.y >= rows)\n" \
+        "        return;\n" \
+        "    ivec3 index = pos;\n" \
+        "    index.y *= 2;\n" \
+        "    ivec3 next = index + ivec3(0, 1, 0);\n" \
+        "    store(ivec2(pos.x, pos.z * rows + pos.y), average(imageLoad(u_image, index), imageLoad(u_image, next),\n" \
+        "                                                      imageLoad(v_image, index), imageLoad(v_image, next)));\n" \
+        "}\n"
+
+#define NV12_IMAGES IMAGE_PLANE(0, u_image) IMAGE_PLANE(1, v_image) IMAGE_LOAD
+#define NV12_IMPORTS IMPORT_PLANE(0, u_image) IMPORT_PLANE(1, v_image) IMPORT_LOAD
+
+static void layoutNV12(StreamGeometry *geo, uint32_t width, uint32_t height, uint32_t uv_stride){
+    geo->inWidth = (width + 3) / 4;   // process 4 pixels together
+    geo->inHeight = height;
+    setPlane(geo, 0, width, height);
+    setPlane(geo, 1, width, height);
+    setPlane(geo, 2, 0, 0);
+    geo->outWidth = uv_stride / 4;
+    geo->outHeight = height / 2; // uv height is half of y
+    geo->outSize = uv_stride * height / 2;
+    geo->outRows[0] = height / 2;
+    geo->outRows[1] = 0;
+    geo->threadsX = (width + 3) / 4;
+    geo->threadsY = height / 2;
+    geo->stride = 0;
+    geo->luma = 0;
+}
+
+const KernelDesc kernel444ToNV12 = {
+    "yuv444_nv12", NV12_SOURCE(NV12_IMAGES, NV12_AVERAGE_FLOAT), NV12_BATCH_SOURCE(NV12_AVERAGE_FLOAT),
+    NV12_SOURCE(NV12_IMPORTS, NV12_AVERAGE_FLOAT), INPUT_IMAGE, 2, 2, GL_RGBA8UI, GL_UNSIGNED_BYTE, layoutNV12, 2, 0
+};
+
+const KernelDesc kernel444ToNV12Fixed = {
+    "yuv444_nv12_fixed", NV12_SOURCE(NV12_IMAGES, NV12_AVERAGE_FIXED), NV12_BATCH_SOURCE(NV12_AVERAGE_FIXED),
+    NV12_SOURCE(NV12_IMPORTS, NV12_AVERAGE_FIXED), INPUT_IMAGE, 2, 2, GL_RGBA8UI, GL_UNSIGNED_BYTE, layoutNV12, 2, 0
+};
+
+// Same chroma math as NV12_SOURCE, each invocation also copies the two luma
+// rows above its uv row, so the output image is the whole frame at stride.
+#define NV12_FULL_SOURCE(planes, average) \
+        "precision highp uimage2D;\n" \
+        planes \
+        average \
+        "void main(void){\n" \
+        "    ivec2 pos = ivec2(gl_GlobalInvocationID.xy);\n" \
+        "    if(pos.y >= luma / 2)\n" \
+        "        return;\n" \
+        "    ivec2 index = pos;\n" \
+        "    index.y *= 2;\n" \
+        "    ivec2 next = index + ivec2(0, 1);\n" \
+        "    store(index, LOAD(y_image, index));\n" \
+        "    store(next, LOAD(y_image, next));\n" \
+        "    store(ivec2(pos.x, luma + pos.y), average(LOAD(u_image, index), LOAD(u_image, next),\n" \
+        "                                              LOAD(v_image, index), LOAD(v_image, next)));\n" \
+        "}\n"
+
+#define NV12_FULL_BATCH_SOURCE(average) \
+        "precision highp uimage2D;\n" \
+        "precision highp uimage2DArray;\n" \
+        "layout(binding = 0, rgba8ui) readonly uniform  uimage2DArray y_image; \n" \
+        "layout(binding = 1, rgba8ui) readonly uniform  uimage2DArray u_image; \n" \
+        "layout(binding = 2, rgba8ui) readonly uniform  uimage2DArray v_image; \n" \
+        average \
+        "void main(void){\n" \
+        "    ivec3 pos = ivec3(gl_GlobalInvocationID);\n" \
+        "    if(pos.y >= luma / 2)\n" \
+        "        return;\n" \
+        "    int base = pos.z * rows;\n" \
+        "    ivec3 index = pos;\n" \
+        "    index.y *= 2;\n" \
+        "    ivec3 next = index + ivec3(0, 1, 0);\n" \
+        "    store(ivec2(pos.x, base + index.y), imageLoad(y_image, index));\n" \
+        "    store(ivec2(pos.x, base + next.y), imageLoad(y_image, next));\n" \
+        "    store(ivec2(pos.x, base + luma + pos.y), average(imageLoad(u_image, index), imageLoad(u_image, next),\n" \
+        "                                                     imageLoad(v_image, index), imageLoad(v_image, next)));\n" \
+        "}\n"
+
+#define NV12_FULL_IMAGES IMAGE_PLANE(0, y_image) IMAGE_PLANE(1, u_image) IMAGE_PLANE(2, v_image) IMAGE_LOAD
+#define NV12_FULL_IMPORTS IMPORT_PLANE(0, y_image) IMPORT_PLANE(1, u_image) IMPORT_PLANE(2, v_image) IMPORT_LOAD
+
+static void layoutNV12Full(StreamGeometry *geo, uint32_t width, uint32_t height, uint32_t stride){
+    geo->inWidth = (width + 3) / 4;
+    geo->inHeight = height;
+    for(uint32_t j = 0; j < 3; j++)
+        setPlane(geo, j, width, height);
+    geo->outWidth = stride / 4;
+    geo->outHeight = height + height / 2;
+    geo->outSize = stride * (height + height / 2);
+    geo->outRows[0] = height;
+    geo->outRows[1] = height / 2;
+    geo->threadsX = (width + 3) / 4;
+    geo->threadsY = height / 2;
+    geo->stride = 0;
+    geo->luma = height;
+}
+
+const KernelDesc kernel444ToNV12Full = {
+    "yuv444_nv12_full", NV12_FULL_SOURCE(NV12_FULL_IMAGES, NV12_AVERAGE_FLOAT),
+    NV12_FULL_BATCH_SOURCE(NV12_AVERAGE_FLOAT), NV12_FULL_SOURCE(NV12_FULL_IMPORTS, NV12_AVERAGE_FLOAT),
+    INPUT_IMAGE, 3, 3, GL_RGBA8UI, GL_UNSIGNED_BYTE, layoutNV12Full, 2, 0
+};
+
+const KernelDesc kernel444ToNV12FullFixed = {
+    "yuv444_nv12_full_fixed", NV12_FULL_SOURCE(NV12_FULL_IMAGES, NV12_AVERAGE_FIXED),
+    NV12_FULL_BATCH_SOURCE(NV12_AVERAGE_FIXED), NV12_FULL_SOURCE(NV12_FULL_IMPORTS, NV12_AVERAGE_FIXED),
+    INPUT_IMAGE, 3, 3, GL_RGBA8UI, GL_UNSIGNED_BYTE, layoutNV12Full, 2, 0
+};
+
+// Templates: the math block of the variant (color constants and toRGBA())
+// goes in at the first %s, the input planes at the second and the chroma()
+// fetch for the input layout at the third. The planes block defines
+// yWord(i), uWord(i) and vWord(i) (NV12: uWord() reads the uv plane), word
+// i of each plane at its pitch. chroma() returns u and v of the 4 pixels
+// at pos as bytes, toRGBA() turns 4 pixels into 4 packed RGBA words.
+static const char *rgb_source =
+        "\n"
+        "uvec4 bytes4(uint w){\n"
+        "    return (uvec4(w) >> uvec4(0u, 8u, 16u, 24u)) & 0xffu;\n"
+        "}\n"
+        "%s"
+        "\n"
+        "%s"
+        "%s"
+        "\n"
+        "void main(void){\n"
+        "    ivec2 pos = ivec2(gl_GlobalInvocationID.xy);\n"
+        "    if(pos.x * 4 >= stride || pos.y >= rows)\n"
+        "        return;\n"
+        "    uvec4 u, v;\n"
+        "    chroma(ivec3(pos, 0), u, v);\n"
+        "    store(pos, toRGBA(yWord(pos.y * (pitch.x / 4) + pos.x), u, v));\n"
+        "}\n";
+
+static const char *rgb_batch_source =
+        "\n"
+        "uvec4 bytes4(uint w){\n"
+        "    return (uvec4(w) >> uvec4(0u, 8u, 16u, 24u)) & 0xffu;\n"
+        "}\n"
+        "%s"
+        "\n"
+        "%s"
+        "%s"
+        "\n"
+        "void main(void){\n"
+        "    ivec3 pos = ivec3(gl_GlobalInvocationID);\n"
+        "    if(pos.y >= rows || pos.x * 4 >= stride)\n"
+        "        return;\n"
+        "    int index = (pos.z * rows + pos.y) * (pitch.x / 4) + pos.x;\n"
+        "    uvec4 u, v;\n"
+        "    chroma(pos, u, v);\n"
+        "    store(ivec2(pos.x, pos.z * rows + pos.y), toRGBA(yWord(index), u, v));\n"
+        "}\n";
+
+// column j of coef holds the y, u, v, 1 weights of output channel j
+static const char *math_float =
+        "const mat4 coef = mat4(\n"
+        "    %.8f, 0.0, %.8f, 0.0,\n"
+        "    %.8f, %.8f, %.8f, 0.0,\n"
+        "    %.8f, %.8f, 0.0, 0.0,\n"
+        "    0.0, 0.0, 0.0, 1.0\n"
+        ");\n"
+        "const float yoff = %.8f;\n"
+        "uvec4 toRGBA(uint y, uvec4 u, uvec4 v){\n"
+        "    mat4 yuv;\n"
+        "    yuv[0] = unpackUnorm4x8(y) - yoff;        // y\n"
+        "    yuv[1] = vec4(u) / 255. - 128./255.;      // u\n"
+        "    yuv[2] = vec4(v) / 255. - 128./255.;      // v\n"
+        "    yuv[3] = vec4(1.0);\n"
+        "    mat4 tmp = yuv * coef;\n"
+        "    mat4 rgba = transpose(tmp);\n"
+        "    uvec4 outdata; \n"
+        "    outdata.x = packUnorm4x8(rgba[0]);\n"
+        "    outdata.y = packUnorm4x8(rgba[1]);\n"
+        "    outdata.z = packUnorm4x8(rgba[2]);\n"
+        "    outdata.w = packUnorm4x8(rgba[3]);\n"
+        "    return outdata;\n"
+        "}\n";
+
+// kFixedCoefs and fixedClamp() of ColorSpace.h, 4 pixels per ivec4
+static const char *math_fixed =
+        "const int cy = %d;\n"
+        "const int crv = %d;\n"
+        "const int cgu = %d;\n"
+        "const int cgv = %d;\n"
+        "const int cbu = %d;\n"
+        "const int yoff = %d;\n"
+        "uvec4 channel(ivec4 x){\n"
+        "    return uvec4(min(max(x + %d, 0) >> %d, 255));\n"
+        "}\n"
+        "uvec4 toRGBA(uint y, uvec4 u, uvec4 v){\n"
+        "    ivec4 yv = (ivec4(bytes4(y)) - yoff) * cy;\n"
+        "    ivec4 cu = ivec4(u) - 128;\n"
+        "    ivec4 cv = ivec4(v) - 128;\n"
+        "    uvec4 r = channel(yv + crv * cv);\n"
+        "    uvec4 g = channel(yv + cgu * cu + cgv * cv);\n"
+        "    uvec4 b = channel(yv + cbu * cu);\n"
+        "    return r | (g << 8) | (b << 16) | uvec4(0xff000000u);\n"
+        "}\n";
+
+// Planes as std430 buffers at bindings 0.., the staging input and batches
+static const char *planes_ssbo =
+        "struct YUVData{\n"
+        "  uint yuv;  \n"
+        "};\n"
+        "layout(std430, binding=0) readonly buffer yBuffer{\n"
+        "    YUVData data[];\n"
+        "}YData;\n"
+        "layout(std430, binding=1) readonly buffer uBuffer{\n"
+        "    YUVData data[];\n"
+        "}UData;\n"
+        "layout(std430, binding=2) readonly buffer vBuffer{\n"
+        "    YUVData data[];\n"
+        "}VData;\n"
+        "uint yWord(int i){\n"
+        "    return YData.data[i].yuv;\n"
+        "}\n"
+        "uint uWord(int i){\n"
+        "    return UData.data[i].yuv;\n"
+        "}\n"
+        "uint vWord(int i){\n"
+        "    return VData.data[i].yuv;\n"
+        "}\n";
+
+static const char *planes_ssbo_nv12 =
+        "struct YUVData{\n"
+        "  uint yuv;  \n"
+        "};\n"
+        "layout(std430, binding=0) readonly buffer yBuffer{\n"
+        "    YUVData data[];\n"
+        "}YData;\n"
+        "layout(std430, binding=1) readonly buffer uvBuffer{\n"
+        "    YUVData data[];\n"
+        "}UVData;\n"
+        "uint yWord(int i){\n"
+        "    return YData.data[i].yuv;\n"
+        "}\n"
+        "uint uWord(int i){\n"
+        "    return UVData.data[i].yuv;\n"
+        "}\n";
+
+// Planes of an imported buffer: RGBA8 textures at units 0.. whose texels
+// are 4 plane bytes, rows at the plane's pitch
+#define TEX_WORD \
+        "uint texWord(highp sampler2D tex, int pitch, int i){\n" \
+        "    uvec4 b = uvec4(texelFetch(tex, ivec2(i % (pitch / 4), i / (pitch / 4)), 0) * 255.0 + 0.5);\n" \
+        "    return b.x | (b.y << 8) | (b.z << 16) | (b.w << 24);\n" \
+        "}\n"
+
+static const char *planes_import =
+        "layout(binding = 0) uniform highp sampler2D y_tex;\n"
+        "layout(binding = 1) uniform highp sampler2D u_tex;\n"
+        "layout(binding = 2) uniform highp sampler2D v_tex;\n"
+        TEX_WORD
+        "uint yWord(int i){\n"
+        "    return texWord(y_tex, pitch.x, i);\n"
+        "}\n"
+        "uint uWord(int i){\n"
+        "    return texWord(u_tex, pitch.y, i);\n"
+        "}\n"
+        "uint vWord(int i){\n"
+        "    return texWord(v_tex, pitch.z, i);\n"
+        "}\n";
+
+static const char *planes_import_nv12 =
+        "layout(binding = 0) uniform highp sampler2D y_tex;\n"
+        "layout(binding = 1) uniform highp sampler2D uv_tex;\n"
+        TEX_WORD
+        "uint yWord(int i){\n"
+        "    return texWord(y_tex, pitch.x, i);\n"
+        "}\n"
+        "uint uWord(int i){\n"
+        "    return texWord(uv_tex, pitch.y, i);\n"
+        "}\n";
+
+// 4:4:4, one chroma word per luma word, each plane at its own pitch
+static const char *chroma_444 =
+        "void chroma(ivec3 pos, out uvec4 u, out uvec4 v){\n"
+        "    int row = pos.z * rows + pos.y;\n"
+        "    u = bytes4(uWord(row * (pitch.y / 4) + pos.x));\n"
+        "    v = bytes4(vWord(row * (pitch.z / 4) + pos.x));\n"
+        "}\n";
+
+// 4:2:0 planes are read a byte at a time, uRow / vRow return the samples of
+// chroma row r at columns c for layer z. stride is the width in pixels, a
+// chroma row has stride / 2 samples at pitch.y (u) / pitch.z (v) bytes.
+static const char *chroma_i420 =
+        "uint byteAt(uint word, int i){\n"
+        "    return (word >> uint((i & 3) * 8)) & 0xffu;\n"
+        "}\n"
+        "uvec4 uRow(int z, int r, ivec4 c){\n"
+        "    ivec4 i = ivec4((z * (rows / 2) + r) * pitch.y) + c;\n"
+        "    return uvec4(byteAt(uWord(i.x >> 2), i.x), byteAt(uWord(i.y >> 2), i.y),\n"
+        "                 byteAt(uWord(i.z >> 2), i.z), byteAt(uWord(i.w >> 2), i.w));\n"
+        "}\n"
+        "uvec4 vRow(int z, int r, ivec4 c){\n"
+        "    ivec4 i = ivec4((z * (rows / 2) + r) * pitch.z) + c;\n"
+        "    return uvec4(byteAt(vWord(i.x >> 2), i.x), byteAt(vWord(i.y >> 2), i.y),\n"
+        "                 byteAt(vWord(i.z >> 2), i.z), byteAt(vWord(i.w >> 2), i.w));\n"
+        "}\n";
+
+static const char *chroma_nv12 =
+        "uint byteAt(uint word, int i){\n"
+        "    return (word >> uint((i & 3) * 8)) & 0xffu;\n"
+        "}\n"
+        "uvec4 uvRow(int z, int r, ivec4 c, int plane){\n"
+        "    ivec4 i = ivec4((z * (rows / 2) + r) * pitch.y + plane) + c * 2;\n"
+        "    return uvec4(byteAt(uWord(i.x >> 2), i.x), byteAt(uWord(i.y >> 2), i.y),\n"
+        "                 byteAt(uWord(i.z >> 2), i.z), byteAt(uWord(i.w >> 2), i.w));\n"
+        "}\n"
+        "uvec4 uRow(int z, int r, ivec4 c){\n"
+        "    return uvRow(z, r, c, 0);\n"
+        "}\n"
+        "uvec4 vRow(int z, int r, ivec4 c){\n"
+        "    return uvRow(z, r, c, 1);\n"
+        "}\n";
+
+// Pixels 4x .. 4x+3 of row y sit on chroma columns 2x, 2x, 2x+1, 2x+1 of
+// chroma row y / 2
+static const char *filter_nearest =
+        "void chroma(ivec3 pos, out uvec4 u, out uvec4 v){\n"
+        "    ivec4 c = ivec4(pos.x * 2) + ivec4(0, 0, 1, 1);\n"
+        "    u = uRow(pos.z, pos.y / 2, c);\n"
+        "    v = vRow(pos.z, pos.y / 2, c);\n"
+        "}\n";
+
+// Centered siting: each pixel mixes its own chroma sample with the
+// horizontal, vertical and diagonal neighbour towards it, 9/3/3/1. Integer
+// math so CPUConvert can match it exactly.
+static const char *filter_bilinear =
+        "void chroma(ivec3 pos, out uvec4 u, out uvec4 v){\n"
+        "    int k = pos.x * 2;\n"
+        "    int r = pos.y / 2;\n"
+        "    int rn = clamp((pos.y & 1) == 0 ? r - 1 : r + 1, 0, rows / 2 - 1);\n"
+        "    ivec4 c = clamp(ivec4(k - 1, k, k + 1, k + 2), 0, stride / 2 - 1);\n"
+        "    uvec4 a = uRow(pos.z, r, c);\n"
+        "    uvec4 b = uRow(pos.z, rn, c);\n"
+        "    u = (9u * a.yyzz + 3u * (a.xzyw + b.yyzz) + b.xzyw + 8u) >> 4;\n"
+        "    a = vRow(pos.z, r, c);\n"
+        "    b = vRow(pos.z, rn, c);\n"
+        "    v = (9u * a.yyzz + 3u * (a.xzyw + b.yyzz) + b.xzyw + 8u) >> 4;\n"
+        "}\n";
+
+static void layoutRGB(StreamGeometry *geo, uint32_t width, uint32_t height, uint32_t rgbstride){
+    geo->inWidth = (width + 3) / 4;
+    geo->inHeight = height;
+    for(uint32_t j = 0; j < 3; j++)
+        setPlane(geo, j, width, height);
+    geo->outWidth = rgbstride / 4;  // one rgba32ui texel holds 4 pixels
+    geo->outHeight = height;
+    geo->outSize = rgbstride * height * 4;
+    geo->outRows[0] = height;
+    geo->outRows[1] = 0;
+    geo->threadsX = (width + 3) / 4;
+    geo->threadsY = height;
+    geo->stride = width;
+    geo->luma = 0;
+}
+
+static void layoutRGBI420(StreamGeometry *geo, uint32_t width, uint32_t height, uint32_t rgbstride){
+    layoutRGB(geo, width, height, rgbstride);
+    setPlane(geo, 1, width / 2, height / 2);
+    setPlane(geo, 2, width / 2, height / 2);
+}
+
+static void layoutRGBNV12(StreamGeometry *geo, uint32_t width, uint32_t height, uint32_t rgbstride){
+    layoutRGB(geo, width, height, rgbstride);
+    setPlane(geo, 1, width, height / 2);
+    setPlane(geo, 2, 0, 0);
+}
+
+struct RGBVariant{
+    KernelDesc desc;
+    char name[48];
+    char source[6144];
+    char batchSource[6144];
+    char importSource[6144];
+    bool ready;
+};
+
+static pthread_mutex_t sVariantLock = PTHREAD_MUTEX_INITIALIZER;
+// 4:4:4 has no filter, only [..][CHROMA_444][FILTER_NEAREST] is used
+static RGBVariant sRGBVariants[COLOR_MATRIX_COUNT][COLOR_RANGE_COUNT][CHROMA_LAYOUT_COUNT][CHROMA_FILTER_COUNT]
+                              [KERNEL_MATH_COUNT];
+
+const KernelDesc *kernelYUVToRGBAFor(ColorMatrix matrix, ColorRange range, ChromaLayout layout, ChromaFilter filter,
+                                     KernelMath math){
+    RGBVariant *v;
+    char consts[1536];
+    char fetch[3072];
+    const char *ssbo, *imported;
+
+    if(matrix < 0 || matrix >= COLOR_MATRIX_COUNT || range < 0 || range >= COLOR_RANGE_COUNT)
+        return NULL;
+    if(layout < 0 || layout >= CHROMA_LAYOUT_COUNT || filter < 0 || filter >= CHROMA_FILTER_COUNT)
+        return NULL;
+    if(math < 0 || math >= KERNEL_MATH_COUNT)
+        return NULL;
+    if(layout == CHROMA_444)
+        filter = FILTER_NEAREST;
+    v = &sRGBVariants[matrix][range][layout][filter][math];
+    pthread_mutex_lock(&sVariantLock);
+    if(!v->ready){
+        if(math == MATH_FIXED){
+            const FixedCoefs *c = &kFixedCoefs[matrix][range];
+            snprintf(consts, sizeof(consts), math_fixed, c->y, c->rv, c->gu, c->gv, c->bu, c->yOffset,
+                     1 << (FIXED_SHIFT - 1), FIXED_SHIFT);
+        }else{
+            const ColorCoefs *c = &kColorCoefs[matrix][range];
+            snprintf(consts, sizeof(consts), math_float,
+                     c->y, c->rv, c->y, c->gu, c->gv, c->y, c->bu, c->yOffset / 255.0);
+        }
+        if(layout == CHROMA_444){
+            snprintf(fetch, sizeof(fetch), "%s", chroma_444);
+            snprintf(v->name, sizeof(v->name), "yuv444_rgba_%s%s", colorSpaceName(matrix, range),
+                     math == MATH_FIXED ? "_fixed" : "");
+        }else{
+            snprintf(fetch, sizeof(fetch), "%s%s", layout == CHROMA_NV12 ? chroma_nv12 : chroma_i420,
+                     filter == FILTER_BILINEAR ? filter_bilinear : filter_nearest);
+            snprintf(v->name, sizeof(v->name), "%s_rgba_%s_%s%s", chromaLayoutName(layout),
+                     colorSpaceName(matrix, range), chromaFilterName(filter), math == MATH_FIXED ? "_fixed" : "");
+        }
+        ssbo = layout == CHROMA_NV12 ? planes_ssbo_nv12 : planes_ssbo;
+        imported = layout == CHROMA_NV12 ? planes_import_nv12 : planes_import;
+        snprintf(v->source, sizeof(v->source), rgb_source, consts, ssbo, fetch);
+        snprintf(v->batchSource, sizeof(v->batchSource), rgb_batch_source, consts, ssbo, fetch);
+        snprintf(v->importSource, sizeof(v->importSource), rgb_source, consts, imported, fetch);
+        v->desc.name = v->name;
+        v->desc.source = v->source;
+        v->desc.batchSource = v->batchSource;
+        v->desc.importSource = v->importSource;
+        v->desc.input = INPUT_SSBO;
+        v->desc.planes = chromaPlanes(layout);
+        v->desc.outBinding = 1;
+        v->desc.outFormat = GL_RGBA32UI;
+        v->desc.outType = GL_UNSIGNED_INT;
+        if(layout == CHROMA_I420)
+            v->desc.layout = layoutRGBI420;
+        else if(layout == CHROMA_NV12)
+            v->desc.layout = layoutRGBNV12;
+        else
+            v->desc.layout = layoutRGB;
+        // 4:2:0 strips start on a chroma row, the bilinear filter also
+        // reads the chroma row on the far side of the strip edge
+        v->desc.rowAlign = layout == CHROMA_444 ? 1 : 2;
+        v->desc.halo = filter == FILTER_BILINEAR ? 2 : 0;
+        v->ready = true;
+    }
+    pthread_mutex_unlock(&sVariantLock);
+    return &v->desc;
+}
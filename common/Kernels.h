@@ -0,0 +1,144 @@
+#ifndef _KERNELS_H_
+#define _KERNELS_H_
+#include <stdint.h>
+#include <GLES3/gl31.h>
+#include "ColorSpace.h"
+
+#define MAX_PLANES 3
+// Row sections stacked in one output image (NV12: y rows, then uv rows)
+#define MAX_OUT_PLANES 2
+
+// How a kernel reads its input planes
+enum InputMode{
+	INPUT_IMAGE,  // rgba8ui image per plane, uploaded through an unpack buffer
+	INPUT_SSBO,   // std430 buffer per plane, written directly by the caller
+};
+
+// Where a kernel's output goes
+enum OutputMode{
+	OUTPUT_IMAGE,  // image unit outBinding, read back through an fbo with glReadPixels
+	OUTPUT_SSBO,   // std430 buffer at OUTPUT_SSBO_BINDING, mapped directly
+};
+
+// Above the input planes, SSBO and image bindings are separate namespaces
+#define OUTPUT_SSBO_BINDING 3
+
+// Size dependent part of a stream, filled in by the kernel's layout()
+struct StreamGeometry{
+	uint32_t inWidth;      // input image size in texels (INPUT_IMAGE)
+	uint32_t inHeight;
+	GLsizeiptr planeSize[MAX_PLANES];  // bytes of each input plane, 4:2:0 chroma planes are smaller
+	uint32_t pitch[MAX_PLANES];        // bytes per row of each input plane, a multiple of 4, the "pitch" uniform
+	uint32_t outWidth;     // output image size in texels, read back whole
+	uint32_t outHeight;
+	GLsizeiptr outSize;    // bytes per output frame
+	uint32_t outRows[MAX_OUT_PLANES];  // output image rows of each section, top to bottom
+	GLuint threadsX;       // invocations needed to cover the frame
+	GLuint threadsY;
+	GLuint groupsX;        // workgroups for the kernel's local size, set by the stream
+	GLuint groupsY;
+	GLint stride;          // "stride" parameter (RGB: width in pixels), if the kernel reads it
+	GLint luma;            // "luma" parameter (luma rows), if the kernel reads it
+};
+
+// Uniform block binding of the kernel parameters
+#define KERNEL_PARAMS_BINDING 0
+
+// The parameter block in front of every kernel, std140. Kernels read
+// stride, rows, luma, outStride and pitch by name, whichever they need.
+// Programs are shared between engines, so the values live in a buffer of
+// each engine instead of in program uniforms.
+struct KernelParams{
+	GLint stride;
+	GLint rows;        // output rows (outHeight)
+	GLint luma;
+	GLint outStride;   // output texels per row (outWidth)
+	GLint pitch[3];
+	GLint pad;
+};
+
+static inline void kernelParams(KernelParams *params, const StreamGeometry *geo){
+    params->stride = geo->stride;
+    params->rows = geo->outHeight;
+    params->luma = geo->luma;
+    params->outStride = geo->outWidth;
+    for(uint32_t j = 0; j < 3; j++)
+        params->pitch[j] = geo->pitch[j];
+    params->pad = 0;
+}
+
+// Byte offset of plane j when the planes are staged back to back
+static inline GLsizeiptr planeOffset(const StreamGeometry *geo, uint32_t plane){
+    GLsizeiptr offset = 0;
+    for(uint32_t j = 0; j < plane; j++)
+        offset += geo->planeSize[j];
+    return offset;
+}
+
+// A conversion the engine knows how to run. Inputs are bound to image units
+// or SSBO bindings 0..planes-1, the output image to unit outBinding.
+//
+// Sources leave out the #version and local_size lines and the parameter
+// block, the engine puts them in front with the workgroup size it picked
+// for the stream, so invocations
+// past threadsX / threadsY must be harmless. Output texels are written with
+// store(ivec2 pos, uvec4 texel), which the engine declares for the stream's
+// OutputMode: an imageStore to outBinding, or packed words at
+// pos.y * outStride + pos.x texels of the output SSBO, laid out exactly
+// like the glReadPixels result.
+//
+// batchSource, if set, converts several same size frames in one dispatch:
+// gl_GlobalInvocationID.z is the layer, inputs are uimage2DArray layers
+// (INPUT_IMAGE) or planeSize[j] spaced slices of one SSBO per plane
+// (INPUT_SSBO), and layer z is written to rows [z * rows, (z + 1) * rows) of the output image.
+//
+// importSource, if set, is source for frames imported from a dma-buf (see
+// DmaImport): plane j is an RGBA8 texture at texture unit j, each texel 4
+// plane bytes read with texelFetch() * 255.0, rows at the staging pitch.
+// Without it a stream maps imported buffers and copies them in like
+// submit() does.
+//
+// Layouts fill in tightly packed planes, rows padded to whole words and the
+// last group of 4 pixels covered when the width is not a multiple of 4. The
+// stream then widens pitch / planeSize to the staging pitch it uses. The
+// output stride passed to layout() is a multiple of 4 and at least the
+// width, kernels may write garbage into the pixels past the width.
+//
+// Frames too big for the GL limits run as horizontal strips, each one a
+// normal dispatch of the kernel at a smaller height. Strip heights are a
+// multiple of rowAlign input rows, and a strip sees halo extra rows above
+// and below it (when the frame has them) for kernels that read across rows.
+struct KernelDesc{
+	const char *name;
+	const char *source;
+	const char *batchSource;
+	const char *importSource;
+	InputMode input;
+	uint32_t planes;
+	GLuint outBinding;
+	GLenum outFormat;  // internal format of the output image
+	GLenum outType;    // type used to read it back as GL_RGBA_INTEGER
+	void (*layout)(StreamGeometry *geo, uint32_t width, uint32_t height, uint32_t stride);
+	uint32_t rowAlign;
+	uint32_t halo;
+};
+
+// 4:4:4 u, v -> interleaved NV12 uv plane, stride is the uv stride in bytes
+extern const KernelDesc kernel444ToNV12;
+// 4:4:4 y, u, v -> full NV12 frame, y plane then uv plane, both at stride
+extern const KernelDesc kernel444ToNV12Full;
+// Integer only versions of the two above, same output
+extern const KernelDesc kernel444ToNV12Fixed;
+extern const KernelDesc kernel444ToNV12FullFixed;
+// y, u, v -> RGBA, stride is in pixels. The matrix and range are folded
+// into the shader as constants, each variant is generated on first use and
+// then compiled and cached like any other kernel. NULL if unknown.
+// With 4:2:0 input (I420: y, u, v planes, NV12: y, uv planes) the kernel
+// upsamples the chroma itself, the width has to be even.
+// MATH_FIXED variants use kFixedCoefs and integer ops only, their output
+// is bit-exact with the scalar CPUConvert reference.
+const KernelDesc *kernelYUVToRGBAFor(ColorMatrix matrix, ColorRange range,
+                                     ChromaLayout layout = CHROMA_444, ChromaFilter filter = FILTER_NEAREST,
+                                     KernelMath math = MATH_FLOAT);
+
+#endif
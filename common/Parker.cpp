@@ -0,0 +1,59 @@
+#include "Parker.h"
+#include <errno.h>
+
+static inline void cpuRelax(void){
+#if defined(__aarch64__) || defined(__arm__)
+    __asm__ __volatile__("yield");
+#elif defined(__i386__) || defined(__x86_64__)
+    __builtin_ia32_pause();
+#endif
+}
+
+Parker::Parker():
+    mSleeping(false), mSpin(PARK_MIN_SPIN), mParks(0){
+    sem_init(&mSem, 0, 0);
+}
+
+Parker::~Parker(){
+    sem_destroy(&mSem);
+}
+
+void Parker::wake(void){
+    // pairs with the fence in wait(): either the waiter sees the work or
+    // we see it asleep
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(mSleeping.exchange(false))
+        sem_post(&mSem);
+}
+
+void Parker::wait(ReadyFunc ready, void *ctx){
+    for(uint32_t i = 0; i < mSpin; i++){
+        if(ready(ctx)){
+            if(i > 0 && mSpin < PARK_MAX_SPIN)
+                mSpin *= 2;
+            return;
+        }
+        cpuRelax();
+    }
+    if(mSpin > PARK_MIN_SPIN)
+        mSpin /= 2;
+
+    for(;;){
+        mSleeping.store(true);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(ready(ctx)){
+            // a waker may still post for this, the next wait() eats it
+            mSleeping.store(false);
+            return;
+        }
+        mParks++;
+        while(sem_wait(&mSem) != 0 && errno == EINTR)
+            ;
+        if(ready(ctx))
+            return;
+    }
+}
+
+uint64_t Parker::parks(void){
+    return mParks;
+}
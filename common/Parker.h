@@ -0,0 +1,36 @@
+#ifndef _PARKER_H_
+#define _PARKER_H_
+#include <stdint.h>
+#include <semaphore.h>
+#include <atomic>
+
+// Spin budget of Parker::wait(), in polls of the ready check
+#define PARK_MIN_SPIN 16
+#define PARK_MAX_SPIN 8192
+
+// Spin-then-park wakeup for one waiting thread and any number of wakers.
+// wait() polls ready() for a while before it sleeps on a semaphore. The
+// budget doubles when the poll pays off and halves when it ends in a sleep
+// anyway, so a busy pipeline never makes a syscall and an idle one stops
+// burning the core quickly. wake() only posts when the waiter is asleep.
+// Wakeups can be spurious, wait() rechecks ready() until it holds.
+class Parker{
+public:
+    typedef bool (*ReadyFunc)(void *ctx);
+
+    Parker();
+    ~Parker();
+    // waker: call after publishing the work ready() looks for
+    void wake(void);
+    // waiter thread only
+    void wait(ReadyFunc ready, void *ctx);
+    // times wait() had to sleep
+    uint64_t parks(void);
+
+private:
+	std::atomic<bool> mSleeping;
+	sem_t mSem;
+	uint32_t mSpin;    // current budget, waiter side
+	uint64_t mParks;
+};
+#endif
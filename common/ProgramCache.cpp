@@ -0,0 +1,219 @@
+#include "ProgramCache.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#ifdef HAVE_ANDROID_OS
+#define DEFAULT_CACHE_DIR "/data/local/tmp/glesconvert_cache"
+#else
+#define DEFAULT_CACHE_DIR "/tmp/glesconvert_cache"
+#endif
+
+#define CACHE_MAGIC 0x48435047  // "GPCH"
+#define CACHE_VERSION 1
+
+// Build options that change what ends up in the binary
+static const char *build_defines = "v1"
+#ifdef HAVE_ANDROID_OS
+        " HAVE_ANDROID_OS"
+#endif
+        ;
+
+struct CacheHeader{
+	uint32_t magic;
+	uint32_t version;
+	uint64_t key;
+	uint32_t format;   // binaryFormat from glGetProgramBinary
+	uint32_t length;
+	uint32_t checksum; // of the blob, catches truncated files
+	uint32_t reserved;
+};
+
+// FNV-1a
+static uint64_t hash64(uint64_t h, const void *data, size_t len){
+    const uint8_t *p = (const uint8_t *)data;
+    for(size_t i = 0; i < len; i++){
+        h ^= p[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static uint64_t hashString(uint64_t h, const char *s){
+    if(s == NULL)
+        s = "";
+    // keep the terminator so "ab"+"c" != "a"+"bc"
+    return hash64(h, s, strlen(s) + 1);
+}
+
+ProgramCache::ProgramCache():
+    mEnabled(false), mDeviceHash(0), mHits(0), mMisses(0){
+    mDir[0] = 0;
+}
+
+void ProgramCache::init(void){
+    GLint formats = 0;
+    const char *dir = getenv("GLESCONVERT_CACHE_DIR");
+
+    if(dir == NULL)
+        dir = DEFAULT_CACHE_DIR;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    if(dir[0] == 0 || formats <= 0){
+        printf("program cache disabled, binary formats:%d\n", formats);
+        return;
+    }
+    if(mkdir(dir, 0775) != 0 && errno != EEXIST){
+        printf("program cache: can't create %s, errno:%d\n", dir, errno);
+        return;
+    }
+    snprintf(mDir, sizeof(mDir), "%s", dir);
+
+    mDeviceHash = 0xcbf29ce484222325ULL;
+    mDeviceHash = hashString(mDeviceHash, (const char *)glGetString(GL_VENDOR));
+    mDeviceHash = hashString(mDeviceHash, (const char *)glGetString(GL_RENDERER));
+    mDeviceHash = hashString(mDeviceHash, (const char *)glGetString(GL_VERSION));
+    mDeviceHash = hashString(mDeviceHash, build_defines);
+    mEnabled = true;
+    printf("program cache:%s\n", mDir);
+}
+
+bool ProgramCache::enabled(void){
+    return mEnabled;
+}
+
+const char *ProgramCache::dir(void){
+    return mEnabled ? mDir : NULL;
+}
+
+uint64_t ProgramCache::key(const char *source){
+    return hashString(mDeviceHash, source);
+}
+
+// -1 if the name doesn't fit buf, that entry is then never cached
+int ProgramCache::path(char *buf, size_t size, uint64_t key){
+    int n = snprintf(buf, size, "%s/%016llx.bin", mDir, (unsigned long long)key);
+    return n < 0 || (size_t)n >= size ? -1 : 0;
+}
+
+GLuint ProgramCache::load(const char *source){
+    char file[PATH_MAX];
+    CacheHeader hdr;
+    uint8_t *blob = NULL;
+    GLuint program = 0;
+    GLint linked = 0;
+    uint64_t k;
+    int fd;
+
+    if(!mEnabled)
+        return 0;
+    k = key(source);
+    if(path(file, sizeof(file), k) != 0)
+        goto miss;
+
+    fd = open(file, O_RDONLY);
+    if(fd < 0)
+        goto miss;
+    if(read(fd, &hdr, sizeof(hdr)) != sizeof(hdr) || hdr.magic != CACHE_MAGIC ||
+       hdr.version != CACHE_VERSION || hdr.key != k || hdr.length == 0)
+        goto bad;
+    blob = (uint8_t *)malloc(hdr.length);
+    if(read(fd, blob, hdr.length) != (ssize_t)hdr.length ||
+       (uint32_t)hash64(0xcbf29ce484222325ULL, blob, hdr.length) != hdr.checksum)
+        goto bad;
+    close(fd);
+    fd = -1;
+
+    program = glCreateProgram();
+    glProgramBinary(program, hdr.format, blob, hdr.length);
+    free(blob);
+    blob = NULL;
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+    if(!linked){
+        // driver changed underneath us or the blob is stale, rebuild it
+        printf("program cache: binary rejected, error:%x\n", glGetError());
+        glDeleteProgram(program);
+        unlink(file);
+        goto miss;
+    }
+    mHits++;
+    return program;
+
+bad:
+    printf("program cache: dropping corrupt %s\n", file);
+    unlink(file);
+    close(fd);
+    free(blob);
+miss:
+    mMisses++;
+    return 0;
+}
+
+void ProgramCache::store(GLuint program, const char *source){
+    char file[PATH_MAX];
+    char tmp[PATH_MAX];
+    CacheHeader hdr;
+    GLint length = 0;
+    GLenum format = 0;
+    uint8_t *blob;
+    uint64_t k;
+    bool ok;
+    int fd, n;
+
+    if(!mEnabled)
+        return;
+    // private temp file + rename, readers only ever see a complete entry
+    k = key(source);
+    n = -1;
+    if(path(file, sizeof(file), k) == 0)
+        n = snprintf(tmp, sizeof(tmp), "%s.%d.%lx.tmp", file, (int)getpid(), (unsigned long)pthread_self());
+    if(n < 0 || (size_t)n >= sizeof(tmp)){
+        printf("program cache: path too long under %s\n", mDir);
+        return;
+    }
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if(length <= 0)
+        return;
+    blob = (uint8_t *)malloc(length);
+    glGetProgramBinary(program, length, &length, &format, blob);
+    if(length <= 0){
+        free(blob);
+        return;
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = CACHE_MAGIC;
+    hdr.version = CACHE_VERSION;
+    hdr.key = k;
+    hdr.format = format;
+    hdr.length = length;
+    hdr.checksum = (uint32_t)hash64(0xcbf29ce484222325ULL, blob, length);
+
+    fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL, 0664);
+    if(fd < 0){
+        printf("program cache: can't write %s, errno:%d\n", tmp, errno);
+        free(blob);
+        return;
+    }
+    ok = write(fd, &hdr, sizeof(hdr)) == sizeof(hdr) && write(fd, blob, length) == length;
+    ok = fsync(fd) == 0 && ok;
+    close(fd);
+    free(blob);
+    if(!ok || rename(tmp, file) != 0){
+        printf("program cache: failed to store %s, errno:%d\n", file, errno);
+        unlink(tmp);
+    }
+}
+
+uint32_t ProgramCache::hits(void){
+    return mHits;
+}
+
+uint32_t ProgramCache::misses(void){
+    return mMisses;
+}
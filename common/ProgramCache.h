@@ -0,0 +1,43 @@
+#ifndef _PROGRAMCACHE_H_
+#define _PROGRAMCACHE_H_
+#include <stdint.h>
+#include <stddef.h>
+#include <limits.h>
+#include <GLES3/gl31.h>
+
+// On-disk cache of linked program binaries (glGetProgramBinary). Entries are
+// keyed by a hash of the shader source, GL vendor/renderer/version and the
+// build defines, so a driver update or a shader change just misses. Files
+// are written to a temp name and renamed into place, several processes can
+// share one directory.
+//
+// GLESCONVERT_CACHE_DIR overrides the directory, an empty value disables it.
+class ProgramCache{
+public:
+    ProgramCache();
+    // GL thread, once the context is current
+    void init(void);
+    // Linked program for source, 0 on a miss or if the driver rejects the blob
+    GLuint load(const char *source);
+    // Save a program linked with GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+    void store(GLuint program, const char *source);
+    bool enabled(void);
+    // cache directory, NULL when disabled
+    const char *dir(void);
+
+    uint32_t hits(void);
+    uint32_t misses(void);
+
+private:
+	uint64_t key(const char *source);
+	int path(char *buf, size_t size, uint64_t key);
+
+private:
+	bool mEnabled;
+	char mDir[PATH_MAX];
+	uint64_t mDeviceHash;  // vendor, renderer, version, defines
+	// only written on the GL thread
+	volatile uint32_t mHits;
+	volatile uint32_t mMisses;
+};
+#endif
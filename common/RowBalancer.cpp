@@ -0,0 +1,68 @@
+#include "RowBalancer.h"
+#include <string.h>
+
+RowBalancer::RowBalancer(uint32_t height, uint32_t align):
+    mHeight(height), mAlign(align > 0 ? align : 1){
+    memset(mSamples, 0, sizeof(mSamples));
+    memset(mCount, 0, sizeof(mCount));
+    memset(mNext, 0, sizeof(mNext));
+    mSplit = mHeight / 2 / mAlign * mAlign;
+    if(mSplit < mAlign)
+        mSplit = mAlign < mHeight ? mAlign : mHeight;
+}
+
+void RowBalancer::resize(uint32_t height){
+    uint32_t split = mHeight > 0 ? (uint64_t)mSplit * height / mHeight : height / 2;
+
+    memset(mSamples, 0, sizeof(mSamples));
+    memset(mCount, 0, sizeof(mCount));
+    memset(mNext, 0, sizeof(mNext));
+    mHeight = height;
+    mSplit = split / mAlign * mAlign;
+    if(mHeight >= 2 * mAlign && mSplit > mHeight - mAlign)
+        mSplit = (mHeight - mAlign) / mAlign * mAlign;
+    if(mSplit < mAlign)
+        mSplit = mAlign < mHeight ? mAlign : mHeight;
+}
+
+uint32_t RowBalancer::split(void){
+    return mSplit;
+}
+
+double RowBalancer::nsPerRow(uint32_t side){
+    uint64_t rows = 0, ns = 0;
+
+    for(uint32_t i = 0; i < mCount[side]; i++){
+        rows += mSamples[side][i].rows;
+        ns += mSamples[side][i].ns;
+    }
+    return rows > 0 ? (double)ns / rows : 0.0;
+}
+
+void RowBalancer::add(uint32_t rows0, uint64_t ns0, uint32_t rows1, uint64_t ns1){
+    uint32_t rows[2] = {rows0, rows1};
+    uint64_t ns[2] = {ns0, ns1};
+    double t0, t1, target;
+
+    for(uint32_t s = 0; s < 2; s++){
+        if(rows[s] == 0 || ns[s] == 0)
+            continue;
+        mSamples[s][mNext[s]].rows = rows[s];
+        mSamples[s][mNext[s]].ns = ns[s];
+        mNext[s] = (mNext[s] + 1) % BALANCE_WINDOW;
+        if(mCount[s] < BALANCE_WINDOW)
+            mCount[s]++;
+    }
+    t0 = nsPerRow(0);
+    t1 = nsPerRow(1);
+    if(t0 <= 0.0 || t1 <= 0.0 || mHeight < 2 * mAlign)
+        return;
+
+    // rows0 * t0 == (height - rows0) * t1
+    target = mHeight * t1 / (t0 + t1);
+    mSplit = (uint32_t)(target + mAlign / 2.0) / mAlign * mAlign;
+    if(mSplit < mAlign)
+        mSplit = mAlign;
+    if(mSplit > mHeight - mAlign)
+        mSplit = (mHeight - mAlign) / mAlign * mAlign;
+}
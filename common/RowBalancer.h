@@ -0,0 +1,40 @@
+#ifndef _ROWBALANCER_H_
+#define _ROWBALANCER_H_
+#include <stdint.h>
+
+// Frames the per row throughput is averaged over
+#define BALANCE_WINDOW 16
+
+// Splits the rows of a frame between two sides that convert them in
+// parallel (the GPU kernel and the CPU threads), so both finish at about
+// the same time. Each side's rows per ns come from its last BALANCE_WINDOW
+// frames. Both sides keep at least align rows so neither stops being
+// measured. Caller side only, not thread safe.
+class RowBalancer{
+public:
+    // split() starts out at half the frame
+    RowBalancer(uint32_t height, uint32_t align);
+    // rows of side 0 for the next frame, the rest go to side 1
+    uint32_t split(void);
+    // what a frame took, ns == 0 skips that side
+    void add(uint32_t rows0, uint64_t ns0, uint32_t rows1, uint64_t ns1);
+    // mean ns per row of a side over the window, 0 before the first frame
+    double nsPerRow(uint32_t side);
+    // New frame height: the split keeps its share of the frame, the window
+    // starts over since row times change with the width
+    void resize(uint32_t height);
+
+private:
+	struct Sample{
+		uint32_t rows;
+		uint64_t ns;
+	};
+
+	uint32_t mHeight;
+	uint32_t mAlign;
+	uint32_t mSplit;
+	Sample mSamples[2][BALANCE_WINDOW];
+	uint32_t mCount[2];
+	uint32_t mNext[2];
+};
+#endif
@@ -0,0 +1,67 @@
+#ifndef _SPSCRING_H_
+#define _SPSCRING_H_
+#include <stdint.h>
+#include <atomic>
+
+// Bounded lock-free ring between exactly one producer thread and one
+// consumer thread. N must be a power of two. push() fails when the ring is
+// full, pop() / peek() when it is empty; neither ever blocks, pair the ring
+// with a Parker to sleep on it.
+template<typename T, uint32_t N>
+class SpscRing{
+public:
+    SpscRing(): mHead(0), mTail(0){
+    }
+
+    // producer
+    bool push(const T &item){
+        uint32_t tail = mTail.load(std::memory_order_relaxed);
+
+        if(tail - mHead.load(std::memory_order_acquire) == N)
+            return false;
+        mItems[tail & (N - 1)] = item;
+        mTail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // consumer
+    bool pop(T *item){
+        uint32_t head = mHead.load(std::memory_order_relaxed);
+
+        if(mTail.load(std::memory_order_acquire) == head)
+            return false;
+        *item = mItems[head & (N - 1)];
+        mHead.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // consumer, the i-th oldest item without taking it
+    bool peek(T *item, uint32_t i = 0){
+        uint32_t head = mHead.load(std::memory_order_relaxed);
+
+        if(mTail.load(std::memory_order_acquire) - head <= i)
+            return false;
+        *item = mItems[(head + i) & (N - 1)];
+        return true;
+    }
+
+    // consumer, items queued right now
+    uint32_t size(void){
+        return mTail.load(std::memory_order_acquire) - mHead.load(std::memory_order_relaxed);
+    }
+
+    // consumer
+    bool empty(void){
+        return mTail.load(std::memory_order_acquire) == mHead.load(std::memory_order_relaxed);
+    }
+
+private:
+	// head and tail a cache line apart, each is written by one side only.
+	// Padding rather than alignas, heap objects are only 16 byte aligned
+	// before C++17.
+	std::atomic<uint32_t> mHead;
+	uint8_t mPad[64];
+	std::atomic<uint32_t> mTail;
+	T mItems[N];
+};
+#endif
@@ -0,0 +1,185 @@
+#include "StageTimer.h"
+#include <EGL/egl.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+
+#ifndef GL_TIME_ELAPSED_EXT
+#define GL_TIME_ELAPSED_EXT 0x88BF
+#define GL_GPU_DISJOINT_EXT 0x8FBB
+#endif
+#ifndef GL_QUERY_RESULT_EXT
+#define GL_QUERY_RESULT_EXT 0x8866
+#define GL_QUERY_RESULT_AVAILABLE_EXT 0x8867
+#endif
+
+typedef void (GL_APIENTRYP GenQueriesEXTProc)(GLsizei n, GLuint *ids);
+typedef void (GL_APIENTRYP DeleteQueriesEXTProc)(GLsizei n, const GLuint *ids);
+typedef void (GL_APIENTRYP BeginQueryEXTProc)(GLenum target, GLuint id);
+typedef void (GL_APIENTRYP EndQueryEXTProc)(GLenum target);
+typedef void (GL_APIENTRYP GetQueryObjectuivEXTProc)(GLuint id, GLenum pname, GLuint *params);
+typedef void (GL_APIENTRYP GetQueryObjectui64vEXTProc)(GLuint id, GLenum pname, GLuint64 *params);
+
+static GenQueriesEXTProc glGenQueriesEXTPtr = NULL;
+static DeleteQueriesEXTProc glDeleteQueriesEXTPtr = NULL;
+static BeginQueryEXTProc glBeginQueryEXTPtr = NULL;
+static EndQueryEXTProc glEndQueryEXTPtr = NULL;
+static GetQueryObjectuivEXTProc glGetQueryObjectuivEXTPtr = NULL;
+static GetQueryObjectui64vEXTProc glGetQueryObjectui64vEXTPtr = NULL;
+static bool sGpuTimer = false;
+
+//static
+bool StageTimer::initGL(void){
+    const char *ext = (const char *)glGetString(GL_EXTENSIONS);
+
+    if(ext == NULL || strstr(ext, "GL_EXT_disjoint_timer_query") == NULL)
+        return false;
+    glGenQueriesEXTPtr = (GenQueriesEXTProc)eglGetProcAddress("glGenQueriesEXT");
+    glDeleteQueriesEXTPtr = (DeleteQueriesEXTProc)eglGetProcAddress("glDeleteQueriesEXT");
+    glBeginQueryEXTPtr = (BeginQueryEXTProc)eglGetProcAddress("glBeginQueryEXT");
+    glEndQueryEXTPtr = (EndQueryEXTProc)eglGetProcAddress("glEndQueryEXT");
+    glGetQueryObjectuivEXTPtr = (GetQueryObjectuivEXTProc)eglGetProcAddress("glGetQueryObjectuivEXT");
+    glGetQueryObjectui64vEXTPtr = (GetQueryObjectui64vEXTProc)eglGetProcAddress("glGetQueryObjectui64vEXT");
+    sGpuTimer = glGenQueriesEXTPtr && glDeleteQueriesEXTPtr && glBeginQueryEXTPtr && glEndQueryEXTPtr &&
+                glGetQueryObjectuivEXTPtr && glGetQueryObjectui64vEXTPtr;
+    return sGpuTimer;
+}
+
+//static
+bool StageTimer::gpuTimer(void){
+    return sGpuTimer;
+}
+
+//static
+uint64_t StageTimer::now(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+StageTimer::StageTimer():
+    mEvery(0), mFrame(0){
+    pthread_mutex_init(&mLock, NULL);
+    memset(mCount, 0, sizeof(mCount));
+    memset(mPos, 0, sizeof(mPos));
+    memset(mGpu, 0, sizeof(mGpu));
+}
+
+StageTimer::~StageTimer(){
+    pthread_mutex_destroy(&mLock);
+}
+
+void StageTimer::setInterval(uint32_t every){
+    mEvery = every;
+}
+
+uint32_t StageTimer::interval(void){
+    return mEvery;
+}
+
+bool StageTimer::sampleFrame(void){
+    uint32_t every = mEvery;
+    uint32_t frame;
+
+    if(every == 0)
+        return false;
+    // the first frame pays for lazy shader JIT and allocation, and some
+    // drivers report a bogus elapsed time for it, keep it out of the stats
+    frame = mFrame++;
+    return frame > 0 && frame % every == 0;
+}
+
+void StageTimer::add(ConvertStage stage, uint64_t ns, bool gpu){
+    pthread_mutex_lock(&mLock);
+    mSamples[stage][mPos[stage]] = ns;
+    mPos[stage] = (mPos[stage] + 1) % TIMING_WINDOW;
+    if(mCount[stage] < TIMING_WINDOW)
+        mCount[stage]++;
+    mGpu[stage] = gpu;
+    pthread_mutex_unlock(&mLock);
+}
+
+int StageTimer::stats(ConvertStage stage, StageStats *out){
+    uint64_t sorted[TIMING_WINDOW];
+    uint64_t sum = 0;
+    uint32_t n;
+
+    if(stage < 0 || stage >= STAGE_COUNT)
+        return -1;
+    pthread_mutex_lock(&mLock);
+    n = mCount[stage];
+    memcpy(sorted, mSamples[stage], n * sizeof(uint64_t));
+    out->gpu = mGpu[stage];
+    pthread_mutex_unlock(&mLock);
+
+    out->count = n;
+    if(n == 0){
+        out->minNs = out->meanNs = out->p50Ns = out->p99Ns = 0;
+        return 0;
+    }
+    std::sort(sorted, sorted + n);
+    for(uint32_t i = 0; i < n; i++)
+        sum += sorted[i];
+    out->minNs = sorted[0];
+    out->meanNs = sum / n;
+    // nearest rank
+    out->p50Ns = sorted[(n * 50 + 99) / 100 - 1];
+    out->p99Ns = sorted[(n * 99 + 99) / 100 - 1];
+    return 0;
+}
+
+void StageTimer::createQueries(Queries *q){
+    memset(q, 0, sizeof(*q));
+    if(sGpuTimer)
+        glGenQueriesEXTPtr(STAGE_MAP, q->id);
+}
+
+void StageTimer::deleteQueries(Queries *q){
+    if(sGpuTimer)
+        glDeleteQueriesEXTPtr(STAGE_MAP, q->id);
+}
+
+void StageTimer::begin(Queries *q, ConvertStage stage){
+    q->begun |= 1u << stage;
+    if(sGpuTimer)
+        glBeginQueryEXTPtr(GL_TIME_ELAPSED_EXT, q->id[stage]);
+    else
+        q->cpuStart = now();
+}
+
+void StageTimer::end(Queries *q, ConvertStage stage){
+    if(sGpuTimer)
+        glEndQueryEXTPtr(GL_TIME_ELAPSED_EXT);
+    else
+        add(stage, now() - q->cpuStart, false);
+}
+
+void StageTimer::collect(Queries *q){
+    GLint disjoint = 0;
+    GLuint available;
+    GLuint64 ns;
+    uint32_t begun = q->begun;
+
+    q->begun = 0;
+    if(!q->active)
+        return;
+    q->active = false;
+    if(!sGpuTimer)
+        return;
+    // clocks jumped (frequency change, power event), the results are junk
+    glGetIntegerv(GL_GPU_DISJOINT_EXT, &disjoint);
+    if(disjoint)
+        return;
+    for(int s = 0; s < STAGE_MAP; s++){
+        // a query that was never begun is no query object yet
+        if(!(begun & (1u << s)))
+            continue;
+        available = 0;
+        glGetQueryObjectuivEXTPtr(q->id[s], GL_QUERY_RESULT_AVAILABLE_EXT, &available);
+        if(!available)
+            continue;
+        glGetQueryObjectui64vEXTPtr(q->id[s], GL_QUERY_RESULT_EXT, &ns);
+        add((ConvertStage)s, ns, true);
+    }
+}
@@ -0,0 +1,73 @@
+#ifndef _STAGETIMER_H_
+#define _STAGETIMER_H_
+#include <stdint.h>
+#include <pthread.h>
+#include <GLES3/gl31.h>
+
+// Samples kept per stage for the rolling stats
+#define TIMING_WINDOW 256
+
+enum ConvertStage{
+	STAGE_UPLOAD = 0,  // staging buffer -> input textures / SSBOs
+	STAGE_DISPATCH,    // compute shader, or the CPU kernel
+	STAGE_READBACK,    // glReadPixels into the pack buffer
+	STAGE_MAP,         // fence wait + map on the engine thread
+	STAGE_COPY,        // memcpy out to the caller's dst
+	STAGE_COUNT,
+};
+
+struct StageStats{
+	uint32_t count;   // samples in the window
+	bool gpu;         // GPU time from timer queries, else CPU time spent issuing the calls
+	uint64_t minNs;
+	uint64_t meanNs;
+	uint64_t p50Ns;
+	uint64_t p99Ns;
+};
+
+// Rolling per stage timings of one stream. Upload, dispatch and readback
+// are bracketed with GL_EXT_disjoint_timer_query when the driver has it and
+// with CLOCK_MONOTONIC otherwise. Only every Nth frame is sampled, with
+// timing off a stream pays one branch per stage.
+class StageTimer{
+public:
+    StageTimer();
+    ~StageTimer();
+    // Engine thread, once the context is current. false if there are no
+    // GPU timer queries.
+    static bool initGL(void);
+    static bool gpuTimer(void);
+    static uint64_t now(void);
+
+    // sample every Nth frame, 0 turns timing off
+    void setInterval(uint32_t every);
+    uint32_t interval(void);
+    // engine thread: should the next frame be sampled
+    bool sampleFrame(void);
+    void add(ConvertStage stage, uint64_t ns, bool gpu);
+    int stats(ConvertStage stage, StageStats *out);
+
+    // Timer queries of one frame, GPU stages only
+    struct Queries{
+        GLuint id[STAGE_MAP];
+        uint32_t begun;    // stages bracketed this frame, strips skip some
+        uint64_t cpuStart;
+        bool active;       // this frame is being sampled
+    };
+    void createQueries(Queries *q);
+    void deleteQueries(Queries *q);
+    void begin(Queries *q, ConvertStage stage);
+    void end(Queries *q, ConvertStage stage);
+    // after the frame's fence has signaled
+    void collect(Queries *q);
+
+private:
+	pthread_mutex_t mLock;
+	uint64_t mSamples[STAGE_COUNT][TIMING_WINDOW];
+	uint32_t mCount[STAGE_COUNT];
+	uint32_t mPos[STAGE_COUNT];
+	bool mGpu[STAGE_COUNT];
+	volatile uint32_t mEvery;
+	uint32_t mFrame;
+};
+#endif
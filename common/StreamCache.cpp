@@ -0,0 +1,299 @@
+#include "StreamCache.h"
+#include "StageTimer.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+// An idle pool and when it was put back
+struct WarmEntry{
+	StreamPool *pool;
+	uint64_t bytes;
+	uint64_t idleSince;
+};
+
+static pthread_mutex_t sWarmLock = PTHREAD_MUTEX_INITIALIZER;
+static WarmEntry sWarm[MAX_WARM];
+static uint32_t sWarmCount = 0;
+static bool sWarmInit = false;
+static uint64_t sBudgetBytes = 64 << 20;
+static uint64_t sBudgetNs = 30000000000ULL;
+static WarmStats sStats;
+static pthread_cond_t sReaperCond;
+static pthread_once_t sReaperOnce = PTHREAD_ONCE_INIT;
+
+// sWarmLock held
+static void loadBudget(void){
+    const char *env;
+
+    if(sWarmInit)
+        return;
+    sWarmInit = true;
+    env = getenv("GLESCONVERT_WARM_BYTES");
+    if(env != NULL)
+        sBudgetBytes = strtoull(env, NULL, 0);
+    env = getenv("GLESCONVERT_WARM_IDLE_MS");
+    if(env != NULL)
+        sBudgetNs = strtoull(env, NULL, 0) * 1000000ULL;
+}
+
+// Take the idle pools past the budget out of the cache, sWarmLock held.
+// They are deleted after the lock is dropped, that waits for GL threads.
+static uint32_t evict(StreamPool **victims){
+    uint64_t now = StageTimer::now();
+    uint64_t total = 0;
+    uint32_t n = 0;
+
+    for(uint32_t i = 0; i < sWarmCount; ){
+        if(now - sWarm[i].idleSince > sBudgetNs){
+            victims[n++] = sWarm[i].pool;
+            sWarm[i] = sWarm[--sWarmCount];
+        }else{
+            total += sWarm[i++].bytes;
+        }
+    }
+    while(sWarmCount > 0 && total > sBudgetBytes){
+        uint32_t oldest = 0;
+        for(uint32_t i = 1; i < sWarmCount; i++){
+            if(sWarm[i].idleSince < sWarm[oldest].idleSince)
+                oldest = i;
+        }
+        total -= sWarm[oldest].bytes;
+        victims[n++] = sWarm[oldest].pool;
+        sWarm[oldest] = sWarm[--sWarmCount];
+    }
+    sStats.trimmed += n;
+    return n;
+}
+
+// Drops idle pools as their time runs out, sleeps until the next one does
+// or put() / setBudget() change that
+static void *reaper_entry(void *){
+    StreamPool *victims[MAX_WARM];
+    uint64_t due;
+    uint32_t n;
+    struct timespec ts;
+
+    pthread_mutex_lock(&sWarmLock);
+    for(;;){
+        n = evict(victims);
+        if(n > 0){
+            pthread_mutex_unlock(&sWarmLock);
+            for(uint32_t i = 0; i < n; i++)
+                delete victims[i];
+            pthread_mutex_lock(&sWarmLock);
+            continue;
+        }
+        if(sWarmCount == 0){
+            pthread_cond_wait(&sReaperCond, &sWarmLock);
+            continue;
+        }
+        due = sWarm[0].idleSince;
+        for(uint32_t i = 1; i < sWarmCount; i++){
+            if(sWarm[i].idleSince < due)
+                due = sWarm[i].idleSince;
+        }
+        // a millisecond late, evict() wants it past the budget
+        due += sBudgetNs + 1000000ULL;
+        ts.tv_sec = due / 1000000000ULL;
+        ts.tv_nsec = due % 1000000000ULL;
+        pthread_cond_timedwait(&sReaperCond, &sWarmLock, &ts);
+    }
+    return NULL;
+}
+
+static void startReaper(void){
+    pthread_condattr_t attr;
+    pthread_t thread;
+
+    // deadlines are StageTimer::now(), CLOCK_MONOTONIC
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&sReaperCond, &attr);
+    pthread_condattr_destroy(&attr);
+    if(0 != pthread_create(&thread, NULL, reaper_entry, NULL)){
+        printf("no warm cache reaper, idle pools only go on get() / put() / trim()\n");
+        return;
+    }
+    pthread_detach(thread);
+}
+
+static bool matches(const PoolParams *p, const KernelDesc *desc, uint32_t width, uint32_t height, uint32_t stride,
+                    uint32_t depth, uint32_t workers, const PlaneLayout *input){
+    return p->desc == desc && p->width == width && p->height == height && p->stride == stride && p->depth == depth &&
+           p->workers == workers && memcmp(&p->input, input, sizeof(*input)) == 0;
+}
+
+//static
+StreamPool *StreamCache::get(const KernelDesc *desc, uint32_t width, uint32_t height, uint32_t stride,
+                             uint32_t depth, uint32_t workers, const PlaneLayout *input){
+    StreamPool *victims[MAX_WARM];
+    StreamPool *pool = NULL;
+    PlaneLayout layout;
+    uint32_t n;
+    uint64_t start, ns;
+
+    // the key as StreamPool resolves it
+    memset(&layout, 0, sizeof(layout));
+    if(input != NULL)
+        layout = *input;
+    if(workers == 0){
+        const char *env = getenv("GLESCONVERT_WORKERS");
+        workers = env != NULL && atoi(env) > 0 ? atoi(env) : 1;
+    }
+    if(workers > MAX_ENGINES)
+        workers = MAX_ENGINES;
+    if(depth < 1)
+        depth = 1;
+    if(depth > MAX_PIPELINE_DEPTH)
+        depth = MAX_PIPELINE_DEPTH;
+
+    pthread_mutex_lock(&sWarmLock);
+    loadBudget();
+    n = evict(victims);
+    for(uint32_t i = 0; i < sWarmCount; i++){
+        if(matches(sWarm[i].pool->params(), desc, width, height, stride, depth, workers, &layout)){
+            pool = sWarm[i].pool;
+            sWarm[i] = sWarm[--sWarmCount];
+            break;
+        }
+    }
+    if(pool != NULL)
+        sStats.hits++;
+    else
+        sStats.misses++;
+    pthread_mutex_unlock(&sWarmLock);
+
+    for(uint32_t i = 0; i < n; i++)
+        delete victims[i];
+    if(pool != NULL)
+        return pool;
+
+    start = StageTimer::now();
+    pool = new StreamPool(desc, width, height, stride, depth, workers, NULL, NULL, &layout);
+    ns = StageTimer::now() - start;
+    pthread_mutex_lock(&sWarmLock);
+    sStats.builds++;
+    sStats.buildNs += ns;
+    if(ns > sStats.maxBuildNs)
+        sStats.maxBuildNs = ns;
+    pthread_mutex_unlock(&sWarmLock);
+    return pool;
+}
+
+//static
+void StreamCache::put(StreamPool *pool){
+    StreamPool *victims[MAX_WARM + 1];
+    uint32_t n = 0;
+
+    if(pool == NULL)
+        return;
+    // the slice callback belongs to the converter that is done
+    if(pool->params()->cpu || !pool->ready() || !pool->idle() || pool->setSlices(1, NULL, NULL) != 0){
+        delete pool;
+        return;
+    }
+    pthread_mutex_lock(&sWarmLock);
+    loadBudget();
+    if(sWarmCount == MAX_WARM){
+        // make room, the oldest goes first
+        uint32_t oldest = 0;
+        for(uint32_t i = 1; i < sWarmCount; i++){
+            if(sWarm[i].idleSince < sWarm[oldest].idleSince)
+                oldest = i;
+        }
+        victims[n++] = sWarm[oldest].pool;
+        sWarm[oldest] = sWarm[--sWarmCount];
+        sStats.trimmed++;
+    }
+    sWarm[sWarmCount].pool = pool;
+    sWarm[sWarmCount].bytes = pool->bytes();
+    sWarm[sWarmCount].idleSince = StageTimer::now();
+    sWarmCount++;
+    n += evict(victims + n);
+    pthread_mutex_unlock(&sWarmLock);
+    pthread_once(&sReaperOnce, startReaper);
+    pthread_cond_signal(&sReaperCond);
+
+    for(uint32_t i = 0; i < n; i++)
+        delete victims[i];
+}
+
+//static
+void StreamCache::setBudget(uint64_t bytes, uint32_t idleMs){
+    pthread_mutex_lock(&sWarmLock);
+    sWarmInit = true;
+    sBudgetBytes = bytes;
+    sBudgetNs = idleMs * 1000000ULL;
+    pthread_mutex_unlock(&sWarmLock);
+    pthread_once(&sReaperOnce, startReaper);
+    pthread_cond_signal(&sReaperCond);
+    trim();
+}
+
+//static
+void StreamCache::trim(void){
+    StreamPool *victims[MAX_WARM];
+    uint32_t n;
+
+    pthread_mutex_lock(&sWarmLock);
+    loadBudget();
+    n = evict(victims);
+    pthread_mutex_unlock(&sWarmLock);
+    for(uint32_t i = 0; i < n; i++)
+        delete victims[i];
+}
+
+//static
+void StreamCache::clear(void){
+    StreamPool *victims[MAX_WARM];
+    uint32_t n;
+
+    pthread_mutex_lock(&sWarmLock);
+    n = sWarmCount;
+    for(uint32_t i = 0; i < n; i++)
+        victims[i] = sWarm[i].pool;
+    sWarmCount = 0;
+    pthread_mutex_unlock(&sWarmLock);
+    for(uint32_t i = 0; i < n; i++)
+        delete victims[i];
+}
+
+//static
+void StreamCache::stats(WarmStats *stats){
+    pthread_mutex_lock(&sWarmLock);
+    *stats = sStats;
+    stats->idle = sWarmCount;
+    stats->idleBytes = 0;
+    for(uint32_t i = 0; i < sWarmCount; i++)
+        stats->idleBytes += sWarm[i].bytes;
+    pthread_mutex_unlock(&sWarmLock);
+}
+
+//static
+int StreamCache::nextSize(const char **list, uint32_t *width, uint32_t *height, uint32_t *stride){
+    const char *p = *list;
+    char *end;
+
+    while(*p == ',' || *p == ' ')
+        p++;
+    if(*p == '\0')
+        return -1;
+    *width = strtoul(p, &end, 10);
+    if(end == p || *end != 'x')
+        return -1;
+    p = end + 1;
+    *height = strtoul(p, &end, 10);
+    if(end == p)
+        return -1;
+    *stride = 0;
+    if(*end == ':'){
+        p = end + 1;
+        *stride = strtoul(p, &end, 10);
+    }
+    if(*end != '\0' && *end != ',' && *end != ' ')
+        return -1;
+    *list = end;
+    return *width > 0 && *height > 0 ? 0 : -1;
+}
@@ -0,0 +1,58 @@
+#ifndef _STREAMCACHE_H_
+#define _STREAMCACHE_H_
+#include <stdint.h>
+#include "StreamPool.h"
+
+// Most idle pools kept at once
+#define MAX_WARM 16
+
+struct WarmStats{
+	uint64_t hits;       // get() calls served from an idle pool
+	uint64_t misses;     // get() calls that had to build one
+	uint64_t builds;     // pools built, prewarming included
+	uint64_t buildNs;    // time spent building them
+	uint64_t maxBuildNs;
+	uint64_t trimmed;    // idle pools dropped for the budget
+	uint32_t idle;
+	uint64_t idleBytes;
+};
+
+// Process wide cache of idle GPU StreamPools. Starting a stream costs a
+// kernel lookup, buffer and texture allocation and a round trip to every
+// worker's GL thread. A converter that is done gives its pool back with
+// put(), and the next get() for the same kernel, size, stride, depth,
+// workers and input layout takes it as is, without its slice callback.
+// Pools that still have frames queued or views held are deleted, so are
+// CPU pools.
+//
+// Idle pools are dropped oldest first past the byte budget, and once they
+// have been idle for longer than the time budget. Both are checked on
+// get() / put() and by trim(). A reaper thread, started by the first put(),
+// also wakes when the oldest idle pool runs out of time, so the time budget
+// holds when no converter calls in.
+// GLESCONVERT_WARM_BYTES and GLESCONVERT_WARM_IDLE_MS set them from the
+// environment, default 64 MB and 30 s. A byte budget of 0 turns caching off.
+//
+// Warm pools keep the output mode they were built with, clear() after
+// GLEngine::setOutputMode(). Timing settings and stats carry over too.
+class StreamCache{
+public:
+    // An idle pool matching the arguments, or a new one. Same arguments
+    // as the StreamPool constructor, without a CPU function.
+    static StreamPool *get(const KernelDesc *desc, uint32_t width, uint32_t height, uint32_t stride,
+                           uint32_t depth, uint32_t workers = 0, const PlaneLayout *input = NULL);
+    // Give a pool from get() back. It is kept warm if it is idle and fits
+    // the budget, deleted otherwise.
+    static void put(StreamPool *pool);
+    static void setBudget(uint64_t bytes, uint32_t idleMs);
+    static void trim(void);
+    // delete every idle pool
+    static void clear(void);
+    static void stats(WarmStats *stats);
+
+    // Config lists for prewarming: "WxH[:stride],..." with stride 0 when it
+    // is left out. Takes the next entry off *list, -1 at the end or on a
+    // malformed one.
+    static int nextSize(const char **list, uint32_t *width, uint32_t *height, uint32_t *stride);
+};
+#endif
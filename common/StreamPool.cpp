@@ -0,0 +1,479 @@
+#include "StreamPool.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#define ORDER_SIZE (MAX_ENGINES * MAX_PIPELINE_DEPTH)
+// PoolFrame::worker until a worker has the frame
+#define FRAME_WAITING -1
+#define FRAME_TAKING -2   // a worker is queueing it
+#define FRAME_FAILED -3   // it couldn't, retrieve() returns -1 for it
+
+StreamPool::StreamPool(const KernelDesc *desc, uint32_t width, uint32_t height, uint32_t stride, uint32_t depth,
+                       uint32_t workers, GLStream::CpuFunc cpu, void *cpuCtx, const PlaneLayout *input):
+    mWorkers(0), mInputWorker(-1), mInputBuffer(-1), mLeased(0), mSliced(false), mOrderHead(0), mOrderCount(0),
+    mWaiting(0), mBufferCount(0), mSpareCount(0), mBufferSize(0), mFdMapped(0){
+    memset(&mParams, 0, sizeof(mParams));
+    memset(mEngines, 0, sizeof(mEngines));
+    memset(mStreams, 0, sizeof(mStreams));
+    memset(mFrames, 0, sizeof(mFrames));
+    memset(mOrder, 0, sizeof(mOrder));
+    memset(mBuffers, 0, sizeof(mBuffers));
+    pthread_mutex_init(&mLock, NULL);
+
+    if(workers == 0){
+        const char *env = getenv("GLESCONVERT_WORKERS");
+        workers = env != NULL && atoi(env) > 0 ? atoi(env) : 1;
+    }
+    if(workers > MAX_ENGINES)
+        workers = MAX_ENGINES;
+    if(cpu != NULL)
+        workers = 1;
+    // as GLStream clamps it
+    if(depth < 1)
+        depth = 1;
+    if(depth > MAX_PIPELINE_DEPTH)
+        depth = MAX_PIPELINE_DEPTH;
+    mParams.desc = desc;
+    mParams.width = width;
+    mParams.height = height;
+    mParams.stride = stride;
+    mParams.depth = depth;
+    mParams.workers = workers;
+    mParams.cpu = cpu != NULL;
+    if(input != NULL)
+        mParams.input = *input;
+
+    for(uint32_t i = 0; i < workers; i++){
+        GLEngine *engine = GLEngine::get(i);
+        GLStream *stream = new GLStream(engine, desc, width, height, stride, depth, cpu, cpuCtx, input);
+
+        if(i > 0 && !stream->ready()){
+            printf("worker %d not ready, pool keeps %d\n", i, i);
+            delete stream;
+            GLEngine::put(engine);
+            break;
+        }
+        mEngines[i] = engine;
+        mStreams[i] = stream;
+        mWorkers++;
+    }
+    if(workers > 1)
+        printf("pool workers:%d\n", mWorkers);
+    if(mWorkers > 1){
+        mBufferSize = planeOffset(mStreams[0]->geometry(), desc->planes);
+        for(uint32_t i = 0; i < mWorkers; i++)
+            mStreams[i]->setFeed(feed_entry, this);
+    }
+}
+
+StreamPool::~StreamPool(){
+    // no worker is inside feed() once this returns
+    if(mWorkers > 1){
+        for(uint32_t i = 0; i < mWorkers; i++)
+            mStreams[i]->setFeed(NULL, NULL);
+    }
+    // streams first, a worker engine takes engine 0 down with it
+    for(uint32_t i = 0; i < mWorkers; i++)
+        delete mStreams[i];
+    for(uint32_t i = mWorkers; i-- > 0; )
+        GLEngine::put(mEngines[i]);
+    for(uint32_t i = 0; i < mBufferCount; i++)
+        free(mBuffers[i]);
+    pthread_mutex_destroy(&mLock);
+}
+
+bool StreamPool::ready(void){
+    return mStreams[0]->ready();
+}
+
+uint32_t StreamPool::workers(void){
+    return mWorkers;
+}
+
+GLStream *StreamPool::stream(uint32_t worker){
+    return worker < mWorkers ? mStreams[worker] : NULL;
+}
+
+uint64_t StreamPool::frames(uint32_t worker){
+    uint64_t n;
+
+    if(worker >= mWorkers)
+        return 0;
+    pthread_mutex_lock(&mLock);
+    n = mFrames[worker];
+    pthread_mutex_unlock(&mLock);
+    return n;
+}
+
+const PoolParams *StreamPool::params(void){
+    return &mParams;
+}
+
+bool StreamPool::idle(void){
+    if(mOrderCount > 0 || mInputWorker >= 0 || mInputBuffer >= 0)
+        return false;
+    for(uint32_t i = 0; i < mWorkers; i++){
+        if(mStreams[i]->freeSlots() != mParams.depth)
+            return false;
+    }
+    return true;
+}
+
+uint64_t StreamPool::bytes(void){
+    uint64_t total = 0;
+
+    for(uint32_t i = 0; i < mWorkers; i++)
+        total += mStreams[i]->bytes();
+    return total;
+}
+
+// Every slot the workers have is spoken for: frames not retrieved yet,
+// views not released and the held input
+bool StreamPool::full(void){
+    return mOrderCount + mLeased + (mInputBuffer >= 0 ? 1 : 0) >= mWorkers * mParams.depth;
+}
+
+// A pool buffer for the input of a frame, -1 if the pool is full
+int StreamPool::takeBuffer(void){
+    int b = -1;
+
+    if(full())
+        return -1;
+    pthread_mutex_lock(&mLock);
+    if(mSpareCount > 0){
+        b = mSpare[--mSpareCount];
+    }else if(mBufferCount < ORDER_SIZE && (mBuffers[mBufferCount] = (uint8_t *)malloc(mBufferSize)) != NULL){
+        b = mBufferCount++;
+    }
+    pthread_mutex_unlock(&mLock);
+    if(b < 0)
+        printf("no memory for a %llu byte frame\n", (unsigned long long)mBufferSize);
+    return b;
+}
+
+void StreamPool::bufferPlanes(int buffer, uint8_t **planes){
+    const StreamGeometry *geo = mStreams[0]->geometry();
+
+    for(uint32_t j = 0; j < mParams.desc->planes; j++)
+        planes[j] = mBuffers[buffer] + planeOffset(geo, j);
+}
+
+// Add a frame for the workers to take, its input in buffer or in fd
+int StreamPool::queue(int buffer, int fd, uint8_t *dst, uint32_t rows, void *tag){
+    PoolFrame *f;
+
+    pthread_mutex_lock(&mLock);
+    f = &mOrder[(mOrderHead + mOrderCount) % ORDER_SIZE];
+    f->worker = FRAME_WAITING;
+    f->buffer = buffer;
+    f->fd = fd;
+    f->dst = dst;
+    f->rows = dst != NULL ? mStreams[0]->gpuRows(rows) : mParams.height;
+    f->tag = tag;
+    mOrderCount++;
+    mWaiting++;
+    pthread_mutex_unlock(&mLock);
+    wakeWorkers();
+    return 0;
+}
+
+void StreamPool::wakeWorkers(void){
+    if(mWaiting.load() == 0)
+        return;
+    for(uint32_t i = 0; i < mWorkers; i++)
+        mEngines[i]->frameQueued();
+}
+
+// A frame went straight to a worker, one worker pools only
+void StreamPool::queued(uint32_t worker){
+    PoolFrame *f = &mOrder[(mOrderHead + mOrderCount) % ORDER_SIZE];
+
+    memset(f, 0, sizeof(*f));
+    f->worker = worker;
+    f->buffer = -1;
+    f->fd = -1;
+    mOrderCount++;
+    mFrames[worker]++;
+}
+
+//static
+bool StreamPool::feed_entry(void *ctx, GLStream *stream, bool take){
+    StreamPool *me = static_cast<StreamPool *>(ctx);
+
+    if(!take)
+        return me->mWaiting.load() > 0;
+    return me->feed(stream);
+}
+
+// Engine thread of a worker whose stream ran dry: queue the oldest frame no
+// worker has taken on it, copying its input into the stream's staging
+bool StreamPool::feed(GLStream *stream){
+    uint8_t *staging[MAX_PLANES];
+    uint8_t *planes[MAX_PLANES];
+    PoolFrame *f;
+    uint32_t w = 0;
+    int ret;
+
+    while(w < mWorkers && mStreams[w] != stream)
+        w++;
+    pthread_mutex_lock(&mLock);
+    if(mWaiting.load() == 0){
+        pthread_mutex_unlock(&mLock);
+        return false;
+    }
+    // they are taken in submit order, the waiting ones are the newest
+    f = &mOrder[(mOrderHead + mOrderCount - mWaiting.load()) % ORDER_SIZE];
+    f->worker = FRAME_TAKING;
+    mWaiting--;
+    pthread_mutex_unlock(&mLock);
+
+    // the caller leaves the frame alone until it has a worker
+    if(f->buffer >= 0){
+        ret = stream->getInputBuffer(staging);
+        if(ret == 0){
+            bufferPlanes(f->buffer, planes);
+            stream->copyInput(staging, planes, f->rows, true);
+            ret = stream->submitInput(f->dst, f->rows, f->tag);
+        }
+    }else{
+        ret = stream->submitFd(f->fd, f->dst, f->rows, f->tag);
+    }
+
+    pthread_mutex_lock(&mLock);
+    if(f->buffer >= 0)
+        mSpare[mSpareCount++] = f->buffer;
+    f->buffer = -1;
+    f->worker = ret == 0 ? (int)w : FRAME_FAILED;
+    if(ret == 0)
+        mFrames[w]++;
+    pthread_mutex_unlock(&mLock);
+    mTaken.wake();
+    return ret == 0;
+}
+
+//static
+bool StreamPool::taken_ready(void *data){
+    StreamPool *me = static_cast<StreamPool *>(data);
+    int worker;
+
+    pthread_mutex_lock(&me->mLock);
+    worker = me->mOrder[me->mOrderHead].worker;
+    pthread_mutex_unlock(&me->mLock);
+    return worker != FRAME_WAITING && worker != FRAME_TAKING;
+}
+
+// Take the oldest frame off the order and return its worker, once one has
+// it. -1 if it couldn't be queued (tag is still set) or if no worker can
+// ever take it because acquire() views hold every free slot, that frame
+// stays.
+int StreamPool::takeOldest(void **tag, uint8_t **dst){
+    PoolFrame *f = &mOrder[mOrderHead];
+    bool stuck = true;
+    int worker;
+
+    if(mOrderCount == 0)
+        return -1;
+    pthread_mutex_lock(&mLock);
+    worker = f->worker;
+    pthread_mutex_unlock(&mLock);
+    // only this thread frees slots, a frame still waiting once none are
+    // free stays waiting. A worker may take it while they're counted.
+    if(worker == FRAME_WAITING){
+        for(uint32_t i = 0; i < mWorkers && stuck; i++)
+            stuck = mStreams[i]->freeSlots() == 0;
+        pthread_mutex_lock(&mLock);
+        worker = f->worker;
+        pthread_mutex_unlock(&mLock);
+        if(stuck && worker == FRAME_WAITING)
+            return -1;
+    }
+    mTaken.wait(taken_ready, this);
+
+    pthread_mutex_lock(&mLock);
+    worker = f->worker;
+    if(dst != NULL)
+        *dst = f->dst;
+    if(worker == FRAME_FAILED && tag != NULL)
+        *tag = f->tag;
+    mOrderHead = (mOrderHead + 1) % ORDER_SIZE;
+    mOrderCount--;
+    pthread_mutex_unlock(&mLock);
+    return worker >= 0 ? worker : -1;
+}
+
+int StreamPool::submit(uint8_t **planes, uint8_t *dst, uint32_t rows, void *tag){
+    uint8_t *input[MAX_PLANES];
+    int b;
+
+    if(mWorkers == 1){
+        if(mStreams[0]->submit(planes, dst, rows, tag) != 0)
+            return -1;
+        queued(0);
+        return 0;
+    }
+    if((b = takeBuffer()) < 0)
+        return -1;
+    bufferPlanes(b, input);
+    mStreams[0]->copyInput(input, planes, dst != NULL ? mStreams[0]->gpuRows(rows) : mParams.height, false);
+    return queue(b, -1, dst, rows, tag);
+}
+
+int StreamPool::submitFd(int fd, uint8_t *dst, uint32_t rows, void *tag){
+    uint8_t *planes[MAX_PLANES];
+    const uint8_t *base;
+    uint64_t size;
+    FdKey key;
+    int ret;
+
+    if(mWorkers == 1){
+        if(mStreams[0]->submitFd(fd, dst, rows, tag) != 0)
+            return -1;
+        queued(0);
+        return 0;
+    }
+    if(fdKey(fd, &key, &size) != 0 || size < mStreams[0]->fdSize()){
+        printf("fd %d does not hold a %dx%d frame\n", fd, mParams.width, mParams.height);
+        return -1;
+    }
+    // the worker that takes it imports it, nothing to copy here
+    if(mStreams[0]->importable())
+        return full() ? -1 : queue(-1, fd, dst, rows, tag);
+    base = mMaps.map(fd, &key, mStreams[0]->fdSize());
+    if(base == NULL)
+        return -1;
+    mStreams[0]->fdPlanes(base, planes);
+    FdMapCache::beginRead(fd);
+    ret = submit(planes, dst, rows, tag);
+    FdMapCache::endRead(fd);
+    if(ret == 0)
+        mFdMapped++;
+    return ret;
+}
+
+int StreamPool::getInputBuffer(uint8_t **planes){
+    if(mInputWorker >= 0 || mInputBuffer >= 0)
+        return -1;
+    if(mWorkers > 1){
+        if((mInputBuffer = takeBuffer()) < 0)
+            return -1;
+        bufferPlanes(mInputBuffer, planes);
+        return 0;
+    }
+    if(mStreams[0]->getInputBuffer(planes) != 0)
+        return -1;
+    mInputWorker = 0;
+    return 0;
+}
+
+int StreamPool::submitInput(uint8_t *dst, uint32_t rows, void *tag){
+    int w = mInputWorker;
+
+    if(mInputBuffer >= 0){
+        queue(mInputBuffer, -1, dst, rows, tag);
+        mInputBuffer = -1;
+        return 0;
+    }
+    if(w < 0 || mStreams[w]->submitInput(dst, rows, tag) != 0)
+        return -1;
+    mInputWorker = -1;
+    queued(w);
+    return 0;
+}
+
+void StreamPool::cancelInput(void){
+    if(mInputBuffer >= 0){
+        pthread_mutex_lock(&mLock);
+        mSpare[mSpareCount++] = mInputBuffer;
+        pthread_mutex_unlock(&mLock);
+        mInputBuffer = -1;
+    }
+    if(mInputWorker < 0)
+        return;
+    mStreams[mInputWorker]->cancelInput();
+    mInputWorker = -1;
+}
+
+int StreamPool::retrieve(uint8_t **dst, void **tag){
+    int w = takeOldest(tag, NULL);
+    int ret;
+
+    if(w < 0)
+        return -1;
+    ret = mStreams[w]->retrieve(dst, tag);
+    // its slot is free again
+    wakeWorkers();
+    return ret;
+}
+
+int StreamPool::acquire(const uint8_t **data, void **tag){
+    uint8_t *dst = NULL;
+    int w = takeOldest(tag, &dst);
+    int ret;
+
+    if(w < 0)
+        return -1;
+    ret = mStreams[w]->acquire(data, tag);
+    // frames with a dst were copied out, only views hold their slot
+    if(ret == 0 && dst == NULL)
+        mLeased++;
+    wakeWorkers();
+    return ret;
+}
+
+int StreamPool::release(const uint8_t *data){
+    // views are distinct mappings, only their own stream takes them back
+    for(uint32_t i = 0; i < mWorkers; i++){
+        if(mStreams[i]->release(data) == 0){
+            mLeased--;
+            wakeWorkers();
+            return 0;
+        }
+    }
+    return -1;
+}
+
+uint32_t StreamPool::inputPitch(uint32_t plane){
+    return mStreams[0]->inputPitch(plane);
+}
+
+uint32_t StreamPool::outputStride(void){
+    return mStreams[0]->outputStride();
+}
+
+void StreamPool::fdStats(uint64_t *imported, uint64_t *mapped, uint64_t *misses){
+    uint64_t hits;
+
+    *imported = 0;
+    *mapped = mFdMapped;
+    mMaps.stats(&hits, misses);
+    for(uint32_t i = 0; i < mWorkers; i++){
+        uint64_t a, b, c;
+        mStreams[i]->fdStats(&a, &b, &c);
+        *imported += a;
+        *mapped += b;
+        *misses += c;
+    }
+}
+
+void StreamPool::setTiming(uint32_t every){
+    for(uint32_t i = 0; i < mWorkers; i++)
+        mStreams[i]->setTiming(every);
+}
+
+int StreamPool::stageStats(ConvertStage stage, StageStats *stats){
+    return mStreams[0]->stageStats(stage, stats);
+}
+
+int StreamPool::setSlices(uint32_t count, GLStream::SliceFunc fn, void *ctx){
+    if(fn == NULL && !mSliced)
+        return 0;
+    if(mWorkers > 1){
+        printf("slices need a single worker, pool has %d\n", mWorkers);
+        return -1;
+    }
+    if(mStreams[0]->setSlices(count, fn, ctx) != 0)
+        return -1;
+    mSliced = fn != NULL;
+    return 0;
+}
@@ -0,0 +1,131 @@
+#ifndef _STREAMPOOL_H_
+#define _STREAMPOOL_H_
+#include <stdint.h>
+#include <pthread.h>
+#include <atomic>
+#include "GLEngine.h"
+#include "GLStream.h"
+#include "Parker.h"
+#include "DmaImport.h"
+
+// What a pool was built for, StreamCache matches on it
+struct PoolParams{
+	const KernelDesc *desc;
+	uint32_t width;
+	uint32_t height;
+	uint32_t stride;
+	uint32_t depth;
+	uint32_t workers;     // as asked for, 0 resolved from the environment
+	bool cpu;
+	PlaneLayout input;    // all zero for NULL
+};
+
+// The same conversion on several engines at once (GLEngine::get(worker)),
+// one GLStream per worker, behind the caller side API of a single stream.
+// With more than one worker no frame is dealt out at submit time: submit()
+// copies it into a buffer of the pool and it waits there, in submit order,
+// until the first worker whose engine thread has nothing left queued for
+// its stream and a free slot takes it (GLStream::setFeed()). The input is
+// copied into that worker's staging then, on its thread, so a worker busy
+// converting leaves the next frames to the idle ones. getInputBuffer()
+// hands out a pool buffer the same way. dma-bufs the workers can import
+// wait as fds and are imported by the worker that takes them, so fd stays
+// open until the frame is retrieved; anything else is mapped and copied
+// in by submitFd(). Frames come back in submit order.
+//
+// workers == 0 takes GLESCONVERT_WORKERS from the environment, default 1.
+// Every worker has depth slots of its own. CPU streams (cpu != NULL) run
+// on one worker, the CPU function is not reentrant. A worker whose stream
+// can't be set up is dropped, ready() only needs the first one.
+class StreamPool{
+public:
+    StreamPool(const KernelDesc *desc, uint32_t width, uint32_t height, uint32_t stride, uint32_t depth,
+               uint32_t workers = 0, GLStream::CpuFunc cpu = NULL, void *cpuCtx = NULL,
+               const PlaneLayout *input = NULL);
+    ~StreamPool();
+    bool ready(void);
+    uint32_t workers(void);
+    GLStream *stream(uint32_t worker);
+    // frames each worker has taken so far
+    uint64_t frames(uint32_t worker);
+    const PoolParams *params(void);
+    // nothing queued, held or leased out
+    bool idle(void);
+    // GPU memory held by every worker's stream, roughly
+    uint64_t bytes(void);
+
+    // Same as GLStream
+    int submit(uint8_t **planes, uint8_t *dst, uint32_t rows = 0, void *tag = NULL);
+    int submitFd(int fd, uint8_t *dst, uint32_t rows = 0, void *tag = NULL);
+    int getInputBuffer(uint8_t **planes);
+    int submitInput(uint8_t *dst, uint32_t rows = 0, void *tag = NULL);
+    void cancelInput(void);
+    int retrieve(uint8_t **dst, void **tag = NULL);
+    int acquire(const uint8_t **data, void **tag = NULL);
+    int release(const uint8_t *data);
+    uint32_t inputPitch(uint32_t plane);
+    uint32_t outputStride(void);
+    // summed over the workers, each imports / maps a buffer itself
+    void fdStats(uint64_t *imported, uint64_t *mapped, uint64_t *misses);
+    // every worker samples, stats are the first worker's
+    void setTiming(uint32_t every);
+    int stageStats(ConvertStage stage, StageStats *stats);
+    // slices come from every worker's thread out of frame order, one
+    // worker only. fn == NULL turns them off, a no-op if they are.
+    int setSlices(uint32_t count, GLStream::SliceFunc fn, void *ctx);
+
+private:
+	// A frame not retrieved yet
+	struct PoolFrame{
+		int worker;       // that took it, or FRAME_*
+		int buffer;       // its input in mBuffers, -1 for none
+		int fd;           // or the dma-buf it is in, -1 for none
+		uint8_t *dst;
+		uint32_t rows;
+		void *tag;
+	};
+
+	static bool feed_entry(void *ctx, GLStream *stream, bool take);
+	static bool taken_ready(void *data);
+	bool feed(GLStream *stream);
+	bool full(void);
+	int takeBuffer(void);
+	void bufferPlanes(int buffer, uint8_t **planes);
+	int queue(int buffer, int fd, uint8_t *dst, uint32_t rows, void *tag);
+	void queued(uint32_t worker);
+	int takeOldest(void **tag, uint8_t **dst);
+	void wakeWorkers(void);
+
+private:
+	PoolParams mParams;
+	GLEngine *mEngines[MAX_ENGINES];
+	GLStream *mStreams[MAX_ENGINES];
+	uint64_t mFrames[MAX_ENGINES];  // under mLock
+	uint32_t mWorkers;
+	int mInputWorker;       // worker holding the getInputBuffer() slot, -1 if none
+	int mInputBuffer;       // or the pool buffer, with several workers
+	uint32_t mLeased;       // acquire() views not released yet
+	bool mSliced;           // setSlices() callback installed
+
+	// Every frame not retrieved yet, oldest at mOrderHead. The last
+	// mWaiting of them have no worker yet. The caller adds and removes
+	// frames, workers take them, both under mLock.
+	pthread_mutex_t mLock;
+	PoolFrame mOrder[MAX_ENGINES * MAX_PIPELINE_DEPTH];
+	uint32_t mOrderHead;
+	uint32_t mOrderCount;
+	std::atomic<uint32_t> mWaiting;
+	Parker mTaken;          // caller waits here for a worker to take a frame
+
+	// input of frames waiting for a worker, staging layout, made on demand
+	uint8_t *mBuffers[MAX_ENGINES * MAX_PIPELINE_DEPTH];
+	uint32_t mBufferCount;
+	int mSpare[MAX_ENGINES * MAX_PIPELINE_DEPTH];  // free ones
+	uint32_t mSpareCount;
+	uint64_t mBufferSize;
+
+	// submitFd() frames mapped by the pool, several workers
+	FdMapCache mMaps;
+	uint64_t mFdMapped;
+};
+#endif
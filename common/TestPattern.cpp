@@ -0,0 +1,49 @@
+#include "TestPattern.h"
+
+static const char *sPatternNames[TEST_PATTERN_COUNT] = {
+    "black", "white", "limits", "hramp", "vramp", "checker", "random"
+};
+
+void fillPattern(TestPattern pattern, uint32_t plane, uint8_t *dst, uint32_t w, uint32_t h, uint32_t seed){
+    uint32_t state = seed * 2654435761u + plane + 1;
+
+    for(uint32_t r = 0; r < h; r++){
+        uint8_t *row = dst + r * w;
+        for(uint32_t x = 0; x < w; x++){
+            switch(pattern){
+            case PATTERN_BLACK:
+                // chroma at 128 so the frame is really black
+                row[x] = plane == 0 ? 0 : 128;
+                break;
+            case PATTERN_WHITE:
+                row[x] = plane == 0 ? 255 : 128;
+                break;
+            case PATTERN_LIMITS:
+                if(plane == 0)
+                    row[x] = ((x / 4 + r) & 1) ? 235 : 16;
+                else
+                    row[x] = ((x / 4 + r + plane) & 1) ? 240 : 16;
+                break;
+            case PATTERN_HRAMP:
+                row[x] = w > 1 ? x * 255 / (w - 1) : 0;
+                break;
+            case PATTERN_VRAMP:
+                row[x] = h > 1 ? r * 255 / (h - 1) : 0;
+                break;
+            case PATTERN_CHECKER:
+                row[x] = ((x / 8 + r / 8 + plane) & 1) ? 255 : 0;
+                break;
+            default:
+                state ^= state << 13;
+                state ^= state >> 17;
+                state ^= state << 5;
+                row[x] = state >> 24;
+                break;
+            }
+        }
+    }
+}
+
+const char *patternName(TestPattern pattern){
+    return sPatternNames[pattern];
+}
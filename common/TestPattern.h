@@ -0,0 +1,22 @@
+#ifndef _TESTPATTERN_H_
+#define _TESTPATTERN_H_
+#include <stdint.h>
+
+// Synthetic planes for the tools' golden and bench modes. Each pattern
+// fills one plane (0 = y, 1 = u, 2 = v) of w x h bytes, chroma planes of
+// 4:2:0 layouts are just filled at their smaller size.
+enum TestPattern{
+	PATTERN_BLACK = 0,
+	PATTERN_WHITE,
+	PATTERN_LIMITS,    // limited range extremes: y 16 / 235, chroma 16 / 240 in stripes
+	PATTERN_HRAMP,     // 0..255 across each row
+	PATTERN_VRAMP,     // 0..255 down the plane
+	PATTERN_CHECKER,   // 8x8 blocks of 0 / 255, u and v out of phase
+	PATTERN_RANDOM,    // xorshift noise, repeatable for a seed
+	TEST_PATTERN_COUNT,
+};
+
+void fillPattern(TestPattern pattern, uint32_t plane, uint8_t *dst, uint32_t w, uint32_t h, uint32_t seed);
+const char *patternName(TestPattern pattern);
+
+#endif
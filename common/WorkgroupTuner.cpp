@@ -0,0 +1,163 @@
+#include "WorkgroupTuner.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+// Tried in this order, the first one is also the untuned default
+static const LocalSize sLocalSizes[] = {
+    {32, 32}, {16, 16}, {8, 8}, {32, 16}, {32, 8}, {64, 4}, {16, 8},
+    {8, 16}, {64, 2}, {128, 1}, {32, 4}, {16, 4},
+};
+
+WorkgroupTuner::WorkgroupTuner():
+    mEnabled(false), mMaxInvocations(0), mMaxX(0), mMaxY(0){
+    pthread_mutex_init(&mLock, NULL);
+    mRenderer[0] = 0;
+    mFile[0] = 0;
+}
+
+WorkgroupTuner::~WorkgroupTuner(){
+    pthread_mutex_destroy(&mLock);
+}
+
+void WorkgroupTuner::init(const char *dir){
+    const char *renderer = (const char *)glGetString(GL_RENDERER);
+    const char *env = getenv("GLESCONVERT_AUTOTUNE");
+
+    glGetIntegerv(GL_MAX_COMPUTE_WORK_GROUP_INVOCATIONS, &mMaxInvocations);
+    glGetIntegeri_v(GL_MAX_COMPUTE_WORK_GROUP_SIZE, 0, &mMaxX);
+    glGetIntegeri_v(GL_MAX_COMPUTE_WORK_GROUP_SIZE, 1, &mMaxY);
+    // one token per line field, keep the renderer on one line
+    snprintf(mRenderer, sizeof(mRenderer), "%s", renderer != NULL ? renderer : "unknown");
+    for(char *c = mRenderer; *c; c++){
+        if(*c == '\n' || *c == '\r')
+            *c = ' ';
+    }
+    mEnabled = env != NULL && atoi(env) != 0;
+    if(dir != NULL){
+        snprintf(mFile, sizeof(mFile), "%s/workgroups.txt", dir);
+        load(&mEntries);
+    }
+    printf("workgroup tuning:%d max invocations:%d tuned sizes:%u\n", mEnabled, mMaxInvocations,
+           (uint32_t)mEntries.size());
+}
+
+bool WorkgroupTuner::enabled(void){
+    return mEnabled;
+}
+
+uint32_t WorkgroupTuner::candidates(LocalSize *out, uint32_t max){
+    uint32_t n = 0;
+
+    for(size_t i = 0; i < sizeof(sLocalSizes) / sizeof(sLocalSizes[0]) && n < max; i++){
+        const LocalSize *s = &sLocalSizes[i];
+        if((GLint)(s->x * s->y) > mMaxInvocations || (GLint)s->x > mMaxX || (GLint)s->y > mMaxY)
+            continue;
+        out[n++] = *s;
+    }
+    return n;
+}
+
+bool WorkgroupTuner::lookup(const char *kernel, GLuint threadsX, GLuint threadsY, LocalSize *out){
+    bool found = false;
+
+    pthread_mutex_lock(&mLock);
+    for(size_t i = 0; i < mEntries.size() && !found; i++){
+        const Entry *e = &mEntries[i];
+        if(e->threadsX == threadsX && e->threadsY == threadsY && strcmp(e->kernel, kernel) == 0 &&
+           strcmp(e->renderer, mRenderer) == 0){
+            *out = e->size;
+            found = true;
+        }
+    }
+    pthread_mutex_unlock(&mLock);
+    return found;
+}
+
+// Index of the entry for e's renderer, kernel and grid, -1 if there is none
+//static
+int WorkgroupTuner::find(const std::vector<Entry> *entries, const Entry *e){
+    for(size_t i = 0; i < entries->size(); i++){
+        const Entry *o = &(*entries)[i];
+        if(o->threadsX == e->threadsX && o->threadsY == e->threadsY && strcmp(o->kernel, e->kernel) == 0 &&
+           strcmp(o->renderer, e->renderer) == 0)
+            return (int)i;
+    }
+    return -1;
+}
+
+void WorkgroupTuner::store(const char *kernel, GLuint threadsX, GLuint threadsY, LocalSize size){
+    Entry e;
+    int i;
+
+    memset(&e, 0, sizeof(e));
+    snprintf(e.renderer, sizeof(e.renderer), "%s", mRenderer);
+    snprintf(e.kernel, sizeof(e.kernel), "%s", kernel);
+    e.threadsX = threadsX;
+    e.threadsY = threadsY;
+    e.size = size;
+
+    pthread_mutex_lock(&mLock);
+    i = find(&mEntries, &e);
+    if(i >= 0)
+        mEntries[i] = e;
+    else
+        mEntries.push_back(e);
+    if(mFile[0] != 0)
+        save();
+    pthread_mutex_unlock(&mLock);
+}
+
+// one entry per line: kernel WxH XxY renderer
+void WorkgroupTuner::load(std::vector<Entry> *entries){
+    char line[512];
+    Entry e;
+    FILE *fp = fopen(mFile, "r");
+
+    if(fp == NULL)
+        return;
+    while(fgets(line, sizeof(line), fp) != NULL){
+        memset(&e, 0, sizeof(e));
+        if(sscanf(line, "%63s %ux%u %ux%u %127[^\n]", e.kernel, &e.threadsX, &e.threadsY,
+                  &e.size.x, &e.size.y, e.renderer) != 6 || e.size.x == 0 || e.size.y == 0)
+            continue;
+        entries->push_back(e);
+    }
+    fclose(fp);
+}
+
+// temp file + rename like the program cache, readers never see half a file.
+// Other processes may have stored sizes since this one loaded the file, those
+// are read back in first so they aren't dropped; on the same key ours win.
+void WorkgroupTuner::save(void){
+    std::vector<Entry> disk;
+    char tmp[600];
+    FILE *fp;
+    bool ok = true;
+
+    load(&disk);
+    for(size_t i = 0; i < disk.size(); i++){
+        if(find(&mEntries, &disk[i]) < 0)
+            mEntries.push_back(disk[i]);
+    }
+
+    snprintf(tmp, sizeof(tmp), "%s.%d.%lx.tmp", mFile, (int)getpid(), (unsigned long)pthread_self());
+    fp = fopen(tmp, "w");
+    if(fp == NULL){
+        printf("workgroup tuning: can't write %s, errno:%d\n", tmp, errno);
+        return;
+    }
+    for(size_t i = 0; i < mEntries.size(); i++){
+        const Entry *e = &mEntries[i];
+        ok = fprintf(fp, "%s %ux%u %ux%u %s\n", e->kernel, e->threadsX, e->threadsY, e->size.x, e->size.y,
+                     e->renderer) > 0 && ok;
+    }
+    ok = fflush(fp) == 0 && fsync(fileno(fp)) == 0 && ok;
+    ok = fclose(fp) == 0 && ok;
+    if(!ok || rename(tmp, mFile) != 0){
+        printf("workgroup tuning: failed to store %s, errno:%d\n", mFile, errno);
+        unlink(tmp);
+    }
+}
@@ -0,0 +1,62 @@
+#ifndef _WORKGROUPTUNER_H_
+#define _WORKGROUPTUNER_H_
+#include <stdint.h>
+#include <pthread.h>
+#include <vector>
+#include <GLES3/gl31.h>
+
+// Workgroup size used until a kernel has been tuned
+#define DEFAULT_LOCAL_X 32
+#define DEFAULT_LOCAL_Y 32
+// Most candidate sizes tried per kernel
+#define MAX_LOCAL_SIZES 16
+
+struct LocalSize{
+	GLuint x;
+	GLuint y;
+};
+
+// Remembers the fastest compute workgroup size per GL renderer, kernel and
+// dispatch grid. Results live in a small text file next to the program
+// cache so later processes on the same device start out tuned; the timing
+// itself is done by the engine, which owns the GL resources.
+//
+// GLESCONVERT_AUTOTUNE=1 lets the engine tune sizes it has no result for,
+// otherwise untuned kernels run with DEFAULT_LOCAL_X x DEFAULT_LOCAL_Y.
+class WorkgroupTuner{
+public:
+    WorkgroupTuner();
+    ~WorkgroupTuner();
+    // GL thread, once the context is current. dir is the program cache
+    // directory, NULL keeps results in memory only.
+    void init(const char *dir);
+    bool enabled(void);
+    // Sizes within the device limits, returns how many were written
+    uint32_t candidates(LocalSize *out, uint32_t max);
+    // false if the kernel was never tuned for this grid on this renderer
+    bool lookup(const char *kernel, GLuint threadsX, GLuint threadsY, LocalSize *out);
+    void store(const char *kernel, GLuint threadsX, GLuint threadsY, LocalSize size);
+
+private:
+	struct Entry{
+		char renderer[128];
+		char kernel[64];
+		GLuint threadsX;
+		GLuint threadsY;
+		LocalSize size;
+	};
+	static int find(const std::vector<Entry> *entries, const Entry *e);
+	void load(std::vector<Entry> *entries);
+	void save(void);
+
+private:
+	pthread_mutex_t mLock;
+	std::vector<Entry> mEntries;   // every renderer in the file, merged with it on save
+	char mRenderer[128];
+	char mFile[512];
+	bool mEnabled;
+	GLint mMaxInvocations;
+	GLint mMaxX;
+	GLint mMaxY;
+};
+#endif
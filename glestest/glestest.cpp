@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <EGL/egl.h>
 #include <GLES3/gl31.h>
+#include "GLCheck.h"
 #include <stdlib.h>
 #include <string.h>
 
@@ -233,32 +234,28 @@ int initVBO(void){
 
     glGenTextures(1, &texOut);  
     glBindTexture(GL_TEXTURE_2D, texOut);
-    printf("line:%d glError:%x\n", __LINE__, glGetError());
     glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA32UI, esContext.width / 4, esContext.height);
-    printf("line:%d glError:%x\n", __LINE__, glGetError());
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    printf("line:%d glError:%x\n", __LINE__, glGetError());
+    GL_CHECK_INIT("output texture");
     
     glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texOut, 0);
-    printf("line:%d glError:%x\n", __LINE__, glGetError());
     GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
     if(status != GL_FRAMEBUFFER_COMPLETE){
         printf("failed  %x\n", status);
+        GLCheck::fail();
     }
 
     glGenBuffers(3,  esContext.vbo);
-    printf("line:%d glError:%x\n", __LINE__, glGetError()); 
     
     glGenBuffers(1, &esContext.pboid);
     glBindBuffer(GL_PIXEL_PACK_BUFFER, esContext.pboid);
     glBufferData(GL_PIXEL_PACK_BUFFER, esContext.width * esContext.height * 4, NULL, GL_DYNAMIC_READ);
     //glBindBuffer(GL_ARRAY_BUFFER, esContext.vbo[3]);
-    //printf("line:%d glError:%x\n", __LINE__, glGetError());
     //glBufferData(GL_ARRAY_BUFFER, esContext.width * esContext.height * 4, NULL, GL_DYNAMIC_READ);
-    //printf("line:%d glError:%x\n", __LINE__, glGetError());
+    GL_CHECK_INIT("buffers");
 	esContext.fboid = fboid;
     esContext.texOut = texOut;
     return 0;
@@ -266,37 +263,28 @@ int initVBO(void){
 
 void performCompute(char *y, char *u, char *v){
     glUseProgram(esContext.program);
-    printf("line:%d glError:%x\n", __LINE__, glGetError());
     glUniform1i(esContext.stride_index, esContext.width / 4);
     
     glBindBuffer(GL_ARRAY_BUFFER, esContext.vbo[0]);
-    printf("line:%d glError:%x\n", __LINE__, glGetError());
     glBufferData(GL_ARRAY_BUFFER, esContext.width * esContext.height, y, GL_DYNAMIC_DRAW);
-    printf("line:%d glError:%x\n", __LINE__, glGetError());
 
     glBindBuffer(GL_ARRAY_BUFFER, esContext.vbo[1]);
-    printf("line:%d glError:%x\n", __LINE__, glGetError());
     glBufferData(GL_ARRAY_BUFFER, esContext.width * esContext.height, u, GL_DYNAMIC_DRAW);
-    printf("line:%d glError:%x\n", __LINE__, glGetError());
 
     glBindBuffer(GL_ARRAY_BUFFER, esContext.vbo[2]);
-    printf("line:%d glError:%x\n", __LINE__, glGetError());
     glBufferData(GL_ARRAY_BUFFER, esContext.width * esContext.height, v, GL_DYNAMIC_DRAW);
-    printf("line:%d glError:%x\n", __LINE__, glGetError());
+    GL_CHECK("upload");
     
     glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, esContext.vbo[0]);
-    printf("line:%d glError:%x\n", __LINE__, glGetError());    
     glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, esContext.vbo[1]);
-    printf("line:%d glError:%x\n", __LINE__, glGetError());
     glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, esContext.vbo[2]);
-    printf("line:%d glError:%x\n", __LINE__, glGetError());
     
     //glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, esContext.vbo[3]);
 	glBindImageTexture(1, esContext.texOut, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA32UI);
-    printf("line:%d glError:%x\n", __LINE__, glGetError());
+    GL_CHECK("bind");
     
     glDispatchCompute((esContext.width/4 + 31) / 32, (esContext.height + 31) /32, 1);   // process 1920/4 1080
-    printf("line:%d glError:%x\n", __LINE__, glGetError());
+    GL_CHECK_FRAME("dispatch");
 
     glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
 }
@@ -323,6 +311,7 @@ int main(int argc, char *argv[]){
     bufout = (char *)malloc(size *4 );
 
     initEgl(width, height);
+    GLCheck::install();
     
     initProgram();
     
@@ -340,14 +329,11 @@ int main(int argc, char *argv[]){
         src = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size * 4, GL_MAP_READ_BIT);
         memcpy(bufout, src, size * 4);
         glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
-   	 	printf("line:%d glError:%x\n", __LINE__, glGetError());
+        GL_CHECK_FRAME("readback");
 
         #if 0
-        printf("line:%d glError:%x\n", __LINE__, glGetError());
         glBindBuffer(GL_ARRAY_BUFFER, esContext.vbo[3]);
-        printf("line:%d glError:%x\n", __LINE__, glGetError());
         src = glMapBufferRange(GL_ARRAY_BUFFER, 0, size * 4, GL_MAP_READ_BIT);
-        printf("line:%d glError:%x src=%p\n", __LINE__, glGetError(), src);
         
         memcpy(bufout, src, size * 4);
         glUnmapBuffer(GL_ARRAY_BUFFER);
@@ -357,6 +343,11 @@ int main(int argc, char *argv[]){
     }
     fclose(fin);
     fclose(fout);
+
+    GLErrorStats errors;
+    GLCheck::stats(&errors);
+    printf("gl checks:%llu errors:%llu failures:%llu\n", (unsigned long long)errors.checks,
+           (unsigned long long)errors.errors, (unsigned long long)errors.failures);
     
     // Get info about compute shader
     GLint value;
@@ -0,0 +1,259 @@
+#include "CPUConvert.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define HAVE_NEON 1
+#endif
+
+// Scalar reference, also handles the tail of the SIMD kernels
+static void rowScalar(const uint8_t *u, const uint8_t *v, uint32_t u_stride, uint32_t v_stride, uint8_t *dst,
+                      uint32_t width){
+    const uint8_t *u1 = u + u_stride;
+    const uint8_t *v1 = v + v_stride;
+
+    for(uint32_t x = 0; x + 1 < width; x += 2){
+        dst[x]     = (u[x] + u[x + 1] + u1[x] + u1[x + 1]) >> 2;
+        dst[x + 1] = (v[x] + v[x + 1] + v1[x] + v1[x + 1]) >> 2;
+    }
+}
+
+#ifdef HAVE_X86_SIMD
+// 16 input pixels of one plane -> 8 averaged samples in the low byte of each 16 bit lane
+static inline __m128i average2x2SSE2(__m128i r0, __m128i r1){
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i mask = _mm_set1_epi32(0xffff);
+    __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(r0, zero), _mm_unpacklo_epi8(r1, zero));
+    __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(r0, zero), _mm_unpackhi_epi8(r1, zero));
+    lo = _mm_add_epi32(_mm_srli_epi32(lo, 16), _mm_and_si128(lo, mask));
+    hi = _mm_add_epi32(_mm_srli_epi32(hi, 16), _mm_and_si128(hi, mask));
+    return _mm_packs_epi32(_mm_srli_epi32(lo, 2), _mm_srli_epi32(hi, 2));
+}
+
+static void rowSSE2(const uint8_t *u, const uint8_t *v, uint32_t u_stride, uint32_t v_stride, uint8_t *dst,
+                    uint32_t width){
+    uint32_t x;
+
+    for(x = 0; x + 16 <= width; x += 16){
+        __m128i uu = average2x2SSE2(_mm_loadu_si128((const __m128i *)(u + x)),
+                                    _mm_loadu_si128((const __m128i *)(u + u_stride + x)));
+        __m128i vv = average2x2SSE2(_mm_loadu_si128((const __m128i *)(v + x)),
+                                    _mm_loadu_si128((const __m128i *)(v + v_stride + x)));
+        // u in the low byte, v in the high byte -> UVUV in memory
+        _mm_storeu_si128((__m128i *)(dst + x), _mm_or_si128(uu, _mm_slli_epi16(vv, 8)));
+    }
+    rowScalar(u + x, v + x, u_stride, v_stride, dst + x, width - x);
+}
+
+// Same as above on 32 pixels, unpack/pack stay within 128 bit lanes so the
+// output order comes out right without a permute.
+__attribute__((target("avx2")))
+static inline __m256i average2x2AVX2(__m256i r0, __m256i r1){
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i mask = _mm256_set1_epi32(0xffff);
+    __m256i lo = _mm256_add_epi16(_mm256_unpacklo_epi8(r0, zero), _mm256_unpacklo_epi8(r1, zero));
+    __m256i hi = _mm256_add_epi16(_mm256_unpackhi_epi8(r0, zero), _mm256_unpackhi_epi8(r1, zero));
+    lo = _mm256_add_epi32(_mm256_srli_epi32(lo, 16), _mm256_and_si256(lo, mask));
+    hi = _mm256_add_epi32(_mm256_srli_epi32(hi, 16), _mm256_and_si256(hi, mask));
+    return _mm256_packs_epi32(_mm256_srli_epi32(lo, 2), _mm256_srli_epi32(hi, 2));
+}
+
+__attribute__((target("avx2")))
+static void rowAVX2(const uint8_t *u, const uint8_t *v, uint32_t u_stride, uint32_t v_stride, uint8_t *dst,
+                    uint32_t width){
+    uint32_t x;
+
+    for(x = 0; x + 32 <= width; x += 32){
+        __m256i uu = average2x2AVX2(_mm256_loadu_si256((const __m256i *)(u + x)),
+                                    _mm256_loadu_si256((const __m256i *)(u + u_stride + x)));
+        __m256i vv = average2x2AVX2(_mm256_loadu_si256((const __m256i *)(v + x)),
+                                    _mm256_loadu_si256((const __m256i *)(v + v_stride + x)));
+        _mm256_storeu_si256((__m256i *)(dst + x), _mm256_or_si256(uu, _mm256_slli_epi16(vv, 8)));
+    }
+    rowSSE2(u + x, v + x, u_stride, v_stride, dst + x, width - x);
+}
+#endif
+
+#ifdef HAVE_NEON
+static void rowNEON(const uint8_t *u, const uint8_t *v, uint32_t u_stride, uint32_t v_stride, uint8_t *dst,
+                    uint32_t width){
+    uint32_t x;
+
+    for(x = 0; x + 16 <= width; x += 16){
+        uint16x8_t us = vaddq_u16(vpaddlq_u8(vld1q_u8(u + x)), vpaddlq_u8(vld1q_u8(u + u_stride + x)));
+        uint16x8_t vs = vaddq_u16(vpaddlq_u8(vld1q_u8(v + x)), vpaddlq_u8(vld1q_u8(v + v_stride + x)));
+        uint8x8x2_t uv;
+        uv.val[0] = vshrn_n_u16(us, 2);
+        uv.val[1] = vshrn_n_u16(vs, 2);
+        vst2_u8(dst + x, uv);
+    }
+    rowScalar(u + x, v + x, u_stride, v_stride, dst + x, width - x);
+}
+#endif
+
+static CPUConvert::RowFunc selectRowFunc(const char **name){
+#ifdef HAVE_X86_SIMD
+    if(__builtin_cpu_supports("avx2")){
+        *name = "avx2";
+        return rowAVX2;
+    }
+    if(__builtin_cpu_supports("sse2")){
+        *name = "sse2";
+        return rowSSE2;
+    }
+#endif
+#ifdef HAVE_NEON
+    *name = "neon";
+    return rowNEON;
+#endif
+    *name = "c";
+    return rowScalar;
+}
+
+CPUConvert::CPUConvert(uint32_t width, uint32_t height, uint32_t uv_stride, uint32_t threads, const uint32_t *pitch):
+    mWidth(width), mHeight(height), mUVStride(uv_stride){
+    uint32_t rows = mHeight / 2;
+
+    for(uint32_t j = 0; j < 3; j++)
+        mPitch[j] = pitch != NULL && pitch[j] > 0 ? pitch[j] : mWidth;
+
+    mRowFunc = selectRowFunc(&mSimdName);
+
+    if(threads == 0){
+        long n = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = n > 0 ? n : 1;
+    }
+    if(threads > MAX_CPU_THREADS)
+        threads = MAX_CPU_THREADS;
+    if(threads > rows)
+        threads = rows > 0 ? rows : 1;
+    mThreads = threads;
+
+    mThreadRun = true;
+    mPending = 0;
+    for(uint32_t i = 0; i < mThreads; i++){
+        Worker *w = &mWorkers[i];
+        w->owner = this;
+        w->go = 0;
+        w->seen = 0;
+        w->rowBegin = rows * i / mThreads;
+        w->rowEnd = rows * (i + 1) / mThreads;
+        if(i > 0 && 0 != pthread_create(&w->thread, NULL, worker_entry, w)){
+            printf("Could not create worker thread %d\n", i);
+            // fold the rest of the rows into the threads we already have
+            mWorkers[i - 1].rowEnd = rows;
+            mThreads = i;
+            break;
+        }
+    }
+    printf("CPUConvert %dx%d simd:%s threads:%d\n", mWidth, mHeight, mSimdName, mThreads);
+}
+
+void CPUConvert::resize(uint32_t width, uint32_t height, uint32_t uv_stride, const uint32_t *pitch){
+    uint32_t rows = height / 2;
+
+    mWidth = width;
+    mHeight = height;
+    mUVStride = uv_stride;
+    for(uint32_t j = 0; j < 3; j++)
+        mPitch[j] = pitch != NULL && pitch[j] > 0 ? pitch[j] : mWidth;
+    // workers past the rows of a smaller frame get an empty range
+    for(uint32_t i = 0; i < mThreads; i++){
+        mWorkers[i].rowBegin = rows * i / mThreads;
+        mWorkers[i].rowEnd = rows * (i + 1) / mThreads;
+    }
+}
+
+CPUConvert::~CPUConvert(){
+    mThreadRun = false;
+    runWorkers();
+    for(uint32_t i = 1; i < mThreads; i++)
+        pthread_join(mWorkers[i].thread, NULL);
+}
+
+//static
+bool CPUConvert::worker_ready(void *data){
+    Worker *w = static_cast<Worker *>(data);
+    return w->go.load(std::memory_order_acquire) != w->seen;
+}
+
+//static
+bool CPUConvert::done_ready(void *data){
+    CPUConvert *me = static_cast<CPUConvert *>(data);
+    return me->mPending.load(std::memory_order_acquire) == 0;
+}
+
+//static
+void *CPUConvert::worker_entry(void *data){
+    Worker *w = static_cast<Worker *>(data);
+    CPUConvert *me = w->owner;
+
+    for(;;){
+        while(!worker_ready(w))
+            w->start.wait(worker_ready, w);
+        w->seen++;
+        if(!me->mThreadRun.load())
+            break;
+        me->convertRows(w->rowBegin, w->rowEnd);
+        if(me->mPending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            me->mDoneWait.wake();
+    }
+    return NULL;
+}
+
+// Start workers 1.. on the current job, worker 0 is the calling thread
+void CPUConvert::runWorkers(void){
+    mPending.store(mThreads - 1);
+    for(uint32_t i = 1; i < mThreads; i++){
+        mWorkers[i].go.fetch_add(1, std::memory_order_release);
+        mWorkers[i].start.wake();
+    }
+}
+
+// uv rows [begin, end), and the two luma rows above each of them for a full frame
+void CPUConvert::convertRows(uint32_t begin, uint32_t end){
+    uint8_t *uv = cy != NULL ? cdst + mHeight * mUVStride : cdst;
+
+    for(uint32_t r = begin; r < end; r++){
+        if(cy != NULL){
+            memcpy(cdst + 2 * r * mUVStride, cy + 2 * r * mPitch[0], mWidth);
+            memcpy(cdst + (2 * r + 1) * mUVStride, cy + (2 * r + 1) * mPitch[0], mWidth);
+        }
+        mRowFunc(cu + 2 * r * mPitch[1], cv + 2 * r * mPitch[2], mPitch[1], mPitch[2], uv + r * mUVStride, mWidth);
+    }
+}
+
+int CPUConvert::convert(uint8_t *u, uint8_t *v, uint8_t *dst){
+    return run(NULL, u, v, dst);
+}
+
+int CPUConvert::convertFrame(uint8_t *y, uint8_t *u, uint8_t *v, uint8_t *dst){
+    return run(y, u, v, dst);
+}
+
+int CPUConvert::run(uint8_t *y, uint8_t *u, uint8_t *v, uint8_t *dst){
+    cy = y;
+    cu = u;
+    cv = v;
+    cdst = dst;
+    runWorkers();
+    convertRows(mWorkers[0].rowBegin, mWorkers[0].rowEnd);
+    while(!done_ready(this))
+        mDoneWait.wait(done_ready, this);
+    return 0;
+}
+
+const char *CPUConvert::simdName(void){
+    return mSimdName;
+}
+
+uint32_t CPUConvert::threadCount(void){
+    return mThreads;
+}
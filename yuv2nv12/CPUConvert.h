@@ -0,0 +1,73 @@
+#ifndef _CPUCONVERT_H_
+#define _CPUCONVERT_H_
+#include <stdint.h>
+#include <pthread.h>
+#include <atomic>
+#include "Parker.h"
+
+#define MAX_CPU_THREADS 16
+
+// CPU version of the 4:4:4 -> NV12 chroma conversion, same math as the
+// compute shader in GLESConvert: every output U/V is the 2x2 average of the
+// input plane, rounded down. Rows are split across worker threads and each
+// row runs the widest SIMD kernel the CPU supports.
+class CPUConvert{
+public:
+    // threads == 0 uses one thread per online core. pitch is the bytes per
+    // row of the y, u and v planes, NULL for tightly packed ones.
+    CPUConvert(uint32_t width, uint32_t height, uint32_t uv_stride, uint32_t threads = 0,
+               const uint32_t *pitch = NULL);
+    ~CPUConvert();
+    // Same conversion at a new frame size, the threads stay. Not while a
+    // convert is running.
+    void resize(uint32_t width, uint32_t height, uint32_t uv_stride, const uint32_t *pitch = NULL);
+    int convert(uint8_t *u, uint8_t *v, uint8_t *dst);
+    // Whole NV12 frame: y rows copied at uv_stride, then the uv plane at
+    // dst + uv_stride * height
+    int convertFrame(uint8_t *y, uint8_t *u, uint8_t *v, uint8_t *dst);
+    const char *simdName(void);
+    uint32_t threadCount(void);
+
+    // one uv row from two rows of u and v, u_stride / v_stride are the input row pitches
+    typedef void (*RowFunc)(const uint8_t *u, const uint8_t *v, uint32_t u_stride, uint32_t v_stride, uint8_t *dst,
+                            uint32_t width);
+
+private:
+	struct Worker{
+		CPUConvert *owner;
+		pthread_t thread;
+		Parker start;
+		std::atomic<uint32_t> go;  // bumped by the owner for each job
+		uint32_t seen;             // last go the worker picked up
+		uint32_t rowBegin;
+		uint32_t rowEnd;
+	};
+
+	static void *worker_entry(void *data);
+	static bool worker_ready(void *data);
+	static bool done_ready(void *data);
+	void runWorkers(void);
+	void convertRows(uint32_t begin, uint32_t end);
+	int run(uint8_t *y, uint8_t *u, uint8_t *v, uint8_t *dst);
+
+private:
+	uint32_t mWidth;
+	uint32_t mHeight;
+	uint32_t mUVStride;
+	uint32_t mPitch[3];  // y, u, v bytes per row
+
+	RowFunc mRowFunc;
+	const char *mSimdName;
+
+	Worker mWorkers[MAX_CPU_THREADS];
+	uint32_t mThreads;   // worker 0 is the calling thread
+	std::atomic<uint32_t> mPending;  // workers still converting
+	Parker mDoneWait;
+	std::atomic<bool> mThreadRun;
+
+	uint8_t *cy;
+	uint8_t *cu;
+	uint8_t *cv;
+	uint8_t *cdst;
+};
+#endif
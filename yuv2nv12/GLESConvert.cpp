@@ -1,332 +1,296 @@
 #include "GLESConvert.h"
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+
+
+GLESConvert::GLESConvert(uint32_t width, uint32_t height, uint32_t uv_stride, uint32_t depth,
+                         ConvertBackend backend, NV12Output output, KernelMath math, const PlaneLayout *input,
+                         uint32_t workers):
+    mWidth(width), mHeight(height), mUVStride(uv_stride), mOutput(output), mPool(NULL), mCpu(NULL), mTiming(0),
+    mSliceCount(1), mSliceFn(NULL), mSliceCtx(NULL){
+    const KernelDesc *kernel;
+    uint32_t first = output == NV12_FULL_FRAME ? 0 : 1;
+    PlaneLayout planes;
+    uint32_t pitch[MAX_PLANES];
+
+    if(output == NV12_FULL_FRAME)
+        kernel = math == MATH_FIXED ? &kernel444ToNV12FullFixed : &kernel444ToNV12Full;
+    else
+        kernel = math == MATH_FIXED ? &kernel444ToNV12Fixed : &kernel444ToNV12;
+
+    if(backend == BACKEND_AUTO){
+        const char *env = getenv("GLESCONVERT_BACKEND");
+        if(env != NULL && strcmp(env, "gpu") == 0)
+            backend = BACKEND_GPU;
+        else if(env != NULL && strcmp(env, "cpu") == 0)
+            backend = BACKEND_CPU;
+    }
 
+    resolveInput(input, &planes);
+    if(backend != BACKEND_CPU){
+        mPool = StreamCache::get(kernel, mWidth, mHeight, mUVStride, depth, workers, &planes);
+        if(mPool->ready()){
+            backend = BACKEND_GPU;
+        }else if(backend == BACKEND_AUTO){
+            printf("GLES compute not available, falling back to CPU\n");
+            delete mPool;
+            mPool = NULL;
+            backend = BACKEND_CPU;
+        }
+    }
+    if(backend == BACKEND_CPU){
+        mPool = new StreamPool(kernel, mWidth, mHeight, mUVStride, depth, 1, cpu_entry, this, &planes);
+        // frames are converted from the staging planes
+        memset(pitch, 0, sizeof(pitch));
+        for(uint32_t j = first; j < MAX_PLANES; j++)
+            pitch[j] = mPool->inputPitch(j - first);
+        mCpu = new CPUConvert(mWidth, mHeight, mUVStride, 0, pitch);
+    }
+    mBackend = backend;
+}
 
-GLESConvert::GLESConvert(uint32_t width, uint32_t height, uint32_t uv_stride):
-    mWidth(width), mHeight(height), mUVStride(uv_stride), display(EGL_NO_DISPLAY), context(EGL_NO_CONTEXT){
-    num_groups_x = (mWidth / 4 + 31) / 32; //process 4 pixels together
-    num_groups_y = (mHeight/2 + 31) / 32;  //uv height is half of y
-
-    mOutBufSize = mUVStride * mHeight / 2;
-
-    mThreadRun = false;
+GLESConvert::~GLESConvert(){
+    // GPU pools stay warm for the next converter of this kind and size
+    if(mBackend == BACKEND_CPU)
+        delete mPool;
+    else
+        StreamCache::put(mPool);
+    delete mCpu;
+}
 
-    sem_init(&mGLSem, 0, 0);
-    sem_init(&mCustSem, 0, 0);
-    
-    if(0 != pthread_create(&mThread, NULL, gles_entry, this)){
-        printf("Could not create dispatch thread\n");
+// the stream's planes: y, u, v for a full frame, u, v for the uv plane
+void GLESConvert::resolveInput(const PlaneLayout *input, PlaneLayout *planes){
+    uint32_t first = mOutput == NV12_FULL_FRAME ? 0 : 1;
+
+    memset(&mInput, 0, sizeof(mInput));
+    if(input != NULL)
+        mInput = *input;
+    memset(planes, 0, sizeof(*planes));
+    // no offsets: y, u, v back to back at their strides
+    bool packed = mInput.offset[0] == 0 && mInput.offset[1] == 0 && mInput.offset[2] == 0;
+    for(uint32_t j = 0; j < MAX_PLANES; j++){
+        if(mInput.stride[j] == 0)
+            mInput.stride[j] = mWidth;
+        if(packed)
+            mInput.offset[j] = j > 0 ? mInput.offset[j - 1] + mInput.stride[j - 1] * mHeight : 0;
+        if(j >= first){
+            planes->stride[j - first] = mInput.stride[j];
+            planes->offset[j - first] = mInput.offset[j];
+        }
     }
 }
 
-GLESConvert::~GLESConvert(){    
-
-    mThreadRun = false;
-    
-    sem_post(&mGLSem);
-    sem_post(&mCustSem);
+int GLESConvert::reconfigure(uint32_t width, uint32_t height, uint32_t uv_stride, const PlaneLayout *input){
+    const PoolParams *p = mPool->params();
+    uint32_t oldWidth = mWidth, oldHeight = mHeight, oldStride = mUVStride;
+    uint32_t first = mOutput == NV12_FULL_FRAME ? 0 : 1;
+    PlaneLayout oldInput = mInput;
+    PlaneLayout planes;
+    uint32_t pitch[MAX_PLANES];
+    StreamPool *pool;
+
+    if(!mPool->idle()){
+        printf("reconfigure needs every frame retrieved and released\n");
+        return -1;
+    }
+    mWidth = width;
+    mHeight = height;
+    mUVStride = uv_stride;
+    resolveInput(input, &planes);
+    if(mWidth == p->width && mHeight == p->height && mUVStride == p->stride &&
+       memcmp(&planes, &p->input, sizeof(planes)) == 0)
+        return 0;
+
+    // the engines stay up, this pool holds on to them before the old one goes
+    if(mBackend == BACKEND_CPU)
+        pool = new StreamPool(p->desc, mWidth, mHeight, mUVStride, p->depth, 1, cpu_entry, this, &planes);
+    else
+        pool = StreamCache::get(p->desc, mWidth, mHeight, mUVStride, p->depth, p->workers, &planes);
+    if(!pool->ready()){
+        printf("can't convert %dx%d, staying at %dx%d\n", mWidth, mHeight, oldWidth, oldHeight);
+        delete pool;
+        mWidth = oldWidth;
+        mHeight = oldHeight;
+        mUVStride = oldStride;
+        mInput = oldInput;
+        return -1;
+    }
+    if(mBackend == BACKEND_CPU)
+        delete mPool;
+    else
+        StreamCache::put(mPool);
+    mPool = pool;
+    mPool->setTiming(mTiming);
+    // the new size may not take the slices, then the frames come whole
+    if(mSliceFn != NULL && mPool->setSlices(mSliceCount, mSliceFn, mSliceCtx) != 0){
+        printf("%d slices dropped at %dx%d\n", mSliceCount, mWidth, mHeight);
+        mSliceFn = NULL;
+        mSliceCtx = NULL;
+    }
 
-    int status = pthread_join(mThread, NULL);
-    if (status != 0) {
-       printf("pthread_join error:%d\n", status);
+    if(mBackend == BACKEND_CPU){
+        memset(pitch, 0, sizeof(pitch));
+        for(uint32_t j = first; j < MAX_PLANES; j++)
+            pitch[j] = mPool->inputPitch(j - first);
+        mCpu->resize(mWidth, mHeight, mUVStride, pitch);
     }
+    return 0;
+}
 
-    sem_destroy(&mGLSem);
-    sem_destroy(&mCustSem);
+//static
+int GLESConvert::prewarm(const char *list, uint32_t depth, NV12Output output, KernelMath math, uint32_t workers){
+    uint32_t width, height, stride;
+    int warmed = 0;
+
+    while(StreamCache::nextSize(&list, &width, &height, &stride) == 0){
+        // deleting it hands the pool to the cache
+        GLESConvert convert(width, height, stride > 0 ? stride : width, depth, BACKEND_GPU, output, math, NULL,
+                            workers);
+        // an explicit BACKEND_GPU stays one even when GL init failed
+        if(convert.ready())
+            warmed++;
+    }
+    return warmed;
 }
 
 //static
-void *GLESConvert::gles_entry(void *data){
-    GLESConvert *me = static_cast<GLESConvert *>(data);
-    me->glesMain();
-    return NULL;
+void GLESConvert::cpu_entry(void *ctx, uint8_t **planes, uint8_t *dst){
+    GLESConvert *me = static_cast<GLESConvert *>(ctx);
+    if(me->mOutput == NV12_FULL_FRAME)
+        me->mCpu->convertFrame(planes[0], planes[1], planes[2], dst);
+    else
+        me->mCpu->convert(planes[0], planes[1], dst);
 }
 
-void GLESConvert::glesMain(void){
-    void *src;
-    
-    initEgl();
-    initProgram();
-    initFBO();
-    
-
-    mThreadRun = true;
-    sem_post(&mCustSem);
-    for(;;){
-        sem_wait(&mGLSem);
-        if (!mThreadRun)
-            break;
-        performCompute(cu, cv);
-        
-        glReadBuffer(GL_COLOR_ATTACHMENT0);
-        glReadPixels(0, 0, mUVStride / 4, mHeight / 2, GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, 0);
-        src = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, mOutBufSize , GL_MAP_READ_BIT);
-        memcpy(cdst, src, mOutBufSize);
-        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
-        sem_post(&mCustSem);
-    }
-    cleanGLES();
-    return;
+int GLESConvert::convert(uint8_t *u, uint8_t *v, uint8_t * dst){
+    if(submit(u, v, dst) != 0)
+        return -1;
+    return retrieve(NULL);
 }
 
-int GLESConvert::initEgl(){
-	EGLint major,minor;
-
-	display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
-	if (display == EGL_NO_DISPLAY){
-		printf("unable to open connection to local windowing system, error:%d\n", eglGetError());
-		return -1;
-	}
-
-	if (!eglInitialize(display, &major, &minor)){
-		printf("unable to initialize EGL, error:%d\n", eglGetError());
-		return -1;
-	}
-	printf("EGL Verion:%d.%d\n", major, minor);
-
-	EGLint attribs [] = {
-		EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
-		EGL_RENDERABLE_TYPE, EGL_OPENGL_ES2_BIT,
-		EGL_RED_SIZE, 8,
-		EGL_GREEN_SIZE, 8,
-		EGL_BLUE_SIZE, 8,
-		EGL_DEPTH_SIZE, 0,
-		EGL_NONE
-	};
-
-	EGLint numConfigs;
-	EGLConfig config;
-	if (!eglChooseConfig(display, attribs, &config, 1, &numConfigs)){
-		printf("can't find suitable configs, error:%d\n", eglGetError());
-		return -1;
-	}
-    
-    EGLint value;
-	eglGetConfigAttrib(display, config, EGL_SURFACE_TYPE, &value);
-	printf("EGL_SURFACE_TYPE:%x\n", value);
-
-	eglGetConfigAttrib(display, config, EGL_MAX_PBUFFER_WIDTH, &value);
-	printf("EGL_MAX_PBUFFER_WIDTH:%x\n", value);
-    
-    EGLint contextAttrib[] = {
-		EGL_CONTEXT_CLIENT_VERSION, 3,
-		EGL_NONE
-	};
-
-	context = eglCreateContext(display, config, NULL, contextAttrib);
-	if (context == EGL_NO_CONTEXT){
-		printf("Can't Create EGLContext, error:%d\n", eglGetError());
-		return -1;
-	}
-
-#ifdef USE_PBUFFER
-    EGLint attrib_pb[] = {
-        EGL_WIDTH, 1, 
-        EGL_HEIGHT, 1, 
-        EGL_NONE
-    };
-    
-    surface = eglCreatePbufferSurface(display, config, attrib_pb);
-    if (eglMakeCurrent(display, surface, surface, context) == EGL_FALSE){
-        printf("Initilize error at eglMakeCurrent, error:%d\n", eglGetError());
+int GLESConvert::convert(uint8_t *y, uint8_t *u, uint8_t *v, uint8_t *dst){
+    if(submit(y, u, v, dst) != 0)
         return -1;
-    }
-#else
-	if (eglMakeCurrent(display, NULL, NULL, context) == EGL_FALSE){
-		printf("Initilize error at eglMakeCurrent, error:%d\n", eglGetError());
-		return -1;
-	}
-#endif
-	return 0;
+    return retrieve(NULL);
+}
 
+int GLESConvert::submit(uint8_t *u, uint8_t *v, uint8_t *dst){
+    uint8_t *planes[2] = {u, v};
+
+    if(mOutput != NV12_UV_PLANE)
+        return -1;
+    return mPool->submit(planes, dst);
 }
 
-GLuint loadShader(GLenum type, const char *shaderSrc){
-	GLuint shader;
-	GLint compiled;
-
-	// Create the shader object
-	shader = glCreateShader(type);
-	if (shader == 0){
-		return 0;
-	}
-	// Load the shader source
-	glShaderSource(shader, 1, &shaderSrc, NULL);
-	// Compile the shader
-	glCompileShader(shader);
-	// Check the compile status
-	glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
-	if (!compiled){
-		GLint infoLen = 0;
-		glGetShaderiv ( shader, GL_INFO_LOG_LENGTH, &infoLen );
-		if (infoLen > 1){
-			char *infoLog = (char *)malloc(sizeof (char) * infoLen);
-
-			glGetShaderInfoLog (shader, infoLen, NULL, infoLog);
-			printf("Error compiling shader:\n%s\n", infoLog);
-			free ( infoLog );
-		}
-		glDeleteShader ( shader );
-		return 0;
-	}
-	return shader;
+int GLESConvert::submit(uint8_t *y, uint8_t *u, uint8_t *v, uint8_t *dst){
+    uint8_t *planes[3] = {y, u, v};
+
+    if(mOutput != NV12_FULL_FRAME)
+        return -1;
+    return mPool->submit(planes, dst);
 }
 
-int GLESConvert::initProgram(void){
-    GLuint computeShader;
-    GLint linked;
-    const char *shader_source = 
-            "#version 310 es\n"
-            "layout(local_size_x = 32, local_size_y = 32, local_size_z = 1) in;\n"
-            "layout(binding = 0, rgba8ui) readonly uniform  uimage2D u_image; \n"
-            "layout(binding = 1, rgba8ui) readonly uniform  uimage2D v_image; \n"
-            "layout(binding = 2, rgba8ui) writeonly uniform  uimage2D output_image;\n"
-            "void main(void){\n"
-            "    ivec2 pos = ivec2(gl_GlobalInvocationID.xy);\n"
-            "    ivec2 index = pos;\n"
-            "    index.y *= 2;\n"
-            "    vec4 u = vec4(imageLoad(u_image, index));\n"
-            "    vec4 v = vec4(imageLoad(v_image, index));\n"
-            "    index.y += 1;\n"
-            "    u += vec4(imageLoad(u_image, index));\n"
-            "    v += vec4(imageLoad(v_image, index));\n"
-            "    u.x += u.y;\n"
-            "    u.z += u.w;\n"
-            "    u.y = v.x + v.y;\n"
-            "    u.w = v.z + v.w;\n"
-            "    u = u * 0.25 ;\n"
-			"    imageStore(output_image, pos, uvec4(u));\n"
-            "}\n";
-    
-    // Load the vertex/fragment shaders
-    computeShader = loadShader(GL_COMPUTE_SHADER, shader_source);
-
-    // Create the program object
-    program = glCreateProgram();
-    glAttachShader(program, computeShader);
-    // Link the program
-    glLinkProgram(program);
-
-    // Check the link status
-    glGetProgramiv(program, GL_LINK_STATUS, &linked);
-    if(!linked){
-        GLint infoLen = 0;
-        glGetProgramiv(program, GL_INFO_LOG_LENGTH, &infoLen);
-        if (infoLen > 1){
-            char *infoLog = (char *)malloc(sizeof (char) * infoLen);
-
-            glGetProgramInfoLog(program, infoLen, NULL, infoLog);
-            printf("Error linking program:\n%s\n", infoLog);
-            free(infoLog);
-        }
-        glDeleteProgram(program);
+int GLESConvert::submitFrame(uint8_t *frame, uint8_t *dst){
+    if(mOutput == NV12_FULL_FRAME)
+        return submit(frame + mInput.offset[0], frame + mInput.offset[1], frame + mInput.offset[2], dst);
+    return submit(frame + mInput.offset[1], frame + mInput.offset[2], dst);
+}
+
+int GLESConvert::submitFd(int fd, uint8_t *dst){
+    return mPool->submitFd(fd, dst);
+}
+
+int GLESConvert::getInputBuffer(uint8_t **u, uint8_t **v){
+    uint8_t *planes[2];
+
+    if(mOutput != NV12_UV_PLANE || mPool->getInputBuffer(planes) != 0)
         return -1;
-    }
-    
-    glDeleteShader(computeShader);
+    *u = planes[0];
+    *v = planes[1];
     return 0;
 }
 
-int GLESConvert::initFBO(void){
-    glGenFramebuffers(1, &fboid);
-    glBindFramebuffer(GL_FRAMEBUFFER, fboid);
-
-    glGenTextures(2, texIn); 
-    printf("texIn:%d,%d\n", texIn[0], texIn[1]);
-    glBindTexture(GL_TEXTURE_2D, texIn[0]);
-    printf("line:%d glError:%x\n", __LINE__, glGetError());
-    glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8UI, mWidth / 4, mHeight);
-    printf("line:%d glError:%x\n", __LINE__, glGetError());
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    printf("line:%d glError:%x\n", __LINE__, glGetError()); 
-
-    glBindTexture(GL_TEXTURE_2D, texIn[1]);
-    printf("line:%d glError:%x\n", __LINE__, glGetError());
-    glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8UI, mWidth / 4, mHeight);
-    printf("line:%d glError:%x\n", __LINE__, glGetError());
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    printf("line:%d glError:%x\n", __LINE__, glGetError()); 
-
-    glGenTextures(1, &texOut);  
-    glBindTexture(GL_TEXTURE_2D, texOut);
-    glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8UI, mUVStride / 4, mHeight / 2);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    printf("line:%d glError:%x\n", __LINE__, glGetError());
-    
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texOut, 0);
-    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
-    if(status != GL_FRAMEBUFFER_COMPLETE){
-        printf("failed  %x\n", status);
-    }    
-    printf("line:%d glError:%x\n", __LINE__, glGetError());
-
-    glGenBuffers(1, &pboid);
-    glBindBuffer(GL_PIXEL_PACK_BUFFER, pboid);
-    glBufferData(GL_PIXEL_PACK_BUFFER, mOutBufSize, NULL, GL_DYNAMIC_READ);
+int GLESConvert::getInputBuffer(uint8_t **y, uint8_t **u, uint8_t **v){
+    uint8_t *planes[3];
+
+    if(mOutput != NV12_FULL_FRAME || mPool->getInputBuffer(planes) != 0)
+        return -1;
+    *y = planes[0];
+    *u = planes[1];
+    *v = planes[2];
     return 0;
 }
 
-void GLESConvert::performCompute(uint8_t *u, uint8_t *v){
+int GLESConvert::submitInput(uint8_t *dst){
+    return mPool->submitInput(dst);
+}
 
-    glUseProgram(program);
+void GLESConvert::cancelInput(void){
+    mPool->cancelInput();
+}
 
-    
+uint32_t GLESConvert::getInputStride(uint32_t plane){
+    return mPool->inputPitch(plane);
+}
 
-    glBindTexture(GL_TEXTURE_2D, texIn[0]);
-    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0,  mWidth / 4, mHeight, GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, u);
-    printf("line:%d glError:%x\n", __LINE__, glGetError());
+int GLESConvert::retrieve(uint8_t **dst){
+    return mPool->retrieve(dst);
+}
 
-    glBindTexture(GL_TEXTURE_2D, texIn[1]);
-    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0,  mWidth / 4, mHeight, GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, v);
-    printf("line:%d glError:%x\n", __LINE__, glGetError());
+int GLESConvert::acquire(const uint8_t **data){
+    return mPool->acquire(data);
+}
 
-    glBindImageTexture(0, texIn[0], 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA8UI);
-    glBindImageTexture(1, texIn[1], 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA8UI);
-    glBindImageTexture(2, texOut, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA8UI);
-    printf("line:%d glError:%x\n", __LINE__, glGetError());
+int GLESConvert::release(const uint8_t *data){
+    return mPool->release(data);
+}
 
-    glDispatchCompute(num_groups_x, num_groups_y, 1);
-    printf("line:%d glError:%x\n", __LINE__, glGetError());
+uint32_t GLESConvert::getOutputStride(void){
+    return mPool->outputStride();
+}
 
-    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+void GLESConvert::waitGLInit(void){
 }
 
-int GLESConvert::convert(uint8_t *u, uint8_t *v, uint8_t * dst){
-    if(!mThreadRun)
-        return -1;
-    cu = u;
-    cv = v;
-    cdst = dst;
-    sem_post(&mGLSem);
-    
-    sem_wait(&mCustSem);    
+ConvertBackend GLESConvert::getBackend(void){
+    return mBackend;
 }
 
-void GLESConvert::waitGLInit(void){
-    sem_wait(&mCustSem);
+bool GLESConvert::ready(void){
+    return mPool->ready();
+}
+
+NV12Output GLESConvert::getOutput(void){
+    return mOutput;
+}
+
+uint32_t GLESConvert::getWorkers(void){
+    return mPool->workers();
+}
+
+uint64_t GLESConvert::getWorkerFrames(uint32_t worker){
+    return mPool->frames(worker);
 }
 
-void GLESConvert::cleanGLES(void){    
-    glDeleteProgram(program);
-
-    glDeleteTextures(2, texIn);
-    glDeleteTextures(1, &texOut);
-    glDeleteFramebuffers(1, &fboid);
-    glDeleteBuffers(1, &pboid);    
-#ifdef USE_PBUFFER
-    eglDestroySurface(display, surface);
-#endif
-    eglDestroyContext(display, context);
-    eglTerminate(display);
-    eglReleaseThread();
+void GLESConvert::setTiming(uint32_t every){
+    mTiming = every;
+    mPool->setTiming(every);
+}
+
+int GLESConvert::getStageStats(ConvertStage stage, StageStats *stats){
+    return mPool->stageStats(stage, stats);
+}
+
+void GLESConvert::getFdStats(uint64_t *imported, uint64_t *mapped, uint64_t *misses){
+    mPool->fdStats(imported, mapped, misses);
+}
+
+int GLESConvert::setSlices(uint32_t count, GLStream::SliceFunc fn, void *ctx){
+    if(mPool->setSlices(count, fn, ctx) != 0)
+        return -1;
+    mSliceCount = count;
+    mSliceFn = fn;
+    mSliceCtx = ctx;
+    return 0;
 }
@@ -1,66 +1,122 @@
 #ifndef _GLESCONVERT_H_
 #define _GLESCONVERT_H_
 #include <stdint.h>
-#include <EGL/egl.h>
-#include <GLES3/gl31.h>
-#include <pthread.h>
-#include <semaphore.h>
+#include "GLEngine.h"
+#include "GLStream.h"
+#include "StreamPool.h"
+#include "StreamCache.h"
+#include "CPUConvert.h"
 
+enum NV12Output{
+	NV12_UV_PLANE = 0,  // u, v in, uv plane out (uv_stride * height / 2)
+	NV12_FULL_FRAME,    // y, u, v in, y plane then uv plane out (uv_stride * height * 3 / 2)
+};
 
-// Some platform can't do eglMakeCurrent with NULL surface
-// So use pbuffer to create a 1x1 surface
-#define USE_PBUFFER 1
-
+// 4:4:4 -> NV12 on the shared GLEngine. The plane count of convert(),
+// submit() and getInputBuffer() must match the output mode, -1 otherwise.
+// MATH_FIXED runs the integer only kernels, the output is the same.
+//
+// input gives the decoder's plane layout, y, u, v in that order (the
+// uv plane mode ignores y): submit() reads rows at its strides,
+// submitFrame() and submitFd() take the whole buffer at its offsets. NULL,
+// or no offsets, is y, u, v back to back. The width has to be even, uv_stride only has to cover it.
+//
+// BACKEND_GPU spreads frames over workers engines (StreamPool), 0 takes
+// GLESCONVERT_WORKERS. Every worker has depth slots of its own. GPU
+// converters take their pool from the process wide StreamCache and give it
+// back when they are deleted.
+//
+// reconfigure() switches to another frame size between frames. Engines,
+// contexts and kernels stay, the pool of the old size goes back to the
+// StreamCache and the new one comes from it, so recently used sizes come
+// back without GPU work.
 class GLESConvert{
 public:
-    GLESConvert(uint32_t width, uint32_t height, uint32_t uv_stride);
+    GLESConvert(uint32_t width, uint32_t height, uint32_t uv_stride, uint32_t depth = 2,
+                ConvertBackend backend = BACKEND_AUTO, NV12Output output = NV12_UV_PLANE,
+                KernelMath math = MATH_FLOAT, const PlaneLayout *input = NULL, uint32_t workers = 0);
     ~GLESConvert();
+    // Warm the StreamCache for every size in list, "WxH[:uv_stride],..."
+    // with the stride defaulting to the width. Returns how many sizes could
+    // be warmed.
+    static int prewarm(const char *list, uint32_t depth = 2, NV12Output output = NV12_UV_PLANE,
+                       KernelMath math = MATH_FLOAT, uint32_t workers = 0);
+    // New frame size and input layout (NULL: tightly packed), -1 while
+    // frames are queued, unretrieved or held, or if the new size can't be
+    // set up, the converter then keeps the old one. Timing and slice
+    // settings carry over.
+    int reconfigure(uint32_t width, uint32_t height, uint32_t uv_stride, const PlaneLayout *input = NULL);
+    // Synchronous conversion, same as submit() followed by retrieve()
     int convert(uint8_t *u, uint8_t *v, uint8_t *dst);
+    int convert(uint8_t *y, uint8_t *u, uint8_t *v, uint8_t *dst);
+    // Queue one frame without blocking, -1 when depth frames are already
+    // queued or unretrieved.
+    // u and v are copied into the staging ring before this returns, dst must
+    // stay valid until the frame is retrieved.
+    int submit(uint8_t *u, uint8_t *v, uint8_t *dst);
+    int submit(uint8_t *y, uint8_t *u, uint8_t *v, uint8_t *dst);
+    // Either of the above with the planes at the input layout's offsets into frame
+    int submitFrame(uint8_t *frame, uint8_t *dst);
+    // Same with the frame in a dma-buf or memfd, see GLStream::submitFd().
+    // Imported dma-bufs have to stay unchanged until the frame is retrieved.
+    int submitFd(int fd, uint8_t *dst);
+    // Zero copy upload: get the staging memory of the next free slot so the
+    // decoder can write the planes straight into it, then queue it with
+    // submitInput() or give it back with cancelInput().
+    int getInputBuffer(uint8_t **u, uint8_t **v);
+    int getInputBuffer(uint8_t **y, uint8_t **u, uint8_t **v);
+    int submitInput(uint8_t *dst);
+    void cancelInput(void);
+    // Bytes per row of getInputBuffer() plane 0..2 of the output mode, the
+    // decoder's stride when the kernel can read it as is
+    uint32_t getInputStride(uint32_t plane);
+    // Wait for the oldest submitted frame, frames come back in submit order
+    int retrieve(uint8_t **dst);
+    // Zero copy retrieve for frames submitted with dst == NULL: hands out a
+    // read-only view of the mapped pack buffer instead of copying it. The
+    // view stays valid until release(), and holds on to its pipeline slot.
+    int acquire(const uint8_t **data);
+    int release(const uint8_t *data);
+    // Bytes per row of acquire() views, uv_stride rounded up to a multiple of 4
+    uint32_t getOutputStride(void);
+	// The constructor already waits for the shared engine, kept for old callers
 	void waitGLInit(void);
+	ConvertBackend getBackend(void);
+	// false if the converter's streams could not be set up (no GL)
+	bool ready(void);
+	NV12Output getOutput(void);
+	// Pool size, and frames each worker has been given
+	uint32_t getWorkers(void);
+	uint64_t getWorkerFrames(uint32_t worker);
+	// Per stage timing, see GLStream::setTiming(), the first worker's stats
+	void setTiming(uint32_t every);
+	int getStageStats(ConvertStage stage, StageStats *stats);
+	// submitFd() frames imported / copied from a mapping, and buffers
+	// imported or mapped first, see GLStream::fdStats()
+	void getFdStats(uint64_t *imported, uint64_t *mapped, uint64_t *misses);
+	// Hand out each frame in count horizontal slices as they finish, see
+	// GLStream::setSlices(). Only between frames.
+	int setSlices(uint32_t count, GLStream::SliceFunc fn, void *ctx);
 
 private:
-	static void *gles_entry(void *data);
-	void glesMain(void);
-
-	int initEgl(void);
-	int initProgram(void);
-	int initFBO(void);
-	void performCompute(uint8_t *u, uint8_t *v);
+	static void cpu_entry(void *ctx, uint8_t **planes, uint8_t *dst);
+	void resolveInput(const PlaneLayout *input, PlaneLayout *planes);
 
-	void cleanGLES(void);
 private:
 	uint32_t mWidth;
 	uint32_t mHeight;
 	uint32_t mUVStride;
+	NV12Output mOutput;
+	PlaneLayout mInput;  // y, u, v, strides and offsets resolved
 
-	pthread_t mThread;
-	uint8_t *cu;
-	uint8_t *cv;
-	uint8_t *cdst;
-	sem_t mGLSem;
-	sem_t mCustSem;
-	
-	bool mThreadRun;
-	
-	// OPENGL ES 3.1 ComputeShader
-	EGLDisplay display;
-	EGLContext context;
-#ifdef USE_PBUFFER
-	EGLSurface surface; 
-#endif
-	//framebuffer object
-	GLuint fboid;
-    GLuint texIn[2];
-    GLuint texOut;
-
-    //Vertex Buffer Object
-    GLuint pboid;
-	
-	// computer program
-    GLuint program;
+	StreamPool *mPool;
+	ConvertBackend mBackend;
+	CPUConvert *mCpu;
 
-	GLuint num_groups_x;
-	GLuint num_groups_y;
-	GLsizeiptr mOutBufSize;
+	// what reconfigure() hands on to the next pool
+	uint32_t mTiming;
+	uint32_t mSliceCount;
+	GLStream::SliceFunc mSliceFn;
+	void *mSliceCtx;
 };
 #endif
@@ -1,53 +1,527 @@
 #include "GLESConvert.h"
+#include "FrameIO.h"
+#include "TestPattern.h"
+#include "GLCheck.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
+#include <unistd.h>
 
 void usage(char *name){
 	printf("offscreen render\n");
-	printf("%s texfile savefile width height stride cnt\n", name);
+	printf("%s texfile savefile width height stride cnt [depth] [auto|gpu|cpu|check] [math]\n", name);
+	printf("%s golden\n", name);
+	printf("%s bench width height cnt\n", name);
+	printf("  check: convert on the GPU and compare every frame with CPUConvert\n");
+	printf("  math: float (default) or fixed\n");
+	printf("  golden: both kernels and output modes against CPUConvert on test patterns and plane layouts,\n");
+	printf("          then converters resized through every size\n");
+	printf("  bench: float and fixed kernels on random frames, fps, GPU dispatch time, start and resize time\n");
+	printf("  GLESCONVERT_GL_CHECK=N: check for GL errors every Nth frame, GLESCONVERT_GL_DEBUG=high|medium|low|all:\n");
+	printf("          KHR_debug severity of GLCHECK=1 builds\n");
+	printf("  GLESCONVERT_WORKERS=N: spread GPU frames over N GL threads and contexts, bench compares 1..N\n");
+	printf("  GLESCONVERT_WARM=WxH[:stride],...: prewarm converters of those sizes, bench times cold and warm starts\n");
 	exit(0);
 }
+
+// hands the oldest frame to the writer thread, returns 1 if it differs from ref
+static int writeFrame(FrameWriter *writer, GLESConvert *convert, const uint8_t *ref,
+                      int frame, int width, int stride, int height){
+	uint8_t *nv12;
+	int diff = 0;
+
+	convert->retrieve(&nv12);
+	if (ref != NULL){
+		for (int i = 0; i < height * 3 / 2; i++)
+			for (int j = 0; j < width; j++)
+				diff += nv12[i * stride + j] != ref[i * stride + j];
+	}
+	writer->put(stride * height * 3 / 2);
+	if (diff > 0)
+		printf("frame %d: %d bytes differ from the CPU reference\n", frame, diff);
+	return diff > 0;
+}
+
+// GLESCONVERT_TIMING=N samples every Nth frame
+static void printTiming(GLESConvert *convert){
+	static const char *names[STAGE_COUNT] = {"upload", "dispatch", "readback", "map", "copy"};
+	StageStats st;
+
+	for (int s = 0; s < STAGE_COUNT; s++){
+		if (convert->getStageStats((ConvertStage)s, &st) != 0 || st.count == 0)
+			continue;
+		printf("%-8s %s n:%3u min:%7.3fms mean:%7.3fms p50:%7.3fms p99:%7.3fms\n", names[s],
+		       st.gpu ? "gpu" : "cpu", st.count, st.minNs / 1e6, st.meanNs / 1e6, st.p50Ns / 1e6, st.p99Ns / 1e6);
+	}
+}
+
+// GL errors the checks found and failures the streams hit, sampled
+// checks only in release builds (GLESCONVERT_GL_CHECK=N)
+static void printGLErrors(void){
+	GLErrorStats es;
+
+	GLCheck::stats(&es);
+	if (es.errors == 0 && es.failures == 0 && es.messages == 0)
+		return;
+	printf("gl checks:%llu errors:%llu last:%x failures:%llu debug messages:%llu\n", (unsigned long long)es.checks,
+	       (unsigned long long)es.errors, es.lastError, (unsigned long long)es.failures,
+	       (unsigned long long)es.messages);
+}
+
+// GLESCONVERT_WORKERS=N: how the pool spread the frames
+static void printWorkers(GLESConvert *convert){
+	if (convert->getWorkers() < 2)
+		return;
+	printf("workers:%u", convert->getWorkers());
+	for (uint32_t i = 0; i < convert->getWorkers(); i++)
+		printf(" %u:%llu", i, (unsigned long long)convert->getWorkerFrames(i));
+	printf("\n");
+}
+
+// Warm converter cache, when it was used
+static void printWarm(void){
+	WarmStats ws;
+
+	StreamCache::stats(&ws);
+	if (ws.builds == 0 && ws.hits == 0)
+		return;
+	printf("warm cache hits:%llu misses:%llu builds:%llu mean:%.3fms max:%.3fms idle:%u %lluKB trimmed:%llu\n",
+	       (unsigned long long)ws.hits, (unsigned long long)ws.misses, (unsigned long long)ws.builds,
+	       ws.builds > 0 ? ws.buildNs / 1e6 / ws.builds : 0.0, ws.maxBuildNs / 1e6, ws.idle,
+	       (unsigned long long)(ws.idleBytes >> 10), (unsigned long long)ws.trimmed);
+}
+
+static void printIO(FrameReader *reader, FrameWriter *writer, int frames, uint64_t ns, uint64_t readNs){
+	printf("%d frames in %.3fs, %.1f fps, input:%s read stall:%.3fms write stall:%.3fms writer busy:%.3fms\n",
+	       frames, ns / 1e9, ns > 0 ? frames * 1e9 / ns : 0.0, reader->mapped() ? "mmap" : "fread",
+	       readNs / 1e6, writer->stallNs() / 1e6, writer->writeNs() / 1e6);
+}
+
+// differing bytes over the visible part of rows rows
+static int compareRows(const uint8_t *a, const uint8_t *b, uint32_t width, uint32_t rows, uint32_t stride){
+	int diff = 0;
+
+	for (uint32_t i = 0; i < rows; i++)
+		for (uint32_t j = 0; j < width; j++)
+			diff += a[i * stride + j] != b[i * stride + j];
+	return diff;
+}
+
+// Plane layouts the golden mode feeds in: tightly packed planes, rows padded
+// to 64 bytes like most decoders, and rows 3 bytes longer than the plane at
+// odd offsets, which the stream has to repack
+enum{LAYOUT_TIGHT, LAYOUT_PADDED, LAYOUT_ODD, LAYOUT_COUNT};
+static const char *sLayoutNames[LAYOUT_COUNT] = {"tight", "padded", "odd"};
+
+// layout of y, u, v planes of width x height bytes, returns the frame size
+static uint32_t testLayout(int kind, uint32_t width, uint32_t height, PlaneLayout *pl){
+	uint32_t offset = kind == LAYOUT_ODD ? 5 : 0;
+
+	for (uint32_t j = 0; j < 3; j++){
+		if (kind == LAYOUT_TIGHT)
+			pl->stride[j] = width;
+		else if (kind == LAYOUT_PADDED)
+			pl->stride[j] = (width + 63) & ~63;
+		else
+			pl->stride[j] = width + 3;
+		pl->offset[j] = offset;
+		offset += pl->stride[j] * height + (kind == LAYOUT_ODD ? 7 : 0);
+	}
+	return offset;
+}
+
+static const uint32_t sGoldenSizes[][2] = {{8, 2}, {24, 6}, {30, 6}, {62, 10}, {64, 32}, {200, 60}, {1280, 720}};
+#define GOLDEN_SIZES (sizeof(sGoldenSizes) / sizeof(sGoldenSizes[0]))
+
+// Both output modes with the float and the fixed kernels against CPUConvert
+// on every test pattern and plane layout, at a few sizes with a stride wider
+// than the frame, widths that are not a multiple of 4 among them. Both
+// kernels round down like the CPU, so both have to match exactly. The
+// padded layout also goes in through submitFd() from a memfd.
+static int runGolden(void){
+	int cases = 0, failed = 0;
+	uint64_t fdImported = 0, fdMapped = 0, fdMisses = 0;
+
+	for (uint32_t s = 0; s < GOLDEN_SIZES; s++){
+		uint32_t width = sGoldenSizes[s][0], height = sGoldenSizes[s][1], stride = width + 8;
+		uint32_t outsize = stride * height * 3 / 2;
+		uint8_t *planes[3];
+		PlaneLayout pl[LAYOUT_COUNT];
+		uint8_t *frames[LAYOUT_COUNT];
+		uint32_t bytes[LAYOUT_COUNT];
+		int fd;
+		uint8_t *gpu = (uint8_t *)malloc(outsize);
+		uint8_t *cpu = (uint8_t *)malloc(outsize);
+		CPUConvert ref(width, height, stride);
+		for (uint32_t j = 0; j < 3; j++)
+			planes[j] = (uint8_t *)malloc(width * height);
+		for (int k = 0; k < LAYOUT_COUNT; k++){
+			bytes[k] = testLayout(k, width, height, &pl[k]);
+			frames[k] = (uint8_t *)malloc(bytes[k]);
+		}
+		fd = memfdFrame(frames[LAYOUT_PADDED], bytes[LAYOUT_PADDED]);
+		for (int o = 0; o < 2; o++){
+			NV12Output output = (NV12Output)o;
+			uint32_t rows = output == NV12_FULL_FRAME ? height * 3 / 2 : height / 2;
+			for (int m = 0; m < KERNEL_MATH_COUNT; m++){
+				for (int k = 0; k < LAYOUT_COUNT; k++){
+					GLESConvert convert(width, height, stride, 1, BACKEND_GPU, output, (KernelMath)m, &pl[k]);
+					for (int p = 0; p < TEST_PATTERN_COUNT; p++){
+						int ret, diff;
+						for (uint32_t j = 0; j < 3; j++){
+							fillPattern((TestPattern)p, j, planes[j], width, height, s + 1);
+							copyPlane(frames[k] + pl[k].offset[j], pl[k].stride[j], planes[j], width, width, height);
+						}
+						memset(gpu, 0, outsize);
+						if (output == NV12_FULL_FRAME)
+							ref.convertFrame(planes[0], planes[1], planes[2], cpu);
+						else
+							ref.convert(planes[1], planes[2], cpu);
+						ret = convert.submitFrame(frames[k], gpu);
+						if (ret == 0)
+							ret = convert.retrieve(NULL);
+						cases++;
+						diff = ret == 0 ? compareRows(gpu, cpu, width, rows, stride) : -1;
+						if (diff != 0){
+							printf("golden %dx%d %s %s %s %s: %d bytes differ\n", width, height,
+							       output == NV12_FULL_FRAME ? "frame" : "uv", kernelMathName((KernelMath)m),
+							       sLayoutNames[k], patternName((TestPattern)p), diff);
+							failed++;
+						}
+						if (k != LAYOUT_PADDED || fd < 0 || pwrite(fd, frames[k], bytes[k], 0) != (ssize_t)bytes[k])
+							continue;
+						memset(gpu, 0, outsize);
+						ret = convert.submitFd(fd, gpu);
+						if (ret == 0)
+							ret = convert.retrieve(NULL);
+						cases++;
+						diff = ret == 0 ? compareRows(gpu, cpu, width, rows, stride) : -1;
+						if (diff != 0){
+							printf("golden %dx%d %s %s fd %s: %d bytes differ\n", width, height,
+							       output == NV12_FULL_FRAME ? "frame" : "uv", kernelMathName((KernelMath)m),
+							       patternName((TestPattern)p), diff);
+							failed++;
+						}
+					}
+					if (k == LAYOUT_PADDED){
+						uint64_t imported, mapped, misses;
+						convert.getFdStats(&imported, &mapped, &misses);
+						fdImported += imported;
+						fdMapped += mapped;
+						fdMisses += misses;
+					}
+					printf("golden %dx%d %s %s %s backend:%s done\n", width, height,
+					       output == NV12_FULL_FRAME ? "frame" : "uv", kernelMathName((KernelMath)m), sLayoutNames[k],
+					       convert.getBackend() == BACKEND_CPU ? "cpu" : "gpu");
+				}
+			}
+		}
+		for (uint32_t j = 0; j < 3; j++)
+			free(planes[j]);
+		if (fd >= 0)
+			close(fd);
+		for (int k = 0; k < LAYOUT_COUNT; k++)
+			free(frames[k]);
+		free(gpu);
+		free(cpu);
+	}
+	printf("golden fd frames imported:%llu mapped:%llu buffers imported or mapped:%llu\n",
+	       (unsigned long long)fdImported, (unsigned long long)fdMapped, (unsigned long long)fdMisses);
+	printf("golden: %d of %d cases differ\n", failed, cases);
+	return failed > 0 ? -1 : 0;
+}
+
+// One converter per output mode and backend taken up through the golden
+// sizes and back down with reconfigure(), every frame checked against a
+// CPUConvert built for its size
+static int runGoldenResize(void){
+	static const ConvertBackend backends[] = {BACKEND_GPU, BACKEND_CPU};
+	uint32_t maxw = sGoldenSizes[GOLDEN_SIZES - 1][0] + 8, maxh = sGoldenSizes[GOLDEN_SIZES - 1][1];
+	uint8_t *planes[3];
+	uint8_t *gpu = (uint8_t *)malloc(maxw * maxh * 3 / 2);
+	uint8_t *cpu = (uint8_t *)malloc(maxw * maxh * 3 / 2);
+	int cases = 0, failed = 0;
+	WarmStats before, after;
+
+	for (uint32_t j = 0; j < 3; j++)
+		planes[j] = (uint8_t *)malloc(maxw * maxh);
+	StreamCache::stats(&before);
+	for (int o = 0; o < 2; o++){
+		NV12Output output = (NV12Output)o;
+		for (uint32_t b = 0; b < sizeof(backends) / sizeof(backends[0]); b++){
+			GLESConvert convert(sGoldenSizes[0][0], sGoldenSizes[0][1], sGoldenSizes[0][0] + 8, 1, backends[b], output,
+			                    MATH_FIXED);
+			for (uint32_t step = 0; step < 2 * GOLDEN_SIZES - 1; step++){
+				uint32_t s = step < GOLDEN_SIZES ? step : 2 * GOLDEN_SIZES - 2 - step;
+				uint32_t width = sGoldenSizes[s][0], height = sGoldenSizes[s][1], stride = width + 8;
+				uint32_t rows = output == NV12_FULL_FRAME ? height * 3 / 2 : height / 2;
+				CPUConvert ref(width, height, stride);
+				int ret, diff;
+				for (uint32_t j = 0; j < 3; j++)
+					fillPattern(PATTERN_RANDOM, j, planes[j], width, height, step + 1);
+				memset(gpu, 0, stride * rows);
+				ret = convert.reconfigure(width, height, stride);
+				if (output == NV12_FULL_FRAME){
+					ref.convertFrame(planes[0], planes[1], planes[2], cpu);
+					if (ret == 0)
+						ret = convert.convert(planes[0], planes[1], planes[2], gpu);
+				}else{
+					ref.convert(planes[1], planes[2], cpu);
+					if (ret == 0)
+						ret = convert.convert(planes[1], planes[2], gpu);
+				}
+				cases++;
+				diff = ret == 0 ? compareRows(gpu, cpu, width, rows, stride) : -1;
+				if (diff != 0){
+					printf("golden reconfigure %dx%d %s %s: %d bytes differ\n", width, height,
+					       output == NV12_FULL_FRAME ? "frame" : "uv", backends[b] == BACKEND_CPU ? "cpu" : "gpu", diff);
+					failed++;
+				}
+			}
+		}
+	}
+	StreamCache::stats(&after);
+	printf("golden reconfigure: %d of %d cases differ, warm cache hits:%llu builds:%llu\n", failed, cases,
+	       (unsigned long long)(after.hits - before.hits), (unsigned long long)(after.builds - before.builds));
+	for (uint32_t j = 0; j < 3; j++)
+		free(planes[j]);
+	free(gpu);
+	free(cpu);
+	return failed > 0 ? -1 : 0;
+}
+
+// Float against fixed on the same random frames, full frame output at
+// depth 2. Dispatch time comes from the GPU timer queries.
+// Frames per second with inflight frames queued, one dst buffer each
+static double benchFps(GLESConvert *convert, uint8_t **planes, uint8_t **dst, int inflight, int count){
+	uint64_t start = StageTimer::now();
+	int pending = 0;
+
+	for (int i = 0; i < count; i++){
+		if (pending == inflight){
+			convert->retrieve(NULL);
+			pending--;
+		}
+		convert->submit(planes[0], planes[1], planes[2], dst[i % inflight]);
+		pending++;
+	}
+	while (pending-- > 0)
+		convert->retrieve(NULL);
+	uint64_t ns = StageTimer::now() - start;
+	return ns > 0 ? count * 1e9 / ns : 0.0;
+}
+
+// Stream start latency: the first converter of a size builds its pool
+// (and the engine, if it is gone), the next one takes it from the warm cache
+static void benchStart(uint32_t width, uint32_t height){
+	uint64_t ns[2];
+
+	StreamCache::clear();
+	for (int i = 0; i < 2; i++){
+		uint64_t start = StageTimer::now();
+		GLESConvert *convert = new GLESConvert(width, height, width, 2, BACKEND_GPU, NV12_FULL_FRAME, MATH_FLOAT, NULL, 1);
+		ns[i] = StageTimer::now() - start;
+		delete convert;
+	}
+	printf("bench %dx%d start cold:%.3fms warm:%.3fms\n", width, height, ns[0] / 1e6, ns[1] / 1e6);
+}
+
+// Resolution switches of a running converter: to half size the first time
+// builds that size's pool, back and forth after that reuses both
+static void benchResize(uint32_t width, uint32_t height){
+	GLESConvert convert(width, height, width, 2, BACKEND_GPU, NV12_FULL_FRAME, MATH_FLOAT, NULL, 1);
+	uint32_t half = (width / 2) & ~1;
+	uint64_t first, start = StageTimer::now();
+	int switches = 0;
+
+	convert.reconfigure(half, height / 2, half);
+	first = StageTimer::now() - start;
+	start = StageTimer::now();
+	for (int i = 0; i < 10; i++){
+		convert.reconfigure(width, height, width);
+		convert.reconfigure(half, height / 2, half);
+		switches += 2;
+	}
+	printf("bench %dx%d reconfigure first:%.3fms then:%.3fms\n", width, height, first / 1e6,
+	       (StageTimer::now() - start) / 1e6 / switches);
+}
+
+static int runBench(uint32_t width, uint32_t height, int count){
+	uint8_t *planes[3];
+	uint8_t *dst[2 * MAX_ENGINES];
+	const char *env = getenv("GLESCONVERT_WORKERS");
+	int workers = env != NULL ? atoi(env) : 1;
+	double base = 0;
+
+	if (workers < 1)
+		workers = 1;
+	if (workers > MAX_ENGINES)
+		workers = MAX_ENGINES;
+	for (uint32_t j = 0; j < 3; j++){
+		planes[j] = (uint8_t *)malloc(width * height);
+		fillPattern(PATTERN_RANDOM, j, planes[j], width, height, 1);
+	}
+	for (int i = 0; i < 2 * workers; i++)
+		dst[i] = (uint8_t *)malloc(width * height * 3 / 2);
+	for (int m = 0; m < KERNEL_MATH_COUNT; m++){
+		GLESConvert convert(width, height, width, 2, BACKEND_GPU, NV12_FULL_FRAME, (KernelMath)m, NULL, 1);
+		StageStats st;
+
+		convert.setTiming(1);
+		double fps = benchFps(&convert, planes, dst, 2, count);
+		if (convert.getStageStats(STAGE_DISPATCH, &st) != 0)
+			st.count = 0;
+		printf("bench %dx%d %s backend:%s %d frames %.1f fps dispatch mean:%7.3fms p50:%7.3fms\n", width, height,
+		       kernelMathName((KernelMath)m), convert.getBackend() == BACKEND_CPU ? "cpu" : "gpu", count,
+		       fps, st.count > 0 ? st.meanNs / 1e6 : 0.0, st.count > 0 ? st.p50Ns / 1e6 : 0.0);
+	}
+	// GLESCONVERT_WORKERS=N: the float kernel on 1..N workers, depth 2 each
+	for (int w = 1; workers > 1 && w <= workers; w++){
+		GLESConvert convert(width, height, width, 2, BACKEND_GPU, NV12_FULL_FRAME, MATH_FLOAT, NULL, w);
+		double fps = benchFps(&convert, planes, dst, 2 * convert.getWorkers(), count);
+
+		if (w == 1)
+			base = fps;
+		printf("bench %dx%d float workers:%u %d frames %.1f fps x%.2f\n", width, height, convert.getWorkers(),
+		       count, fps, base > 0 ? fps / base : 0.0);
+	}
+	benchStart(width, height);
+	benchResize(width, height);
+	for (uint32_t j = 0; j < 3; j++)
+		free(planes[j]);
+	for (int i = 0; i < 2 * workers; i++)
+		free(dst[i]);
+	return 0;
+}
+
 int main(int argc, char *argv[]){
-	FILE *fin, *fout;
+	FILE *fout;
+	FrameReader reader;
+	FrameWriter *writer;
 	int width, height, stride;
-    int size;
-    uint8_t *bufin, *bufout;
-    uint8_t *y, *u, *v, *uv;
-    int count;
-	void *src;
-	if (argc != 7)
+    int size, outsize;
+    uint8_t *bufref[MAX_PIPELINE_DEPTH];
+    const uint8_t *src;
+    uint8_t *y, *u, *v, *dst;
+    uint64_t start, readNs, t;
+    int count, depth, index, pending;
+    int frames, bad;
+    ConvertBackend backend = BACKEND_AUTO;
+    KernelMath math = MATH_FLOAT;
+    CPUConvert *ref = NULL;
+    const char *env;
+	if (argc == 2 && strcmp(argv[1], "golden") == 0)
+		return runGolden() | runGoldenResize();
+	if (argc == 5 && strcmp(argv[1], "bench") == 0)
+		return runBench(atoi(argv[2]), atoi(argv[3]), atoi(argv[4]));
+	if (argc < 7 || argc > 10)
 		usage(argv[0]);
-		
-    fin = fopen(argv[1], "rb");
-    fout = fopen(argv[2], "wb+");
+	if (argc == 10 && parseKernelMath(argv[9], &math) != 0)
+		usage(argv[0]);
+
   	width = atoi(argv[3]);
 	height = atoi(argv[4]);
     stride = atoi(argv[5]);
     count = atoi(argv[6]);
-    
+    depth = argc >= 8 ? atoi(argv[7]) : 2;
+    if (depth < 1)
+        depth = 1;
+    if (depth > MAX_PIPELINE_DEPTH)
+        depth = MAX_PIPELINE_DEPTH;
+
     size = width * height;
-    bufin = (uint8_t *)malloc(size * 3);
-    bufout = (uint8_t *)malloc(stride * height * 3 / 2 );
+    outsize = stride * height * 3 / 2;
+    for (int i = 0; i < depth; i++)
+        bufref[i] = NULL;
+    fout = fopen(argv[2], "wb+");
+    if (fout == NULL || reader.open(argv[1], size * 3) != 0){
+        printf("can't open %s or %s\n", argv[1], argv[2]);
+        return -1;
+    }
+
+    if (argc >= 9){
+        if (strcmp(argv[8], "gpu") == 0){
+            backend = BACKEND_GPU;
+        }else if (strcmp(argv[8], "cpu") == 0){
+            backend = BACKEND_CPU;
+        }else if (strcmp(argv[8], "check") == 0){
+            backend = BACKEND_GPU;
+            ref = new CPUConvert(width, height, stride);
+            for (int i = 0; i < depth; i++)
+                bufref[i] = (uint8_t *)malloc(outsize);
+        }
+    }
 
-	GLESConvert *mConvert = new GLESConvert(width, height, stride);
+	env = getenv("GLESCONVERT_WARM");
+	if (env != NULL)
+		printf("prewarmed %d sizes\n", GLESConvert::prewarm(env, depth, NV12_FULL_FRAME, math));
+	t = StageTimer::now();
+	GLESConvert *mConvert = new GLESConvert(width, height, stride, depth, backend, NV12_FULL_FRAME, math);
 	mConvert->waitGLInit();
-	
-	memset(bufout, 0, stride * height * 3 / 2);
-	y = bufin;
-    u = y + size;
-    v = u + size;
-    uv = bufout + stride * height;
-	while(fread(bufin, size, 3, fin) && count-- > 0){
-        for (int i = 0; i < height; i++){
-            memcpy(bufout + i *stride, bufin + i * width, width);
+	printf("start:%.3fms\n", (StageTimer::now() - t) / 1e6);
+	printf("backend:%s\n", mConvert->getBackend() == BACKEND_CPU ? "cpu" : "gpu");
+
+	// keep depth frames queued, hand the oldest one to the writer thread when
+	// the ring is full. Input comes straight from the mapped file, output is
+	// converted into the writer's queue so disk writes overlap the GPU work.
+	writer = new FrameWriter(fout, outsize, depth + WRITE_QUEUE);
+	index = 0;
+	pending = 0;
+	frames = 0;
+	bad = 0;
+	readNs = 0;
+	start = StageTimer::now();
+	for(;;){
+        if (pending == depth){
+            bad += writeFrame(writer, mConvert, bufref[(index + depth - pending) % depth],
+                              frames++, width, stride, height);
+            pending--;
         }
-		mConvert->convert(u, v, uv);
-        
-		fwrite(bufout, stride, height, fout);
-        fwrite(uv, stride / 2, height, fout);
+        if (count-- <= 0)
+            break;
+        // page faults on the mapping land here, count them as read stall
+        t = StageTimer::now();
+        src = reader.next();
+        readNs += StageTimer::now() - t;
+        if (src == NULL)
+            break;
+        // all three planes go into the staging buffer, the GPU writes the
+        // luma rows at stride so the CPU never touches them again
+        mConvert->getInputBuffer(&y, &u, &v);
+        t = StageTimer::now();
+        // staging rows are padded to whole words for odd widths
+        copyPlane(y, mConvert->getInputStride(0), src, width, width, height);
+        copyPlane(u, mConvert->getInputStride(1), src + size, width, width, height);
+        copyPlane(v, mConvert->getInputStride(2), src + size * 2, width, width, height);
+        readNs += StageTimer::now() - t;
+        if (ref != NULL)
+            ref->convertFrame((uint8_t *)src, (uint8_t *)src + size, (uint8_t *)src + size * 2, bufref[index]);
+        dst = writer->get();
+		mConvert->submitInput(dst);
+        index = (index + 1) % depth;
+        pending++;
+	}
+	while (pending > 0){
+        bad += writeFrame(writer, mConvert, bufref[(index + depth - pending) % depth],
+                          frames++, width, stride, height);
+        pending--;
 	}
-	
-	fclose(fin);
+	writer->finish();
+	printIO(&reader, writer, frames, StageTimer::now() - start, readNs);
+	if (writer->failed())
+        printf("writing %s failed\n", argv[2]);
+	if (ref != NULL){
+        printf("check: %d of %d frames differ\n", bad, frames);
+        delete ref;
+	}
+
+	printTiming(mConvert);
+	printGLErrors();
+	printWorkers(mConvert);
+	delete mConvert;
+	printWarm();
+	delete writer;
+	reader.close();
     fclose(fout);
 }
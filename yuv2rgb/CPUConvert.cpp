@@ -0,0 +1,414 @@
+#include "CPUConvert.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define HAVE_NEON 1
+#endif
+
+static inline uint8_t clampRound(float x){
+    if(x <= 0.0f)
+        return 0;
+    if(x >= 255.0f)
+        return 255;
+    return (uint8_t)(x + 0.5f);
+}
+
+// Scalar reference, also handles the tail of the SIMD kernels
+static void rowScalar(const uint8_t *y, const uint8_t *u, const uint8_t *v, uint8_t *dst, uint32_t width,
+                      const ColorCoefs *c){
+    for(uint32_t x = 0; x < width; x++){
+        float yf = c->y * (y[x] - c->yOffset);
+        float uf = u[x] - 128.0f;
+        float vf = v[x] - 128.0f;
+        dst[4 * x + 0] = clampRound(yf + c->rv * vf);
+        dst[4 * x + 1] = clampRound(yf + c->gu * uf + c->gv * vf);
+        dst[4 * x + 2] = clampRound(yf + c->bu * uf);
+        dst[4 * x + 3] = 255;
+    }
+}
+
+// Fixed point reference, same integer ops as the MATH_FIXED shaders
+static void rowFixed(const uint8_t *y, const uint8_t *u, const uint8_t *v, uint8_t *dst, uint32_t width,
+                     const FixedCoefs *c){
+    for(uint32_t x = 0; x < width; x++){
+        int32_t yv = c->y * (y[x] - c->yOffset);
+        int32_t cu = u[x] - 128;
+        int32_t cv = v[x] - 128;
+        dst[4 * x + 0] = fixedClamp(yv + c->rv * cv);
+        dst[4 * x + 1] = fixedClamp(yv + c->gu * cu + c->gv * cv);
+        dst[4 * x + 2] = fixedClamp(yv + c->bu * cu);
+        dst[4 * x + 3] = 255;
+    }
+}
+
+#ifdef HAVE_X86_SIMD
+// 4 pixels as 32 bit ints -> rounded r, g, b as 32 bit ints
+static inline void matrixSSE2(__m128i y, __m128i u, __m128i v, __m128i *r, __m128i *g, __m128i *b,
+                              const ColorCoefs *c){
+    __m128 yf = _mm_mul_ps(_mm_sub_ps(_mm_cvtepi32_ps(y), _mm_set1_ps(c->yOffset)), _mm_set1_ps(c->y));
+    __m128 uf = _mm_sub_ps(_mm_cvtepi32_ps(u), _mm_set1_ps(128.0f));
+    __m128 vf = _mm_sub_ps(_mm_cvtepi32_ps(v), _mm_set1_ps(128.0f));
+    *r = _mm_cvtps_epi32(_mm_add_ps(yf, _mm_mul_ps(vf, _mm_set1_ps(c->rv))));
+    *g = _mm_cvtps_epi32(_mm_add_ps(yf, _mm_add_ps(_mm_mul_ps(uf, _mm_set1_ps(c->gu)),
+                                                   _mm_mul_ps(vf, _mm_set1_ps(c->gv)))));
+    *b = _mm_cvtps_epi32(_mm_add_ps(yf, _mm_mul_ps(uf, _mm_set1_ps(c->bu))));
+}
+
+// 16 bytes each of r, g, b -> 64 bytes RGBA
+static inline void storeRGBA(uint8_t *dst, __m128i r, __m128i g, __m128i b){
+    const __m128i a = _mm_set1_epi8((char)0xff);
+    __m128i rg = _mm_unpacklo_epi8(r, g);
+    __m128i ba = _mm_unpacklo_epi8(b, a);
+    _mm_storeu_si128((__m128i *)(dst +  0), _mm_unpacklo_epi16(rg, ba));
+    _mm_storeu_si128((__m128i *)(dst + 16), _mm_unpackhi_epi16(rg, ba));
+    rg = _mm_unpackhi_epi8(r, g);
+    ba = _mm_unpackhi_epi8(b, a);
+    _mm_storeu_si128((__m128i *)(dst + 32), _mm_unpacklo_epi16(rg, ba));
+    _mm_storeu_si128((__m128i *)(dst + 48), _mm_unpackhi_epi16(rg, ba));
+}
+
+static void rowSSE2(const uint8_t *y, const uint8_t *u, const uint8_t *v, uint8_t *dst, uint32_t width,
+                    const ColorCoefs *c){
+    const __m128i zero = _mm_setzero_si128();
+    uint32_t x;
+
+    for(x = 0; x + 16 <= width; x += 16){
+        __m128i y8 = _mm_loadu_si128((const __m128i *)(y + x));
+        __m128i u8 = _mm_loadu_si128((const __m128i *)(u + x));
+        __m128i v8 = _mm_loadu_si128((const __m128i *)(v + x));
+        __m128i y16[2] = {_mm_unpacklo_epi8(y8, zero), _mm_unpackhi_epi8(y8, zero)};
+        __m128i u16[2] = {_mm_unpacklo_epi8(u8, zero), _mm_unpackhi_epi8(u8, zero)};
+        __m128i v16[2] = {_mm_unpacklo_epi8(v8, zero), _mm_unpackhi_epi8(v8, zero)};
+        __m128i r[4], g[4], b[4];
+        for(int i = 0; i < 2; i++){
+            matrixSSE2(_mm_unpacklo_epi16(y16[i], zero), _mm_unpacklo_epi16(u16[i], zero),
+                       _mm_unpacklo_epi16(v16[i], zero), &r[2 * i], &g[2 * i], &b[2 * i], c);
+            matrixSSE2(_mm_unpackhi_epi16(y16[i], zero), _mm_unpackhi_epi16(u16[i], zero),
+                       _mm_unpackhi_epi16(v16[i], zero), &r[2 * i + 1], &g[2 * i + 1], &b[2 * i + 1], c);
+        }
+        // saturating packs do the clamp to [0, 255]
+        storeRGBA(dst + 4 * x,
+                  _mm_packus_epi16(_mm_packs_epi32(r[0], r[1]), _mm_packs_epi32(r[2], r[3])),
+                  _mm_packus_epi16(_mm_packs_epi32(g[0], g[1]), _mm_packs_epi32(g[2], g[3])),
+                  _mm_packus_epi16(_mm_packs_epi32(b[0], b[1]), _mm_packs_epi32(b[2], b[3])));
+    }
+    rowScalar(y + x, u + x, v + x, dst + 4 * x, width - x, c);
+}
+
+// 8 pixels -> rounded r, g, b as 32 bit ints
+__attribute__((target("avx2")))
+static inline void matrixAVX2(const uint8_t *y, const uint8_t *u, const uint8_t *v, __m256i *r, __m256i *g, __m256i *b,
+                              const ColorCoefs *c){
+    __m256 yf = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)y)));
+    __m256 uf = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)u)));
+    __m256 vf = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)v)));
+    yf = _mm256_mul_ps(_mm256_sub_ps(yf, _mm256_set1_ps(c->yOffset)), _mm256_set1_ps(c->y));
+    uf = _mm256_sub_ps(uf, _mm256_set1_ps(128.0f));
+    vf = _mm256_sub_ps(vf, _mm256_set1_ps(128.0f));
+    *r = _mm256_cvtps_epi32(_mm256_add_ps(yf, _mm256_mul_ps(vf, _mm256_set1_ps(c->rv))));
+    *g = _mm256_cvtps_epi32(_mm256_add_ps(yf, _mm256_add_ps(_mm256_mul_ps(uf, _mm256_set1_ps(c->gu)),
+                                                            _mm256_mul_ps(vf, _mm256_set1_ps(c->gv)))));
+    *b = _mm256_cvtps_epi32(_mm256_add_ps(yf, _mm256_mul_ps(uf, _mm256_set1_ps(c->bu))));
+}
+
+// 2 x 8 pixels as 32 bit ints -> 16 bytes, in order
+__attribute__((target("avx2")))
+static inline __m128i pack16AVX2(__m256i lo, __m256i hi){
+    __m128i a = _mm_packs_epi32(_mm256_castsi256_si128(lo), _mm256_extracti128_si256(lo, 1));
+    __m128i b = _mm_packs_epi32(_mm256_castsi256_si128(hi), _mm256_extracti128_si256(hi, 1));
+    return _mm_packus_epi16(a, b);
+}
+
+__attribute__((target("avx2")))
+static void rowAVX2(const uint8_t *y, const uint8_t *u, const uint8_t *v, uint8_t *dst, uint32_t width,
+                    const ColorCoefs *c){
+    uint32_t x;
+
+    for(x = 0; x + 16 <= width; x += 16){
+        __m256i r[2], g[2], b[2];
+        matrixAVX2(y + x, u + x, v + x, &r[0], &g[0], &b[0], c);
+        matrixAVX2(y + x + 8, u + x + 8, v + x + 8, &r[1], &g[1], &b[1], c);
+        storeRGBA(dst + 4 * x, pack16AVX2(r[0], r[1]), pack16AVX2(g[0], g[1]), pack16AVX2(b[0], b[1]));
+    }
+    rowScalar(y + x, u + x, v + x, dst + 4 * x, width - x, c);
+}
+#endif
+
+#ifdef HAVE_NEON
+// 4 pixels -> rounded and saturated r, g, b as 16 bit
+static inline void matrixNEON(uint16x4_t y, uint16x4_t u, uint16x4_t v, int16x4_t *r, int16x4_t *g, int16x4_t *b,
+                              const ColorCoefs *c){
+    const float32x4_t half = vdupq_n_f32(0.5f);
+    float32x4_t yf = vmulq_n_f32(vsubq_f32(vcvtq_f32_u32(vmovl_u16(y)), vdupq_n_f32(c->yOffset)), c->y);
+    float32x4_t uf = vsubq_f32(vcvtq_f32_u32(vmovl_u16(u)), vdupq_n_f32(128.0f));
+    float32x4_t vf = vsubq_f32(vcvtq_f32_u32(vmovl_u16(v)), vdupq_n_f32(128.0f));
+    // +0.5 and truncate, negative results are clamped to 0 by the narrowing below
+    *r = vqmovn_s32(vcvtq_s32_f32(vaddq_f32(vmlaq_n_f32(yf, vf, c->rv), half)));
+    *g = vqmovn_s32(vcvtq_s32_f32(vaddq_f32(vmlaq_n_f32(vmlaq_n_f32(yf, uf, c->gu), vf, c->gv), half)));
+    *b = vqmovn_s32(vcvtq_s32_f32(vaddq_f32(vmlaq_n_f32(yf, uf, c->bu), half)));
+}
+
+static void rowNEON(const uint8_t *y, const uint8_t *u, const uint8_t *v, uint8_t *dst, uint32_t width,
+                    const ColorCoefs *c){
+    uint32_t x;
+
+    for(x = 0; x + 16 <= width; x += 16){
+        uint8x16_t y8 = vld1q_u8(y + x);
+        uint8x16_t u8 = vld1q_u8(u + x);
+        uint8x16_t v8 = vld1q_u8(v + x);
+        uint16x8_t y16[2] = {vmovl_u8(vget_low_u8(y8)), vmovl_u8(vget_high_u8(y8))};
+        uint16x8_t u16[2] = {vmovl_u8(vget_low_u8(u8)), vmovl_u8(vget_high_u8(u8))};
+        uint16x8_t v16[2] = {vmovl_u8(vget_low_u8(v8)), vmovl_u8(vget_high_u8(v8))};
+        int16x4_t r[4], g[4], b[4];
+        for(int i = 0; i < 2; i++){
+            matrixNEON(vget_low_u16(y16[i]), vget_low_u16(u16[i]), vget_low_u16(v16[i]),
+                       &r[2 * i], &g[2 * i], &b[2 * i], c);
+            matrixNEON(vget_high_u16(y16[i]), vget_high_u16(u16[i]), vget_high_u16(v16[i]),
+                       &r[2 * i + 1], &g[2 * i + 1], &b[2 * i + 1], c);
+        }
+        uint8x16x4_t rgba;
+        rgba.val[0] = vcombine_u8(vqmovun_s16(vcombine_s16(r[0], r[1])), vqmovun_s16(vcombine_s16(r[2], r[3])));
+        rgba.val[1] = vcombine_u8(vqmovun_s16(vcombine_s16(g[0], g[1])), vqmovun_s16(vcombine_s16(g[2], g[3])));
+        rgba.val[2] = vcombine_u8(vqmovun_s16(vcombine_s16(b[0], b[1])), vqmovun_s16(vcombine_s16(b[2], b[3])));
+        rgba.val[3] = vdupq_n_u8(255);
+        vst4q_u8(dst + 4 * x, rgba);
+    }
+    rowScalar(y + x, u + x, v + x, dst + 4 * x, width - x, c);
+}
+#endif
+
+static CPUConvert::RowFunc selectRowFunc(const char **name){
+#ifdef HAVE_X86_SIMD
+    if(__builtin_cpu_supports("avx2")){
+        *name = "avx2";
+        return rowAVX2;
+    }
+    if(__builtin_cpu_supports("sse2")){
+        *name = "sse2";
+        return rowSSE2;
+    }
+#endif
+#ifdef HAVE_NEON
+    *name = "neon";
+    return rowNEON;
+#endif
+    *name = "c";
+    return rowScalar;
+}
+
+CPUConvert::CPUConvert(uint32_t width, uint32_t height, uint32_t rgbstride, uint32_t threads,
+                       ColorMatrix matrix, ColorRange range, ChromaLayout layout, ChromaFilter filter,
+                       KernelMath math, const uint32_t *pitch):
+    mWidth(width), mHeight(height), mRGBStride(rgbstride), mCoefs(&kColorCoefs[matrix][range]),
+    mFixed(NULL), mLayout(layout), mFilter(filter){
+    uint32_t rows = mHeight;
+
+    setPitch(pitch);
+    mRowFunc = selectRowFunc(&mSimdName);
+    if(math == MATH_FIXED){
+        mFixed = &kFixedCoefs[matrix][range];
+        mSimdName = "fixed";
+    }
+
+    if(threads == 0){
+        long n = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = n > 0 ? n : 1;
+    }
+    if(threads > MAX_CPU_THREADS)
+        threads = MAX_CPU_THREADS;
+    if(threads > rows)
+        threads = rows > 0 ? rows : 1;
+    mThreads = threads;
+
+    mThreadRun = true;
+    mPending = 0;
+    for(uint32_t i = 0; i < mThreads; i++){
+        Worker *w = &mWorkers[i];
+        w->owner = this;
+        w->go = 0;
+        w->seen = 0;
+        w->rowBegin = rows * i / mThreads;
+        w->rowEnd = rows * (i + 1) / mThreads;
+        w->rowU = NULL;
+        w->rowV = NULL;
+        if(mLayout != CHROMA_444){
+            w->rowU = (uint8_t *)malloc(mWidth);
+            w->rowV = (uint8_t *)malloc(mWidth);
+        }
+        if(i > 0 && 0 != pthread_create(&w->thread, NULL, worker_entry, w)){
+            printf("Could not create worker thread %d\n", i);
+            // fold the rest of the rows into the threads we already have
+            mWorkers[i - 1].rowEnd = rows;
+            free(w->rowU);
+            free(w->rowV);
+            mThreads = i;
+            break;
+        }
+    }
+    printf("CPUConvert %dx%d %s simd:%s threads:%d\n", mWidth, mHeight, chromaLayoutName(mLayout), mSimdName,
+           mThreads);
+}
+
+void CPUConvert::setPitch(const uint32_t *pitch){
+    for(uint32_t j = 0; j < 3; j++){
+        if(pitch != NULL && pitch[j] > 0)
+            mPitch[j] = pitch[j];
+        else
+            mPitch[j] = j == 0 || mLayout != CHROMA_I420 ? mWidth : mWidth / 2;
+    }
+}
+
+void CPUConvert::resize(uint32_t width, uint32_t height, uint32_t rgbstride, const uint32_t *pitch){
+    // convertRange() deals out the rows, only the upsampled rows depend on the width
+    if(mLayout != CHROMA_444 && width != mWidth){
+        for(uint32_t i = 0; i < mThreads; i++){
+            mWorkers[i].rowU = (uint8_t *)realloc(mWorkers[i].rowU, width);
+            mWorkers[i].rowV = (uint8_t *)realloc(mWorkers[i].rowV, width);
+        }
+    }
+    mWidth = width;
+    mHeight = height;
+    mRGBStride = rgbstride;
+    setPitch(pitch);
+}
+
+CPUConvert::~CPUConvert(){
+    mThreadRun = false;
+    runWorkers();
+    for(uint32_t i = 1; i < mThreads; i++)
+        pthread_join(mWorkers[i].thread, NULL);
+    for(uint32_t i = 0; i < mThreads; i++){
+        free(mWorkers[i].rowU);
+        free(mWorkers[i].rowV);
+    }
+}
+
+//static
+bool CPUConvert::worker_ready(void *data){
+    Worker *w = static_cast<Worker *>(data);
+    return w->go.load(std::memory_order_acquire) != w->seen;
+}
+
+//static
+bool CPUConvert::done_ready(void *data){
+    CPUConvert *me = static_cast<CPUConvert *>(data);
+    return me->mPending.load(std::memory_order_acquire) == 0;
+}
+
+//static
+void *CPUConvert::worker_entry(void *data){
+    Worker *w = static_cast<Worker *>(data);
+    CPUConvert *me = w->owner;
+
+    for(;;){
+        while(!worker_ready(w))
+            w->start.wait(worker_ready, w);
+        w->seen++;
+        if(!me->mThreadRun.load())
+            break;
+        me->convertRows(w);
+        if(me->mPending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            me->mDoneWait.wake();
+    }
+    return NULL;
+}
+
+// Start workers 1.. on the current job, worker 0 is the calling thread
+void CPUConvert::runWorkers(void){
+    mPending.store(mThreads - 1);
+    for(uint32_t i = 1; i < mThreads; i++){
+        mWorkers[i].go.fetch_add(1, std::memory_order_release);
+        mWorkers[i].start.wake();
+    }
+}
+
+// One row of 4:2:0 chroma brought up to width samples. cur is the chroma
+// row of the pixel row, near the vertical neighbour the bilinear filter
+// mixes in, step is 2 for interleaved uv. Same integer math as the shaders.
+static void upsampleRow(const uint8_t *cur, const uint8_t *near, uint32_t step, uint8_t *dst, uint32_t width,
+                        ChromaFilter filter){
+    uint32_t cw = width / 2;
+
+    if(filter == FILTER_NEAREST){
+        for(uint32_t x = 0; x < width; x++)
+            dst[x] = cur[(x / 2) * step];
+        return;
+    }
+    for(uint32_t x = 0; x < width; x++){
+        uint32_t k = x / 2;
+        uint32_t kn = (x & 1) ? (k + 1 < cw ? k + 1 : k) : (k > 0 ? k - 1 : 0);
+        dst[x] = (9 * cur[k * step] + 3 * (cur[kn * step] + near[k * step]) + near[kn * step] + 8) >> 4;
+    }
+}
+
+// rows [rowBegin, rowEnd) of the worker, mRGBStride is in pixels like the GPU path
+void CPUConvert::convertRows(Worker *w){
+    uint32_t ch = mHeight / 2;
+    uint32_t step = mLayout == CHROMA_NV12 ? 2 : 1;
+    // NV12 v samples sit one byte after u in the uv plane
+    uint32_t vpitch = mLayout == CHROMA_NV12 ? mPitch[1] : mPitch[2];
+    const uint8_t *pu = cu;
+    const uint8_t *pv = mLayout == CHROMA_NV12 ? cu + 1 : cv;
+
+    for(uint32_t r = w->rowBegin; r < w->rowEnd; r++){
+        const uint8_t *y = cy + (size_t)r * mPitch[0];
+        uint8_t *dst = cdst + (size_t)r * mRGBStride * 4;
+        if(mLayout == CHROMA_444){
+            convertRow(y, cu + (size_t)r * mPitch[1], cv + (size_t)r * mPitch[2], dst);
+            continue;
+        }
+        uint32_t cr = r / 2;
+        uint32_t rn = (r & 1) ? (cr + 1 < ch ? cr + 1 : cr) : (cr > 0 ? cr - 1 : 0);
+        upsampleRow(pu + cr * mPitch[1], pu + rn * mPitch[1], step, w->rowU, mWidth, mFilter);
+        upsampleRow(pv + cr * vpitch, pv + rn * vpitch, step, w->rowV, mWidth, mFilter);
+        convertRow(y, w->rowU, w->rowV, dst);
+    }
+}
+
+void CPUConvert::convertRow(const uint8_t *y, const uint8_t *u, const uint8_t *v, uint8_t *dst){
+    if(mFixed != NULL)
+        rowFixed(y, u, v, dst, mWidth, mFixed);
+    else
+        mRowFunc(y, u, v, dst, mWidth, mCoefs);
+}
+
+int CPUConvert::convert(uint8_t *y, uint8_t *u, uint8_t *v, uint8_t *dst){
+    return convertRange(y, u, v, dst, 0, mHeight);
+}
+
+int CPUConvert::convertRange(uint8_t *y, uint8_t *u, uint8_t *v, uint8_t *dst, uint32_t rowBegin, uint32_t rowEnd){
+    uint32_t rows = rowEnd - rowBegin;
+
+    if(rowBegin > rowEnd || rowEnd > mHeight)
+        return -1;
+    cy = y;
+    cu = u;
+    cv = v;
+    cdst = dst;
+    // the workers see their new range once their go count is bumped
+    for(uint32_t i = 0; i < mThreads; i++){
+        mWorkers[i].rowBegin = rowBegin + rows * i / mThreads;
+        mWorkers[i].rowEnd = rowBegin + rows * (i + 1) / mThreads;
+    }
+    runWorkers();
+    convertRows(&mWorkers[0]);
+    while(!done_ready(this))
+        mDoneWait.wait(done_ready, this);
+    return 0;
+}
+
+const char *CPUConvert::simdName(void){
+    return mSimdName;
+}
+
+uint32_t CPUConvert::threadCount(void){
+    return mThreads;
+}
@@ -0,0 +1,87 @@
+#ifndef _CPUCONVERT_H_
+#define _CPUCONVERT_H_
+#include <stdint.h>
+#include <pthread.h>
+#include <atomic>
+#include "Parker.h"
+#include "ColorSpace.h"
+
+#define MAX_CPU_THREADS 16
+
+// CPU version of the YUV -> RGBA conversion, same kColorCoefs constants as
+// the generated compute shaders. Rows are split across worker threads and
+// each row runs the widest SIMD kernel the CPU supports. 4:2:0 chroma is
+// upsampled a row at a time with the same integer filter as the shaders.
+// The width has to be even for 4:2:0 input. With MATH_FIXED every row runs
+// the scalar 16.16 kernel instead, the bit-exact reference of the fixed
+// point shaders.
+class CPUConvert{
+public:
+    // threads == 0 uses one thread per online core. pitch is the bytes per
+    // row of the y, u and v planes, NULL for tightly packed ones.
+    CPUConvert(uint32_t width, uint32_t height, uint32_t rgbstride, uint32_t threads = 0,
+               ColorMatrix matrix = COLOR_BT601, ColorRange range = RANGE_LIMITED,
+               ChromaLayout layout = CHROMA_444, ChromaFilter filter = FILTER_NEAREST,
+               KernelMath math = MATH_FLOAT, const uint32_t *pitch = NULL);
+    ~CPUConvert();
+    // Same conversion at a new frame size, the threads stay. Not while a
+    // convert is running.
+    void resize(uint32_t width, uint32_t height, uint32_t rgbstride, const uint32_t *pitch = NULL);
+    // NV12: u is the uv plane, v is unused
+    int convert(uint8_t *y, uint8_t *u, uint8_t *v, uint8_t *dst);
+    // Only rows [rowBegin, rowEnd) of the frame, split across the threads.
+    // The planes are still whole frames.
+    int convertRange(uint8_t *y, uint8_t *u, uint8_t *v, uint8_t *dst, uint32_t rowBegin, uint32_t rowEnd);
+    const char *simdName(void);
+    uint32_t threadCount(void);
+
+    // one row of width pixels, dst gets RGBA
+    typedef void (*RowFunc)(const uint8_t *y, const uint8_t *u, const uint8_t *v, uint8_t *dst, uint32_t width,
+                            const ColorCoefs *c);
+
+private:
+	struct Worker{
+		CPUConvert *owner;
+		pthread_t thread;
+		Parker start;
+		std::atomic<uint32_t> go;  // bumped by the owner for each job
+		uint32_t seen;             // last go the worker picked up
+		uint32_t rowBegin;
+		uint32_t rowEnd;
+		uint8_t *rowU;  // upsampled chroma of the current row, 4:2:0 only
+		uint8_t *rowV;
+	};
+
+	static void *worker_entry(void *data);
+	static bool worker_ready(void *data);
+	static bool done_ready(void *data);
+	void setPitch(const uint32_t *pitch);
+	void runWorkers(void);
+	void convertRows(Worker *w);
+	void convertRow(const uint8_t *y, const uint8_t *u, const uint8_t *v, uint8_t *dst);
+
+private:
+	uint32_t mWidth;
+	uint32_t mHeight;
+	uint32_t mRGBStride;
+	uint32_t mPitch[3];  // y, u, v bytes per row
+
+	const ColorCoefs *mCoefs;
+	const FixedCoefs *mFixed;  // MATH_FIXED only, NULL otherwise
+	ChromaLayout mLayout;
+	ChromaFilter mFilter;
+	RowFunc mRowFunc;
+	const char *mSimdName;
+
+	Worker mWorkers[MAX_CPU_THREADS];
+	uint32_t mThreads;   // worker 0 is the calling thread
+	std::atomic<uint32_t> mPending;  // workers still converting
+	Parker mDoneWait;
+	std::atomic<bool> mThreadRun;
+
+	uint8_t *cy;
+	uint8_t *cu;
+	uint8_t *cv;
+	uint8_t *cdst;
+};
+#endif
@@ -1,342 +1,331 @@
 #include "GLESConvert.h"
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+
+
+GLESConvert::GLESConvert(uint32_t width, uint32_t height, uint32_t rgbstride, uint32_t depth,
+                         ConvertBackend backend, ColorMatrix matrix, ColorRange range,
+                         ChromaLayout layout, ChromaFilter filter, KernelMath math, const PlaneLayout *input,
+                         uint32_t workers):
+    mWidth(width), mHeight(height), mRGBStride(rgbstride), mLayout(layout), mPool(NULL), mCpu(NULL),
+    mBalancer(NULL), mSubmitted(0), mPending(0), mTiming(0), mSliceCount(1), mSliceFn(NULL), mSliceCtx(NULL){
+    // generated on first use, one branch-free shader per colorspace and input layout
+    const KernelDesc *kernel = kernelYUVToRGBAFor(matrix, range, layout, filter, math);
+
+    if(backend == BACKEND_AUTO){
+        const char *env = getenv("GLESCONVERT_BACKEND");
+        if(env != NULL && strcmp(env, "gpu") == 0)
+            backend = BACKEND_GPU;
+        else if(env != NULL && strcmp(env, "cpu") == 0)
+            backend = BACKEND_CPU;
+        else if(env != NULL && strcmp(env, "hybrid") == 0)
+            backend = BACKEND_HYBRID;
+    }
 
+    resolveInput(input);
+    if(backend != BACKEND_CPU){
+        mPool = StreamCache::get(kernel, mWidth, mHeight, mRGBStride, depth, backend == BACKEND_HYBRID ? 1 : workers,
+                                 &mInput);
+        if(mPool->ready()){
+            if(backend != BACKEND_HYBRID)
+                backend = BACKEND_GPU;
+        }else if(backend == BACKEND_AUTO || backend == BACKEND_HYBRID){
+            printf("GLES compute not available, falling back to CPU\n");
+            delete mPool;
+            mPool = NULL;
+            backend = BACKEND_CPU;
+        }
+    }
+    if(backend == BACKEND_HYBRID){
+        // the CPU share reads the caller's planes
+        mCpu = new CPUConvert(mWidth, mHeight, mRGBStride, 0, matrix, range, layout, filter, math, mInput.stride);
+        mBalancer = new RowBalancer(mHeight, kernel->rowAlign);
+    }
+    if(backend == BACKEND_CPU){
+        uint32_t pitch[MAX_PLANES];
+        mPool = new StreamPool(kernel, mWidth, mHeight, mRGBStride, depth, 1, cpu_entry, this, &mInput);
+        // frames are converted from the staging planes
+        for(uint32_t j = 0; j < MAX_PLANES; j++)
+            pitch[j] = mPool->inputPitch(j);
+        mCpu = new CPUConvert(mWidth, mHeight, mRGBStride, 0, matrix, range, layout, filter, math, pitch);
+    }
+    mBackend = backend;
+}
 
-GLESConvert::GLESConvert(uint32_t width, uint32_t height, uint32_t rgbstride):
-    mWidth(width), mHeight(height), mRGBStride(rgbstride), display(EGL_NO_DISPLAY), context(EGL_NO_CONTEXT){
-    num_groups_x = (mWidth / 4 + 31) / 32;
-    num_groups_y = (mHeight + 31) / 32;
-
-    mInBufSize = mWidth * mHeight;
-    mOutBufSize = mRGBStride * mHeight * 4;
-
-    mThreadRun = false;
+GLESConvert::~GLESConvert(){
+    // GPU pools stay warm for the next converter of this kind and size
+    if(mBackend == BACKEND_CPU)
+        delete mPool;
+    else
+        StreamCache::put(mPool);
+    delete mCpu;
+    delete mBalancer;
+}
 
-    sem_init(&mGLSem, 0, 0);
-    sem_init(&mCustSem, 0, 0);
-    
-    if(0 != pthread_create(&mThread, NULL, gles_entry, this)){
-        printf("Could not create dispatch thread\n");
+void GLESConvert::resolveInput(const PlaneLayout *input){
+    memset(&mInput, 0, sizeof(mInput));
+    if(input != NULL)
+        mInput = *input;
+    for(uint32_t j = 0; j < chromaPlanes(mLayout); j++){
+        if(mInput.stride[j] == 0)
+            mInput.stride[j] = j > 0 && mLayout == CHROMA_I420 ? mWidth / 2 : mWidth;
+    }
+    // no offsets: the planes are back to back at their strides
+    bool packed = mInput.offset[0] == 0 && mInput.offset[1] == 0 && mInput.offset[2] == 0;
+    mFrameSize = 0;
+    for(uint32_t j = 0; j < chromaPlanes(mLayout); j++){
+        uint32_t rows = j > 0 && mLayout != CHROMA_444 ? mHeight / 2 : mHeight;
+        if(packed)
+            mInput.offset[j] = mFrameSize;
+        if(mInput.offset[j] + mInput.stride[j] * rows > mFrameSize)
+            mFrameSize = mInput.offset[j] + mInput.stride[j] * rows;
     }
 }
 
-GLESConvert::~GLESConvert(){    
+int GLESConvert::reconfigure(uint32_t width, uint32_t height, uint32_t rgbstride, const PlaneLayout *input){
+    const PoolParams *p = mPool->params();
+    uint32_t oldWidth = mWidth, oldHeight = mHeight, oldStride = mRGBStride;
+    PlaneLayout oldInput = mInput;
+    uint64_t oldSize = mFrameSize;
+    uint32_t pitch[MAX_PLANES];
+    StreamPool *pool;
 
-    mThreadRun = false;
-    
-    sem_post(&mGLSem);
-    sem_post(&mCustSem);
+    if(!mPool->idle()){
+        printf("reconfigure needs every frame retrieved and released\n");
+        return -1;
+    }
+    mWidth = width;
+    mHeight = height;
+    mRGBStride = rgbstride;
+    resolveInput(input);
+    if(mWidth == p->width && mHeight == p->height && mRGBStride == p->stride &&
+       memcmp(&mInput, &p->input, sizeof(mInput)) == 0)
+        return 0;
+
+    // the engines stay up, this pool holds on to them before the old one goes
+    if(mBackend == BACKEND_CPU)
+        pool = new StreamPool(p->desc, mWidth, mHeight, mRGBStride, p->depth, 1, cpu_entry, this, &mInput);
+    else
+        pool = StreamCache::get(p->desc, mWidth, mHeight, mRGBStride, p->depth, p->workers, &mInput);
+    if(!pool->ready()){
+        printf("can't convert %dx%d, staying at %dx%d\n", mWidth, mHeight, oldWidth, oldHeight);
+        delete pool;
+        mWidth = oldWidth;
+        mHeight = oldHeight;
+        mRGBStride = oldStride;
+        mInput = oldInput;
+        mFrameSize = oldSize;
+        return -1;
+    }
+    if(mBackend == BACKEND_CPU)
+        delete mPool;
+    else
+        StreamCache::put(mPool);
+    mPool = pool;
+    mPool->setTiming(mTiming);
+    // the new size may not take the slices, then the frames come whole
+    if(mSliceFn != NULL && mPool->setSlices(mSliceCount, mSliceFn, mSliceCtx) != 0){
+        printf("%d slices dropped at %dx%d\n", mSliceCount, mWidth, mHeight);
+        mSliceFn = NULL;
+        mSliceCtx = NULL;
+    }
 
-    int status = pthread_join(mThread, NULL);
-    if (status != 0) {
-       printf("pthread_join error:%d\n", status);
+    if(mBackend == BACKEND_CPU){
+        for(uint32_t j = 0; j < MAX_PLANES; j++)
+            pitch[j] = mPool->inputPitch(j);
+        mCpu->resize(mWidth, mHeight, mRGBStride, pitch);
+    }else if(mBalancer != NULL){
+        mCpu->resize(mWidth, mHeight, mRGBStride, mInput.stride);
+        mBalancer->resize(mHeight);
     }
+    return 0;
+}
 
-    sem_destroy(&mGLSem);
-    sem_destroy(&mCustSem);
+//static
+int GLESConvert::prewarm(const char *list, uint32_t depth, ColorMatrix matrix, ColorRange range, ChromaLayout layout,
+                         ChromaFilter filter, KernelMath math, uint32_t workers){
+    uint32_t width, height, stride;
+    int warmed = 0;
+
+    while(StreamCache::nextSize(&list, &width, &height, &stride) == 0){
+        // deleting it hands the pool to the cache
+        GLESConvert convert(width, height, stride > 0 ? stride : width, depth, BACKEND_GPU, matrix, range, layout,
+                            filter, math, NULL, workers);
+        // an explicit BACKEND_GPU stays one even when GL init failed
+        if(convert.ready())
+            warmed++;
+    }
+    return warmed;
 }
 
 //static
-void *GLESConvert::gles_entry(void *data){
-    GLESConvert *me = static_cast<GLESConvert *>(data);
-    me->glesMain();
-    return NULL;
+void GLESConvert::cpu_entry(void *ctx, uint8_t **planes, uint8_t *dst){
+    GLESConvert *me = static_cast<GLESConvert *>(ctx);
+    me->mCpu->convert(planes[0], planes[1], planes[2], dst);
 }
 
-void GLESConvert::glesMain(void){
-    void *src;
-    
-    initEgl();
-    initProgram();
-    initVBO();
-    
-
-    mThreadRun = true;
-    sem_post(&mCustSem);
-    for(;;){
-        sem_wait(&mGLSem);
-        if (!mThreadRun)
-            break;
-        performCompute(cy, cu, cv);
-        
-        glReadBuffer(GL_COLOR_ATTACHMENT0);
-		glReadPixels(0, 0, mRGBStride / 4, mHeight, GL_RGBA_INTEGER, GL_UNSIGNED_INT, 0);
-        src = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, mOutBufSize , GL_MAP_READ_BIT);
-        memcpy(cdst, src, mOutBufSize);
-        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
-        sem_post(&mCustSem);
-    }
-    cleanGLES();
-    return;
+int GLESConvert::convert(uint8_t *y, uint8_t *u, uint8_t *v, uint8_t * dst){
+    if(submit(y, u, v, dst) != 0)
+        return -1;
+    return retrieve(NULL);
 }
 
-int GLESConvert::initEgl(){
-	EGLint major,minor;
-
-	display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
-	if (display == EGL_NO_DISPLAY){
-		printf("unable to open connection to local windowing system, error:%d\n", eglGetError());
-		return -1;
-	}
-
-	if (!eglInitialize(display, &major, &minor)){
-		printf("unable to initialize EGL, error:%d\n", eglGetError());
-		return -1;
-	}
-	printf("EGL Verion:%d.%d\n", major, minor);
-
-	EGLint attribs [] = {
-		EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
-		EGL_RENDERABLE_TYPE, EGL_OPENGL_ES2_BIT,
-		EGL_RED_SIZE, 8,
-		EGL_GREEN_SIZE, 8,
-		EGL_BLUE_SIZE, 8,
-		EGL_DEPTH_SIZE, 0,
-		EGL_NONE
-	};
-
-	EGLint numConfigs;
-	EGLConfig config;
-	if (!eglChooseConfig(display, attribs, &config, 1, &numConfigs)){
-		printf("can't find suitable configs, error:%d\n", eglGetError());
-		return -1;
-	}
-    
-    EGLint value;
-	eglGetConfigAttrib(display, config, EGL_SURFACE_TYPE, &value);
-	printf("EGL_SURFACE_TYPE:%x\n", value);
-
-	eglGetConfigAttrib(display, config, EGL_MAX_PBUFFER_WIDTH, &value);
-	printf("EGL_MAX_PBUFFER_WIDTH:%x\n", value);
-    
-    EGLint contextAttrib[] = {
-		EGL_CONTEXT_CLIENT_VERSION, 3,
-		EGL_NONE
-	};
-
-	context = eglCreateContext(display, config, NULL, contextAttrib);
-	if (context == EGL_NO_CONTEXT){
-		printf("Can't Create EGLContext, error:%d\n", eglGetError());
-		return -1;
-	}
-
-#ifdef USE_PBUFFER
-    EGLint attrib_pb[] = {
-        EGL_WIDTH, 1, 
-        EGL_HEIGHT, 1, 
-        EGL_NONE
-    };
-    
-    surface = eglCreatePbufferSurface(display, config, attrib_pb);
-    if (eglMakeCurrent(display, surface, surface, context) == EGL_FALSE){
-        printf("Initilize error at eglMakeCurrent, error:%d\n", eglGetError());
+int GLESConvert::submit(uint8_t *y, uint8_t *u, uint8_t *v, uint8_t *dst){
+    uint8_t *planes[3] = {y, u, v};
+    HybridFrame *f = &mFrames[mSubmitted % MAX_PIPELINE_DEPTH];
+    uint64_t start;
+
+    if(mBalancer == NULL)
+        return mPool->submit(planes, dst);
+    f->rows = dst != NULL ? mPool->stream(0)->gpuRows(mBalancer->split()) : mHeight;
+    f->cpuNs = 0;
+    if(mPool->submit(planes, dst, f->rows) != 0)
         return -1;
+    mSubmitted++;
+    mPending++;
+    // the GPU has the top rows, the CPU threads do the rest meanwhile
+    if(f->rows < mHeight){
+        start = StageTimer::now();
+        mCpu->convertRange(y, u, v, dst, f->rows, mHeight);
+        f->cpuNs = StageTimer::now() - start;
     }
-#else
-	if (eglMakeCurrent(display, NULL, NULL, context) == EGL_FALSE){
-		printf("Initilize error at eglMakeCurrent, error:%d\n", eglGetError());
-		return -1;
-	}
-#endif
-	return 0;
-
+    return 0;
 }
 
-GLuint loadShader(GLenum type, const char *shaderSrc){
-	GLuint shader;
-	GLint compiled;
-
-	// Create the shader object
-	shader = glCreateShader(type);
-	if (shader == 0){
-		return 0;
-	}
-	// Load the shader source
-	glShaderSource(shader, 1, &shaderSrc, NULL);
-	// Compile the shader
-	glCompileShader(shader);
-	// Check the compile status
-	glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
-	if (!compiled){
-		GLint infoLen = 0;
-		glGetShaderiv ( shader, GL_INFO_LOG_LENGTH, &infoLen );
-		if (infoLen > 1){
-			char *infoLog = (char *)malloc(sizeof (char) * infoLen);
-
-			glGetShaderInfoLog (shader, infoLen, NULL, infoLog);
-			printf("Error compiling shader:\n%s\n", infoLog);
-			free ( infoLog );
-		}
-		glDeleteShader ( shader );
-		return 0;
-	}
-	return shader;
+int GLESConvert::submitFrame(uint8_t *frame, uint8_t *dst){
+    return submit(frame + mInput.offset[0], frame + mInput.offset[1], frame + mInput.offset[2], dst);
 }
 
-int GLESConvert::initProgram(void){
-    GLuint computeShader;
-    GLint linked;
-    const char *shader_source = 
-            "#version 310 es\n"
-            "\n"
-            "struct YUVData{\n"
-            "  uint yuv;  \n"
-            "};\n"
-            "\n"
-            "uniform int stride;\n"
-            "\n"
-            "const mat4 coef = mat4(\n"
-            "    1.164,    0.0,  1.596, 0.0,\n"
-            "    1.164, -0.391, -0.813, 0.0,\n"
-            "    1.164,  2.018,    0.0, 0.0,\n"
-            "    0.0,      0.0,    0.0, 1.0\n"
-            ");\n"
-            "\n"
-            "layout(local_size_x = 32, local_size_y = 32, local_size_z = 1) in;\n"
-            "layout(std430, binding=0) readonly buffer yBuffer{\n"
-            "    YUVData data[];\n"
-            "}YData;\n"
-            "layout(std430, binding=1) readonly buffer uBuffer{\n"
-            "    YUVData data[];\n"
-            "}UData;\n"
-            "layout(std430, binding=2) readonly buffer vBuffer{\n"
-            "    YUVData data[];\n"
-            "}VData;\n"
-            "\n"
-            "layout(binding = 1, rgba32ui) writeonly uniform  uimage2D output_image;\n"
-            "void main(void){\n"
-            "    ivec2 pos = ivec2(gl_GlobalInvocationID.xy);\n"
-            "    int index = pos.y * stride + pos.x;\n"
-            "    mat4 yuv;\n"
-            "    yuv[0] = unpackUnorm4x8(YData.data[index].yuv) - 16./255.;  // y\n"
-            "    yuv[1] = unpackUnorm4x8(UData.data[index].yuv) - 128./255.; // u\n"
-            "    yuv[2] = unpackUnorm4x8(VData.data[index].yuv) - 128./255.; // v\n"
-            "    yuv[3] = vec4(1.0);\n"
-            "    mat4 tmp = yuv * coef;\n"
-            "    mat4 rgba = transpose(tmp);\n"
-			"    uvec4 outdata; \n"
-            "    outdata.x = packUnorm4x8(rgba[0]);\n"
-            "    outdata.y = packUnorm4x8(rgba[1]);\n"
-            "    outdata.z = packUnorm4x8(rgba[2]);\n"
-            "    outdata.w = packUnorm4x8(rgba[3]);\n"
-			"    imageStore(output_image, pos, outdata);\n"
-            "}\n";
-    
-    // Load the vertex/fragment shaders
-    computeShader = loadShader(GL_COMPUTE_SHADER, shader_source);
-
-    // Create the program object
-    program = glCreateProgram();
-    glAttachShader(program, computeShader);
-    // Link the program
-    glLinkProgram(program);
-
-    // Check the link status
-    glGetProgramiv(program, GL_LINK_STATUS, &linked);
-    if(!linked){
-        GLint infoLen = 0;
-        glGetProgramiv(program, GL_INFO_LOG_LENGTH, &infoLen);
-        if (infoLen > 1){
-            char *infoLog = (char *)malloc(sizeof (char) * infoLen);
-
-            glGetProgramInfoLog(program, infoLen, NULL, infoLog);
-            printf("Error linking program:\n%s\n", infoLog);
-            free(infoLog);
-        }
-        glDeleteProgram(program);
+int GLESConvert::submitFd(int fd, uint8_t *dst){
+    const uint8_t *frame;
+    uint64_t size;
+    FdKey key;
+    int ret;
+
+    if(mBalancer == NULL)
+        return mPool->submitFd(fd, dst);
+    // the CPU share reads the planes as well, map the buffer here
+    if(fdKey(fd, &key, &size) != 0 || size < mFrameSize || (frame = mMaps.map(fd, &key, mFrameSize)) == NULL){
+        printf("fd %d does not hold a %dx%d frame\n", fd, mWidth, mHeight);
         return -1;
     }
-    
-    glDeleteShader(computeShader);
-    stride_index = glGetUniformLocation(program, "stride");
+    FdMapCache::beginRead(fd);
+    ret = submitFrame((uint8_t *)frame, dst);
+    FdMapCache::endRead(fd);
+    return ret;
+}
+
+int GLESConvert::getInputBuffer(uint8_t **y, uint8_t **u, uint8_t **v){
+    uint8_t *planes[3] = {NULL, NULL, NULL};
+
+    if(mPool->getInputBuffer(planes) != 0)
+        return -1;
+    *y = planes[0];
+    *u = planes[1];
+    *v = planes[2];
     return 0;
 }
 
-int GLESConvert::initVBO(void){
-    glGenFramebuffers(1, &fboid);
-    glBindFramebuffer(GL_FRAMEBUFFER, fboid);
-
-    glGenTextures(1, &texOut);  
-    glBindTexture(GL_TEXTURE_2D, texOut);
-    glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA32UI, mRGBStride / 4, mHeight);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    printf("line:%d glError:%x\n", __LINE__, glGetError());
-    
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texOut, 0);
-    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
-    if(status != GL_FRAMEBUFFER_COMPLETE){
-        printf("failed  %x\n", status);
-    }    
-    printf("line:%d glError:%x\n", __LINE__, glGetError());
-
-    glGenBuffers(3,  vbo);
-    
-    glGenBuffers(1, &pboid);
-    glBindBuffer(GL_PIXEL_PACK_BUFFER, pboid);
-    glBufferData(GL_PIXEL_PACK_BUFFER, mOutBufSize, NULL, GL_DYNAMIC_READ);
+int GLESConvert::submitInput(uint8_t *dst){
+    if(mPool->submitInput(dst) != 0)
+        return -1;
+    if(mBalancer != NULL){
+        mFrames[mSubmitted % MAX_PIPELINE_DEPTH].rows = mHeight;
+        mSubmitted++;
+        mPending++;
+    }
     return 0;
 }
 
-void GLESConvert::performCompute(uint8_t *y, uint8_t *u, uint8_t *v){
-    
-    glUseProgram(program);    
-    glUniform1i(stride_index, mWidth / 4);
-    
-    glBindBuffer(GL_ARRAY_BUFFER, vbo[0]);
-    glBufferData(GL_ARRAY_BUFFER, mInBufSize, y, GL_DYNAMIC_DRAW);
-
-    glBindBuffer(GL_ARRAY_BUFFER, vbo[1]);
-    glBufferData(GL_ARRAY_BUFFER, mInBufSize, u, GL_DYNAMIC_DRAW);
-
-    glBindBuffer(GL_ARRAY_BUFFER, vbo[2]);
-    glBufferData(GL_ARRAY_BUFFER, mInBufSize, v, GL_DYNAMIC_DRAW);
-    printf("line:%d glError:%x\n", __LINE__, glGetError());
-    
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, vbo[0]);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, vbo[1]);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, vbo[2]);
-    printf("line:%d glError:%x\n", __LINE__, glGetError());
-    
-	glBindImageTexture(1, texOut, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA32UI);
-    printf("line:%d glError:%x\n", __LINE__, glGetError());
-    
-    glDispatchCompute(num_groups_x, num_groups_y, 1);
-    printf("line:%d glError:%x\n", __LINE__, glGetError());
-    
-    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+// BACKEND_HYBRID: the oldest frame has been taken off the stream, feed
+// both sides' times to the balancer
+void GLESConvert::retired(void){
+    HybridFrame *f;
+
+    if(mBalancer == NULL || mPending == 0)
+        return;
+    f = &mFrames[(mSubmitted - mPending) % MAX_PIPELINE_DEPTH];
+    mPending--;
+    if(f->rows < mHeight)
+        mBalancer->add(f->rows, mPool->stream(0)->busyNs(), mHeight - f->rows, f->cpuNs);
 }
 
-int GLESConvert::convert(uint8_t *y, uint8_t *u, uint8_t *v, uint8_t * dst){
-    if(!mThreadRun)
-        return -1;
-    cy = y;
-    cu = u;
-    cv = v;
-    cdst = dst;
-    sem_post(&mGLSem);
-    
-    sem_wait(&mCustSem);    
+void GLESConvert::cancelInput(void){
+    mPool->cancelInput();
+}
+
+uint32_t GLESConvert::getInputStride(uint32_t plane){
+    return mPool->inputPitch(plane);
+}
+
+int GLESConvert::retrieve(uint8_t **dst){
+    int ret = mPool->retrieve(dst);
+    retired();
+    return ret;
+}
+
+int GLESConvert::acquire(const uint8_t **data){
+    int ret = mPool->acquire(data);
+    // a failed frame has been taken off the stream as well
+    retired();
+    return ret;
+}
+
+int GLESConvert::release(const uint8_t *data){
+    return mPool->release(data);
+}
+
+uint32_t GLESConvert::getOutputStride(void){
+    return mPool->outputStride();
 }
 
 void GLESConvert::waitGLInit(void){
-    sem_wait(&mCustSem);
 }
 
-void GLESConvert::cleanGLES(void){    
-    glDeleteProgram(program);
-
-    glDeleteBuffers(3, vbo);
-    glDeleteTextures(1, &texOut);
-    glDeleteFramebuffers(1, &fboid);
-    glDeleteBuffers(1, &pboid);    
-#ifdef USE_PBUFFER
-    eglDestroySurface(display, surface);
-#endif
-    eglDestroyContext(display, context);
-    eglTerminate(display);
-    eglReleaseThread();
+ConvertBackend GLESConvert::getBackend(void){
+    return mBackend;
+}
+
+bool GLESConvert::ready(void){
+    return mPool->ready();
+}
+
+uint32_t GLESConvert::getWorkers(void){
+    return mPool->workers();
+}
+
+uint64_t GLESConvert::getWorkerFrames(uint32_t worker){
+    return mPool->frames(worker);
+}
+
+void GLESConvert::setTiming(uint32_t every){
+    mTiming = every;
+    mPool->setTiming(every);
+}
+
+int GLESConvert::getStageStats(ConvertStage stage, StageStats *stats){
+    return mPool->stageStats(stage, stats);
+}
+
+void GLESConvert::getFdStats(uint64_t *imported, uint64_t *mapped, uint64_t *misses){
+    mPool->fdStats(imported, mapped, misses);
+}
+
+int GLESConvert::getHybridSplit(uint32_t *gpuRows, double *gpuNsPerRow, double *cpuNsPerRow){
+    if(mBalancer == NULL)
+        return -1;
+    *gpuRows = mBalancer->split();
+    *gpuNsPerRow = mBalancer->nsPerRow(0);
+    *cpuNsPerRow = mBalancer->nsPerRow(1);
+    return 0;
+}
+
+int GLESConvert::setSlices(uint32_t count, GLStream::SliceFunc fn, void *ctx){
+    if(mPool->setSlices(count, fn, ctx) != 0)
+        return -1;
+    mSliceCount = count;
+    mSliceFn = fn;
+    mSliceCtx = ctx;
+    return 0;
 }
@@ -1,69 +1,149 @@
 #ifndef _GLESCONVERT_H_
 #define _GLESCONVERT_H_
 #include <stdint.h>
-#include <EGL/egl.h>
-#include <GLES3/gl31.h>
-#include <pthread.h>
-#include <semaphore.h>
-
-
-// Some platform can't do eglMakeCurrent with NULL surface
-// So use pbuffer to create a 1x1 surface
-#define USE_PBUFFER 1
+#include "GLEngine.h"
+#include "GLStream.h"
+#include "StreamPool.h"
+#include "StreamCache.h"
+#include "CPUConvert.h"
+#include "RowBalancer.h"
 
+// y, u, v -> RGBA on the shared GLEngine, in the given colorspace. Input is
+// 4:4:4 planes, or I420 / NV12 that the kernel upsamples itself, in which
+// case u and v are the quarter size planes (NV12: u is the uv plane and v
+// is unused). 4:2:0 needs an even width. MATH_FIXED picks the integer
+// kernels, the CPU fallback then matches them bit for bit.
+//
+// input gives the decoder's plane layout: submit() and the CPU share read
+// rows at its strides, submitFrame() takes the whole buffer at its
+// offsets, and so does submitFd(). NULL, or no offsets, is planes back to
+// back. Any width works, rgbstride only has to cover it.
+//
+// BACKEND_HYBRID converts the top rows of each submit()ed frame on the GPU
+// while CPUConvert does the rest on the calling thread and its workers,
+// both straight into dst. The split follows the measured per row time of
+// each side (RowBalancer). Frames queued with submitInput() or without a
+// dst run on the GPU alone.
+//
+// BACKEND_GPU spreads frames over workers engines, each with its own GL
+// thread and context (StreamPool), 0 takes GLESCONVERT_WORKERS. Every
+// worker has depth slots, keep up to workers * depth frames queued to
+// keep them all busy. The other backends run on one worker.
+//
+// GPU and hybrid converters take their pool from the process wide
+// StreamCache and give it back when they are deleted, so a converter of a
+// kind and size that ran before starts without touching the GPU.
+//
+// reconfigure() switches a converter to another frame size between frames,
+// for streams that change resolution. The engines, their GL threads and
+// contexts and the compiled kernel stay, only the pool of streams, which
+// holds the size dependent textures and buffers, is swapped: the one of the
+// old size goes back to the StreamCache and the new one comes from it, so
+// switching between recently used sizes costs no GPU work as long as they
+// fit GLESCONVERT_WARM_BYTES. The CPU side is resized in place.
 class GLESConvert{
 public:
-    GLESConvert(uint32_t width, uint32_t height, uint32_t rgbstride);
+    GLESConvert(uint32_t width, uint32_t height, uint32_t rgbstride, uint32_t depth = 2,
+                ConvertBackend backend = BACKEND_AUTO, ColorMatrix matrix = COLOR_BT601,
+                ColorRange range = RANGE_LIMITED, ChromaLayout layout = CHROMA_444,
+                ChromaFilter filter = FILTER_NEAREST, KernelMath math = MATH_FLOAT,
+                const PlaneLayout *input = NULL, uint32_t workers = 0);
     ~GLESConvert();
+    // Warm the StreamCache for every size in list, "WxH[:rgbstride],..."
+    // with the stride defaulting to the width, so converters built with
+    // the same arguments later start right away. Returns how many sizes
+    // could be warmed.
+    static int prewarm(const char *list, uint32_t depth = 2, ColorMatrix matrix = COLOR_BT601,
+                       ColorRange range = RANGE_LIMITED, ChromaLayout layout = CHROMA_444,
+                       ChromaFilter filter = FILTER_NEAREST, KernelMath math = MATH_FLOAT, uint32_t workers = 0);
+    // New frame size and input layout (NULL: tightly packed), -1 while
+    // frames are queued, unretrieved or held, or if the new size can't be
+    // set up, the converter then keeps the old one. Timing and slice
+    // settings carry over, stage stats come from the new size's pool.
+    int reconfigure(uint32_t width, uint32_t height, uint32_t rgbstride, const PlaneLayout *input = NULL);
+    // Synchronous conversion, same as submit() followed by retrieve()
     int convert(uint8_t *y, uint8_t *u, uint8_t *v, uint8_t *dst);
+    // Queue one frame without blocking, -1 when depth frames are already
+    // queued or unretrieved.
+    // y, u and v are copied into the staging ring before this returns, dst
+    // must stay valid until the frame is retrieved.
+    int submit(uint8_t *y, uint8_t *u, uint8_t *v, uint8_t *dst);
+    // Same with the planes at the input layout's offsets into frame
+    int submitFrame(uint8_t *frame, uint8_t *dst);
+    // Same with the frame in a dma-buf or memfd, see GLStream::submitFd().
+    // Imported dma-bufs have to stay unchanged until the frame is retrieved.
+    int submitFd(int fd, uint8_t *dst);
+    // Zero copy upload: get the staging memory of the next free slot so the
+    // decoder can write the planes straight into it, then queue it with
+    // submitInput() or give it back with cancelInput().
+    int getInputBuffer(uint8_t **y, uint8_t **u, uint8_t **v);
+    int submitInput(uint8_t *dst);
+    void cancelInput(void);
+    // Bytes per row of getInputBuffer() plane 0..2, the decoder's stride
+    // when the kernels can read it as is
+    uint32_t getInputStride(uint32_t plane);
+    // Wait for the oldest submitted frame, frames come back in submit order
+    int retrieve(uint8_t **dst);
+    // Zero copy retrieve for frames submitted with dst == NULL: hands out a
+    // read-only view of the mapped pack buffer instead of copying it. The
+    // view stays valid until release(), and holds on to its pipeline slot.
+    int acquire(const uint8_t **data);
+    int release(const uint8_t *data);
+    // Pixels per row of acquire() views, rgbstride rounded up to a multiple of 4
+    uint32_t getOutputStride(void);
+	// The constructor already waits for the shared engine, kept for old callers
 	void waitGLInit(void);
+	ConvertBackend getBackend(void);
+	// false if the converter's streams could not be set up (no GL)
+	bool ready(void);
+	// Pool size, and frames each worker has been given
+	uint32_t getWorkers(void);
+	uint64_t getWorkerFrames(uint32_t worker);
+	// Per stage timing, see GLStream::setTiming(), the first worker's stats
+	void setTiming(uint32_t every);
+	int getStageStats(ConvertStage stage, StageStats *stats);
+	// submitFd() frames the GPU imported / copied from a mapping, and
+	// buffers imported or mapped first, see GLStream::fdStats()
+	void getFdStats(uint64_t *imported, uint64_t *mapped, uint64_t *misses);
+	// Hand out each frame in count horizontal slices as they finish, see
+	// GLStream::setSlices(). Only between frames.
+	int setSlices(uint32_t count, GLStream::SliceFunc fn, void *ctx);
+	// BACKEND_HYBRID: rows the GPU gets next and the mean ns per row of each
+	// side, -1 for the other backends
+	int getHybridSplit(uint32_t *gpuRows, double *gpuNsPerRow, double *cpuNsPerRow);
 
 private:
-	static void *gles_entry(void *data);
-	void glesMain(void);
+	static void cpu_entry(void *ctx, uint8_t **planes, uint8_t *dst);
+	void resolveInput(const PlaneLayout *input);
+	void retired(void);
 
-	int initEgl(void);
-	int initProgram(void);
-	int initVBO(void);
-	void performCompute(uint8_t *y, uint8_t *u, uint8_t *v);
+	// rows and CPU time of a frame in flight, BACKEND_HYBRID
+	struct HybridFrame{
+		uint32_t rows;
+		uint64_t cpuNs;
+	};
 
-	void cleanGLES(void);
 private:
 	uint32_t mWidth;
 	uint32_t mHeight;
 	uint32_t mRGBStride;
+	ChromaLayout mLayout;
+	PlaneLayout mInput;  // strides and offsets resolved, 0 only for planes the layout lacks
+	uint64_t mFrameSize; // least submitFd() buffer
+	FdMapCache mMaps;    // BACKEND_HYBRID submitFd()
 
-	pthread_t mThread;
-	uint8_t *cy;
-	uint8_t *cu;
-	uint8_t *cv;
-	uint8_t *cdst;
-	sem_t mGLSem;
-	sem_t mCustSem;
-	
-	bool mThreadRun;
-	
-	// OPENGL ES 3.1 ComputeShader
-	EGLDisplay display;
-	EGLContext context;
-#ifdef USE_PBUFFER
-	EGLSurface surface; 
-#endif
-	//framebuffer object
-	GLuint fboid;
-    GLuint texOut;
-
-    //Vertex Buffer Object
-    GLuint vbo[3];
-    GLuint pboid;
-	
-	// computer program
-    GLuint program;
-    GLint stride_index;
+	StreamPool *mPool;
+	ConvertBackend mBackend;
+	CPUConvert *mCpu;
+	RowBalancer *mBalancer;  // BACKEND_HYBRID only
+	HybridFrame mFrames[MAX_PIPELINE_DEPTH];
+	uint32_t mSubmitted;
+	uint32_t mPending;
 
-	GLuint num_groups_x;
-	GLuint num_groups_y;
-	GLsizeiptr mInBufSize;
-	GLsizeiptr mOutBufSize;
+	// what reconfigure() hands on to the next pool
+	uint32_t mTiming;
+	uint32_t mSliceCount;
+	GLStream::SliceFunc mSliceFn;
+	void *mSliceCtx;
 };
 #endif
@@ -1,46 +1,658 @@
 #include "GLESConvert.h"
+#include "FrameIO.h"
+#include "TestPattern.h"
+#include "GLCheck.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
+#include <unistd.h>
 
 void usage(char *name){
 	printf("offscreen render\n");
-	printf("%s texfile savefile width height cnt\n", name);
+	printf("%s texfile savefile width height cnt [depth] [auto|gpu|cpu|hybrid|check] [colorspace] [input] [math]\n", name);
+	printf("%s golden\n", name);
+	printf("%s bench width height cnt [input]\n", name);
+	printf("  check: convert on the GPU and compare every frame with CPUConvert\n");
+	printf("  hybrid: split every frame between the GPU and the CPU threads\n");
+	printf("  colorspace: bt601 (default), bt709 or bt2020, -full for full range (bt709-full)\n");
+	printf("  input: 444 (default), i420 or nv12, -bilinear for filtered chroma (nv12-bilinear)\n");
+	printf("  math: float (default) or fixed, fixed kernels must match CPUConvert exactly\n");
+	printf("  golden: fixed kernels against CPUConvert on test patterns, every input, colorspace and plane layout,\n");
+	printf("          then converters resized through every size\n");
+	printf("  bench: float and fixed kernels on random frames, fps, GPU dispatch time, start and resize time\n");
+	printf("  GLESCONVERT_SLICES=K: deliver frames in K slices, prints first slice and frame latency\n");
+	printf("  GLESCONVERT_GL_CHECK=N: check for GL errors every Nth frame, GLESCONVERT_GL_DEBUG=high|medium|low|all:\n");
+	printf("          KHR_debug severity of GLCHECK=1 builds\n");
+	printf("  GLESCONVERT_WORKERS=N: spread GPU frames over N GL threads and contexts, bench compares 1..N\n");
+	printf("  GLESCONVERT_WARM=WxH[:stride],...: prewarm converters of those sizes, bench times cold and warm starts\n");
 	exit(0);
 }
+
+// hands the oldest frame to the writer thread, returns 1 if it is off by
+// more than tolerance steps from ref
+static int writeFrame(FrameWriter *writer, GLESConvert *convert, const uint8_t *ref, int frame, int size,
+                      int tolerance){
+	uint8_t *dst;
+	int diff = 0, maxdiff = 0, d;
+
+	convert->retrieve(&dst);
+	if (ref != NULL){
+		for (int i = 0; i < size * 4; i++){
+			d = abs(dst[i] - ref[i]);
+			if (d > maxdiff)
+				maxdiff = d;
+			diff += d > tolerance;
+		}
+	}
+	writer->put(size * 4);
+	if (diff > 0)
+		printf("frame %d: %d bytes differ from the CPU reference, max %d\n", frame, diff, maxdiff);
+	return diff > 0;
+}
+
+// GLESCONVERT_TIMING=N samples every Nth frame
+static void printTiming(GLESConvert *convert){
+	static const char *names[STAGE_COUNT] = {"upload", "dispatch", "readback", "map", "copy"};
+	StageStats st;
+
+	for (int s = 0; s < STAGE_COUNT; s++){
+		if (convert->getStageStats((ConvertStage)s, &st) != 0 || st.count == 0)
+			continue;
+		printf("%-8s %s n:%3u min:%7.3fms mean:%7.3fms p50:%7.3fms p99:%7.3fms\n", names[s],
+		       st.gpu ? "gpu" : "cpu", st.count, st.minNs / 1e6, st.meanNs / 1e6, st.p50Ns / 1e6, st.p99Ns / 1e6);
+	}
+}
+
+// GLESCONVERT_SLICES=K: time from submit to the first slice and to the
+// whole frame. Submit times are written before the frame is queued and read
+// back on the engine thread.
+struct SliceLatency{
+	uint64_t submit[MAX_PIPELINE_DEPTH];
+	uint32_t submitted;
+	uint32_t delivered;
+	uint32_t height;
+	uint64_t firstNs;
+	uint64_t frameNs;
+};
+
+static void sliceDone(void *ctx, uint32_t rowBegin, uint32_t rowEnd, const uint8_t *){
+	SliceLatency *lat = (SliceLatency *)ctx;
+	uint64_t ns = StageTimer::now() - lat->submit[lat->delivered % MAX_PIPELINE_DEPTH];
+
+	if (rowBegin == 0)
+		lat->firstNs += ns;
+	if (rowEnd == lat->height){
+		lat->frameNs += ns;
+		lat->delivered++;
+	}
+}
+
+// GL errors the checks found and failures the streams hit, sampled
+// checks only in release builds (GLESCONVERT_GL_CHECK=N)
+static void printGLErrors(void){
+	GLErrorStats es;
+
+	GLCheck::stats(&es);
+	if (es.errors == 0 && es.failures == 0 && es.messages == 0)
+		return;
+	printf("gl checks:%llu errors:%llu last:%x failures:%llu debug messages:%llu\n", (unsigned long long)es.checks,
+	       (unsigned long long)es.errors, es.lastError, (unsigned long long)es.failures,
+	       (unsigned long long)es.messages);
+}
+
+// GLESCONVERT_WORKERS=N: how the pool spread the frames
+static void printWorkers(GLESConvert *convert){
+	if (convert->getWorkers() < 2)
+		return;
+	printf("workers:%u", convert->getWorkers());
+	for (uint32_t i = 0; i < convert->getWorkers(); i++)
+		printf(" %u:%llu", i, (unsigned long long)convert->getWorkerFrames(i));
+	printf("\n");
+}
+
+// Warm converter cache, when it was used
+static void printWarm(void){
+	WarmStats ws;
+
+	StreamCache::stats(&ws);
+	if (ws.builds == 0 && ws.hits == 0)
+		return;
+	printf("warm cache hits:%llu misses:%llu builds:%llu mean:%.3fms max:%.3fms idle:%u %lluKB trimmed:%llu\n",
+	       (unsigned long long)ws.hits, (unsigned long long)ws.misses, (unsigned long long)ws.builds,
+	       ws.builds > 0 ? ws.buildNs / 1e6 / ws.builds : 0.0, ws.maxBuildNs / 1e6, ws.idle,
+	       (unsigned long long)(ws.idleBytes >> 10), (unsigned long long)ws.trimmed);
+}
+
+static void printIO(FrameReader *reader, FrameWriter *writer, int frames, uint64_t ns, uint64_t readNs){
+	printf("%d frames in %.3fs, %.1f fps, input:%s read stall:%.3fms write stall:%.3fms writer busy:%.3fms\n",
+	       frames, ns / 1e9, ns > 0 ? frames * 1e9 / ns : 0.0, reader->mapped() ? "mmap" : "fread",
+	       readNs / 1e6, writer->stallNs() / 1e6, writer->writeNs() / 1e6);
+}
+
+// width of plane j of a layout, the height follows from chromaPlaneSize()
+static uint32_t planeWidth(ChromaLayout layout, uint32_t width, uint32_t plane){
+	if (plane == 0 || layout != CHROMA_I420)
+		return width;
+	return width / 2;
+}
+
+static void fillFrame(TestPattern pattern, ChromaLayout layout, uint8_t **planes, uint32_t width, uint32_t height,
+                      uint32_t seed){
+	for (uint32_t j = 0; j < chromaPlanes(layout); j++){
+		uint32_t pw = planeWidth(layout, width, j);
+		fillPattern(pattern, j, planes[j], pw, chromaPlaneSize(layout, width, height, j) / pw, seed);
+	}
+}
+
+// largest difference over the visible pixels, count gets the differing bytes
+static int compareRGBA(const uint8_t *a, const uint8_t *b, uint32_t width, uint32_t height, uint32_t stride,
+                       int *count){
+	int maxdiff = 0, d;
+
+	*count = 0;
+	for (uint32_t r = 0; r < height; r++){
+		for (uint32_t i = 0; i < width * 4; i++){
+			d = abs(a[r * stride * 4 + i] - b[r * stride * 4 + i]);
+			if (d > maxdiff)
+				maxdiff = d;
+			*count += d != 0;
+		}
+	}
+	return maxdiff;
+}
+
+// Plane layouts the golden modes feed in: tightly packed planes, rows padded
+// to 64 bytes like most decoders, and rows 3 bytes longer than the plane at
+// odd offsets, which the stream has to repack
+enum{LAYOUT_TIGHT, LAYOUT_PADDED, LAYOUT_ODD, LAYOUT_COUNT};
+static const char *sLayoutNames[LAYOUT_COUNT] = {"tight", "padded", "odd"};
+
+// layout of a frame with planes of widths x rows bytes, returns its size
+static uint32_t testLayout(int kind, uint32_t planes, const uint32_t *widths, const uint32_t *rows, PlaneLayout *pl){
+	uint32_t offset = kind == LAYOUT_ODD ? 5 : 0;
+
+	memset(pl, 0, sizeof(*pl));
+	for (uint32_t j = 0; j < planes; j++){
+		if (kind == LAYOUT_TIGHT)
+			pl->stride[j] = widths[j];
+		else if (kind == LAYOUT_PADDED)
+			pl->stride[j] = (widths[j] + 63) & ~63;
+		else
+			pl->stride[j] = widths[j] + 3;
+		pl->offset[j] = offset;
+		offset += pl->stride[j] * rows[j] + (kind == LAYOUT_ODD ? 7 : 0);
+	}
+	return offset;
+}
+
+static const uint32_t sGoldenSizes[][2] = {{8, 2}, {24, 6}, {30, 6}, {62, 10}, {64, 32}, {200, 60}, {1280, 720}};
+#define GOLDEN_SIZES (sizeof(sGoldenSizes) / sizeof(sGoldenSizes[0]))
+
+// Every input layout, colorspace and test pattern at a few sizes, including
+// the smallest the 4:2:0 kernels take, widths that are not a multiple of 4
+// and a stride wider than the frame. The fixed point kernels have to match
+// the scalar reference byte for byte with the planes in every test layout,
+// the float kernels are only reported. The padded layout also goes in
+// through submitFd() from a memfd, rewritten for every pattern.
+static int runGolden(void){
+	static const char *inputs[] = {"444", "i420", "i420-bilinear", "nv12", "nv12-bilinear"};
+	int cases = 0, failed = 0;
+	uint64_t fdImported = 0, fdMapped = 0, fdMisses = 0;
+
+	for (uint32_t s = 0; s < GOLDEN_SIZES; s++){
+		uint32_t width = sGoldenSizes[s][0], height = sGoldenSizes[s][1], stride = width + 8;
+		uint8_t *planes[3];
+		uint8_t *gpu = (uint8_t *)malloc(stride * height * 4);
+		uint8_t *cpu = (uint8_t *)malloc(stride * height * 4);
+		for (uint32_t j = 0; j < 3; j++)
+			planes[j] = (uint8_t *)malloc(width * height);
+		for (uint32_t in = 0; in < sizeof(inputs) / sizeof(inputs[0]); in++){
+			ChromaLayout layout;
+			ChromaFilter filter;
+			uint32_t widths[3], rows[3];
+			PlaneLayout pl[LAYOUT_COUNT];
+			uint8_t *frames[LAYOUT_COUNT];
+			uint32_t bytes[LAYOUT_COUNT];
+			int fd;
+			parseChromaLayout(inputs[in], &layout, &filter);
+			for (uint32_t j = 0; j < chromaPlanes(layout); j++){
+				widths[j] = planeWidth(layout, width, j);
+				rows[j] = chromaPlaneSize(layout, width, height, j) / widths[j];
+			}
+			for (int k = 0; k < LAYOUT_COUNT; k++){
+				bytes[k] = testLayout(k, chromaPlanes(layout), widths, rows, &pl[k]);
+				frames[k] = (uint8_t *)malloc(bytes[k]);
+			}
+			fd = memfdFrame(frames[LAYOUT_PADDED], bytes[LAYOUT_PADDED]);
+			for (int m = 0; m < COLOR_MATRIX_COUNT; m++){
+				for (int rg = 0; rg < COLOR_RANGE_COUNT; rg++){
+					ColorMatrix matrix = (ColorMatrix)m;
+					ColorRange range = (ColorRange)rg;
+					GLESConvert *fixed[LAYOUT_COUNT];
+					GLESConvert fl(width, height, stride, 1, BACKEND_GPU, matrix, range, layout, filter, MATH_FLOAT);
+					CPUConvert ref(width, height, stride, 0, matrix, range, layout, filter, MATH_FIXED);
+					int floatmax = 0;
+					for (int k = 0; k < LAYOUT_COUNT; k++)
+						fixed[k] = new GLESConvert(width, height, stride, 1, BACKEND_GPU, matrix, range, layout, filter,
+						                           MATH_FIXED, &pl[k]);
+					for (int p = 0; p < TEST_PATTERN_COUNT; p++){
+						int count, maxdiff;
+						fillFrame((TestPattern)p, layout, planes, width, height, s + 1);
+						ref.convert(planes[0], planes[1], planes[2], cpu);
+						for (int k = 0; k < LAYOUT_COUNT; k++){
+							for (uint32_t j = 0; j < chromaPlanes(layout); j++)
+								copyPlane(frames[k] + pl[k].offset[j], pl[k].stride[j], planes[j], widths[j], widths[j],
+								          rows[j]);
+							memset(gpu, 0, stride * height * 4);
+							cases++;
+							if (fixed[k]->submitFrame(frames[k], gpu) != 0 || fixed[k]->retrieve(NULL) != 0){
+								printf("golden %dx%d %s %s %s %s: convert failed\n", width, height, inputs[in],
+								       sLayoutNames[k], colorSpaceName(matrix, range), patternName((TestPattern)p));
+								failed++;
+								continue;
+							}
+							maxdiff = compareRGBA(gpu, cpu, width, height, stride, &count);
+							if (count > 0){
+								printf("golden %dx%d %s %s %s %s: %d bytes differ, max %d\n", width, height,
+								       inputs[in], sLayoutNames[k], colorSpaceName(matrix, range),
+								       patternName((TestPattern)p), count, maxdiff);
+								failed++;
+							}
+						}
+						if (fd >= 0 && pwrite(fd, frames[LAYOUT_PADDED], bytes[LAYOUT_PADDED], 0) ==
+						    (ssize_t)bytes[LAYOUT_PADDED]){
+							memset(gpu, 0, stride * height * 4);
+							cases++;
+							if (fixed[LAYOUT_PADDED]->submitFd(fd, gpu) != 0 ||
+							    fixed[LAYOUT_PADDED]->retrieve(NULL) != 0){
+								printf("golden %dx%d %s fd %s %s: convert failed\n", width, height, inputs[in],
+								       colorSpaceName(matrix, range), patternName((TestPattern)p));
+								failed++;
+							}else if (compareRGBA(gpu, cpu, width, height, stride, &count), count > 0){
+								printf("golden %dx%d %s fd %s %s: %d bytes differ\n", width, height, inputs[in],
+								       colorSpaceName(matrix, range), patternName((TestPattern)p), count);
+								failed++;
+							}
+						}
+						if (fl.convert(planes[0], planes[1], planes[2], gpu) == 0){
+							maxdiff = compareRGBA(gpu, cpu, width, height, stride, &count);
+							if (maxdiff > floatmax)
+								floatmax = maxdiff;
+						}
+					}
+					printf("golden %dx%d %s %s backend:%s float max diff %d\n", width, height, inputs[in],
+					       colorSpaceName(matrix, range), fixed[0]->getBackend() == BACKEND_CPU ? "cpu" : "gpu",
+					       floatmax);
+					uint64_t imported, mapped, misses;
+					fixed[LAYOUT_PADDED]->getFdStats(&imported, &mapped, &misses);
+					fdImported += imported;
+					fdMapped += mapped;
+					fdMisses += misses;
+					for (int k = 0; k < LAYOUT_COUNT; k++)
+						delete fixed[k];
+				}
+			}
+			if (fd >= 0)
+				close(fd);
+			for (int k = 0; k < LAYOUT_COUNT; k++)
+				free(frames[k]);
+		}
+		for (uint32_t j = 0; j < 3; j++)
+			free(planes[j]);
+		free(gpu);
+		free(cpu);
+	}
+	printf("golden fd frames imported:%llu mapped:%llu buffers imported or mapped:%llu\n",
+	       (unsigned long long)fdImported, (unsigned long long)fdMapped, (unsigned long long)fdMisses);
+	printf("golden: %d of %d cases differ\n", failed, cases);
+	return failed > 0 ? -1 : 0;
+}
+
+// One fixed point converter per input and backend taken up through the
+// golden sizes and back down with reconfigure(), every frame checked
+// against a CPUConvert built for its size. The way down runs on the pools
+// the way up left in the warm cache.
+static int runGoldenResize(void){
+	static const char *inputs[] = {"444", "i420-bilinear", "nv12"};
+	static const ConvertBackend backends[] = {BACKEND_GPU, BACKEND_HYBRID, BACKEND_CPU};
+	static const char *backendNames[] = {"gpu", "hybrid", "cpu"};
+	uint32_t maxw = sGoldenSizes[GOLDEN_SIZES - 1][0] + 8, maxh = sGoldenSizes[GOLDEN_SIZES - 1][1];
+	uint8_t *planes[3];
+	uint8_t *gpu = (uint8_t *)malloc(maxw * maxh * 4);
+	uint8_t *cpu = (uint8_t *)malloc(maxw * maxh * 4);
+	int cases = 0, failed = 0;
+	WarmStats before, after;
+
+	for (uint32_t j = 0; j < 3; j++)
+		planes[j] = (uint8_t *)malloc(maxw * maxh);
+	StreamCache::stats(&before);
+	for (uint32_t in = 0; in < sizeof(inputs) / sizeof(inputs[0]); in++){
+		ChromaLayout layout;
+		ChromaFilter filter;
+		parseChromaLayout(inputs[in], &layout, &filter);
+		for (uint32_t b = 0; b < sizeof(backends) / sizeof(backends[0]); b++){
+			GLESConvert convert(sGoldenSizes[0][0], sGoldenSizes[0][1], sGoldenSizes[0][0] + 8, 1, backends[b],
+			                    COLOR_BT601, RANGE_LIMITED, layout, filter, MATH_FIXED);
+			for (uint32_t step = 0; step < 2 * GOLDEN_SIZES - 1; step++){
+				uint32_t s = step < GOLDEN_SIZES ? step : 2 * GOLDEN_SIZES - 2 - step;
+				uint32_t width = sGoldenSizes[s][0], height = sGoldenSizes[s][1], stride = width + 8;
+				CPUConvert ref(width, height, stride, 0, COLOR_BT601, RANGE_LIMITED, layout, filter, MATH_FIXED);
+				int count;
+				cases++;
+				fillFrame(PATTERN_RANDOM, layout, planes, width, height, step + 1);
+				ref.convert(planes[0], planes[1], planes[2], cpu);
+				memset(gpu, 0, stride * height * 4);
+				if (convert.reconfigure(width, height, stride) != 0 ||
+				    convert.convert(planes[0], planes[1], planes[2], gpu) != 0){
+					printf("golden reconfigure %dx%d %s %s: convert failed\n", width, height, inputs[in],
+					       backendNames[b]);
+					failed++;
+				}else if (compareRGBA(gpu, cpu, width, height, stride, &count), count > 0){
+					printf("golden reconfigure %dx%d %s %s: %d bytes differ\n", width, height, inputs[in],
+					       backendNames[b], count);
+					failed++;
+				}
+			}
+		}
+	}
+	StreamCache::stats(&after);
+	printf("golden reconfigure: %d of %d cases differ, warm cache hits:%llu builds:%llu\n", failed, cases,
+	       (unsigned long long)(after.hits - before.hits), (unsigned long long)(after.builds - before.builds));
+	for (uint32_t j = 0; j < 3; j++)
+		free(planes[j]);
+	free(gpu);
+	free(cpu);
+	return failed > 0 ? -1 : 0;
+}
+
+// Frames per second with inflight frames queued, one dst buffer each
+static double benchFps(GLESConvert *convert, uint8_t **planes, uint8_t **dst, int inflight, int count){
+	uint64_t start = StageTimer::now();
+	int pending = 0;
+
+	for (int i = 0; i < count; i++){
+		if (pending == inflight){
+			convert->retrieve(NULL);
+			pending--;
+		}
+		convert->submit(planes[0], planes[1], planes[2], dst[i % inflight]);
+		pending++;
+	}
+	while (pending-- > 0)
+		convert->retrieve(NULL);
+	uint64_t ns = StageTimer::now() - start;
+	return ns > 0 ? count * 1e9 / ns : 0.0;
+}
+
+// Stream start latency: the first converter of a size builds its pool
+// (and the engine, if it is gone), the next one takes it from the warm cache
+static void benchStart(uint32_t width, uint32_t height, ChromaLayout layout, ChromaFilter filter){
+	uint64_t ns[2];
+
+	StreamCache::clear();
+	for (int i = 0; i < 2; i++){
+		uint64_t start = StageTimer::now();
+		GLESConvert *convert = new GLESConvert(width, height, width, 2, BACKEND_GPU, COLOR_BT601, RANGE_LIMITED, layout,
+		                                       filter, MATH_FLOAT, NULL, 1);
+		ns[i] = StageTimer::now() - start;
+		delete convert;
+	}
+	printf("bench %dx%d %s start cold:%.3fms warm:%.3fms\n", width, height, chromaLayoutName(layout), ns[0] / 1e6,
+	       ns[1] / 1e6);
+}
+
+// Resolution switches of a running converter: to half size the first time
+// builds that size's pool, back and forth after that reuses both
+static void benchResize(uint32_t width, uint32_t height, ChromaLayout layout, ChromaFilter filter){
+	GLESConvert convert(width, height, width, 2, BACKEND_GPU, COLOR_BT601, RANGE_LIMITED, layout, filter, MATH_FLOAT,
+	                    NULL, 1);
+	uint32_t half = (width / 2) & ~1;
+	uint64_t first, start = StageTimer::now();
+	int switches = 0;
+
+	convert.reconfigure(half, height / 2, half);
+	first = StageTimer::now() - start;
+	start = StageTimer::now();
+	for (int i = 0; i < 10; i++){
+		convert.reconfigure(width, height, width);
+		convert.reconfigure(half, height / 2, half);
+		switches += 2;
+	}
+	printf("bench %dx%d %s reconfigure first:%.3fms then:%.3fms\n", width, height, chromaLayoutName(layout),
+	       first / 1e6, (StageTimer::now() - start) / 1e6 / switches);
+}
+
+// Float against fixed on the same random frames, depth 2 like the default
+// pipeline. Dispatch time comes from the GPU timer queries. With
+// GLESCONVERT_WORKERS=N the float kernel then runs on 1..N workers, depth 2
+// each.
+static int runBench(uint32_t width, uint32_t height, int count, ChromaLayout layout, ChromaFilter filter){
+	uint8_t *planes[3];
+	uint8_t *dst[2 * MAX_ENGINES];
+	const char *env = getenv("GLESCONVERT_WORKERS");
+	int workers = env != NULL ? atoi(env) : 1;
+	double base = 0;
+
+	if (workers < 1)
+		workers = 1;
+	if (workers > MAX_ENGINES)
+		workers = MAX_ENGINES;
+	for (uint32_t j = 0; j < 3; j++)
+		planes[j] = (uint8_t *)malloc(width * height);
+	fillFrame(PATTERN_RANDOM, layout, planes, width, height, 1);
+	for (int i = 0; i < 2 * workers; i++)
+		dst[i] = (uint8_t *)malloc(width * height * 4);
+	for (int m = 0; m < KERNEL_MATH_COUNT; m++){
+		GLESConvert convert(width, height, width, 2, BACKEND_GPU, COLOR_BT601, RANGE_LIMITED, layout, filter,
+		                    (KernelMath)m, NULL, 1);
+		StageStats st;
+
+		convert.setTiming(1);
+		double fps = benchFps(&convert, planes, dst, 2, count);
+		if (convert.getStageStats(STAGE_DISPATCH, &st) != 0)
+			st.count = 0;
+		printf("bench %dx%d %s %s backend:%s %d frames %.1f fps dispatch mean:%7.3fms p50:%7.3fms\n", width, height,
+		       chromaLayoutName(layout), kernelMathName((KernelMath)m),
+		       convert.getBackend() == BACKEND_CPU ? "cpu" : "gpu", count, fps,
+		       st.count > 0 ? st.meanNs / 1e6 : 0.0, st.count > 0 ? st.p50Ns / 1e6 : 0.0);
+	}
+	for (int w = 1; workers > 1 && w <= workers; w++){
+		GLESConvert convert(width, height, width, 2, BACKEND_GPU, COLOR_BT601, RANGE_LIMITED, layout, filter,
+		                    MATH_FLOAT, NULL, w);
+		double fps = benchFps(&convert, planes, dst, 2 * convert.getWorkers(), count);
+
+		if (w == 1)
+			base = fps;
+		printf("bench %dx%d %s float workers:%u %d frames %.1f fps x%.2f\n", width, height, chromaLayoutName(layout),
+		       convert.getWorkers(), count, fps, base > 0 ? fps / base : 0.0);
+	}
+	benchStart(width, height, layout, filter);
+	benchResize(width, height, layout, filter);
+	for (uint32_t j = 0; j < 3; j++)
+		free(planes[j]);
+	for (int i = 0; i < 2 * workers; i++)
+		free(dst[i]);
+	return 0;
+}
+
 int main(int argc, char *argv[]){
-	FILE *fin, *fout;
+	FILE *fout;
+	FrameReader reader;
+	FrameWriter *writer;
 	int width, height;
-    int size;
-    uint8_t *bufin, *bufout;
-    uint8_t *y, *u, *v;
-    int count;
-	void *src;
-	if (argc != 6)
+    int size, frameSize;
+    uint32_t planeSize[3];
+    const uint8_t *src;
+    uint8_t *y, *u, *v, *dst;
+    uint64_t start, readNs, t;
+    uint8_t *bufref[MAX_PIPELINE_DEPTH];
+    int count, depth, index, pending;
+    int frames, bad, tolerance;
+    ConvertBackend backend = BACKEND_AUTO;
+    ColorMatrix matrix = COLOR_BT601;
+    ColorRange range = RANGE_LIMITED;
+    ChromaLayout layout = CHROMA_444;
+    ChromaFilter filter = FILTER_NEAREST;
+    KernelMath math = MATH_FLOAT;
+    CPUConvert *ref = NULL;
+    SliceLatency lat;
+    uint32_t split;
+    double gpuRow, cpuRow;
+    const char *env;
+	if (argc == 2 && strcmp(argv[1], "golden") == 0)
+		return runGolden() | runGoldenResize();
+	if ((argc == 5 || argc == 6) && strcmp(argv[1], "bench") == 0){
+		if (argc == 6 && parseChromaLayout(argv[5], &layout, &filter) != 0)
+			usage(argv[0]);
+		return runBench(atoi(argv[2]), atoi(argv[3]), atoi(argv[4]), layout, filter);
+	}
+	if (argc < 6 || argc > 11)
 		usage(argv[0]);
-		
-    fin = fopen(argv[1], "rb");
-    fout = fopen(argv[2], "wb+");
+	if (argc >= 9 && parseColorSpace(argv[8], &matrix, &range) != 0)
+		usage(argv[0]);
+	if (argc >= 10 && parseChromaLayout(argv[9], &layout, &filter) != 0)
+		usage(argv[0]);
+	if (argc == 11 && parseKernelMath(argv[10], &math) != 0)
+		usage(argv[0]);
+
   	width = atoi(argv[3]);
 	height = atoi(argv[4]);
     count = atoi(argv[5]);
-    
+    depth = argc >= 7 ? atoi(argv[6]) : 2;
+    if (depth < 1)
+        depth = 1;
+    if (depth > MAX_PIPELINE_DEPTH)
+        depth = MAX_PIPELINE_DEPTH;
+
     size = width * height;
-    bufin = (uint8_t *)malloc(size * 3);
-    bufout = (uint8_t *)malloc(size *4 );
+    frameSize = 0;
+    for (uint32_t j = 0; j < 3; j++){
+        planeSize[j] = chromaPlaneSize(layout, width, height, j);
+        frameSize += planeSize[j];
+    }
+    for (int i = 0; i < depth; i++)
+        bufref[i] = NULL;
+    fout = fopen(argv[2], "wb+");
+    if (fout == NULL || reader.open(argv[1], frameSize) != 0){
+        printf("can't open %s or %s\n", argv[1], argv[2]);
+        return -1;
+    }
+
+    if (argc >= 8){
+        if (strcmp(argv[7], "gpu") == 0){
+            backend = BACKEND_GPU;
+        }else if (strcmp(argv[7], "cpu") == 0){
+            backend = BACKEND_CPU;
+        }else if (strcmp(argv[7], "hybrid") == 0){
+            backend = BACKEND_HYBRID;
+        }else if (strcmp(argv[7], "check") == 0){
+            backend = BACKEND_GPU;
+            ref = new CPUConvert(width, height, width, 0, matrix, range, layout, filter, math);
+            for (int i = 0; i < depth; i++)
+                bufref[i] = (uint8_t *)malloc(size * 4);
+        }
+    }
 
-	GLESConvert *mConvert = new GLESConvert(width, height, width);
+	env = getenv("GLESCONVERT_WARM");
+	if (env != NULL)
+		printf("prewarmed %d sizes\n", GLESConvert::prewarm(env, depth, matrix, range, layout, filter, math));
+	t = StageTimer::now();
+	GLESConvert *mConvert = new GLESConvert(width, height, width, depth, backend, matrix, range, layout, filter, math);
 	mConvert->waitGLInit();
-	
-	memset(bufout, 0, size * 4);
-	y = bufin;
-    u = y + size;
-    v = u + size;
-	while(fread(bufin, size, 3, fin) && count-- > 0){
-		mConvert->convert(y, u, v, bufout);
-		fwrite(bufout, size, 4, fout);
-	}
-	
-	fclose(fin);
+	printf("start:%.3fms\n", (StageTimer::now() - t) / 1e6);
+	printf("backend:%s\n", mConvert->getBackend() == BACKEND_CPU ? "cpu" :
+	       mConvert->getBackend() == BACKEND_HYBRID ? "hybrid" : "gpu");
+	memset(&lat, 0, sizeof(lat));
+	lat.height = height;
+	env = getenv("GLESCONVERT_SLICES");
+	if (env != NULL && atoi(env) > 0 && mConvert->setSlices(atoi(env), sliceDone, &lat) != 0)
+		printf("can't deliver in %s slices\n", env);
+
+	// keep depth frames queued, hand the oldest one to the writer thread when
+	// the ring is full. Input comes straight from the mapped file, output is
+	// converted into the writer's queue so disk writes overlap the GPU work.
+	// float math on both sides may round one step apart, fixed has to match
+	tolerance = math == MATH_FIXED ? 0 : 1;
+	writer = new FrameWriter(fout, size * 4, depth + WRITE_QUEUE);
+	index = 0;
+	pending = 0;
+	frames = 0;
+	bad = 0;
+	readNs = 0;
+	start = StageTimer::now();
+	for(;;){
+        if (pending == depth){
+            bad += writeFrame(writer, mConvert, bufref[(index + depth - pending) % depth], frames++, size, tolerance);
+            pending--;
+        }
+        if (count-- <= 0)
+            break;
+        // page faults on the mapping land here, count them as read stall
+        t = StageTimer::now();
+        src = reader.next();
+        readNs += StageTimer::now() - t;
+        if (src == NULL)
+            break;
+        dst = writer->get();
+        if (mConvert->getBackend() == BACKEND_HYBRID){
+            // the CPU share reads the planes too, hand over the mapped file
+            // instead of write-only staging memory
+            y = (uint8_t *)src;
+            u = y + planeSize[0];
+            v = u + planeSize[1];
+            if (ref != NULL)
+                ref->convert(y, u, v, bufref[index]);
+            lat.submit[lat.submitted++ % MAX_PIPELINE_DEPTH] = StageTimer::now();
+            mConvert->submit(y, u, v, dst);
+        }else{
+            uint8_t *planes[3];
+            mConvert->getInputBuffer(&planes[0], &planes[1], &planes[2]);
+            t = StageTimer::now();
+            // 4:2:0 planes go in at their real size, the kernel upsamples.
+            // Staging rows are padded to whole words for odd widths.
+            for (uint32_t j = 0, offset = 0; j < 3; j++){
+                uint32_t pw = planeWidth(layout, width, j);
+                if (planeSize[j] > 0)
+                    copyPlane(planes[j], mConvert->getInputStride(j), src + offset, pw, pw, planeSize[j] / pw);
+                offset += planeSize[j];
+            }
+            readNs += StageTimer::now() - t;
+            y = (uint8_t *)src;
+            u = y + planeSize[0];
+            v = u + planeSize[1];
+            if (ref != NULL)
+                ref->convert(y, u, v, bufref[index]);
+            lat.submit[lat.submitted++ % MAX_PIPELINE_DEPTH] = StageTimer::now();
+            mConvert->submitInput(dst);
+        }
+        index = (index + 1) % depth;
+        pending++;
+	}
+	while (pending > 0){
+        bad += writeFrame(writer, mConvert, bufref[(index + depth - pending) % depth], frames++, size, tolerance);
+        pending--;
+	}
+	writer->finish();
+	printIO(&reader, writer, frames, StageTimer::now() - start, readNs);
+	if (writer->failed())
+        printf("writing %s failed\n", argv[2]);
+	if (ref != NULL){
+        printf("check: %d of %d frames differ\n", bad, frames);
+        delete ref;
+	}
+
+	if (lat.delivered > 0)
+		printf("slices: %u frames, first slice:%.3fms whole frame:%.3fms\n", lat.delivered,
+		       lat.firstNs / 1e6 / lat.delivered, lat.frameNs / 1e6 / lat.delivered);
+	if (mConvert->getHybridSplit(&split, &gpuRow, &cpuRow) == 0)
+		printf("hybrid: gpu rows %u of %d, gpu %.1fns/row cpu %.1fns/row\n", split, height, gpuRow, cpuRow);
+	printTiming(mConvert);
+	printGLErrors();
+	printWorkers(mConvert);
+	delete mConvert;
+	printWarm();
+	delete writer;
+	reader.close();
     fclose(fout);
 }